@@ -0,0 +1,112 @@
+#pragma once
+// Benchmark harness shared declarations
+// Each scenario is a function taking the parsed command line and returning a process exit code
+#include <string>
+#include <map>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <pigpio_sim.h>
+
+// Command line options of the form --key value
+class BenchOptions {
+    std::map<std::string, std::string> values;
+public:
+    BenchOptions(int argc, const char* argv[], int first);
+    int64_t get(const std::string& key, int64_t fallback) const;
+    std::string get(const std::string& key, const std::string& fallback) const;
+};
+
+// Collects samples in microseconds and prints a percentile summary
+class LatencyStats {
+    std::vector<uint32_t> samples;
+public:
+    void add(uint32_t us) { samples.push_back(us); }
+    size_t count() const { return samples.size(); }
+    uint32_t percentile(double p);
+    void print(const std::string& label);
+};
+
+// Matches scheduled input edges to the state PUBLISHes that report them
+// Edges coalesced by the debounce are attributed to the publish that follows them;
+// the latency of a publish is taken from the oldest edge it reflects.
+struct EdgeTracker {
+    struct PendingEdge {
+        uint32_t tick;
+        uint8_t level;
+    };
+    std::mutex lock;
+    std::condition_variable published;
+    std::map<std::string, std::deque<PendingEdge>> pending; // zone id -> unpublished edges
+    LatencyStats latency;
+    uint64_t publishes = 0, coalesced = 0;
+    bool measuring = false;
+
+    void on_publish(const std::string& id, uint8_t level, uint32_t tick);
+    size_t outstanding(); // caller holds the lock
+};
+
+// Waits for the gpioWrite a command should cause, seen through the simulator's write hook
+struct CommandTracker {
+    std::mutex lock;
+    std::condition_variable written;
+    unsigned gpio = 0;
+    bool waiting = false;
+    uint32_t write_tick = 0;
+
+    static void write_hook(const SimWrite& w, void* userdata);
+};
+
+// CPU time consumed so far, in nanoseconds
+uint64_t process_cpu_ns();
+uint64_t thread_cpu_ns();
+
+// Heap allocations through operator new, counted on threads that opted in
+void alloc_track_thread(); // counts the calling thread from now on
+uint64_t alloc_count(); // allocations on every tracked thread so far
+
+// Service config with simulated input zones on pins 2.. and output zones after them
+struct BenchConfig {
+    std::string name = "bench";
+    uint16_t mqtt_port = 1883;
+    int inputs = 4;
+    int outputs = 1;
+    int trigger_timeout = 100;
+    std::string log_level = "warn";
+    std::string zones; // replaces the generated zone list when set
+    std::string input_extra; // raw members appended to every generated input zone
+    std::string extra; // raw top-level members appended to the config
+};
+std::string bench_config(const BenchConfig& cfg);
+std::string bench_input_id(int index);
+std::string bench_output_id(int index);
+int bench_input_pin(int index);
+int bench_output_pin(const BenchConfig& cfg, int index);
+
+// Scenarios
+int bench_latency(const BenchOptions& options);
+int bench_remote(const BenchOptions& options);
+int bench_expander(const BenchOptions& options);
+int bench_federation(const BenchOptions& options);
+int bench_rules(const BenchOptions& options);
+int bench_alarm(const BenchOptions& options);
+int bench_snapshot(const BenchOptions& options);
+int bench_refresh(const BenchOptions& options);
+int bench_flap(const BenchOptions& options);
+int bench_realtime(const BenchOptions& options);
+int bench_alloc(const BenchOptions& options);
+int bench_dispatch(const BenchOptions& options);
+int bench_discovery(const BenchOptions& options);
+int bench_upgrade(const BenchOptions& options);
+int bench_supervision(const BenchOptions& options);
+int bench_mqtt5(const BenchOptions& options);
+int bench_failover(const BenchOptions& options);
+int bench_backpressure(const BenchOptions& options);
+int bench_buttons(const BenchOptions& options);
+int bench_group(const BenchOptions& options);
+int bench_pulse(const BenchOptions& options);
+int bench_reconcile(const BenchOptions& options);
+int bench_federation_node(const BenchOptions& options); // a child process of bench_federation
+int bench_upgrade_successor(const BenchOptions& options); // started by the service as --takeover <fd>
@@ -0,0 +1,47 @@
+#pragma once
+// Expander nodes stand-in for the PJON serial bus, used by the benchmark harness
+// One PJON ThroughSerial instance in router mode answers for every emulated node id.
+// Input changes are coalesced per node and sent as DELTA frames; POLLs are answered
+// with a SNAPSHOT. Deltas can be dropped on purpose to exercise the master's resync.
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+class ExpanderNodeStub {
+    struct Node {
+        uint32_t levels = 0;
+        uint32_t pending = 0; // bits changed since the last delta
+        uint8_t seq = 0;
+        bool snapshot_due = false;
+    };
+    struct Link;
+
+    std::unique_ptr<Link> link;
+    std::mutex lock;
+    std::map<uint8_t, Node> nodes;
+    std::thread worker;
+    std::atomic_bool running;
+    uint32_t drop_every; // 0 never, otherwise every Nth delta is lost
+    std::atomic<uint64_t> deltas_sent, deltas_dropped, snapshots_sent, polls_received;
+
+    void run();
+    void on_frame(uint8_t node, const uint8_t* payload, uint16_t length);
+
+public:
+    ExpanderNodeStub();
+    virtual ~ExpanderNodeStub();
+
+    // fd is this end of the wire; master is the PJON id of the bus master
+    bool start(int fd, const std::vector<uint8_t>& ids, uint8_t master, uint32_t drop_every = 0);
+    void stop();
+    void set_input(uint8_t node, uint8_t bit, uint8_t level);
+
+    uint64_t delta_count() const { return deltas_sent; }
+    uint64_t dropped_count() const { return deltas_dropped; }
+    uint64_t snapshot_count() const { return snapshots_sent; }
+    uint64_t poll_count() const { return polls_received; }
+};
@@ -0,0 +1,96 @@
+#pragma once
+// Minimal in-process MQTT 3.1.1 / 5 broker used by the benchmark harness
+// Supports CONNECT, SUBSCRIBE/UNSUBSCRIBE (with + and # wildcards), PUBLISH at QoS 0/1,
+// retained messages and PINGREQ. One thread serves every client over loopback.
+// MQTT 5 clients get inbound topic aliases, reason codes and sessions kept for their
+// Session Expiry Interval; set_max_level(4) makes it a broker that only speaks 3.1.1.
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class MqttBrokerStub {
+public:
+    struct Message {
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+        uint32_t tick; // gpioTick() when the packet was fully received
+        size_t wire_bytes = 0; // size of the PUBLISH packet that carried it
+    };
+    using PublishHook = std::function<void(const Message&)>;
+private:
+    struct Client {
+        int fd = -1;
+        std::vector<uint8_t> inbuf;
+        std::vector<std::pair<std::string, uint8_t>> filters;
+        std::string client_id;
+        uint16_t next_id = 1;
+        uint8_t level = 4;
+        uint32_t session_expiry_s = 0;
+        std::map<uint16_t, std::string> aliases; // topic aliases the client set up
+    };
+    struct Session {
+        std::vector<std::pair<std::string, uint8_t>> filters;
+        uint64_t expires_ms;
+    };
+    uint16_t listen_port;
+    int listen_fd;
+    int wake_pipe[2]; // wakes the broker thread when publish() queues a message
+    std::thread worker;
+    std::atomic_bool running;
+    std::atomic_bool frozen;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<Client> clients;
+    std::map<std::string, Message> retained;
+    std::vector<Message> outbox; // messages queued by publish() for the broker thread
+    std::map<std::string, Session> sessions; // client id -> session kept after the connection ended
+    std::vector<std::pair<std::string, uint8_t>> refused; // topic filter -> PUBACK reason code
+    PublishHook publish_hook;
+    std::atomic<uint64_t> cpu_ns;
+    uint64_t connects, subscribes, resumed;
+    uint8_t max_level;
+    uint16_t alias_max;
+    int receive_buffer;
+
+    void serve();
+    void accept_clients();
+    bool read_client(Client& client);
+    bool handle_packet(Client& client, uint8_t header, const uint8_t* body, size_t len, size_t packet_size);
+    void route(const Message& msg);
+    void send_publish(Client& client, const Message& msg, uint8_t qos);
+    void end_session(const Client& client);
+    static bool send_all(int fd, const uint8_t* buf, size_t len);
+public:
+    static bool topic_matches(const std::string& filter, const std::string& topic);
+
+    MqttBrokerStub();
+    virtual ~MqttBrokerStub();
+
+    bool start(uint16_t port = 0); // port 0 picks a free loopback port
+    void stop();
+    uint16_t port() const { return listen_port; }
+
+    void set_publish_hook(PublishHook hook);
+    // publish from the broker to every matching subscriber
+    void publish(const std::string& topic, const std::string& payload, uint8_t qos = 1, bool retain = false);
+    bool wait_for_subscription(const std::string& topic, uint32_t timeout_ms);
+    uint64_t connection_count();
+    uint64_t subscribe_count(); // SUBSCRIBE packets received
+    uint64_t resumed_count(); // connections that picked up a kept session
+
+    void set_max_level(uint8_t level); // 4 answers a level 5 CONNECT with "unacceptable protocol version"
+    void set_topic_alias_max(uint16_t max); // offered to MQTT 5 clients, 0 for none
+    void refuse_topic(const std::string& filter, uint8_t reason); // PUBACK reason code for MQTT 5 publishers
+    void drop_clients(); // every connection ends as in a network outage, sessions are kept
+    void freeze(bool on) { frozen = on; } // stops answering and reading, connections stay open as to a dead host
+    void set_receive_buffer(int bytes) { receive_buffer = bytes; } // SO_RCVBUF of client connections, set before start()
+    uint64_t broker_cpu_ns() const { return cpu_ns; }
+};
@@ -0,0 +1,50 @@
+#pragma once
+// In-process pigpiod stand-in used by the benchmark harness
+// Serves the pigpiod socket protocol on loopback and executes each command on the
+// simulated pins. A PI_CMD_NOIB connection becomes a notification stream fed from
+// pigpio-sim alerts on the pins selected with PI_CMD_NB, watchdog timeouts included.
+#include <pigpio.h>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class PigpiodStub {
+    struct Client {
+        int fd;
+        bool notify = false; // switched to a report stream by PI_CMD_NOIB
+        uint32_t handle = 0;
+        uint32_t bits = 0; // pins reported on this stream
+        uint16_t seqno = 0;
+    };
+    uint16_t listen_port;
+    int listen_fd;
+    int wake_pipe[2];
+    std::thread worker;
+    std::atomic_bool running;
+    std::recursive_mutex lock; // guards clients, alert callbacks write to notify streams
+    std::vector<Client> clients;
+    uint32_t next_handle;
+    uint32_t alert_bits; // pins this stub holds the simulator alert for
+    uint64_t refuse_until_ms; // connections are dropped until then
+    std::atomic<uint64_t> commands;
+
+    void serve();
+    bool handle_command(Client& client);
+    int execute(Client& client, uint32_t cmd, uint32_t p1, uint32_t p2, const std::vector<uint8_t>& ext);
+    void update_alerts();
+    static void alert(int gpio, int level, uint32_t tick, void* userdata);
+    static bool send_all(int fd, const void* buf, size_t len);
+public:
+    PigpiodStub();
+    virtual ~PigpiodStub();
+
+    bool start(uint16_t port = 0); // port 0 picks a free loopback port
+    void stop();
+    uint16_t port() const { return listen_port; }
+
+    // drop every connection and refuse new ones for ms, as if the host went away
+    void outage(uint32_t ms);
+    uint64_t command_count() const { return commands; }
+};
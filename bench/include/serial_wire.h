@@ -0,0 +1,33 @@
+#pragma once
+// A simulated serial line for the benchmark harness
+// The service opens the slave side of a pseudo-terminal as if it were the RS-485
+// adapter; the other end of the line is a socket handed to the node stand-ins. A
+// relay thread moves bytes between them at the configured baud rate (10 bits per
+// byte, one direction at a time as on a half-duplex bus) and counts them.
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class SerialWire {
+    int pty_master, pty_slave;
+    int sockets[2];
+    uint32_t baud;
+    std::string slave_path;
+    std::thread relay;
+    std::atomic_bool running;
+    std::atomic<uint64_t> to_nodes, to_master;
+
+    void run();
+public:
+    SerialWire();
+    virtual ~SerialWire();
+
+    bool open(uint32_t baud);
+    void close();
+    const std::string& device() const { return slave_path; } // for the service
+    int node_fd() const { return sockets[1]; } // for the node stand-ins
+
+    uint64_t bytes_to_nodes() const { return to_nodes; }
+    uint64_t bytes_to_master() const { return to_master; }
+};
@@ -0,0 +1,49 @@
+#include "bench.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/*
+    Allocation counter
+
+    The bench replaces the global operator new and counts the allocations made
+    on threads that called alloc_track_thread(). Other threads, such as the broker
+    stand-in and the simulator, allocate freely without being counted.
+*/
+
+static std::atomic<uint64_t> tracked_allocations { 0 };
+static thread_local bool tracked = false;
+
+void alloc_track_thread() { tracked = true; }
+uint64_t alloc_count() { return tracked_allocations.load(); }
+
+static void* counted_alloc(size_t size, size_t alignment) {
+    if(tracked) tracked_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(size == 0) size = 1;
+    void* p = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : std::malloc(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return counted_alloc(size, 0); }
+void* operator new[](size_t size) { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return counted_alloc(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_alloc(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size, 0); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size, 0); } catch(...) { return nullptr; }
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,210 @@
+#include "bench.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+BenchOptions::BenchOptions(int argc, const char* argv[], int first) {
+    for(int i = first; i < argc; ++i){
+        std::string key = argv[i];
+        if(!key.starts_with("--")) continue;
+        key = key.substr(2);
+        values[key] = (i + 1 < argc && !std::string(argv[i+1]).starts_with("--")) ? argv[++i] : "1";
+    }
+}
+
+int64_t BenchOptions::get(const std::string& key, int64_t fallback) const {
+    auto it = values.find(key);
+    return it == values.end() ? fallback : std::stoll(it->second);
+}
+
+std::string BenchOptions::get(const std::string& key, const std::string& fallback) const {
+    auto it = values.find(key);
+    return it == values.end() ? fallback : it->second;
+}
+
+uint32_t LatencyStats::percentile(double p) {
+    if(samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t idx = size_t(std::ceil(p * double(samples.size()))) - 1;
+    return samples[std::min(idx, samples.size() - 1)];
+}
+
+void LatencyStats::print(const std::string& label) {
+    if(samples.empty()){
+        std::cout << label << ": no samples\n";
+        return;
+    }
+    uint64_t sum = 0;
+    for(uint32_t s : samples) sum += s;
+    std::cout << label << ": n=" << samples.size()
+              << " mean=" << sum / samples.size() << "us"
+              << " p50=" << percentile(0.50) << "us"
+              << " p99=" << percentile(0.99) << "us"
+              << " p999=" << percentile(0.999) << "us"
+              << " max=" << samples.back() << "us\n";
+}
+
+void EdgeTracker::on_publish(const std::string& id, uint8_t level, uint32_t tick) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!measuring || !pending.count(id)) return;
+    auto& edges = pending.at(id);
+    uint32_t origin = 0;
+    bool matched = false;
+    size_t consumed = 0;
+    // consume every edge injected before this publish arrived
+    while(!edges.empty() && int32_t(tick - edges.front().tick) >= 0){
+        if(!consumed) origin = edges.front().tick;
+        matched = edges.front().level == level;
+        edges.pop_front();
+        ++consumed;
+    }
+    if(consumed && matched){
+        latency.add(tick - origin);
+        coalesced += consumed - 1;
+    }
+    ++publishes;
+    published.notify_all();
+}
+
+size_t EdgeTracker::outstanding() {
+    size_t n = 0;
+    for(const auto& [id, edges] : pending) n += edges.size();
+    return n;
+}
+
+void CommandTracker::write_hook(const SimWrite& w, void* userdata) {
+    CommandTracker& self = *static_cast<CommandTracker*>(userdata);
+    std::lock_guard<std::mutex> guard(self.lock);
+    if(self.waiting && w.gpio == self.gpio){
+        self.write_tick = w.tick;
+        self.waiting = false;
+        self.written.notify_all();
+    }
+}
+
+static uint64_t cpu_ns(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+uint64_t process_cpu_ns() { return cpu_ns(CLOCK_PROCESS_CPUTIME_ID); }
+uint64_t thread_cpu_ns() { return cpu_ns(CLOCK_THREAD_CPUTIME_ID); }
+
+std::string bench_input_id(int index) { return "BenchInput" + std::to_string(index); }
+std::string bench_output_id(int index) { return "BenchOutput" + std::to_string(index); }
+int bench_input_pin(int index) { return 2 + index; }
+int bench_output_pin(const BenchConfig& cfg, int index) { return 2 + cfg.inputs + index; }
+
+std::string bench_config(const BenchConfig& cfg) {
+    std::string zones = cfg.zones;
+    for(int i = 0; cfg.zones.empty() && i < cfg.inputs; ++i){
+        if(!zones.empty()) zones += ",";
+        zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"Bench Input " + std::to_string(i) + "\","
+                 "\"pin\":" + std::to_string(bench_input_pin(i)) + ",\"io\":\"input\",\"pullmode\":\"pulldown\","
+                 "\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) +
+                 (cfg.input_extra.empty() ? "" : "," + cfg.input_extra) + "}";
+    }
+    for(int i = 0; cfg.zones.empty() && i < cfg.outputs; ++i){
+        if(!zones.empty()) zones += ",";
+        zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"Bench Output " + std::to_string(i) + "\","
+                 "\"pin\":" + std::to_string(bench_output_pin(cfg, i)) + ",\"io\":\"output\","
+                 "\"trigger_timeout\":0}";
+    }
+    return "{\"mqtt_ip\":\"127.0.0.1\",\"mqtt_port\":" + std::to_string(cfg.mqtt_port) + ","
+           "\"mqtt_user\":\"\",\"mqtt_password\":\"\",\"name\":\"" + cfg.name + "\","
+           "\"system_runtime_name\":\"Benchmark\",\"auto_refresh_states\":86400,"
+           "\"birth\":\"online\",\"will\":\"offline\",\"log_level\":\"" + cfg.log_level + "\","
+           + (cfg.extra.empty() ? "" : cfg.extra + ",") +
+           "\"zones\":[" + zones + "]}";
+}
+
+static void usage() {
+    std::cout << "usage: bench <scenario> [--option value ...]\n"
+                 "scenarios:\n"
+                 "  latency   edge tick -> broker PUBLISH and /set command -> gpioWrite round trips\n"
+                 "            --zones 4 --rate 10 --events 1000 --commands 100 --debounce 100\n"
+                 "  remote    the same round trips through pigpiod stand-ins, plus resync after a host outage\n"
+                 "            --hosts 2 --zones 2 --rate 10 --events 200 --commands 50 --debounce 100\n"
+                 "  expander  input changes on PJON serial expander nodes -> broker PUBLISH, with line utilisation\n"
+                 "            --nodes 4 --zones 8 --rate 10 --events 200 --baud 9600 --loss 0 --debounce 100\n"
+                 "  federation  changes on controllers in other processes -> PUBLISH of their mirrors over PJON DualUDP\n"
+                 "            --controllers 3 --zones 4 --rate 10 --events 200 --port 7600 --debounce 100\n"
+                 "  rules     rule evaluation cost per state change, then edge -> rule-driven gpioWrite\n"
+                 "            --rules 64 --zones 16 --edges 1000000 --events 50 --debounce 100\n"
+                 "  alarm     armed panel: edge on a perimeter zone -> siren gpioWrite and triggered PUBLISH\n"
+                 "            --events 50 --debounce 100\n"
+                 "  snapshot  resync after Home Assistant's birth message: per-zone publishes against one <name>/state snapshot\n"
+                 "            --zones 24 --rounds 20 --debounce 100\n"
+                 "  refresh   paced per-zone refresh after a birth message, with a live change made while it runs\n"
+                 "            --zones 24 --rounds 10 --window 2000 --jitter 0 --debounce 100\n"
+                 "  flap      a chattering input without a policy, with max_rate and with flap detection\n"
+                 "            --period 30 --duration 3000 --max-rate 2 --flap-count 20 --flap-window 1000 --debounce 5\n"
+                 "  realtime  edge -> rule-driven gpioWrite under CPU load, with the default loop and the realtime profile\n"
+                 "            --events 200 --load <cores> --period 10 --priority 50 --zone-cpu -1 --io-cpu -1 --debounce 5\n"
+                 "  alloc     heap allocations on the service thread per edge, /set and group command, after a warm-up round\n"
+                 "            --zones 4 --rate 10 --events 100 --commands 50 --debounce 20\n"
+                 "  dispatch  cost of one edge from the pigpio alert to the zone's state write, std::function chain against the delegate\n"
+                 "            --edges 10000000 --pulses 100000\n"
+                 "  discovery  device discovery payload for each zone count, JsonLoader DOM against cached fragments\n"
+                 "            --zones 10,100,1000 --rounds 20\n"
+                 "  upgrade   replacing the service: a restart against a handoff of the broker session and zone state\n"
+                 "            --zones 4 --debounce 20\n"
+                 "  supervision  heartbeat inputs on a local and a remote pin going silent past their watchdog timeout\n"
+                 "            --heartbeat 200 --timeout 1000 --beats 20 --debounce 20\n"
+                 "  mqtt5     bytes per state publish and reconnect cost with 3.1.1, with MQTT 5, and falling back from 5\n"
+                 "            --zones 8 --events 200 --period 100 --session-expiry 300 --debounce 5\n"
+                 "  failover  time to recover on the other of two brokers after the one in use exits and after it stops answering\n"
+                 "            --keepalive 4 --debounce 20\n"
+                 "  backpressure  a 24h alarm zone and chattering zones while the broker stops reading: edge -> siren, then alarm PUBLISH order\n"
+                 "            --zones 16 --period 20 --stall 2000 --send-buffer 4096 --debounce 5\n"
+                 "  buttons   press patterns with contact bounce on a button zone: classification, and decidable -> event PUBLISH\n"
+                 "            --rounds 10 --window 300 --long 800 --hold 2000 --bounce 10 --chatter 2\n"
+                 "  group     several output zones switched by a /set command each against one <name>/group/set bank write\n"
+                 "            --outputs 3 --rounds 20\n"
+                 "  pulse     timed output commands: pulse length by gpioTrigger, wave, timer and on a remote host, then with the broker gone\n"
+                 "            --rounds 5 --short 50 --strike 500 --buzz 250 --remote 200\n"
+                 "  reconcile  edges lost without an alert on quiet inputs while others chatter and an output pulses: lost edge -> corrected PUBLISH, missed_edges\n"
+                 "            --zones 16 --remote 4 --lost 20 --period 20 --interval 1000 --pulse 1300 --debounce 5\n"
+                 "common options:\n"
+                 "  --log-level warn   service log level (debug, info, warn, error)\n";
+}
+
+int main(int argc, const char* argv[]) {
+    if(argc < 2){
+        usage();
+        return 1;
+    }
+    std::string scenario = argv[1];
+    if(scenario == "--takeover") return bench_upgrade_successor(BenchOptions(argc, argv, 1));
+    BenchOptions options(argc, argv, 2);
+
+    if(scenario == "latency") return bench_latency(options);
+    if(scenario == "remote") return bench_remote(options);
+    if(scenario == "expander") return bench_expander(options);
+    if(scenario == "federation") return bench_federation(options);
+    if(scenario == "federation-node") return bench_federation_node(options);
+    if(scenario == "rules") return bench_rules(options);
+    if(scenario == "alarm") return bench_alarm(options);
+    if(scenario == "snapshot") return bench_snapshot(options);
+    if(scenario == "refresh") return bench_refresh(options);
+    if(scenario == "flap") return bench_flap(options);
+    if(scenario == "realtime") return bench_realtime(options);
+    if(scenario == "alloc") return bench_alloc(options);
+    if(scenario == "dispatch") return bench_dispatch(options);
+    if(scenario == "discovery") return bench_discovery(options);
+    if(scenario == "upgrade") return bench_upgrade(options);
+    if(scenario == "supervision") return bench_supervision(options);
+    if(scenario == "mqtt5") return bench_mqtt5(options);
+    if(scenario == "failover") return bench_failover(options);
+    if(scenario == "backpressure") return bench_backpressure(options);
+    if(scenario == "buttons") return bench_buttons(options);
+    if(scenario == "group") return bench_group(options);
+    if(scenario == "pulse") return bench_pulse(options);
+    if(scenario == "reconcile") return bench_reconcile(options);
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,123 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+/*
+    Alarm panel
+
+    The panel is armed away over <name>/alarm/set, then an instant perimeter zone
+    opens. The latency is measured from the edge tick to the siren's gpioWrite and
+    to the broker's receipt of the "triggered" state, then the panel is disarmed
+    and the zone closed again before the next round.
+*/
+
+struct AlarmWatcher {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::string state;
+    uint32_t tick = 0;
+
+    bool wait_for(const std::string& wanted, uint32_t timeout_ms) {
+        std::unique_lock<std::mutex> guard(lock);
+        return changed.wait_for(guard, std::chrono::milliseconds(timeout_ms), [&](){ return state == wanted; });
+    }
+};
+
+int bench_alarm(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = 1;
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t events = options.get("events", 50);
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    cfg.input_extra = "\"alarm\":\"perimeter\"";
+    cfg.extra = "\"alarm_panel\":\"Bench Alarm\",\"alarm_siren\":\"" + bench_output_id(0) + "\"";
+
+    AlarmWatcher alarm;
+    const std::string state_topic = cfg.name + "/alarm", command_topic = cfg.name + "/alarm/set";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(msg.topic != state_topic) return;
+        std::lock_guard<std::mutex> guard(alarm.lock);
+        alarm.state = msg.payload;
+        alarm.tick = msg.tick;
+        alarm.changed.notify_all();
+    });
+
+    CommandTracker siren;
+    simSetWriteHook(&CommandTracker::write_hook, &siren);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    if(!broker.wait_for_subscription(command_topic, 5000)){
+        std::cerr << "service never subscribed to " << command_topic << "\n";
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + cfg.trigger_timeout * 2));
+
+    LatencyStats to_siren, to_publish;
+    uint64_t failures = 0;
+    for(int64_t i = 0; i < events; ++i){
+        broker.publish(command_topic, "ARM_AWAY", 1);
+        if(!alarm.wait_for("armed_away", 2000)){
+            ++failures;
+            broker.publish(command_topic, "DISARM", 1);
+            alarm.wait_for("disarmed", 2000);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(siren.lock);
+            siren.gpio = unsigned(bench_output_pin(cfg, 0));
+            siren.waiting = true;
+        }
+        uint32_t tick = gpioTick();
+        simInjectEdge(bench_input_pin(0), 1);
+
+        {
+            std::unique_lock<std::mutex> guard(siren.lock);
+            if(siren.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !siren.waiting; })){
+                to_siren.add(siren.write_tick - tick);
+            } else {
+                siren.waiting = false;
+                ++failures;
+            }
+        }
+        if(alarm.wait_for("triggered", 2000)){
+            std::lock_guard<std::mutex> guard(alarm.lock);
+            to_publish.add(alarm.tick - tick);
+        }
+
+        broker.publish(command_topic, "DISARM", 1);
+        alarm.wait_for("disarmed", 2000);
+        simInjectEdge(bench_input_pin(0), 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(cfg.trigger_timeout * 2 + 100)); // the closed zone reports before re-arming
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    broker.stop();
+
+    std::cout << "\n== alarm: debounce=" << cfg.trigger_timeout << "ms ==\n";
+    to_siren.print("edge -> siren gpioWrite");
+    to_publish.print("edge -> triggered publish");
+    std::cout << "  failures=" << failures << "\n";
+    return 0;
+}
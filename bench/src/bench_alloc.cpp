@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+/*
+    Steady-state allocations
+
+    The service thread is tracked by the counting operator new. After a warm-up
+    round of edges, /set commands and <name>/group/set commands, the same traffic
+    runs again and the heap allocations it causes on the service thread are
+    reported per edge and per command; the state publishes, flap bookkeeping,
+    snapshots, rule timers and the group command's bank write are all on that path. Startup, discovery and the warm-up itself are not counted.
+*/
+
+struct AllocRound {
+    uint64_t edges = 0, commands = 0, groups = 0, timeouts = 0;
+};
+
+static void run_edges(const BenchConfig& cfg, EdgeTracker& tracker, int64_t events, int64_t rate, std::vector<uint8_t>& levels, AllocRound& round) {
+    const auto interval = std::chrono::nanoseconds(1000000000 / std::max<int64_t>(1, rate));
+    auto next = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < events; ++i){
+        int zone = int(i % cfg.inputs);
+        levels[zone] ^= 1;
+        uint32_t tick = gpioTick();
+        {
+            std::lock_guard<std::mutex> guard(tracker.lock);
+            tracker.pending[bench_input_id(zone)].push_back({ tick, levels[zone] });
+        }
+        simScheduleEdge(bench_input_pin(zone), levels[zone], tick);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    std::unique_lock<std::mutex> guard(tracker.lock);
+    tracker.published.wait_for(guard, std::chrono::seconds(5), [&](){ return tracker.outstanding() == 0; });
+    round.edges += uint64_t(events);
+}
+
+// a group command names the same output as a JSON object, so it is written through the bank
+static void run_commands(MqttBrokerStub& broker, const BenchConfig& cfg, CommandTracker& command, int64_t commands, bool group, uint8_t& level, AllocRound& round) {
+    const std::string topic = group ? cfg.name + "/group/set" : cfg.name + "/set/" + bench_output_id(0);
+    for(int64_t i = 0; i < commands; ++i){
+        level ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(command.lock);
+            command.gpio = unsigned(bench_output_pin(cfg, 0));
+            command.waiting = true;
+        }
+        broker.publish(topic, group ? "{\"" + bench_output_id(0) + "\":" + std::to_string(level) + "}" : std::to_string(level), 1);
+        std::unique_lock<std::mutex> guard(command.lock);
+        if(!command.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !command.waiting; })){
+            command.waiting = false;
+            ++round.timeouts;
+        }
+    }
+    (group ? round.groups : round.commands) += uint64_t(commands);
+}
+
+int bench_alloc(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = int(options.get("zones", 4));
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 20));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t events = options.get("events", 100), commands = options.get("commands", 50), rate = options.get("rate", 10);
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    // a rule with a timer, so firing it and its revert are on the measured path too
+    cfg.extra = "\"rules\":[{\"name\":\"pulse\",\"when\":\"" + bench_input_id(0) + "\",\"is\":1,\"set\":\"" + bench_output_id(0) + "\",\"to\":1,\"for\":50}]";
+
+    EdgeTracker edges;
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        edges.on_publish(msg.topic.substr(state_prefix.size()), uint8_t(msg.payload[0] - '0'), msg.tick);
+    });
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        for(int i = 0; i < cfg.inputs; ++i) edges.pending[bench_input_id(i)];
+        edges.measuring = true;
+    }
+
+    CommandTracker command;
+    simSetWriteHook(&CommandTracker::write_hook, &command);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){
+        alloc_track_thread();
+        system->run();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500)); // discovery and the initial refresh
+
+    std::vector<uint8_t> levels(cfg.inputs, 0);
+    uint8_t out_level = 0;
+    AllocRound warmup, measured;
+    run_edges(cfg, edges, events, rate, levels, warmup);
+    run_commands(broker, cfg, command, commands, false, out_level, warmup);
+    run_commands(broker, cfg, command, commands, true, out_level, warmup);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500)); // the last snapshot and rule timers
+    simClearWrites(); // keeps the capacity the warm-up grew
+
+    uint64_t start = alloc_count();
+    run_edges(cfg, edges, events, rate, levels, measured);
+    uint64_t edge_allocs = alloc_count() - start;
+    start = alloc_count();
+    run_commands(broker, cfg, command, commands, false, out_level, measured);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    uint64_t command_allocs = alloc_count() - start;
+    start = alloc_count();
+    run_commands(broker, cfg, command, commands, true, out_level, measured);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    uint64_t group_allocs = alloc_count() - start;
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    broker.stop();
+
+    std::cout << "\n== alloc: zones=" << cfg.inputs << " events=" << events << " commands=" << commands << " ==\n";
+    std::cout << "  edges: allocations=" << edge_allocs << " per edge=" << double(edge_allocs) / double(std::max<uint64_t>(1, measured.edges)) << "\n";
+    std::cout << "  commands: allocations=" << command_allocs << " per command=" << double(command_allocs) / double(std::max<uint64_t>(1, measured.commands)) << "\n";
+    std::cout << "  group commands: allocations=" << group_allocs << " per command=" << double(group_allocs) / double(std::max<uint64_t>(1, measured.groups))
+              << " timeouts=" << measured.timeouts << "\n";
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Backpressure
+
+    One 24h alarm zone driving a siren, and --zones chattering zones that change
+    every --period ms, with a <name>/state snapshot after every 100 ms of changes.
+    The broker stand-in stops reading for --stall ms with small socket buffers
+    on both ends (--send-buffer on the service), so the socket fills and stays
+    full. Halfway through, the alarm zone opens. Reported are the time from its
+    edge to the siren's gpioWrite, which needs the service loop to keep running
+    while the broker is stalled. Once the broker reads again, the bench reports
+    when the alarm zone state and the panel's "triggered" state arrive, and how
+    many publishes arrived before them. Those should only be what the socket
+    buffers already held, since alarm traffic goes out ahead of the backlog.
+*/
+
+struct BackpressureTraffic {
+    std::atomic_bool resumed { false };
+    std::atomic<uint64_t> received { 0 }, before_zone { 0 }, before_panel { 0 };
+    std::atomic<int64_t> zone_us { -1 }, panel_us { -1 };
+    std::chrono::steady_clock::time_point resumed_at;
+};
+
+int bench_backpressure(const BenchOptions& options) {
+    const int chatter = int(std::max<int64_t>(1, options.get("zones", 16)));
+    const int64_t stall = std::max<int64_t>(200, options.get("stall", 2000)), period = std::max<int64_t>(1, options.get("period", 20));
+    const int64_t send_buffer = options.get("send-buffer", 4096);
+
+    MqttBrokerStub broker;
+    broker.set_receive_buffer(1024);
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.inputs = chatter + 1;
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 5));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    for(int i = 0; i < cfg.inputs; ++i){
+        cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"Bench Input " + std::to_string(i) + "\","
+                     "\"pin\":" + std::to_string(bench_input_pin(i)) + ",\"io\":\"input\",\"pullmode\":\"pulldown\","
+                     "\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + "," + (i == 0 ? "\"alarm\":\"24h\"" : "\"flap_count\":0") + "},";
+    }
+    cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"Bench Output 0\",\"pin\":" + std::to_string(bench_output_pin(cfg, 0)) + ",\"io\":\"output\",\"trigger_timeout\":0}";
+    cfg.extra = "\"alarm_panel\":\"Bench Alarm\",\"alarm_siren\":\"" + bench_output_id(0) + "\",\"state_snapshot_interval\":100,"
+                "\"metrics_interval\":0,\"mqtt_send_buffer\":" + std::to_string(send_buffer);
+
+    BackpressureTraffic traffic;
+    const std::string zone_topic = cfg.name + "/state/" + bench_input_id(0), panel_topic = cfg.name + "/alarm";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!traffic.resumed) return;
+        int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traffic.resumed_at).count();
+        if(msg.topic == zone_topic && msg.payload == "1" && traffic.zone_us < 0){
+            traffic.zone_us = us;
+            traffic.before_zone = traffic.received.load();
+        }
+        if(msg.topic == panel_topic && msg.payload == "triggered" && traffic.panel_us < 0){
+            traffic.panel_us = us;
+            traffic.before_panel = traffic.received.load();
+        }
+        ++traffic.received;
+    });
+
+    CommandTracker siren;
+    simSetWriteHook(&CommandTracker::write_hook, &siren);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500)); // discovery and the first state round
+
+    std::cout << "\n== backpressure: zones=" << chatter << " period=" << period << "ms stall=" << stall << "ms send-buffer=" << send_buffer << " ==\n";
+    broker.freeze(true);
+    for(int i = 1; i <= chatter; ++i) simPulseTrain(unsigned(bench_input_pin(i)), unsigned(stall / period), uint32_t(period * 1000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(stall / 2));
+
+    {
+        std::lock_guard<std::mutex> guard(siren.lock);
+        siren.gpio = unsigned(bench_output_pin(cfg, 0));
+        siren.waiting = true;
+    }
+    uint32_t edge = gpioTick();
+    simInjectEdge(unsigned(bench_input_pin(0)), 1);
+    bool sounded;
+    {
+        std::unique_lock<std::mutex> guard(siren.lock);
+        sounded = siren.written.wait_for(guard, std::chrono::milliseconds(stall), [&](){ return !siren.waiting; });
+    }
+    const double siren_ms = sounded ? double(int32_t(siren.write_tick - edge)) / 1000.0 : -1;
+    const double siren_bound = double(cfg.trigger_timeout + 500);
+    std::this_thread::sleep_for(std::chrono::milliseconds(stall / 2));
+
+    traffic.resumed_at = std::chrono::steady_clock::now();
+    traffic.resumed = true;
+    broker.freeze(false);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while((traffic.zone_us < 0 || traffic.panel_us < 0) && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    std::cout << "  siren with the broker stalled: ";
+    if(sounded) std::cout << siren_ms << "ms after the alarm edge (bound " << siren_bound << "ms)\n";
+    else std::cout << "NEVER\n";
+    std::cout << "  after the broker resumed: alarm zone state ";
+    if(traffic.zone_us >= 0) std::cout << double(traffic.zone_us) / 1000.0 << "ms behind " << traffic.before_zone << " publishes";
+    else std::cout << "LOST";
+    std::cout << ", panel triggered ";
+    if(traffic.panel_us >= 0) std::cout << double(traffic.panel_us) / 1000.0 << "ms behind " << traffic.before_panel << " publishes";
+    else std::cout << "LOST";
+    std::cout << ", " << traffic.received << " publishes received in all\n";
+
+    simSetWriteHook(nullptr, nullptr);
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+    return sounded && siren_ms <= siren_bound && traffic.zone_us >= 0 && traffic.panel_us >= 0 ? 0 : 1;
+}
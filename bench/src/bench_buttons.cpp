@@ -0,0 +1,178 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Buttons
+
+    One button zone with the default thresholds (or --window, --long, --hold and
+    --bounce). For --rounds rounds it is pressed in each of the four patterns,
+    with --chatter extra edges 1 ms apart ahead of every settling edge, as a worn
+    contact would give. Edges are scheduled at known ticks, so the point the
+    pattern becomes decidable is known too: the release for a long press, the
+    second press for a double, the release plus the double window for a single
+    and the press plus the hold time for a hold. Reported are the presses
+    classified as intended, and the latency from that point to the event at the
+    broker, which includes the glitch filter's --bounce and the wait for the next
+    zone pass. The discovery payload must carry the event entity.
+*/
+
+struct ButtonTraffic {
+    std::mutex lock;
+    std::condition_variable received;
+    std::string event_type;
+    uint32_t tick = 0; // of the first event since the pattern started
+    uint64_t events = 0;
+    bool discovered = false;
+};
+
+int bench_buttons(const BenchOptions& options) {
+    const int64_t rounds = std::max<int64_t>(1, options.get("rounds", 10)), chatter = std::max<int64_t>(0, options.get("chatter", 2));
+    const int64_t window = options.get("window", 300), long_press = options.get("long", 800), hold = options.get("hold", 2000), bounce = options.get("bounce", 10);
+    if(window < 50 || long_press <= window / 2 || hold <= long_press){
+        std::cerr << "expected window >= 50, long above half the window and hold above long\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.inputs = 1;
+    cfg.outputs = 0;
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.zones = "{\"zone_type\":\"gpio_digital\",\"name\":\"Bench Input 0\",\"pin\":" + std::to_string(bench_input_pin(0)) + ",\"io\":\"input\","
+                "\"pullmode\":\"pulldown\",\"trigger_timeout\":20,\"mode\":\"button\",\"double_window\":" + std::to_string(window) +
+                ",\"long_press\":" + std::to_string(long_press) + ",\"hold_time\":" + std::to_string(hold) + ",\"bounce\":" + std::to_string(bounce) + "}";
+    cfg.extra = "\"metrics_interval\":0";
+
+    ButtonTraffic traffic;
+    const std::string press_topic = cfg.name + "/press/" + bench_input_id(0);
+    const std::string discovery_topic = "homeassistant/device/" + cfg.name + "/config";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        uint32_t tick = gpioTick();
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        if(msg.topic == discovery_topic && msg.payload.find("\"p\":\"event\"") != std::string::npos) traffic.discovered = true;
+        if(msg.topic != press_topic) return;
+        if(traffic.events++) return; // one pattern is one event, a second is counted and not classified
+        size_t at = msg.payload.find("\"event_type\":\"");
+        traffic.event_type = at == std::string::npos ? msg.payload : msg.payload.substr(at + 14, msg.payload.find('"', at + 14) - at - 14);
+        traffic.tick = tick;
+        traffic.received.notify_all();
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500)); // discovery and the first state round
+
+    std::cout << "\n== buttons: rounds=" << rounds << " window=" << window << "ms long=" << long_press << "ms hold=" << hold
+              << "ms bounce=" << bounce << "ms chatter=" << chatter << " ==\n";
+
+    const unsigned pin = unsigned(bench_input_pin(0));
+    // settles the pin at level at tick, after the chatter that leads up to it; returns the settling tick
+    auto settle = [&](uint32_t tick, unsigned level){
+        for(int64_t n = chatter; n > 0; --n){
+            simScheduleEdge(pin, unsigned(n % 2 ? !level : level), tick - uint32_t(n * 1000));
+        }
+        simScheduleEdge(pin, level, tick);
+        return tick;
+    };
+
+    struct Pattern {
+        const char* name;
+        LatencyStats latency {};
+        uint64_t correct = 0, wrong = 0, missing = 0;
+    };
+    Pattern patterns[4] { { "single" }, { "double" }, { "long" }, { "hold" } };
+    const uint32_t us = 1000, tap = uint32_t(std::min<int64_t>(80, long_press / 2)) * us, gap = uint32_t(window / 2) * us;
+
+    for(int64_t round = 0; round < rounds; ++round){
+        for(Pattern& pattern : patterns){
+            {
+                std::lock_guard<std::mutex> guard(traffic.lock);
+                traffic.events = 0;
+            }
+            const uint32_t start = gpioTick() + 20 * us + uint32_t(chatter) * us;
+            uint32_t decided = 0, last = 0;
+            const std::string name = pattern.name;
+            if(name == "single"){
+                settle(start, 1);
+                last = settle(start + tap, 0);
+                decided = last + uint32_t(window) * us;
+            } else if(name == "double"){
+                settle(start, 1);
+                settle(start + tap, 0);
+                decided = settle(start + tap + gap, 1);
+                last = settle(decided + tap, 0);
+            } else if(name == "long"){
+                settle(start, 1);
+                decided = last = settle(start + uint32_t(long_press + (hold - long_press) / 2) * us, 0);
+            } else {
+                settle(start, 1);
+                decided = start + uint32_t(hold) * us;
+                last = settle(decided + 200 * us, 0);
+            }
+
+            std::unique_lock<std::mutex> guard(traffic.lock);
+            bool arrived = traffic.received.wait_for(guard, std::chrono::milliseconds(hold + window + 1000), [&](){ return traffic.events != 0; });
+            if(!arrived){
+                ++pattern.missing;
+            } else if(traffic.event_type == name){
+                ++pattern.correct;
+                pattern.latency.add(uint32_t(std::max<int32_t>(0, int32_t(traffic.tick - decided))));
+            } else {
+                ++pattern.wrong;
+                std::cout << "  " << name << " classified as " << traffic.event_type << "\n";
+            }
+            guard.unlock();
+            // the button is idle again once the last release settles and the window passes
+            int32_t rest = int32_t(last - gpioTick()) / 1000 + int32_t(window + bounce) + 50;
+            if(rest > 0) std::this_thread::sleep_for(std::chrono::milliseconds(rest));
+            std::lock_guard<std::mutex> quiet(traffic.lock);
+            if(traffic.events > 1){
+                ++pattern.wrong;
+                std::cout << "  " << name << " raised " << traffic.events << " events\n";
+            }
+        }
+    }
+
+    bool passed = true;
+    const double bound = double(bounce + 150); // the glitch filter and one 80ms pass of the default loop
+    for(Pattern& pattern : patterns){
+        std::cout << "  " << pattern.name << ": " << pattern.correct << "/" << rounds << " classified";
+        if(pattern.wrong) std::cout << ", " << pattern.wrong << " wrong";
+        if(pattern.missing) std::cout << ", " << pattern.missing << " missing";
+        std::cout << "\n";
+        if(pattern.latency.count()){
+            pattern.latency.print(std::string("    decidable -> event PUBLISH (") + pattern.name + ")");
+            passed = passed && pattern.latency.percentile(0.99) / 1000.0 <= bound;
+        }
+        passed = passed && pattern.correct == uint64_t(rounds) && !pattern.wrong;
+    }
+    {
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        std::cout << "  event entity in discovery: " << (traffic.discovered ? "yes" : "NO") << "\n";
+        passed = passed && traffic.discovered;
+    }
+    std::cout << "  p99 bound " << bound << "ms\n";
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+    return passed ? 0 : 1;
+}
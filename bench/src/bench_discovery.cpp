@@ -0,0 +1,111 @@
+#include "bench.h"
+#include "zone.h"
+#include "rule_engine.h"
+#include "jsonloader.h"
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+
+/*
+    Discovery generation
+
+    The cmps section of the device discovery payload for 10, 100 and 1000
+    virtual zones (or the --zones list), built --rounds times each way:
+
+    * DOM: the previous autodiscover, which formatted each zone's metadata with
+      a JsonLoader, parsed it back into a component, added the topics and
+      serialized the whole tree again
+    * fragments: each zone formats its component once, when it is loaded, and
+      discovery concatenates the cached fragments
+
+    The one-off formatting at load is reported separately, and the assembled
+    payload is parsed once to check that it is valid JSON.
+*/
+
+static double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) / 1000.0;
+}
+
+static std::string dom_components(const RuleEngine::ZoneList& zones, const std::vector<std::string>& ids) {
+    JsonLoader json;
+    JsonLoader::Object cmps;
+    for(size_t i = 0; i < zones.size(); ++i){
+        const Zone& zone = *zones[i];
+        JsonLoader meta;
+        meta.saveProperty("name", zone.get_name());
+        meta.saveProperty("unique_id", zone.get_unique_id());
+        meta.saveProperty("p", std::string(zone.get_io() == Zone::IO_OUTPUT ? "switch" : "binary_sensor"));
+        meta.saveProperty("payload_on", std::string(zone.is_inverted() ? "0" : "1"));
+        meta.saveProperty("payload_off", std::string(zone.is_inverted() ? "1" : "0"));
+
+        JsonLoader::Object cmp;
+        json.parseStringObject(meta.toString(), cmp);
+        json.saveProperty(cmp, "state_topic", "bench/state/" + ids[i]);
+        json.saveProperty(cmp, "command_topic", "bench/set/" + ids[i]);
+        json.saveProperty(cmp, "json_attr_t", "bench/attr/" + ids[i]);
+        json.saveProperty(cmps, ids[i].c_str(), cmp);
+    }
+    json.saveProperty("cmps", cmps);
+    return json.toString();
+}
+
+static void fragment_components(const RuleEngine::ZoneList& zones, std::string& out) {
+    size_t bytes = 16;
+    for(const auto& zone : zones) bytes += zone->get_discovery().size() + 1;
+    out.clear();
+    out.reserve(bytes);
+    out += "{\"cmps\":{";
+    for(const auto& zone : zones){
+        if(out.back() != '{') out += ',';
+        out += zone->get_discovery();
+    }
+    out += "}}";
+}
+
+static void run_discovery(size_t count, int64_t rounds) {
+    ZoneArena arena;
+    arena.reserve(count * sizeof(Virtual_Zone) + ZoneStateTable::footprint(count) + 64);
+    ZoneStateTable table(count, &arena);
+    RuleEngine::ZoneList zones;
+    std::vector<std::string> ids; // component keys outlive the JsonLoader
+    for(size_t z = 0; z < count; ++z){
+        zones.emplace_back(new (arena) Virtual_Zone({ &table, uint32_t(z) }, "Discovery Zone " + std::to_string(z), z % 4 ? Zone::IO_INPUT : Zone::IO_OUTPUT, z % 3 == 0));
+        ids.push_back(zones.back()->get_unique_id());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t z = 0; z < count; ++z){
+        zones[z]->format_discovery("bench/state/" + ids[z], "bench/set/" + ids[z], "bench/attr/" + ids[z]);
+    }
+    double load_us = elapsed_us(start);
+
+    std::string dom, fragments;
+    start = std::chrono::steady_clock::now();
+    for(int64_t r = 0; r < rounds; ++r) dom = dom_components(zones, ids);
+    double dom_us = elapsed_us(start) / double(rounds);
+
+    start = std::chrono::steady_clock::now();
+    for(int64_t r = 0; r < rounds; ++r) fragment_components(zones, fragments);
+    double fragment_us = elapsed_us(start) / double(rounds);
+
+    JsonLoader check;
+    JsonLoader::Object parsed;
+    bool valid = check.parseStringObject(fragments, parsed);
+
+    std::cout << "  zones=" << count << ": DOM=" << dom_us << "us (" << dom.size() << " bytes)"
+              << " fragments=" << fragment_us << "us (" << fragments.size() << " bytes, " << (valid ? "valid" : "INVALID") << ")"
+              << " formatted at load=" << load_us << "us\n";
+}
+
+int bench_discovery(const BenchOptions& options) {
+    const int64_t rounds = std::max<int64_t>(1, options.get("rounds", 20));
+    std::string counts = options.get("zones", std::string("10,100,1000"));
+
+    std::cout << "\n== discovery: rounds=" << rounds << " ==\n";
+    std::stringstream list(counts);
+    for(std::string count; std::getline(list, count, ',');){
+        if(!count.empty()) run_discovery(size_t(std::stoul(count)), rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "bench.h"
+#include "gpio.h"
+#include "zone.h"
+
+#include <iostream>
+#include <chrono>
+#include <functional>
+
+/*
+    Edge dispatch
+
+    The cost of getting an edge from pigpio's alert call to the zone's state
+    write. The std::function chain the service used before the delegate is
+    rebuilt here as the baseline: a static alert on the GPIO object, the pin
+    compare, then a std::function holding a std::bind of the zone handler.
+    The delegate is the thunk GPIO registers with pigpio, called with the zone
+    as userdata. Both are called --edges times through a function pointer the
+    compiler cannot see through, once into a handler that only counts the edge,
+    to show the dispatch alone, and once ending in the ZoneStateTable write.
+
+    The same delegate is then driven by the simulator's alert thread with a
+    --pulses edge train, to put the dispatch next to the rest of an alert.
+*/
+
+struct DispatchTarget {
+    ZoneStateTable* table; // nullptr to count the edge only
+    uint64_t edges = 0;
+};
+
+__attribute__((noinline)) static void on_edge_level(DispatchTarget* target, int level) {
+    if(target->table) target->table->set_level(0, int16_t(level));
+    ++target->edges;
+}
+
+__attribute__((noinline)) static void on_edge(DispatchTarget* target, int, int level, uint32_t) {
+    if(target->table) target->table->set_level(0, int16_t(level));
+    ++target->edges;
+}
+
+// the previous GPIO alert path
+struct LegacyGPIO {
+    int pin;
+    std::function<void(int)> callback;
+
+    static void static_alert(int gpio, int level, uint32_t tick, void* _this) {
+        static_cast<LegacyGPIO*>(_this)->alert(gpio, level, tick);
+    }
+    void alert(int gpio, int level, uint32_t) {
+        if(gpio == pin){
+            callback(level);
+        }
+    }
+};
+
+using AlertFunction = void (*)(int, int, uint32_t, void*);
+
+static double time_alerts(AlertFunction volatile& function, void* userdata, int pin, int64_t edges) {
+    auto start = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < edges; ++i){
+        function(pin, int(i & 1), uint32_t(i), userdata);
+    }
+    auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return double(wall) / double(std::max<int64_t>(1, edges));
+}
+
+int bench_dispatch(const BenchOptions& options) {
+    const int64_t edges = options.get("edges", 10000000), pulses = options.get("pulses", 100000);
+    const int pin = bench_input_pin(0);
+
+    ZoneArena arena;
+    arena.reserve(ZoneStateTable::footprint(1));
+    ZoneStateTable table(1, &arena);
+    table.bind(0, 0);
+
+    std::cout << "\n== dispatch: edges=" << edges << " ==\n";
+    for(ZoneStateTable* write : { (ZoneStateTable*)nullptr, &table }){
+        DispatchTarget legacy_target { write }, delegate_target { write };
+        LegacyGPIO legacy { pin, std::bind(&on_edge_level, &legacy_target, std::placeholders::_1) };
+        GPIO::Callback delegate = GPIO::Callback::bind<&on_edge>(&delegate_target);
+
+        AlertFunction volatile legacy_function = &LegacyGPIO::static_alert;
+        AlertFunction volatile delegate_function = delegate.function();
+        time_alerts(legacy_function, &legacy, pin, edges / 10); // warm-up
+        double legacy_ns = time_alerts(legacy_function, &legacy, pin, edges);
+        time_alerts(delegate_function, delegate.target(), pin, edges / 10);
+        double delegate_ns = time_alerts(delegate_function, delegate.target(), pin, edges);
+
+        std::cout << (write ? "  with the state write:\n" : "  dispatch only:\n");
+        std::cout << "    std::function chain: " << legacy_ns << "ns per edge\n";
+        std::cout << "    delegate: " << delegate_ns << "ns per edge\n";
+    }
+
+    // the delegate registered through GPIO, driven by the simulator's alert thread
+    if(gpioInitialise() < 0){
+        std::cerr << "failed to initialise the simulator\n";
+        return 1;
+    }
+    DispatchTarget sim_target { &table };
+    uint64_t delivered;
+    double per_alert;
+    {
+        GPIO gpio(pin, GPIO::PIN_INPUT_PULLDOWN, GPIO::Callback::bind<&on_edge>(&sim_target));
+        uint64_t before = simAlertsDelivered();
+        auto start = std::chrono::steady_clock::now();
+        simPulseTrain(unsigned(pin), unsigned(pulses), 0);
+        simWaitIdle(60000);
+        auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        delivered = simAlertsDelivered() - before;
+        per_alert = double(wall) / double(std::max<uint64_t>(1, delivered));
+    }
+    gpioTerminate();
+
+    std::cout << "  simulator alert thread: alerts=" << delivered << " handled=" << sim_target.edges
+              << " " << per_alert << "ns per alert\n";
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "expander_node_stub.h"
+#include "serial_wire.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+/*
+    Expander bus
+
+    The service masters a PJON ThroughSerial bus on a pseudo-terminal; the node
+    stand-ins sit on the far end of a simulated line running at --baud. Input
+    changes are made on the nodes at --rate and the latency is measured from the
+    change to the state PUBLISH. The line's byte counts give the bus utilisation,
+    and --loss N drops every Nth delta to exercise the sequence-gap resync.
+*/
+
+static std::string expander_zone_id(int node, int bit) { return "Expander" + std::to_string(node) + "x" + std::to_string(bit); }
+
+int bench_expander(const BenchOptions& options) {
+    const int node_count = int(options.get("nodes", 4));
+    const int inputs = int(options.get("zones", 8));
+    const int64_t rate = std::max<int64_t>(1, options.get("rate", 10));
+    const int64_t events = options.get("events", 200);
+    const uint32_t baud = uint32_t(options.get("baud", 9600));
+    const uint32_t loss = uint32_t(options.get("loss", 0));
+
+    if(node_count < 1 || node_count > 32 || inputs < 1 || inputs > 32){
+        std::cerr << "nodes and zones must be between 1 and 32\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    SerialWire wire;
+    if(!broker.start() || !wire.open(baud)){
+        std::cerr << "failed to start the broker or serial line stand-in\n";
+        return 1;
+    }
+
+    std::vector<uint8_t> ids;
+    for(int n = 0; n < node_count; ++n) ids.push_back(uint8_t(n + 1));
+    ExpanderNodeStub nodes;
+    nodes.start(wire.node_fd(), ids, PJONExpanderBus::DEFAULT_MASTER_ID, loss);
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.extra = "\"pjon_port\":\"" + wire.device() + "\",\"pjon_baud\":" + std::to_string(baud) + ",\"pjon_resync\":30";
+    for(int n = 0; n < node_count; ++n){
+        for(int b = 0; b < inputs; ++b){
+            if(!cfg.zones.empty()) cfg.zones += ",";
+            cfg.zones += "{\"zone_type\":\"pjon_remote\",\"name\":\"" + expander_zone_id(n + 1, b) + "\",\"node\":" + std::to_string(n + 1) + ","
+                         "\"bit\":" + std::to_string(b) + ",\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + "}";
+        }
+    }
+
+    EdgeTracker edges;
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        edges.on_publish(msg.topic.substr(state_prefix.size()), uint8_t(msg.payload[0] - '0'), msg.tick);
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    // every node has to answer its first poll before changes are meaningful
+    for(int i = 0; i < 100 && nodes.snapshot_count() < uint64_t(node_count); ++i){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + cfg.trigger_timeout * 2));
+
+    const int zone_count = node_count * inputs;
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        for(int i = 0; i < zone_count; ++i) edges.pending[expander_zone_id(i / inputs + 1, i % inputs)];
+        edges.measuring = true;
+    }
+
+    std::vector<uint8_t> levels(zone_count, 0);
+    const auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    uint64_t to_nodes = wire.bytes_to_nodes(), to_master = wire.bytes_to_master();
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    auto start = std::chrono::steady_clock::now(), next = start;
+    for(int64_t i = 0; i < events; ++i){
+        int zone = int(i % zone_count), node = zone / inputs + 1, bit = zone % inputs;
+        levels[zone] ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            edges.pending[expander_zone_id(node, bit)].push_back({ gpioTick(), levels[zone] });
+        }
+        nodes.set_input(uint8_t(node), uint8_t(bit), levels[zone]);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    {
+        std::unique_lock<std::mutex> guard(edges.lock);
+        edges.published.wait_for(guard, std::chrono::seconds(10), [&](){ return edges.outstanding() == 0; });
+        edges.measuring = false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t cpu = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+    to_nodes = wire.bytes_to_nodes() - to_nodes;
+    to_master = wire.bytes_to_master() - to_master;
+    size_t unpublished;
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        unpublished = edges.outstanding();
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    nodes.stop();
+    wire.close();
+    broker.stop();
+
+    double utilisation = double(to_nodes + to_master) * 10.0 / (double(baud) * seconds) * 100.0;
+    std::cout << "\n== expander: nodes=" << node_count << " zones/node=" << inputs << " rate=" << rate
+              << "/s baud=" << baud << " loss=" << (loss ? "1/" + std::to_string(loss) : std::string("none")) << " ==\n";
+    edges.latency.print("change -> publish");
+    std::cout << "  publishes=" << edges.publishes << " coalesced_changes=" << edges.coalesced
+              << " unpublished=" << unpublished << " cpu/change=" << (events ? cpu / uint64_t(events) : 0) << "ns\n";
+    std::cout << "line: to_master=" << to_master << "B to_nodes=" << to_nodes << "B ("
+              << double(to_nodes + to_master) / double(std::max<int64_t>(1, events)) << "B/change) utilisation="
+              << utilisation << "%\n";
+    std::cout << "nodes: deltas=" << nodes.delta_count() << " dropped=" << nodes.dropped_count()
+              << " snapshots=" << nodes.snapshot_count() << " polls=" << nodes.poll_count() << "\n";
+    return 0;
+}
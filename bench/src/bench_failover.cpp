@@ -0,0 +1,120 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Failover
+
+    Three broker endpoints: a name that never resolves, "localhost" on broker
+    stand-in A and 127.0.0.1 on stand-in B. Reported is the time to come online
+    while the names resolve in the background. Then the broker in use fails
+    twice, and each failover is timed from the failure to the command
+    subscription on the other broker, with a state change published there
+    after it:
+
+    * its process exits, the connection closes and the service sees EOF
+    * it stops answering with the connection left open, as a dead host looks
+      until TCP gives up; only the MQTT keepalive can tell on loopback
+
+    Each time is checked against its bound. An exit should take one loop pass
+    and a connect. A dead host should take half the keepalive (a PINGREQ after
+    a quarter of silence, another quarter for the PINGRESP) plus a connect.
+*/
+
+static double ms_since(std::chrono::steady_clock::time_point start) {
+    return double(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()) / 1000.0;
+}
+
+int bench_failover(const BenchOptions& options) {
+    const int64_t keepalive = std::max<int64_t>(4, options.get("keepalive", 4));
+    const double exit_bound = double(BrokerEndpoints::CONNECT_TIMEOUT_MS),
+                 dead_bound = double(keepalive * 500 + BrokerEndpoints::CONNECT_TIMEOUT_MS);
+
+    MqttBrokerStub brokers[2];
+    const char* labels[2] { "localhost", "127.0.0.1" };
+    if(!brokers[0].start() || !brokers[1].start()){
+        std::cerr << "failed to start the broker stand-ins\n";
+        return 1;
+    }
+    const uint16_t ports[2] { brokers[0].port(), brokers[1].port() };
+
+    BenchConfig cfg;
+    cfg.inputs = 1;
+    cfg.outputs = 0;
+    cfg.trigger_timeout = int(options.get("debounce", 20));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.extra = "\"mqtt_brokers\":[{\"address\":\"broker.invalid\",\"port\":1883},"
+                "{\"address\":\"localhost\",\"port\":" + std::to_string(ports[0]) + "},"
+                "{\"address\":\"127.0.0.1\",\"port\":" + std::to_string(ports[1]) + "}],"
+                "\"mqtt_keepalive\":" + std::to_string(keepalive);
+
+    const std::string command_topic = cfg.name + "/set/" + bench_input_id(0), state_topic = cfg.name + "/state/" + bench_input_id(0);
+    std::atomic<int> states[2] { 0, 0 };
+    for(int b = 0; b < 2; ++b){
+        brokers[b].set_publish_hook([&, b](const MqttBrokerStub::Message& msg){
+            if(msg.topic == state_topic) ++states[b];
+        });
+    }
+
+    std::cout << "\n== failover: keepalive=" << keepalive << "s ==\n";
+    auto start = std::chrono::steady_clock::now();
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::cout << "  online after " << ms_since(start) << "ms\n";
+    std::thread service([&](){ system->run(); });
+
+    auto active = [&]() -> int {
+        for(int b = 0; b < 2; ++b) if(brokers[b].wait_for_subscription(command_topic, 0)) return b;
+        return -1;
+    };
+    bool ok = true;
+    for(int round = 0; round < 2; ++round){
+        int from = active();
+        if(from < 0){
+            std::cerr << "the service is on neither broker\n";
+            ok = false;
+            break;
+        }
+        int to = 1 - from;
+        if(round == 0){
+            start = std::chrono::steady_clock::now();
+            brokers[from].stop();
+        } else {
+            brokers[from].freeze(true);
+            start = std::chrono::steady_clock::now();
+        }
+        bool recovered = brokers[to].wait_for_subscription(command_topic, uint32_t(keepalive * 1000 + 5000));
+        double took = ms_since(start), bound = round == 0 ? exit_bound : dead_bound;
+
+        int before = states[to];
+        simInjectEdge(unsigned(bench_input_pin(0)), unsigned(gpioRead(unsigned(bench_input_pin(0))) ^ 1));
+        auto published_by = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while(states[to] == before && std::chrono::steady_clock::now() < published_by) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        std::cout << "  " << (round == 0 ? "broker process exits" : "broker host stops answering") << ": ";
+        if(recovered) std::cout << "commands back after " << took << "ms on " << labels[to] << " (bound " << bound << "ms)";
+        else std::cout << "NEVER recovered";
+        std::cout << ", state " << (states[to] != before ? "published" : "LOST") << "\n";
+        ok = ok && recovered && took <= bound && states[to] != before;
+
+        if(round == 0) brokers[from].start(ports[from]); // back for the next failover
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    for(MqttBrokerStub& broker : brokers){
+        broker.freeze(false);
+        broker.stop();
+    }
+    return ok ? 0 : 1;
+}
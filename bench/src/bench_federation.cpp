@@ -0,0 +1,271 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <sstream>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <climits>
+#include <csignal>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+/*
+    Federation
+
+    Several controllers run as separate processes on loopback, each with its own
+    broker stand-in and simulated pins. Controller 1 (this process) mirrors every
+    zone of controllers 2..N through "federated" zones. Input changes are made on
+    the other controllers at --rate, sent to them over a pipe, and the latency is
+    measured from the change to controller 1's PUBLISH of its mirror.
+
+    Controller 2 is then killed and restarted with its first input at the opposite
+    level, which controller 1 has to pick up through the sequence reset.
+*/
+
+static std::string federation_zone_id(int controller, int zone) { return "Site" + std::to_string(controller) + "x" + std::to_string(zone); }
+
+struct FederationNode {
+    pid_t pid = -1;
+    int commands = -1; // write end of the node's stdin
+};
+
+static FederationNode spawn_node(int id, int base_port, int zones, int debounce, int initial, const std::string& log_level) {
+    FederationNode node;
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof exe - 1);
+    int fds[2];
+    if(len <= 0 || pipe2(fds, O_CLOEXEC) != 0) return node;
+    exe[len] = 0;
+
+    std::vector<std::string> args { exe, "federation-node", "--id", std::to_string(id), "--port", std::to_string(base_port),
+                                    "--zones", std::to_string(zones), "--debounce", std::to_string(debounce),
+                                    "--initial", std::to_string(initial), "--log-level", log_level };
+    std::vector<char*> argv;
+    for(auto& a : args) argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    if(posix_spawn(&node.pid, exe, &actions, nullptr, argv.data(), environ) != 0) node.pid = -1;
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if(node.pid < 0){
+        close(fds[1]);
+    } else {
+        node.commands = fds[1];
+    }
+    return node;
+}
+
+static void stop_node(FederationNode& node, bool kill_it) {
+    if(node.pid < 0) return;
+    if(kill_it) kill(node.pid, SIGKILL);
+    close(node.commands); // end of input shuts the node down
+    waitpid(node.pid, nullptr, 0);
+    node = FederationNode {};
+}
+
+// One of controllers 2..N: exports its simulated inputs and applies the changes read from stdin
+int bench_federation_node(const BenchOptions& options) {
+    const int id = int(options.get("id", 2));
+    const int base_port = int(options.get("port", 7600));
+    const int zones = int(options.get("zones", 4));
+    const int initial = int(options.get("initial", -1));
+
+    MqttBrokerStub broker;
+    if(!broker.start()) return 1;
+
+    BenchConfig cfg;
+    cfg.name = "site" + std::to_string(id);
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.extra = "\"federation_id\":" + std::to_string(id) + ",\"federation_port\":" + std::to_string(base_port + id - 1) + ","
+                "\"federation_peers\":[{\"id\":1,\"address\":\"127.0.0.1\",\"port\":" + std::to_string(base_port) + "}]";
+    for(int z = 0; z < zones; ++z){
+        if(!cfg.zones.empty()) cfg.zones += ",";
+        cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"" + federation_zone_id(id, z) + "\","
+                     "\"pin\":" + std::to_string(bench_input_pin(z)) + ",\"io\":\"input\",\"pullmode\":\"pulldown\","
+                     "\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + "}";
+    }
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    if(initial >= 0) simInjectEdge(bench_input_pin(0), unsigned(initial));
+
+    std::string line;
+    while(std::getline(std::cin, line)){
+        std::istringstream command(line);
+        int zone = -1, level = 0;
+        if(command >> zone >> level && zone >= 0 && zone < zones) simInjectEdge(bench_input_pin(zone), unsigned(level));
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+    return 0;
+}
+
+int bench_federation(const BenchOptions& options) {
+    const int controllers = int(options.get("controllers", 3));
+    const int zones = int(options.get("zones", 4));
+    const int64_t rate = std::max<int64_t>(1, options.get("rate", 10));
+    const int64_t events = options.get("events", 200);
+    const int base_port = int(options.get("port", 7600));
+    const int debounce = int(options.get("debounce", 100));
+    const std::string log_level = options.get("log-level", std::string("warn"));
+
+    if(controllers < 2 || controllers > 10 || zones < 1 || zones > 16){
+        std::cerr << "controllers must be between 2 and 10 and zones between 1 and 16\n";
+        return 1;
+    }
+
+    std::vector<FederationNode> nodes(controllers + 1);
+    for(int k = 2; k <= controllers; ++k){
+        nodes[k] = spawn_node(k, base_port, zones, debounce, -1, log_level);
+        if(nodes[k].pid < 0){
+            std::cerr << "failed to start controller " << k << "\n";
+            for(auto& node : nodes) stop_node(node, true);
+            return 1;
+        }
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        for(auto& node : nodes) stop_node(node, true);
+        return 1;
+    }
+
+    // mirrors publish as soon as the replicated state arrives, the debounce already ran on the source
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = debounce;
+    cfg.log_level = log_level;
+    cfg.extra = "\"federation_id\":1,\"federation_port\":" + std::to_string(base_port) + ",\"federation_peers\":[";
+    for(int k = 2; k <= controllers; ++k){
+        if(k > 2) cfg.extra += ",";
+        cfg.extra += "{\"id\":" + std::to_string(k) + ",\"address\":\"127.0.0.1\",\"port\":" + std::to_string(base_port + k - 1) + "}";
+        for(int z = 0; z < zones; ++z){
+            if(!cfg.zones.empty()) cfg.zones += ",";
+            cfg.zones += "{\"zone_type\":\"federated\",\"name\":\"" + federation_zone_id(k, z) + "\",\"peer\":" + std::to_string(k) + ","
+                         "\"zone\":\"" + federation_zone_id(k, z) + "\",\"trigger_timeout\":0}";
+        }
+    }
+    cfg.extra += "]";
+
+    EdgeTracker edges;
+    std::set<std::string> synced;
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        std::string id = msg.topic.substr(state_prefix.size());
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            synced.insert(id);
+        }
+        edges.on_publish(id, uint8_t(msg.payload[0] - '0'), msg.tick);
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        for(auto& node : nodes) stop_node(node, true);
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    // every mirror is published once its controller's first snapshot arrives
+    const int zone_count = (controllers - 1) * zones;
+    for(int i = 0; i < 150; ++i){
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            if(synced.size() >= size_t(zone_count)) break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + debounce * 2));
+
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        for(int i = 0; i < zone_count; ++i) edges.pending[federation_zone_id(i / zones + 2, i % zones)];
+        edges.measuring = true;
+    }
+
+    std::vector<uint8_t> levels(zone_count, 0);
+    const auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    auto next = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < events; ++i){
+        int zone = int(i % zone_count), k = zone / zones + 2, z = zone % zones;
+        levels[zone] ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            edges.pending[federation_zone_id(k, z)].push_back({ gpioTick(), levels[zone] });
+        }
+        std::string command = std::to_string(z) + " " + std::to_string(levels[zone]) + "\n";
+        (void)::write(nodes[k].commands, command.data(), command.size());
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    size_t unpublished;
+    {
+        std::unique_lock<std::mutex> guard(edges.lock);
+        edges.published.wait_for(guard, std::chrono::seconds(5), [&](){ return edges.outstanding() == 0; });
+        edges.measuring = false;
+        unpublished = edges.outstanding();
+    }
+    uint64_t cpu = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+
+    /* Restart phase: controller 2 comes back with its first input at the other level */
+    const std::string restart_topic = state_prefix + federation_zone_id(2, 0);
+    const char restart_level = char('0' + (levels[0] ^ 1));
+    std::atomic<uint32_t> restart_tick { 0 };
+    std::atomic_bool watching { true };
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(watching && msg.topic == restart_topic && !msg.payload.empty() && msg.payload[0] == restart_level){
+            restart_tick = msg.tick;
+            watching = false;
+        }
+    });
+    stop_node(nodes[2], true);
+    uint32_t spawn_tick = gpioTick();
+    nodes[2] = spawn_node(2, base_port, zones, debounce, levels[0] ^ 1, log_level);
+    for(int i = 0; i < 2000 && watching; ++i){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    bool resynced = !watching;
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    for(auto& node : nodes) stop_node(node, false);
+    broker.stop();
+
+    std::cout << "\n== federation: controllers=" << controllers << " zones/controller=" << zones << " rate=" << rate
+              << "/s debounce=" << debounce << "ms ==\n";
+    edges.latency.print("remote change -> mirror publish");
+    std::cout << "  publishes=" << edges.publishes << " coalesced_changes=" << edges.coalesced
+              << " unpublished=" << unpublished << " cpu/change=" << (events ? cpu / uint64_t(events) : 0) << "ns (controller 1 only)\n";
+    if(resynced){
+        std::cout << "restart: controller 2's new level mirrored " << (restart_tick - spawn_tick) / 1000 << "ms after it was started\n";
+    } else {
+        std::cout << "restart: controller 2's new level was never mirrored\n";
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Flapping input
+
+    One input chatters with a --period between edges for --duration ms, well
+    above its debounce, so every swing settles. The service runs once without a
+    publish policy, once with --max-rate and once with flap detection, and the
+    state publishes and CPU time during the chatter are counted. With flap
+    detection the time to the fault attribute and, after the input goes quiet,
+    to its recovery are reported too.
+*/
+
+struct FlapResult {
+    uint64_t publishes = 0;
+    uint64_t cpu_ns = 0;
+    int64_t fault_ms = -1, recover_ms = -1;
+};
+
+static bool run_flap(const BenchOptions& options, const std::string& policy, FlapResult& result) {
+    const int64_t period = options.get("period", 30), duration = options.get("duration", 3000);
+    const int64_t flap_window = options.get("flap-window", 1000);
+
+    MqttBrokerStub broker;
+    if(!broker.start()) return false;
+
+    BenchConfig cfg;
+    cfg.inputs = 1;
+    cfg.outputs = 0;
+    cfg.trigger_timeout = int(options.get("debounce", 5));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.mqtt_port = broker.port();
+    cfg.extra = policy;
+
+    const std::string state_topic = cfg.name + "/state/" + bench_input_id(0), attr_topic = cfg.name + "/attr/" + bench_input_id(0);
+    std::atomic_bool measuring { false };
+    std::atomic<uint64_t> publishes { 0 };
+    std::atomic<uint32_t> fault_tick { 0 }, recover_tick { 0 };
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!measuring) return;
+        if(msg.topic == state_topic) ++publishes;
+        if(msg.topic == attr_topic && msg.payload.find("flapping") != std::string::npos && !fault_tick) fault_tick = msg.tick;
+        if(msg.topic == attr_topic && msg.payload.find("none") != std::string::npos && fault_tick) recover_tick = msg.tick;
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        delete system;
+        return false;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    measuring = true;
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    uint32_t start = gpioTick();
+    uint32_t end = simPulseTrain(bench_input_pin(0), unsigned(duration / period), uint32_t(period * 1000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+    result.cpu_ns = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+    result.publishes = publishes;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(flap_window + 1000)); // quiet long enough to recover
+    measuring = false;
+    if(fault_tick) result.fault_ms = int64_t(fault_tick - start) / 1000;
+    if(recover_tick) result.recover_ms = int64_t(int32_t(recover_tick - end)) / 1000;
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+    return true;
+}
+
+int bench_flap(const BenchOptions& options) {
+    const int64_t max_rate = options.get("max-rate", 2);
+    const int64_t flap_count = options.get("flap-count", 20), flap_window = options.get("flap-window", 1000);
+    const int64_t period = options.get("period", 30), duration = options.get("duration", 3000);
+
+    struct Run {
+        std::string label, policy;
+    };
+    std::vector<Run> runs {
+        { "no policy", "\"flap_count\":0" },
+        { "max_rate=" + std::to_string(max_rate) + "/s", "\"flap_count\":0,\"max_rate\":" + std::to_string(max_rate) },
+        { "flap " + std::to_string(flap_count) + " in " + std::to_string(flap_window) + "ms",
+          "\"flap_count\":" + std::to_string(flap_count) + ",\"flap_window\":" + std::to_string(flap_window) },
+    };
+
+    std::cout << "\n== flap: an edge every " << period << "ms for " << duration << "ms ==\n";
+    for(const Run& run : runs){
+        FlapResult result;
+        if(!run_flap(options, run.policy, result)){
+            std::cerr << "service failed to come online\n";
+            return 1;
+        }
+        std::cout << "  " << run.label << ": publishes=" << result.publishes
+                  << " cpu=" << result.cpu_ns / 1000000 << "ms";
+        if(result.fault_ms >= 0) std::cout << " fault after " << result.fault_ms << "ms";
+        if(result.recover_ms >= 0) std::cout << ", recovered " << result.recover_ms << "ms after the last edge";
+        std::cout << "\n";
+    }
+    return 0;
+}
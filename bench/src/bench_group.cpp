@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+/*
+    Group outputs
+
+    --outputs output zones (a siren, a strobe, a relay...) are switched together
+    for --rounds rounds, first with one /set command per zone sent back to back,
+    then with one <name>/group/set command, which alternates between the JSON and
+    the mask form. Reported are the skew between the first and the last pin
+    write of a round, taken from the simulator's write log, and the spread of
+    the state PUBLISHes that report them at the broker. A group command should
+    write every pin with one bank set and one bank clear, and its publishes
+    should arrive together from a single zone pass.
+*/
+
+struct GroupTraffic {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<uint32_t> write_ticks, publish_ticks; // one per output this round, 0 until seen
+    std::vector<uint8_t> expected;
+    uint64_t bank_writes = 0, single_writes = 0;
+    unsigned first_pin = 0;
+    bool measuring = false;
+
+    static void write_hook(const SimWrite& w, void* userdata);
+    bool complete() const;
+};
+
+void GroupTraffic::write_hook(const SimWrite& w, void* userdata) {
+    GroupTraffic& self = *static_cast<GroupTraffic*>(userdata);
+    std::lock_guard<std::mutex> guard(self.lock);
+    if(!self.measuring || w.gpio < self.first_pin || w.gpio >= self.first_pin + self.write_ticks.size()) return;
+    size_t n = w.gpio - self.first_pin;
+    if(self.write_ticks[n] || w.level != self.expected[n]) return;
+    self.write_ticks[n] = w.tick;
+    (w.source == SimWrite::SIM_WRITE_BITS ? self.bank_writes : self.single_writes)++;
+    self.changed.notify_all();
+}
+
+bool GroupTraffic::complete() const {
+    return std::none_of(write_ticks.begin(), write_ticks.end(), [](uint32_t t){ return t == 0; }) &&
+           std::none_of(publish_ticks.begin(), publish_ticks.end(), [](uint32_t t){ return t == 0; });
+}
+
+static uint32_t spread(const std::vector<uint32_t>& ticks) {
+    auto [low, high] = std::minmax_element(ticks.begin(), ticks.end());
+    return *high - *low;
+}
+
+int bench_group(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = 0;
+    cfg.outputs = int(std::clamp<int64_t>(options.get("outputs", 3), 2, 16));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t rounds = std::max<int64_t>(1, options.get("rounds", 20));
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    cfg.extra = "\"metrics_interval\":0,\"flap_count\":0"; // the outputs change every round on purpose
+
+    GroupTraffic traffic;
+    traffic.first_pin = unsigned(bench_output_pin(cfg, 0));
+    traffic.write_ticks.assign(size_t(cfg.outputs), 0);
+    traffic.publish_ticks.assign(size_t(cfg.outputs), 0);
+    traffic.expected.assign(size_t(cfg.outputs), 0);
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        if(!traffic.measuring) return;
+        for(int n = 0; n < cfg.outputs; ++n){
+            if(msg.topic.compare(state_prefix.size(), std::string::npos, bench_output_id(n)) != 0) continue;
+            if(!traffic.publish_ticks[n] && uint8_t(msg.payload[0] - '0') == traffic.expected[n]) traffic.publish_ticks[n] = msg.tick;
+        }
+        traffic.changed.notify_all();
+    });
+    simSetWriteHook(&GroupTraffic::write_hook, &traffic);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // discovery and the initial refresh
+
+    std::cout << "\n== group: outputs=" << cfg.outputs << " rounds=" << rounds << " ==\n";
+    uint8_t level = 0;
+    bool passed = true;
+    for(int grouped = 0; grouped < 2; ++grouped){
+        LatencyStats skew, publishes;
+        uint64_t timeouts = 0;
+        {
+            std::lock_guard<std::mutex> guard(traffic.lock);
+            traffic.bank_writes = traffic.single_writes = 0;
+        }
+        for(int64_t round = 0; round < rounds; ++round){
+            level ^= 1;
+            {
+                std::lock_guard<std::mutex> guard(traffic.lock);
+                std::fill(traffic.write_ticks.begin(), traffic.write_ticks.end(), 0);
+                std::fill(traffic.publish_ticks.begin(), traffic.publish_ticks.end(), 0);
+                // the outputs alternate, so one command both sets and clears pins
+                for(int n = 0; n < cfg.outputs; ++n) traffic.expected[n] = uint8_t(level ^ (n & 1));
+                traffic.measuring = true;
+            }
+            if(!grouped){
+                for(int n = 0; n < cfg.outputs; ++n) broker.publish(cfg.name + "/set/" + bench_output_id(n), std::to_string(level ^ (n & 1)), 1);
+            } else if(round % 2){
+                std::string payload = "{";
+                for(int n = 0; n < cfg.outputs; ++n) payload += (n ? ",\"" : "\"") + bench_output_id(n) + "\":" + std::to_string(level ^ (n & 1));
+                broker.publish(cfg.name + "/group/set", payload + "}", 1);
+            } else {
+                uint64_t mask = (uint64_t(1) << cfg.outputs) - 1, values = 0;
+                for(int n = 0; n < cfg.outputs; ++n) values |= uint64_t(level ^ (n & 1)) << n;
+                broker.publish(cfg.name + "/group/set", std::to_string(mask) + ":" + std::to_string(values), 1);
+            }
+
+            std::unique_lock<std::mutex> guard(traffic.lock);
+            if(traffic.changed.wait_for(guard, std::chrono::seconds(2), [&](){ return traffic.complete(); })){
+                skew.add(spread(traffic.write_ticks));
+                publishes.add(spread(traffic.publish_ticks));
+            } else {
+                ++timeouts;
+            }
+            traffic.measuring = false;
+            guard.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200)); // the snapshot and any late publish
+        }
+
+        const std::string label = grouped ? "group command" : "per-zone commands";
+        std::cout << "  " << label << ":\n";
+        skew.print("    first -> last pin write");
+        publishes.print("    first -> last state PUBLISH");
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        std::cout << "    bank writes=" << traffic.bank_writes << " gpioWrite=" << traffic.single_writes << " timeouts=" << timeouts << "\n";
+        passed = passed && !timeouts;
+        if(grouped) passed = passed && !traffic.single_writes && skew.count() && publishes.percentile(0.99) <= 20000;
+    }
+
+    simSetWriteHook(nullptr, nullptr);
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+    return passed ? 0 : 1;
+}
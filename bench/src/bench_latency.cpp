@@ -0,0 +1,139 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <pigpio_sim.h>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+/*
+    End-to-end latency
+
+    Edge path: an edge is scheduled on a simulated input at a known tick and the
+    latency is measured to the moment the broker has received the state PUBLISH.
+
+    Command path: the broker publishes to <name>/set/<id> and the latency is
+    measured to the gpioWrite observed through the simulator's write hook.
+*/
+
+int bench_latency(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = int(options.get("zones", 4));
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t rate = std::max<int64_t>(1, options.get("rate", 10));
+    const int64_t events = options.get("events", 1000);
+    const int64_t commands = options.get("commands", 100);
+
+    if(cfg.inputs < 1 || bench_output_pin(cfg, cfg.outputs - 1) > PI_MAX_USER_GPIO){
+        std::cerr << "zone count must be between 1 and " << PI_MAX_USER_GPIO - 2 << "\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+
+    EdgeTracker edges;
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        edges.on_publish(msg.topic.substr(state_prefix.size()), uint8_t(msg.payload[0] - '0'), msg.tick);
+    });
+
+    CommandTracker command;
+    simSetWriteHook(&CommandTracker::write_hook, &command);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    const std::string command_topic = cfg.name + "/set/" + bench_output_id(0);
+    if(!broker.wait_for_subscription(command_topic, 5000)){
+        std::cerr << "service never subscribed to " << command_topic << "\n";
+    }
+    // let the discovery burst and initial state refresh drain before measuring
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + cfg.trigger_timeout * 2));
+
+    /* Edge phase */
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        for(int i = 0; i < cfg.inputs; ++i) edges.pending[bench_input_id(i)];
+        edges.measuring = true;
+    }
+
+    std::vector<uint8_t> levels(cfg.inputs, 0);
+    const auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    auto next = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < events; ++i){
+        int zone = int(i % cfg.inputs);
+        levels[zone] ^= 1;
+        uint32_t tick = gpioTick();
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            edges.pending[bench_input_id(zone)].push_back({ tick, levels[zone] });
+        }
+        simScheduleEdge(bench_input_pin(zone), levels[zone], tick);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    {
+        std::unique_lock<std::mutex> guard(edges.lock);
+        edges.published.wait_for(guard, std::chrono::seconds(5), [&](){ return edges.outstanding() == 0; });
+        edges.measuring = false;
+    }
+    uint64_t edge_cpu = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+
+    /* Command phase */
+    LatencyStats command_latency;
+    uint64_t command_timeouts = 0;
+    uint8_t out_level = 0;
+    cpu_start = process_cpu_ns();
+    broker_start = broker.broker_cpu_ns();
+    for(int64_t i = 0; i < commands; ++i){
+        out_level ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(command.lock);
+            command.gpio = unsigned(bench_output_pin(cfg, 0));
+            command.waiting = true;
+        }
+        uint32_t sent = gpioTick();
+        broker.publish(command_topic, std::to_string(out_level), 1);
+
+        std::unique_lock<std::mutex> guard(command.lock);
+        if(command.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !command.waiting; })){
+            command_latency.add(command.write_tick - sent);
+        } else {
+            command.waiting = false;
+            ++command_timeouts;
+        }
+    }
+    uint64_t command_cpu = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    broker.stop();
+
+    std::cout << "\n== latency: zones=" << cfg.inputs << " rate=" << rate << "/s debounce=" << cfg.trigger_timeout << "ms ==\n";
+    edges.latency.print("edge -> publish");
+    std::cout << "  publishes=" << edges.publishes << " coalesced_edges=" << edges.coalesced
+              << " cpu/edge=" << (events ? edge_cpu / uint64_t(events) : 0) << "ns\n";
+    command_latency.print("command -> gpioWrite");
+    std::cout << "  timeouts=" << command_timeouts
+              << " cpu/command=" << (commands ? command_cpu / uint64_t(commands) : 0) << "ns\n";
+    return 0;
+}
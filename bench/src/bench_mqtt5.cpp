@@ -0,0 +1,147 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    MQTT 5
+
+    The same input traffic over three sessions: the service asking for 3.1.1,
+    asking for 5 (topic aliases for the zone state topics, a session expiry
+    interval), and asking for 5 from a broker stand-in that only speaks 3.1.1.
+    Reported are the protocol each session settled on, the bytes on the wire
+    per zone state PUBLISH, and what a dropped connection costs: the SUBSCRIBE
+    packets sent after the reconnect and whether the broker resumed the session.
+    On the MQTT 5 broker the birth message is refused with reason code 0x87;
+    a 3.1.1 broker could only drop the connection.
+*/
+
+struct Mqtt5Phase {
+    const char* label;
+    const char* requested;
+    uint8_t broker_level;
+};
+
+struct Mqtt5Traffic {
+    std::atomic<uint64_t> states { 0 }, bytes { 0 };
+    std::mutex lock;
+    std::string version;
+};
+
+static bool wait_until(const std::function<bool()>& done, uint32_t timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while(!done() && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return done();
+}
+
+static bool run_mqtt5_phase(const Mqtt5Phase& phase, const BenchOptions& options) {
+    const int zones = int(std::max<int64_t>(1, options.get("zones", 8)));
+    const int64_t events = options.get("events", 200), period = std::max<int64_t>(1, options.get("period", 100));
+
+    MqttBrokerStub broker;
+    broker.set_max_level(phase.broker_level);
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return false;
+    }
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.inputs = zones;
+    cfg.outputs = 0;
+    cfg.trigger_timeout = int(options.get("debounce", 5));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.input_extra = "\"flap_count\":0";
+    cfg.extra = "\"mqtt_version\":\"" + std::string(phase.requested) + "\",\"mqtt_session_expiry\":" + std::to_string(options.get("session-expiry", 300));
+    const bool refusing = std::string(phase.requested) == "5" && phase.broker_level >= 5;
+    if(refusing) broker.refuse_topic(cfg.name + "/system/status", 0x87);
+
+    Mqtt5Traffic traffic;
+    std::atomic_bool measuring { false };
+    const std::string state_prefix = cfg.name + "/state/", version_topic = cfg.name + "/version";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(msg.topic == version_topic){
+            size_t at = msg.payload.find("\"mqtt_version\":\"");
+            std::lock_guard<std::mutex> guard(traffic.lock);
+            if(at != std::string::npos) traffic.version = msg.payload.substr(at + 16, msg.payload.find('"', at + 16) - at - 16);
+        }
+        if(!measuring || msg.topic.compare(0, state_prefix.size(), state_prefix) != 0) return;
+        ++traffic.states;
+        traffic.bytes += msg.wire_bytes;
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return false;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500)); // discovery and the first state round
+
+    measuring = true;
+    uint32_t end = 0;
+    for(int i = 0; i < zones; ++i) end = simPulseTrain(unsigned(bench_input_pin(i)), unsigned(std::max<int64_t>(1, events / zones)), uint32_t(period * 1000));
+    std::this_thread::sleep_for(std::chrono::microseconds(int32_t(end - gpioTick())));
+    simWaitIdle(2000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(cfg.trigger_timeout + 300));
+    measuring = false;
+    uint64_t states = traffic.states, bytes = traffic.bytes;
+    bool kept = broker.connection_count() == 1;
+
+    // the network drops the connection; the service finds out when a publish fails, and reconnects
+    uint64_t subscribes = broker.subscribe_count();
+    broker.drop_clients();
+    bool reconnected = wait_until([&](){
+        simInjectEdge(unsigned(bench_input_pin(0)), unsigned(gpioRead(unsigned(bench_input_pin(0))) ^ 1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(period));
+        return broker.connection_count() >= 2;
+    }, 5000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    uint64_t resubscribes = broker.subscribe_count() - subscribes;
+    bool resumed = broker.resumed_count() > 0;
+
+    // aliases are per connection, the next state publish has to set its alias up again
+    uint64_t before = traffic.states;
+    measuring = true;
+    simInjectEdge(unsigned(bench_input_pin(0)), unsigned(gpioRead(unsigned(bench_input_pin(0))) ^ 1));
+    bool published = wait_until([&](){ return traffic.states > before; }, 2000) && broker.connection_count() == 2;
+    measuring = false;
+
+    std::string version;
+    {
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        version = traffic.version;
+    }
+    std::cout << "  " << std::left << std::setw(22) << phase.label << std::right
+              << "MQTT " << (version.empty() ? "?" : version) << ", " << states << " state publishes, "
+              << std::fixed << std::setprecision(1) << (states ? double(bytes) / double(states) : 0.0) << " bytes each";
+    if(refusing) std::cout << (kept ? ", refused birth kept the connection" : ", refused birth dropped the connection");
+    std::cout << "\n  " << std::setw(22) << "" << "reconnect: ";
+    if(reconnected) std::cout << resubscribes << " SUBSCRIBE, session " << (resumed ? "resumed" : "new") << ", state after it " << (published ? "published" : "LOST") << "\n";
+    else std::cout << "NEVER\n";
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+
+    return reconnected && published && states > 0 && version == (refusing ? "5.0" : "3.1.1") && (!refusing || (kept && resumed && !resubscribes));
+}
+
+int bench_mqtt5(const BenchOptions& options) {
+    const Mqtt5Phase phases[] {
+        { "3.1.1", "3.1.1", 5 },
+        { "5", "5", 5 },
+        { "5, 3.1.1-only broker", "5", 4 },
+    };
+    std::cout << "\n== mqtt5: zones=" << options.get("zones", 8) << " events=" << options.get("events", 200) << " period=" << options.get("period", 100) << "ms ==\n";
+    bool ok = true;
+    for(const Mqtt5Phase& phase : phases) ok = run_mqtt5_phase(phase, options) && ok;
+    return ok ? 0 : 1;
+}
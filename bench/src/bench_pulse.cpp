@@ -0,0 +1,221 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "pigpiod_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+/*
+    Pulses
+
+    Three output zones: a strike with a default "pulse" of --strike ms and a
+    buzzer on this Pi, and a strike on a pigpiod stand-in host. For --rounds
+    rounds each is sent a timed command that pigpio carries out a different way:
+    a --short us buzzer pulse (gpioTrigger), the strike's default pulse (a DMA
+    wave), a --buzz ms buzzer pulse while the strike's wave is still running (a
+    pigpio timer, the wave engine is busy) and a --remote ms pulse on the remote
+    strike (a wave on that host). Reported are the pulse lengths measured from
+    the simulator's write log against the requested ones, the write that ended
+    each pulse, which tells the method used, and whether the zone's state topic
+    published both the "on" and the "off". Last, a --strike ms pulse is started
+    and the broker is stopped at once: the strike must still turn off on time,
+    with no broker and no zone pass involved.
+*/
+
+struct PulseTraffic {
+    std::mutex lock;
+    std::condition_variable ended;
+    unsigned pin = 0;
+    bool measuring = false;
+    uint32_t on_tick = 0, off_tick = 0;
+    SimWrite::Source off_source = SimWrite::SIM_WRITE;
+    std::string state_topic; // of the zone being pulsed
+    bool published_on = false, published_off = false;
+
+    static void write_hook(const SimWrite& w, void* userdata);
+    void arm(unsigned gpio); // caller holds the lock
+};
+
+void PulseTraffic::write_hook(const SimWrite& w, void* userdata) {
+    PulseTraffic& self = *static_cast<PulseTraffic*>(userdata);
+    std::lock_guard<std::mutex> guard(self.lock);
+    if(!self.measuring || w.gpio != self.pin) return;
+    if(w.level && !self.on_tick){
+        self.on_tick = w.tick;
+    } else if(!w.level && self.on_tick && !self.off_tick){
+        self.off_tick = w.tick;
+        self.off_source = w.source;
+        self.ended.notify_all();
+    }
+}
+
+void PulseTraffic::arm(unsigned gpio) {
+    pin = gpio;
+    on_tick = off_tick = 0;
+    published_on = published_off = false;
+    measuring = true;
+}
+
+static const char* source_name(SimWrite::Source source) {
+    switch(source){
+        case SimWrite::SIM_TRIGGER: return "gpioTrigger";
+        case SimWrite::SIM_WAVE: return "wave";
+        case SimWrite::SIM_WRITE: return "gpioWrite";
+        default: return "other";
+    }
+}
+
+int bench_pulse(const BenchOptions& options) {
+    const int64_t rounds = std::max<int64_t>(1, options.get("rounds", 5));
+    const int64_t short_us = std::clamp<int64_t>(options.get("short", 50), 1, 100);
+    const int64_t strike_ms = std::clamp<int64_t>(options.get("strike", 500), 50, 5000);
+    const int64_t buzz_ms = std::clamp<int64_t>(options.get("buzz", strike_ms / 2), 10, strike_ms - 20);
+    const int64_t remote_ms = std::clamp<int64_t>(options.get("remote", 200), 1, 5000);
+
+    MqttBrokerStub broker;
+    PigpiodStub host;
+    if(!broker.start() || !host.start()){
+        std::cerr << "failed to start the broker or pigpiod stand-in\n";
+        return 1;
+    }
+
+    struct Output {
+        const char* id;
+        int pin;
+        const char* host;
+    };
+    const Output strike { "Strike", 20, "" }, buzzer { "Buzzer", 21, "" }, remote { "RemoteStrike", 13, "pi0" };
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    for(const Output* out : { &strike, &buzzer, &remote }){
+        if(!cfg.zones.empty()) cfg.zones += ",";
+        cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"" + std::string(out->id) + "\",\"pin\":" + std::to_string(out->pin) + ",\"io\":\"output\","
+                     "\"trigger_timeout\":0" + (out == &strike ? ",\"pulse\":" + std::to_string(strike_ms) : "") +
+                     (*out->host ? ",\"host\":\"" + std::string(out->host) + "\"" : "") + "}";
+    }
+    cfg.extra = "\"metrics_interval\":0,\"flap_count\":0,\"hosts\":[{\"name\":\"pi0\",\"address\":\"127.0.0.1\",\"port\":" + std::to_string(host.port()) + "}]";
+
+    PulseTraffic traffic;
+    simSetWriteHook(&PulseTraffic::write_hook, &traffic);
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        if(!traffic.measuring || msg.topic != traffic.state_topic) return;
+        if(msg.payload == "1") traffic.published_on = true;
+        else if(msg.payload == "0" && traffic.published_on) traffic.published_off = true;
+        traffic.ended.notify_all();
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // discovery and the remote host connection
+
+    std::cout << "\n== pulse: rounds=" << rounds << " short=" << short_us << "us strike=" << strike_ms << "ms buzz=" << buzz_ms
+              << "ms remote=" << remote_ms << "ms ==\n";
+
+    struct Case {
+        const char* label;
+        const Output& out;
+        std::string payload;
+        uint32_t expected_us;
+        SimWrite::Source expected_source;
+        LatencyStats error {};
+        uint64_t timeouts = 0, wrong_method = 0, unpublished = 0;
+    };
+    Case cases[4] {
+        { "trigger", buzzer, "1:" + std::to_string(short_us) + "us", uint32_t(short_us), SimWrite::SIM_TRIGGER },
+        { "wave", strike, "1", uint32_t(strike_ms * 1000), SimWrite::SIM_WAVE },
+        { "timer", buzzer, "1:" + std::to_string(buzz_ms), uint32_t(buzz_ms * 1000), SimWrite::SIM_WRITE },
+        { "remote wave", remote, "1:" + std::to_string(remote_ms) + "ms", uint32_t(remote_ms * 1000), SimWrite::SIM_WAVE },
+    };
+
+    // publishes the command and waits for the pulse to end on the pin
+    auto run = [&](Case& c, bool busy_engine){
+        if(busy_engine) broker.publish(cfg.name + "/set/" + strike.id, "1", 1); // the strike holds the wave engine
+        if(busy_engine) std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        {
+            std::lock_guard<std::mutex> guard(traffic.lock);
+            traffic.arm(unsigned(c.out.pin));
+            traffic.state_topic = cfg.name + "/state/" + c.out.id;
+        }
+        broker.publish(cfg.name + "/set/" + c.out.id, c.payload, 1);
+        std::unique_lock<std::mutex> guard(traffic.lock);
+        if(traffic.ended.wait_for(guard, std::chrono::milliseconds(c.expected_us / 1000 + 2000), [&](){ return traffic.off_tick != 0; })){
+            c.error.add(uint32_t(std::abs(int32_t(traffic.off_tick - traffic.on_tick) - int32_t(c.expected_us))));
+            if(traffic.off_source != c.expected_source){
+                ++c.wrong_method;
+                std::cout << "  " << c.label << " pulse ended by " << source_name(traffic.off_source) << "\n";
+            }
+        } else {
+            ++c.timeouts;
+        }
+        // the zone pass records the off once the pulse has ended, a pass or two after it
+        if(!traffic.ended.wait_for(guard, std::chrono::milliseconds(1000), [&](){ return traffic.published_off; })){
+            ++c.unpublished;
+            std::cout << "  " << c.label << " pulse published " << (traffic.published_on ? "only its on" : "neither level") << "\n";
+        }
+        traffic.measuring = false;
+    };
+
+    for(int64_t round = 0; round < rounds; ++round){
+        for(Case& c : cases){
+            run(c, &c == &cases[2]);
+            // every pulse is over, and a pass has deleted the waves and cancelled the timers
+            std::this_thread::sleep_for(std::chrono::milliseconds(strike_ms + 200));
+        }
+    }
+
+    // a turn-off left to the zone pass would be up to a pass late, 40ms on average; the simulator logs the
+    // writes of waves, triggers and timers at the tick they were due, so pigpio's timing is measured, not the host's
+    bool passed = true;
+    const double bound_ms = 2;
+    for(Case& c : cases){
+        std::cout << "  " << c.label << " (" << source_name(c.expected_source) << ", " << c.expected_us << "us):\n";
+        if(c.error.count()) c.error.print("    |measured - requested| pulse length");
+        std::cout << "    timeouts=" << c.timeouts << " wrong method=" << c.wrong_method << " unpublished=" << c.unpublished << "\n";
+        passed = passed && !c.timeouts && !c.wrong_method && !c.unpublished && c.error.count() && c.error.percentile(0.99) / 1000.0 <= bound_ms;
+    }
+
+    // with the broker gone the strike still ends on time, timed by pigpio
+    {
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        traffic.arm(unsigned(strike.pin));
+    }
+    broker.publish(cfg.name + "/set/" + strike.id, "1", 1);
+    bool started = false;
+    auto wait_on = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(!started && std::chrono::steady_clock::now() < wait_on){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        started = traffic.on_tick != 0;
+    }
+    broker.stop();
+    bool ended;
+    int32_t length_us = 0;
+    {
+        std::unique_lock<std::mutex> guard(traffic.lock);
+        ended = started && traffic.ended.wait_for(guard, std::chrono::milliseconds(strike_ms + 2000), [&](){ return traffic.off_tick != 0; });
+        if(ended) length_us = int32_t(traffic.off_tick - traffic.on_tick);
+        traffic.measuring = false;
+    }
+    std::cout << "  broker stopped during a " << strike_ms << "ms strike: ";
+    if(ended) std::cout << "off after " << double(length_us) / 1000.0 << "ms\n";
+    else std::cout << "NEVER turned off\n";
+    passed = passed && ended && std::abs(length_us - int32_t(strike_ms * 1000)) <= int32_t(bound_ms * 1000);
+    std::cout << "  p99 bound " << bound_ms << "ms\n";
+
+    simSetWriteHook(nullptr, nullptr);
+    system->shutdown_system();
+    service.join();
+    delete system;
+    host.stop();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Realtime profile
+
+    A rule drives an output to follow an input, so the edge -> gpioWrite latency
+    is the zone consumer's alone, without the broker in the path. The service runs
+    once with the default loop and once with the realtime profile while --load
+    threads spin on every core, and the last <name>/metrics report of each run is
+    printed with it. Without the privilege for SCHED_FIFO (CAP_SYS_NICE) the zone
+    thread keeps the default policy and only the shorter wake period is compared.
+*/
+
+static bool run_realtime(const BenchOptions& options, bool realtime, LatencyStats& latency, std::string& metrics) {
+    const int64_t events = options.get("events", 200), load = options.get("load", int64_t(std::thread::hardware_concurrency()));
+
+    MqttBrokerStub broker;
+    if(!broker.start()) return false;
+
+    BenchConfig cfg;
+    cfg.inputs = 1;
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 5));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.mqtt_port = broker.port();
+    cfg.extra = "\"metrics_interval\":1,\"flap_count\":0,\"rules\":["
+                "{\"name\":\"on\",\"when\":\"" + bench_input_id(0) + "\",\"is\":1,\"set\":\"" + bench_output_id(0) + "\",\"to\":1},"
+                "{\"name\":\"off\",\"when\":\"" + bench_input_id(0) + "\",\"is\":0,\"set\":\"" + bench_output_id(0) + "\",\"to\":0}]";
+    if(realtime){
+        cfg.extra += ",\"realtime\":true,\"realtime_period\":" + std::to_string(options.get("period", 10)) +
+                     ",\"realtime_priority\":" + std::to_string(options.get("priority", 50)) +
+                     ",\"realtime_zone_cpu\":" + std::to_string(options.get("zone-cpu", -1)) +
+                     ",\"realtime_io_cpu\":" + std::to_string(options.get("io-cpu", -1));
+    }
+
+    std::mutex metrics_lock;
+    const std::string metrics_topic = cfg.name + "/metrics";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(msg.topic != metrics_topic) return;
+        std::lock_guard<std::mutex> guard(metrics_lock);
+        metrics = msg.payload;
+    });
+
+    CommandTracker command;
+    simSetWriteHook(&CommandTracker::write_hook, &command);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        delete system;
+        simSetWriteHook(nullptr, nullptr);
+        return false;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    std::atomic_bool loaded { true };
+    std::vector<std::thread> spinners;
+    for(int64_t i = 0; i < load; ++i){
+        spinners.emplace_back([&](){
+            volatile uint64_t spin = 0;
+            while(loaded) spin = spin + 1;
+        });
+    }
+    { std::lock_guard<std::mutex> guard(metrics_lock); metrics.clear(); } // only reports taken under load
+
+    uint8_t level = 0;
+    for(int64_t i = 0; i < events; ++i){
+        level ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(command.lock);
+            command.gpio = unsigned(bench_output_pin(cfg, 0));
+            command.waiting = true;
+        }
+        uint32_t tick = gpioTick();
+        simInjectEdge(bench_input_pin(0), level);
+
+        std::unique_lock<std::mutex> guard(command.lock);
+        if(command.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !command.waiting; })){
+            latency.add(command.write_tick - tick);
+        } else {
+            command.waiting = false;
+        }
+        guard.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(cfg.trigger_timeout * 2 + 10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100)); // one more metrics report
+
+    loaded = false;
+    for(std::thread& t : spinners) t.join();
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    broker.stop();
+    return true;
+}
+
+int bench_realtime(const BenchOptions& options) {
+    const int64_t load = options.get("load", int64_t(std::thread::hardware_concurrency()));
+    std::cout << "\n== realtime: edge -> rule gpioWrite with " << load << " spinning threads ==\n";
+    for(bool realtime : { false, true }){
+        LatencyStats latency;
+        std::string metrics;
+        if(!run_realtime(options, realtime, latency, metrics)){
+            std::cerr << "service failed to come online\n";
+            return 1;
+        }
+        latency.print(realtime ? "realtime profile" : "default loop");
+        std::cout << "  last metrics: " << (metrics.empty() ? "(none)" : metrics) << "\n";
+    }
+    return 0;
+}
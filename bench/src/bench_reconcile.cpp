@@ -0,0 +1,160 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "pigpiod_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Reconcile
+
+    --zones inputs on this Pi and --remote inputs on a pigpiod stand-in host.
+    Every other local input chatters every --period ms for the whole run, so
+    alerts are always in flight. --lost times, an input that does not chatter
+    changes level with no alert at all, as an edge lost to an overflowed
+    sample buffer would. Reported are the edges the bank reads found, the time
+    from each lost edge to the corrected state at the broker (bounded by
+    --interval, the confirming read and a zone pass), and the "missed_edges"
+    counted in <name>/metrics, which must equal the edges lost: a chattering
+    input whose alert is merely late must never be counted. An output strike
+    is pulsed for --pulse ms ahead of every lost edge, so the bank reads run
+    while pigpio holds its pin: a pulse must never be counted either.
+*/
+
+struct ReconcileTraffic {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::string topic; // the state topic awaited, empty when none
+    uint8_t level = 0;
+    uint32_t tick = 0;
+    std::atomic<uint64_t> missed_edges { 0 }, metrics { 0 };
+};
+
+int bench_reconcile(const BenchOptions& options) {
+    const int local = int(std::clamp<int64_t>(options.get("zones", 16), 2, 18));
+    const int remote = int(std::clamp<int64_t>(options.get("remote", 4), 0, 8));
+    const int64_t lost = std::max<int64_t>(1, options.get("lost", 20)), period = std::max<int64_t>(5, options.get("period", 20));
+    const int64_t interval = std::max<int64_t>(0, options.get("interval", 1000));
+    const int64_t pulse = std::clamp<int64_t>(options.get("pulse", interval + 300), 100, 60000); // spans a periodic read
+    const unsigned strike_pin = 20;
+
+    MqttBrokerStub broker;
+    PigpiodStub host;
+    if(!broker.start() || !host.start()){
+        std::cerr << "failed to start the broker or pigpiod stand-in\n";
+        return 1;
+    }
+
+    struct Input {
+        std::string id;
+        unsigned pin;
+        bool remote, chatter;
+    };
+    std::vector<Input> inputs;
+    for(int i = 0; i < local; ++i) inputs.push_back({ "LocalInput" + std::to_string(i), unsigned(2 + i), false, i % 2 == 1 });
+    for(int i = 0; i < remote; ++i) inputs.push_back({ "RemoteInput" + std::to_string(i), unsigned(22 + i), true, false });
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = int(options.get("debounce", 5));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    for(const Input& in : inputs){
+        if(!cfg.zones.empty()) cfg.zones += ",";
+        cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"" + in.id + "\",\"pin\":" + std::to_string(in.pin) + ",\"io\":\"input\","
+                     "\"pullmode\":\"pulldown\",\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + (in.remote ? ",\"host\":\"pi0\"" : "") + "}";
+    }
+    cfg.zones += ",{\"zone_type\":\"gpio_digital\",\"name\":\"Strike\",\"pin\":" + std::to_string(strike_pin) + ",\"io\":\"output\",\"trigger_timeout\":0}";
+    cfg.extra = "\"metrics_interval\":1,\"flap_count\":0,\"reconcile_interval\":" + std::to_string(interval) +
+                ",\"hosts\":[{\"name\":\"pi0\",\"address\":\"127.0.0.1\",\"port\":" + std::to_string(host.port()) + "}]";
+
+    ReconcileTraffic traffic;
+    const std::string metrics_topic = cfg.name + "/metrics";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(msg.topic == metrics_topic){
+            size_t at = msg.payload.find("\"missed_edges\":");
+            if(at != std::string::npos) traffic.missed_edges += std::stoull(msg.payload.substr(at + 15));
+            ++traffic.metrics;
+            return;
+        }
+        std::lock_guard<std::mutex> guard(traffic.lock);
+        if(traffic.topic.empty() || msg.topic != traffic.topic || msg.payload.empty() || uint8_t(msg.payload[0] - '0') != traffic.level) return;
+        traffic.tick = msg.tick;
+        traffic.topic.clear();
+        traffic.changed.notify_all();
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // discovery and the remote host connection
+
+    std::cout << "\n== reconcile: zones=" << local << " remote=" << remote << " lost=" << lost << " period=" << period
+              << "ms interval=" << interval << "ms pulse=" << pulse << "ms ==\n";
+
+    // the chatter outlasts the run: every lost edge waits at most the bound below, plus a settling pause
+    const int64_t bound_ms = interval + 300;
+    const int64_t run_ms = lost * (bound_ms + 200) + 2000;
+    for(const Input& in : inputs){
+        if(in.chatter) simPulseTrain(in.pin, unsigned(run_ms / period), uint32_t(period * 1000));
+    }
+    const uint64_t missed_before = traffic.missed_edges;
+
+    LatencyStats latency;
+    uint64_t timeouts = 0;
+    std::vector<const Input*> quiet;
+    for(const Input& in : inputs){
+        if(!in.chatter) quiet.push_back(&in);
+    }
+    uint64_t pulses = 0;
+    for(int64_t n = 0; n < lost; ++n){
+        if(gpioRead(strike_pin) == 0){
+            broker.publish(cfg.name + "/set/Strike", "1:" + std::to_string(pulse), 1); // still running from the last edge otherwise
+            ++pulses;
+        }
+        const Input& in = *quiet[size_t(n) % quiet.size()];
+        const uint8_t level = uint8_t(gpioRead(in.pin) ^ 1);
+        uint32_t tick;
+        {
+            std::lock_guard<std::mutex> guard(traffic.lock);
+            traffic.topic = cfg.name + "/state/" + in.id;
+            traffic.level = level;
+            tick = gpioTick();
+            simLoseEdge(in.pin, level);
+        }
+        std::unique_lock<std::mutex> guard(traffic.lock);
+        if(traffic.changed.wait_for(guard, std::chrono::milliseconds(bound_ms + 2000), [&](){ return traffic.topic.empty(); })){
+            latency.add(traffic.tick - tick);
+        } else {
+            ++timeouts;
+            traffic.topic.clear();
+        }
+        guard.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    // the last metrics report covers the last correction
+    const uint64_t reports = traffic.metrics;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while(traffic.metrics < reports + 2 && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const uint64_t counted = traffic.missed_edges - missed_before;
+
+    latency.print("  lost edge -> corrected state PUBLISH");
+    std::cout << "  corrected=" << latency.count() << "/" << lost << " timeouts=" << timeouts << " missed_edges in metrics=" << counted
+              << " output pulses=" << pulses << "\n";
+    std::cout << "  p99 bound " << bound_ms << "ms\n";
+    const bool passed = !timeouts && counted == uint64_t(lost) && latency.count() && latency.percentile(0.99) / 1000.0 <= double(bound_ms);
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    host.stop();
+    broker.stop();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+
+/*
+    Paced refresh
+
+    Home Assistant's birth message is replayed with --zones inputs configured and
+    the per-zone refresh publishes are timed at the broker: how long the refresh
+    takes and the most publishes seen in any 100ms. As soon as the refresh starts
+    the last input changes, and the latency from that edge to its publish shows
+    whether live changes still get through ahead of the refresh.
+*/
+
+int bench_refresh(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = int(options.get("zones", 24));
+    cfg.outputs = 0;
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t rounds = options.get("rounds", 10);
+    const int64_t window = options.get("window", 2000), jitter = options.get("jitter", 0);
+
+    if(cfg.inputs < 2 || bench_input_pin(cfg.inputs - 1) > PI_MAX_USER_GPIO){
+        std::cerr << "zone count must be between 2 and " << PI_MAX_USER_GPIO - 1 << "\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    cfg.extra = "\"refresh_window\":" + std::to_string(window) + ",\"refresh_jitter\":" + std::to_string(jitter) + ","
+                "\"state_snapshot_interval\":0";
+
+    const std::string zone_prefix = cfg.name + "/state/", live_id = bench_input_id(cfg.inputs - 1);
+    std::mutex lock;
+    std::condition_variable published;
+    std::vector<uint32_t> ticks; // refresh publishes of this round
+    uint32_t live_tick = 0, live_published = 0;
+    uint8_t live_level = 0;
+    bool measuring = false;
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(zone_prefix) || msg.payload.empty()) return;
+        std::lock_guard<std::mutex> guard(lock);
+        if(!measuring) return;
+        if(live_tick && !live_published && msg.topic.substr(zone_prefix.size()) == live_id && uint8_t(msg.payload[0] - '0') == live_level){
+            live_published = msg.tick;
+        } else {
+            ticks.push_back(msg.tick);
+        }
+        published.notify_all();
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(window + jitter + 1000 + cfg.trigger_timeout * 2)); // the connect refresh drains
+
+    LatencyStats span, live;
+    uint32_t peak = 0;
+    uint64_t live_missed = 0;
+    for(int64_t r = 0; r < rounds; ++r){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ticks.clear();
+            live_tick = live_published = 0;
+            measuring = true;
+        }
+        broker.publish("homeassistant/status", "online", 1);
+
+        std::unique_lock<std::mutex> guard(lock);
+        published.wait_for(guard, std::chrono::seconds(10), [&](){ return !ticks.empty(); });
+        live_level ^= 1;
+        live_tick = gpioTick();
+        guard.unlock();
+        simInjectEdge(bench_input_pin(cfg.inputs - 1), live_level);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(window + jitter + 1000 + cfg.trigger_timeout * 2));
+        guard.lock();
+        measuring = false;
+        if(live_published) live.add(live_published - live_tick); else ++live_missed;
+        if(!ticks.empty()){
+            std::sort(ticks.begin(), ticks.end());
+            span.add(ticks.back() - ticks.front());
+            for(size_t a = 0, b = 0; b < ticks.size(); ++b){
+                while(ticks[b] - ticks[a] >= 100000) ++a;
+                peak = std::max(peak, uint32_t(b - a + 1));
+            }
+        }
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+
+    std::cout << "\n== refresh: zones=" << cfg.inputs << " window=" << window << "ms jitter=" << jitter << "ms ==\n";
+    span.print("first -> last refresh publish");
+    std::cout << "  peak publishes in 100ms=" << peak << "\n";
+    live.print("live edge during refresh -> publish");
+    std::cout << "  live changes missed=" << live_missed << "\n";
+    return 0;
+}
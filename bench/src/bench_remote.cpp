@@ -0,0 +1,205 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "pigpiod_stub.h"
+#include "adt-security.h"
+
+#include <pigpio_sim.h>
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+/*
+    Remote hosts
+
+    The service drives every zone through pigpiod stand-ins on loopback, one per
+    simulated host, all backed by the same simulated pins. Host h owns pins
+    4 + 8h .. 4 + 8h + 6 for inputs and 4 + 8h + 7 for its output.
+
+    Measures the edge -> PUBLISH and /set -> gpioWrite round trips through the
+    notification streams and command sockets, then takes one host away, moves an
+    input while it is gone, and measures how long after the host returns the
+    service publishes the new level.
+*/
+
+static int remote_input_pin(int host, int zone) { return 4 + host * 8 + zone; }
+static int remote_output_pin(int host) { return 4 + host * 8 + 7; }
+static std::string remote_input_id(int host, int zone) { return "RemoteInput" + std::to_string(host) + "x" + std::to_string(zone); }
+static std::string remote_output_id(int host) { return "RemoteOutput" + std::to_string(host); }
+
+int bench_remote(const BenchOptions& options) {
+    const int host_count = int(options.get("hosts", 2));
+    const int zones_per_host = int(options.get("zones", 2));
+    const int64_t rate = std::max<int64_t>(1, options.get("rate", 10));
+    const int64_t events = options.get("events", 200);
+    const int64_t commands = options.get("commands", 50);
+
+    if(host_count < 1 || host_count > 3 || zones_per_host < 1 || zones_per_host > 7){
+        std::cerr << "hosts must be between 1 and 3 and zones between 1 and 7\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    std::vector<std::unique_ptr<PigpiodStub>> hosts;
+    for(int h = 0; h < host_count; ++h){
+        hosts.push_back(std::make_unique<PigpiodStub>());
+        if(!hosts.back()->start()){
+            std::cerr << "failed to start a pigpiod stand-in\n";
+            return 1;
+        }
+    }
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.extra = "\"hosts\":[";
+    for(int h = 0; h < host_count; ++h){
+        if(h) cfg.extra += ",";
+        cfg.extra += "{\"name\":\"pi" + std::to_string(h) + "\",\"address\":\"127.0.0.1\",\"port\":" + std::to_string(hosts[h]->port()) + "}";
+        for(int z = 0; z < zones_per_host; ++z){
+            if(!cfg.zones.empty()) cfg.zones += ",";
+            cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"" + remote_input_id(h, z) + "\",\"host\":\"pi" + std::to_string(h) + "\","
+                         "\"pin\":" + std::to_string(remote_input_pin(h, z)) + ",\"io\":\"input\",\"pullmode\":\"pulldown\","
+                         "\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + "}";
+        }
+        cfg.zones += ",{\"zone_type\":\"gpio_digital\",\"name\":\"" + remote_output_id(h) + "\",\"host\":\"pi" + std::to_string(h) + "\","
+                     "\"pin\":" + std::to_string(remote_output_pin(h)) + ",\"io\":\"output\",\"trigger_timeout\":0}";
+    }
+    cfg.extra += "]";
+
+    EdgeTracker edges;
+    const std::string state_prefix = cfg.name + "/state/";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!msg.topic.starts_with(state_prefix) || msg.payload.empty()) return;
+        edges.on_publish(msg.topic.substr(state_prefix.size()), uint8_t(msg.payload[0] - '0'), msg.tick);
+    });
+
+    CommandTracker command;
+    simSetWriteHook(&CommandTracker::write_hook, &command);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    const std::string command_prefix = cfg.name + "/set/";
+    if(!broker.wait_for_subscription(command_prefix + remote_output_id(0), 5000)){
+        std::cerr << "service never subscribed to " << command_prefix << "+\n";
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + cfg.trigger_timeout * 2));
+
+    /* Edge phase */
+    const int zone_count = host_count * zones_per_host;
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        for(int i = 0; i < zone_count; ++i) edges.pending[remote_input_id(i / zones_per_host, i % zones_per_host)];
+        edges.measuring = true;
+    }
+
+    std::vector<uint8_t> levels(zone_count, 0);
+    const auto interval = std::chrono::nanoseconds(1000000000 / rate);
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    auto next = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < events; ++i){
+        int zone = int(i % zone_count), h = zone / zones_per_host, z = zone % zones_per_host;
+        levels[zone] ^= 1;
+        uint32_t tick = gpioTick();
+        {
+            std::lock_guard<std::mutex> guard(edges.lock);
+            edges.pending[remote_input_id(h, z)].push_back({ tick, levels[zone] });
+        }
+        simScheduleEdge(remote_input_pin(h, z), levels[zone], tick);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    {
+        std::unique_lock<std::mutex> guard(edges.lock);
+        edges.published.wait_for(guard, std::chrono::seconds(5), [&](){ return edges.outstanding() == 0; });
+    }
+    uint64_t edge_cpu = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+
+    /* Command phase */
+    LatencyStats command_latency;
+    uint64_t command_timeouts = 0;
+    std::vector<uint8_t> out_levels(host_count, 0);
+    for(int64_t i = 0; i < commands; ++i){
+        int h = int(i % host_count);
+        out_levels[h] ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(command.lock);
+            command.gpio = unsigned(remote_output_pin(h));
+            command.waiting = true;
+        }
+        uint32_t sent = gpioTick();
+        broker.publish(command_prefix + remote_output_id(h), std::to_string(out_levels[h]), 1);
+
+        std::unique_lock<std::mutex> guard(command.lock);
+        if(command.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !command.waiting; })){
+            command_latency.add(command.write_tick - sent);
+        } else {
+            command.waiting = false;
+            ++command_timeouts;
+        }
+    }
+
+    /* Outage phase: the level changes while host 0 is unreachable */
+    {
+        std::lock_guard<std::mutex> guard(edges.lock);
+        edges.measuring = false;
+    }
+    const uint32_t outage_ms = 1500;
+    const std::string resync_topic = state_prefix + remote_input_id(0, 0);
+    levels[0] ^= 1;
+    const char resync_level = char('0' + levels[0]);
+    std::atomic<uint32_t> resync_tick { 0 };
+    std::atomic_bool watching { true };
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(watching && msg.topic == resync_topic && !msg.payload.empty() && msg.payload[0] == resync_level){
+            resync_tick = msg.tick;
+            watching = false;
+        }
+    });
+    uint32_t outage_tick = gpioTick();
+    hosts[0]->outage(outage_ms);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    simInjectEdge(remote_input_pin(0, 0), levels[0]);
+    uint32_t back_tick = outage_tick + outage_ms * 1000;
+    for(int i = 0; i < 1000 && watching; ++i){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    bool resynced = !watching;
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    uint64_t pigpiod_commands = 0;
+    for(auto& host : hosts){
+        pigpiod_commands += host->command_count();
+        host->stop();
+    }
+    broker.stop();
+
+    std::cout << "\n== remote: hosts=" << host_count << " zones/host=" << zones_per_host << " rate=" << rate
+              << "/s debounce=" << cfg.trigger_timeout << "ms ==\n";
+    edges.latency.print("edge -> publish");
+    std::cout << "  publishes=" << edges.publishes << " coalesced_edges=" << edges.coalesced
+              << " cpu/edge=" << (events ? edge_cpu / uint64_t(events) : 0) << "ns\n";
+    command_latency.print("command -> remote gpioWrite");
+    std::cout << "  timeouts=" << command_timeouts << " pigpiod_commands=" << pigpiod_commands << "\n";
+    if(resynced){
+        std::cout << "outage resync: level published " << (resync_tick - back_tick) / 1000 << "ms after the host returned\n";
+    } else {
+        std::cout << "outage resync: the changed level was never published\n";
+    }
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+#include "rule_engine.h"
+
+#include <iostream>
+#include <random>
+#include <thread>
+#include <chrono>
+
+/*
+    Rules
+
+    Evaluation: a rule table with --rules entries over --zones virtual input zones
+    is fed --edges state changes directly, and the wall and CPU time per change
+    are reported. A third of the rules carry a condition and every rule sets one
+    of the virtual outputs or raises an event.
+
+    End to end: a rule pulses the simulated output whenever the simulated input
+    changes, and the latency is measured from the edge tick to the gpioWrite,
+    the path that otherwise goes out to the broker and back through /set.
+*/
+
+static int bench_rules_evaluation(const BenchOptions& options) {
+    const int rule_count = int(options.get("rules", 64));
+    const int zone_count = int(options.get("zones", 16));
+    const int64_t edges = options.get("edges", 1000000);
+    const int outputs = 4;
+
+    ZoneArena arena;
+    arena.reserve(size_t(zone_count + outputs) * sizeof(Virtual_Zone) * 2 + ZoneStateTable::footprint(size_t(zone_count + outputs)));
+    ZoneStateTable table(size_t(zone_count + outputs), &arena);
+    RuleEngine::ZoneList zones;
+    for(int z = 0; z < zone_count; ++z){
+        zones.emplace_back(new (arena) Virtual_Zone({ &table, uint32_t(zones.size()) }, "Rule Input " + std::to_string(z), Zone::IO_INPUT, false));
+    }
+    for(int o = 0; o < outputs; ++o){
+        zones.emplace_back(new (arena) Virtual_Zone({ &table, uint32_t(zones.size()) }, "Rule Output " + std::to_string(o), Zone::IO_OUTPUT, false));
+    }
+
+    std::mt19937 rng(1);
+    std::string rules;
+    for(int r = 0; r < rule_count; ++r){
+        if(!rules.empty()) rules += ",";
+        rules += "{\"name\":\"rule" + std::to_string(r) + "\",\"when\":\"Rule Input " + std::to_string(rng() % zone_count) + "\",\"is\":" + std::to_string(rng() % 2);
+        if(r % 3 == 0) rules += ",\"if\":\"Rule Input " + std::to_string(rng() % zone_count) + "\",\"if_is\":1";
+        if(r % 4 == 3){
+            rules += ",\"publish\":\"event" + std::to_string(r) + "\"}";
+        } else {
+            rules += ",\"set\":\"Rule Output " + std::to_string(rng() % outputs) + "\",\"to\":" + std::to_string(rng() % 2) + "}";
+        }
+    }
+    JsonLoader config;
+    config.parseString("{\"rules\":[" + rules + "]}");
+
+    uint64_t events = 0;
+    RuleEngine engine(config, zones, [&](const std::string&){ ++events; });
+    for(int z = 0; z < zone_count; ++z) engine.on_state(size_t(z), 0); // initial reports
+
+    std::vector<uint8_t> levels(zone_count, 0);
+    uint64_t cpu_start = thread_cpu_ns();
+    auto start = std::chrono::steady_clock::now();
+    for(int64_t i = 0; i < edges; ++i){
+        int z = int(i % zone_count);
+        levels[z] ^= 1;
+        engine.on_state(size_t(z), levels[z]);
+    }
+    double wall = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    uint64_t cpu = thread_cpu_ns() - cpu_start;
+
+    std::cout << "\n== rules: evaluation, rules=" << engine.rule_count() << " zones=" << zone_count << " edges=" << edges << " ==\n";
+    std::cout << "  per change: wall=" << wall / double(std::max<int64_t>(1, edges)) << "ns cpu="
+              << double(cpu) / double(std::max<int64_t>(1, edges)) << "ns\n";
+    std::cout << "  fired=" << engine.fired_count() << " (" << double(engine.fired_count()) / double(std::max<int64_t>(1, edges))
+              << " per change) events=" << events << "\n";
+    return 0;
+}
+
+static int bench_rules_end_to_end(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = 1;
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t events = options.get("events", 50);
+    const int pulse = 20;
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    cfg.extra = "\"rules\":[{\"name\":\"pulse\",\"when\":\"" + bench_input_id(0) + "\",\"set\":\"" + bench_output_id(0) + "\","
+                "\"to\":1,\"for\":" + std::to_string(pulse) + "}]";
+
+    CommandTracker command;
+    simSetWriteHook(&CommandTracker::write_hook, &command);
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500 + cfg.trigger_timeout * 2));
+
+    LatencyStats latency;
+    uint64_t timeouts = 0;
+    uint8_t level = 0;
+    for(int64_t i = 0; i < events; ++i){
+        level ^= 1;
+        {
+            std::lock_guard<std::mutex> guard(command.lock);
+            command.gpio = unsigned(bench_output_pin(cfg, 0));
+            command.waiting = true;
+        }
+        uint32_t tick = gpioTick();
+        simInjectEdge(bench_input_pin(0), level);
+
+        std::unique_lock<std::mutex> guard(command.lock);
+        if(command.written.wait_for(guard, std::chrono::seconds(2), [&](){ return !command.waiting; })){
+            latency.add(command.write_tick - tick);
+        } else {
+            command.waiting = false;
+            ++timeouts;
+        }
+        guard.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(pulse + 100)); // let the pulse revert
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    simSetWriteHook(nullptr, nullptr);
+    broker.stop();
+
+    std::cout << "\n== rules: end to end, debounce=" << cfg.trigger_timeout << "ms ==\n";
+    latency.print("edge -> rule gpioWrite");
+    std::cout << "  timeouts=" << timeouts << "\n";
+    return 0;
+}
+
+int bench_rules(const BenchOptions& options) {
+    int status = bench_rules_evaluation(options);
+    return status ? status : bench_rules_end_to_end(options);
+}
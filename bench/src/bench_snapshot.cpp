@@ -0,0 +1,97 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    State snapshot
+
+    With --zones inputs at random levels, Home Assistant's birth message is
+    replayed on homeassistant/status. The service answers with a publish per zone
+    and one retained snapshot on <name>/state; both are counted, sized and timed
+    from the birth message, as a consumer resyncing either way would see them.
+*/
+
+int bench_snapshot(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = int(options.get("zones", 24));
+    cfg.outputs = 0;
+    cfg.trigger_timeout = int(options.get("debounce", 100));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    const int64_t rounds = options.get("rounds", 20);
+
+    if(cfg.inputs < 1 || bench_input_pin(cfg.inputs - 1) > PI_MAX_USER_GPIO){
+        std::cerr << "zone count must be between 1 and " << PI_MAX_USER_GPIO - 1 << "\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+
+    const std::string snapshot_topic = cfg.name + "/state", zone_prefix = snapshot_topic + "/";
+    std::atomic_bool measuring { false };
+    std::atomic<uint32_t> birth_tick { 0 }, last_zone_tick { 0 }, snapshot_tick { 0 };
+    std::atomic<uint64_t> zone_messages { 0 }, zone_bytes { 0 }, snapshot_messages { 0 }, snapshot_bytes { 0 }, round_messages { 0 };
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!measuring) return;
+        if(msg.topic == snapshot_topic){
+            ++snapshot_messages;
+            snapshot_bytes += msg.topic.size() + msg.payload.size();
+            snapshot_tick = msg.tick;
+        } else if(msg.topic.starts_with(zone_prefix)){
+            ++zone_messages;
+            ++round_messages;
+            zone_bytes += msg.topic.size() + msg.payload.size();
+            last_zone_tick = msg.tick;
+        }
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+    for(int i = 0; i < cfg.inputs; ++i) simInjectEdge(bench_input_pin(i), unsigned(i & 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500 + cfg.trigger_timeout * 2)); // the first snapshot follows the changes
+
+    LatencyStats zones_done, snapshot_done;
+    for(int64_t r = 0; r < rounds; ++r){
+        snapshot_tick = 0;
+        last_zone_tick = 0;
+        round_messages = 0;
+        birth_tick = gpioTick();
+        measuring = true;
+        broker.publish("homeassistant/status", "online", 1);
+        for(int i = 0; i < 300 && (!snapshot_tick || round_messages < uint64_t(cfg.inputs)); ++i){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // stragglers still count towards the round
+        measuring = false;
+        if(snapshot_tick) snapshot_done.add(snapshot_tick - birth_tick);
+        if(last_zone_tick) zones_done.add(last_zone_tick - birth_tick);
+    }
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    broker.stop();
+
+    std::cout << "\n== snapshot: zones=" << cfg.inputs << " rounds=" << rounds << " ==\n";
+    std::cout << "  per-zone refresh: messages/round=" << zone_messages / uint64_t(std::max<int64_t>(1, rounds))
+              << " bytes/round=" << zone_bytes / uint64_t(std::max<int64_t>(1, rounds)) << "\n";
+    std::cout << "  snapshot: messages/round=" << snapshot_messages / uint64_t(std::max<int64_t>(1, rounds))
+              << " bytes/round=" << snapshot_bytes / uint64_t(std::max<int64_t>(1, rounds)) << "\n";
+    zones_done.print("birth -> last zone publish");
+    snapshot_done.print("birth -> snapshot publish");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "pigpiod_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+/*
+    Supervision
+
+    Two heartbeat inputs with a --timeout supervision watchdog, one on a local
+    pin and one on a pigpiod stand-in host: the timeout reaches the service as a
+    PI_TIMEOUT alert and, for the remote pin, a watchdog report on the
+    notification stream. Both pulse every --heartbeat ms for --beats edges and
+    then fall silent. Reported are supervision losses while they pulse (there
+    should be none), the time from the deadline (last edge + timeout) to the
+    "lost" attribute at the broker, the CPU the process spends while they are
+    silent, and the time from the next edge to the "ok" attribute.
+*/
+
+struct SupervisionTraffic {
+    std::atomic<uint32_t> lost_tick { 0 }, ok_tick { 0 };
+    std::atomic<uint64_t> lost { 0 }, events { 0 };
+};
+
+static double ms_between(uint32_t from, uint32_t to) {
+    return double(int32_t(to - from)) / 1000.0;
+}
+
+static bool wait_for(const std::atomic<uint32_t>& tick, uint32_t timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while(!tick && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return tick != 0;
+}
+
+int bench_supervision(const BenchOptions& options) {
+    const int64_t heartbeat = std::max<int64_t>(1, options.get("heartbeat", 200));
+    const int64_t timeout = options.get("timeout", 1000), beats = options.get("beats", 20);
+    if(timeout <= heartbeat || timeout > PI_MAX_WDOG_TIMEOUT){
+        std::cerr << "timeout must be above heartbeat and at most " << PI_MAX_WDOG_TIMEOUT << "\n";
+        return 1;
+    }
+
+    MqttBrokerStub broker;
+    PigpiodStub host;
+    if(!broker.start() || !host.start()){
+        std::cerr << "failed to start the broker or pigpiod stand-in\n";
+        return 1;
+    }
+
+    struct Heartbeat {
+        std::string id, label;
+        int pin;
+        std::string host;
+    };
+    const Heartbeat heartbeats[2] {
+        { "LocalHeartbeat", "local", 2, "" },
+        { "RemoteHeartbeat", "remote", 12, "pi0" },
+    };
+
+    BenchConfig cfg;
+    cfg.mqtt_port = broker.port();
+    cfg.trigger_timeout = int(options.get("debounce", 20));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+    cfg.extra = "\"hosts\":[{\"name\":\"pi0\",\"address\":\"127.0.0.1\",\"port\":" + std::to_string(host.port()) + "}]";
+    for(const Heartbeat& beat : heartbeats){
+        if(!cfg.zones.empty()) cfg.zones += ",";
+        cfg.zones += "{\"zone_type\":\"gpio_digital\",\"name\":\"" + beat.id + "\",\"pin\":" + std::to_string(beat.pin) + ","
+                     "\"io\":\"input\",\"pullmode\":\"pulldown\",\"trigger_timeout\":" + std::to_string(cfg.trigger_timeout) + ","
+                     "\"supervision\":" + std::to_string(timeout) + (beat.host.empty() ? "" : ",\"host\":\"" + beat.host + "\"") + "}";
+    }
+
+    SupervisionTraffic traffic[2];
+    std::atomic_bool measuring { false };
+    const std::string event_topic = cfg.name + "/event";
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(!measuring) return;
+        for(int z = 0; z < 2; ++z){
+            if(msg.topic == event_topic && msg.payload.find(heartbeats[z].id) != std::string::npos) ++traffic[z].events;
+            if(msg.topic != cfg.name + "/attr/" + heartbeats[z].id) continue;
+            if(msg.payload.find("\"lost\"") != std::string::npos){
+                ++traffic[z].lost;
+                if(!traffic[z].lost_tick) traffic[z].lost_tick = msg.tick;
+            } else if(msg.payload.find("\"ok\"") != std::string::npos && traffic[z].lost_tick && !traffic[z].ok_tick){
+                traffic[z].ok_tick = msg.tick;
+            }
+        }
+    });
+
+    SecuritySystem* system = new SecuritySystem(bench_config(cfg));
+    if(!system->online()){
+        std::cerr << "service failed to come online\n";
+        delete system;
+        return 1;
+    }
+    std::thread service([&](){ system->run(); });
+
+    // the watchdogs are armed, so the heartbeats start with the service and run through its startup
+    const int64_t startup_ms = 1000;
+    uint32_t end = 0;
+    for(const Heartbeat& beat : heartbeats) end = simPulseTrain(unsigned(beat.pin), unsigned(startup_ms / heartbeat + beats), uint32_t(heartbeat * 1000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(startup_ms)); // discovery and the remote host connection
+
+    std::cout << "\n== supervision: heartbeat=" << heartbeat << "ms timeout=" << timeout << "ms beats=" << beats << " ==\n";
+    measuring = true;
+    std::this_thread::sleep_for(std::chrono::microseconds(int32_t(end - gpioTick())));
+    uint64_t false_losses = traffic[0].lost + traffic[1].lost;
+
+    uint64_t cpu_start = process_cpu_ns(), broker_start = broker.broker_cpu_ns();
+    auto silent_start = std::chrono::steady_clock::now();
+    bool lost = wait_for(traffic[0].lost_tick, uint32_t(timeout + 2000)) && wait_for(traffic[1].lost_tick, 2000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout)); // silent on, the watchdogs keep firing
+    double silent_ms = double(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - silent_start).count());
+    uint64_t silent_cpu_ns = process_cpu_ns() - cpu_start - (broker.broker_cpu_ns() - broker_start);
+
+    uint32_t edge = gpioTick();
+    for(const Heartbeat& beat : heartbeats) simInjectEdge(unsigned(beat.pin), unsigned(gpioRead(unsigned(beat.pin)) ^ 1));
+    bool restored = wait_for(traffic[0].ok_tick, 2000) && wait_for(traffic[1].ok_tick, 2000);
+    measuring = false;
+
+    std::cout << "  losses while pulsing: " << false_losses << "\n";
+    for(int z = 0; z < 2; ++z){
+        std::cout << "  " << heartbeats[z].label << ": lost ";
+        if(traffic[z].lost_tick) std::cout << ms_between(end + uint32_t(timeout * 1000), traffic[z].lost_tick) << "ms after the deadline";
+        else std::cout << "NEVER";
+        std::cout << ", ok ";
+        if(traffic[z].ok_tick) std::cout << ms_between(edge, traffic[z].ok_tick) << "ms after the next edge";
+        else std::cout << "NEVER";
+        std::cout << ", events=" << traffic[z].events << "\n";
+    }
+    std::cout << "  cpu while silent: " << double(silent_cpu_ns) / 1e6 << "ms over " << silent_ms << "ms\n";
+
+    system->shutdown_system();
+    service.join();
+    delete system;
+    host.stop();
+    broker.stop();
+    return lost && restored && !false_losses ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include "bench.h"
+#include "mqtt_broker_stub.h"
+#include "adt-security.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <climits>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+    Upgrade
+
+    The service is replaced twice against one broker stand-in:
+
+    * restart: what install-service.sh did before, the service shuts down and a
+      new instance starts, connects and rediscovers
+    * handoff: an upgrade request, the service starts this binary with
+      --takeover and hands it the broker socket and the zone state
+
+    For each, the time from the request until the new instance runs, the time
+    from the request until it has served a /set command, and the broker side of
+    the swap: new connections, discovery and status messages and state
+    publishes. The output is set to 1 ahead of the swap, so a republish of an
+    unchanged zone would show. The config is written to a scratch directory,
+    which the successor process reads as its working directory, with a "pins"
+    file of the output levels: the successor has a simulator of its own, and
+    sets them first to stand in for pins that keep their level.
+*/
+
+struct UpgradeTraffic {
+    std::atomic<uint64_t> discovery { 0 }, status { 0 }, states { 0 };
+    std::mutex lock;
+    std::condition_variable published;
+    std::string waiting_payload; // the output level a command waits for, empty for none
+    bool served = false;
+};
+
+// repeated every 100ms until the output reports the level, a command sent while nobody reads it is lost
+static bool wait_for_command(MqttBrokerStub& broker, UpgradeTraffic& traffic, const std::string& topic, const std::string& level, uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(traffic.lock);
+    traffic.waiting_payload = level;
+    traffic.served = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while(!traffic.served && std::chrono::steady_clock::now() < deadline){
+        guard.unlock();
+        broker.publish(topic, level, 1);
+        guard.lock();
+        traffic.published.wait_for(guard, std::chrono::milliseconds(100), [&](){ return traffic.served; });
+    }
+    traffic.waiting_payload.clear();
+    return traffic.served;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return double(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()) / 1000.0;
+}
+
+static void print_swap(const char* label, double running_ms, double served_ms, bool served, uint64_t connects, const UpgradeTraffic& traffic) {
+    std::cout << "  " << label << ": running after " << running_ms << "ms, first command served after ";
+    if(served) std::cout << served_ms << "ms"; else std::cout << "TIMEOUT";
+    std::cout << "\n    broker: new connections=" << connects << " discovery=" << traffic.discovery << " status=" << traffic.status
+              << " state publishes=" << traffic.states << "\n";
+}
+
+// The process an upgrade hands over to, started by the service as <bench> --takeover <fd>
+int bench_upgrade_successor(const BenchOptions& options) {
+    std::ifstream file("config.conf");
+    std::stringstream config;
+    config << file.rdbuf();
+
+    gpioInitialise();
+    std::ifstream pins("pins");
+    for(unsigned pin, level; pins >> pin >> level;){
+        gpioSetMode(pin, PI_OUTPUT);
+        gpioWrite(pin, level);
+    }
+
+    SecuritySystem* system = SecuritySystem::take_over(config.str(), int(options.get("takeover", 3)));
+    if(!system) return 1;
+    system->run(); // until the bench sends shutdown on <name>/system/command
+    delete system;
+    return 0;
+}
+
+int bench_upgrade(const BenchOptions& options) {
+    BenchConfig cfg;
+    cfg.inputs = int(options.get("zones", 4));
+    cfg.outputs = 1;
+    cfg.trigger_timeout = int(options.get("debounce", 20));
+    cfg.log_level = options.get("log-level", cfg.log_level);
+
+    MqttBrokerStub broker;
+    if(!broker.start()){
+        std::cerr << "failed to start the broker stand-in\n";
+        return 1;
+    }
+    cfg.mqtt_port = broker.port();
+    const std::string config = bench_config(cfg);
+
+    char scratch[] = "/tmp/zcl-upgrade-XXXXXX";
+    char previous[PATH_MAX];
+    if(!mkdtemp(scratch) || !getcwd(previous, sizeof(previous)) || chdir(scratch) != 0){
+        std::cerr << "failed to prepare a scratch directory\n";
+        return 1;
+    }
+    std::ofstream("config.conf") << config;
+
+    UpgradeTraffic traffic;
+    const std::string discovery_topic = "homeassistant/device/" + cfg.name + "/config", status_topic = cfg.name + "/system/status";
+    const std::string state_prefix = cfg.name + "/state/", output_state = state_prefix + bench_output_id(0);
+    const std::string command_topic = cfg.name + "/set/" + bench_output_id(0);
+    broker.set_publish_hook([&](const MqttBrokerStub::Message& msg){
+        if(msg.topic == discovery_topic) ++traffic.discovery;
+        else if(msg.topic == status_topic) ++traffic.status;
+        else if(msg.topic.starts_with(state_prefix)) ++traffic.states;
+        if(msg.topic == output_state){
+            std::lock_guard<std::mutex> guard(traffic.lock);
+            if(!traffic.waiting_payload.empty() && msg.payload == traffic.waiting_payload){
+                traffic.served = true;
+                traffic.published.notify_all();
+            }
+        }
+    });
+    auto reset = [&](){ traffic.discovery = 0; traffic.status = 0; traffic.states = 0; };
+
+    std::cout << "\n== upgrade: zones=" << cfg.inputs << " ==\n";
+    int status = 0;
+
+    // restart, the way the install script replaced the service
+    SecuritySystem* system = new SecuritySystem(config);
+    std::thread service([&](){ system->run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500)); // discovery and the initial refresh
+    if(!system->online() || !wait_for_command(broker, traffic, command_topic, "1", 2000)){
+        std::cerr << "service failed to come online\n";
+        status = 1;
+    } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200)); // the snapshot that follows the command
+        reset();
+        uint64_t connects = broker.connection_count();
+        auto start = std::chrono::steady_clock::now();
+        system->shutdown_system();
+        service.join();
+        delete system;
+        system = new SecuritySystem(config);
+        service = std::thread([&](){ system->run(); });
+        double running_ms = elapsed_ms(start);
+        bool served = wait_for_command(broker, traffic, command_topic, "0", 5000);
+        double served_ms = elapsed_ms(start);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500)); // let the rediscovery and refresh finish
+        print_swap("restart", running_ms, served_ms, served, broker.connection_count() - connects, traffic);
+
+        // handoff, to a successor process that is this binary started with --takeover
+        wait_for_command(broker, traffic, command_topic, "1", 2000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+        std::ofstream("pins") << bench_output_pin(cfg, 0) << " 1\n";
+        reset();
+        connects = broker.connection_count();
+        start = std::chrono::steady_clock::now();
+        system->request_upgrade();
+        service.join(); // the run loop ends once the successor runs
+        running_ms = elapsed_ms(start);
+        delete system;
+        system = nullptr;
+        served = wait_for_command(broker, traffic, command_topic, "0", 5000);
+        served_ms = elapsed_ms(start);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        print_swap("handoff", running_ms, served_ms, served, broker.connection_count() - connects, traffic);
+
+        broker.publish(cfg.name + "/system/command", "shutdown", 1);
+        int successor_status = 0;
+        if(waitpid(-1, &successor_status, 0) < 0 || !WIFEXITED(successor_status) || WEXITSTATUS(successor_status) != 0){
+            std::cerr << "the successor did not exit cleanly\n";
+            status = 1;
+        }
+    }
+    if(system){
+        system->shutdown_system();
+        if(service.joinable()) service.join();
+        delete system;
+    }
+    broker.stop();
+
+    unlink("config.conf");
+    unlink("pins");
+    if(chdir(previous) != 0 || rmdir(scratch) != 0) std::cerr << "failed to remove " << scratch << "\n";
+    return status;
+}
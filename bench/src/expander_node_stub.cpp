@@ -0,0 +1,124 @@
+#include "pjon_serial.h"
+#include "expander_node_stub.h"
+#include "pjon_expander.h"
+
+#include <poll.h>
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); p[2] = uint8_t(v >> 16); p[3] = uint8_t(v >> 24);
+}
+
+struct ExpanderNodeStub::Link {
+    PJONThroughSerial bus;
+    int fd = -1;
+    uint8_t master = 0;
+
+    Link(): bus(PJON_NOT_ASSIGNED) {}
+
+    static void receiver(uint8_t* payload, uint16_t length, const PJON_Packet_Info& info) {
+        ExpanderNodeStub& self = *static_cast<ExpanderNodeStub*>(info.custom_pointer);
+        self.on_frame(info.rx.id, payload, length);
+    }
+
+    void receive_pending() {
+        do {
+            bus.receive();
+        } while(serialDataAvailable(fd) > 0 || bus.strategy.state == TS_DONE);
+    }
+};
+
+ExpanderNodeStub::ExpanderNodeStub(): link(std::make_unique<Link>()), running(false), drop_every(0),
+    deltas_sent(0), deltas_dropped(0), snapshots_sent(0), polls_received(0) {}
+
+ExpanderNodeStub::~ExpanderNodeStub() {
+    stop();
+}
+
+bool ExpanderNodeStub::start(int fd, const std::vector<uint8_t>& ids, uint8_t master, uint32_t drop) {
+    for(uint8_t id : ids) nodes[id];
+    drop_every = drop;
+    link->fd = fd;
+    link->master = master;
+    link->bus.strategy.set_serial(int16_t(fd));
+    link->bus.strategy.set_read_interval(0);
+    link->bus.set_router(true); // receive for every emulated node id
+    link->bus.set_custom_pointer(this);
+    link->bus.set_receiver(&Link::receiver);
+    running = true;
+    worker = std::thread(&ExpanderNodeStub::run, this);
+    return true;
+}
+
+void ExpanderNodeStub::stop() {
+    if(!running) return;
+    running = false;
+    if(worker.joinable()) worker.join();
+}
+
+void ExpanderNodeStub::set_input(uint8_t node, uint8_t bit, uint8_t level) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!nodes.count(node)) return;
+    Node& n = nodes.at(node);
+    uint32_t mask = 1u << bit;
+    if(bool(n.levels & mask) == bool(level)) return;
+    n.levels ^= mask;
+    n.pending |= mask;
+}
+
+// stub thread
+void ExpanderNodeStub::on_frame(uint8_t node, const uint8_t* payload, uint16_t length) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!nodes.count(node)) return;
+    link->bus.send_acknowledge(); // router mode leaves acknowledgement to the receiver
+    if(length >= 1 && payload[0] == PJONExpanderBus::FRAME_POLL){
+        ++polls_received;
+        nodes.at(node).snapshot_due = true;
+    }
+}
+
+void ExpanderNodeStub::run() {
+    uint64_t delta_index = 0;
+    link->bus.begin();
+    while(running){
+        pollfd pfd { link->fd, POLLIN, 0 };
+        ::poll(&pfd, 1, 5);
+        link->receive_pending();
+
+        // collect the frames to send, then transmit without holding the lock
+        std::vector<std::pair<uint8_t, std::vector<uint8_t>>> out;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for(auto& [id, n] : nodes){
+                if(n.snapshot_due){
+                    std::vector<uint8_t> f(PJONExpanderBus::SNAPSHOT_SIZE);
+                    f[0] = PJONExpanderBus::FRAME_SNAPSHOT;
+                    f[1] = n.seq;
+                    put_u32(&f[2], n.levels);
+                    out.emplace_back(id, std::move(f));
+                    n.snapshot_due = false;
+                    n.pending = 0; // the snapshot carries them
+                    ++snapshots_sent;
+                }
+                if(n.pending){
+                    std::vector<uint8_t> f(PJONExpanderBus::DELTA_SIZE);
+                    f[0] = PJONExpanderBus::FRAME_DELTA;
+                    f[1] = ++n.seq;
+                    put_u32(&f[2], n.pending);
+                    put_u32(&f[6], n.levels);
+                    n.pending = 0;
+                    if(drop_every && ++delta_index % drop_every == 0){
+                        ++deltas_dropped;
+                        continue;
+                    }
+                    out.emplace_back(id, std::move(f));
+                    ++deltas_sent;
+                }
+            }
+        }
+        for(auto& [id, frame] : out){
+            link->bus.tx.id = id;
+            link->bus.send_packet_blocking(link->master, frame.data(), uint16_t(frame.size()));
+            link->receive_pending();
+        }
+    }
+}
@@ -0,0 +1,505 @@
+#include "mqtt_broker_stub.h"
+
+#include <pigpio.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+MqttBrokerStub::MqttBrokerStub(): listen_port(0), listen_fd(-1), wake_pipe{-1,-1}, running(false), frozen(false), cpu_ns(0),
+    connects(0), subscribes(0), resumed(0), max_level(5), alias_max(10), receive_buffer(0) {}
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+MqttBrokerStub::~MqttBrokerStub() {
+    stop();
+}
+
+bool MqttBrokerStub::start(uint16_t port) {
+    listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd == -1) return false;
+
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    if(receive_buffer > 0) setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof receive_buffer); // inherited by accepted sockets
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::bind(listen_fd, (sockaddr*)&addr, sizeof addr) == -1 || ::listen(listen_fd, 8) == -1){
+        ::close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    socklen_t len = sizeof addr;
+    getsockname(listen_fd, (sockaddr*)&addr, &len);
+    listen_port = ntohs(addr.sin_port);
+
+    if(::pipe(wake_pipe) == -1) return false;
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+
+    running = true;
+    worker = std::thread(&MqttBrokerStub::serve, this);
+    return true;
+}
+
+void MqttBrokerStub::stop() {
+    if(!running) return;
+    running = false;
+    uint8_t b = 0;
+    (void)::write(wake_pipe[1], &b, 1);
+    if(worker.joinable()) worker.join();
+
+    for(Client& c : clients) ::close(c.fd);
+    clients.clear();
+    ::close(listen_fd);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    listen_fd = wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+void MqttBrokerStub::set_publish_hook(PublishHook hook) {
+    std::lock_guard<std::mutex> guard(lock);
+    publish_hook = hook;
+}
+
+void MqttBrokerStub::publish(const std::string& topic, const std::string& payload, uint8_t qos, bool retain) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        outbox.push_back({ topic, payload, qos, retain, gpioTick() });
+    }
+    uint8_t b = 0;
+    (void)::write(wake_pipe[1], &b, 1);
+}
+
+bool MqttBrokerStub::wait_for_subscription(const std::string& topic, uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(lock);
+    return changed.wait_for(guard, std::chrono::milliseconds(timeout_ms), [&](){
+        for(const Client& c : clients){
+            for(const auto& [filter, qos] : c.filters){
+                if(topic_matches(filter, topic)) return true;
+            }
+        }
+        return false;
+    });
+}
+
+uint64_t MqttBrokerStub::connection_count() {
+    std::lock_guard<std::mutex> guard(lock);
+    return connects;
+}
+
+uint64_t MqttBrokerStub::subscribe_count() {
+    std::lock_guard<std::mutex> guard(lock);
+    return subscribes;
+}
+
+uint64_t MqttBrokerStub::resumed_count() {
+    std::lock_guard<std::mutex> guard(lock);
+    return resumed;
+}
+
+void MqttBrokerStub::set_max_level(uint8_t level) {
+    std::lock_guard<std::mutex> guard(lock);
+    max_level = level;
+}
+
+void MqttBrokerStub::set_topic_alias_max(uint16_t max) {
+    std::lock_guard<std::mutex> guard(lock);
+    alias_max = max;
+}
+
+void MqttBrokerStub::refuse_topic(const std::string& filter, uint8_t reason) {
+    std::lock_guard<std::mutex> guard(lock);
+    refused.emplace_back(filter, reason);
+}
+
+void MqttBrokerStub::drop_clients() {
+    std::lock_guard<std::mutex> guard(lock);
+    for(Client& c : clients) ::shutdown(c.fd, SHUT_RDWR); // the broker thread sees EOF and drops them
+}
+
+// caller holds the lock; an MQTT 5 client with a Session Expiry Interval leaves its session behind
+void MqttBrokerStub::end_session(const Client& client) {
+    if(client.level < 5 || client.session_expiry_s == 0 || client.client_id.empty()) return;
+    sessions[client.client_id] = { client.filters, now_ms() + uint64_t(client.session_expiry_s) * 1000 };
+}
+
+bool MqttBrokerStub::topic_matches(const std::string& filter, const std::string& topic) {
+    size_t f = 0, t = 0;
+    while(f < filter.size()){
+        if(filter[f] == '#') return true;
+        if(filter[f] == '+'){
+            while(t < topic.size() && topic[t] != '/') ++t;
+            ++f;
+            continue;
+        }
+        if(t >= topic.size() || filter[f] != topic[t]) return false;
+        ++f; ++t;
+    }
+    return t == topic.size();
+}
+
+bool MqttBrokerStub::send_all(int fd, const uint8_t* buf, size_t len) {
+    while(len > 0){
+        ssize_t n = ::send(fd, buf, len, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        buf += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+static size_t put_remaining_length(uint8_t* buf, size_t len) {
+    size_t pos = 0;
+    do {
+        uint8_t v = len % 0x80;
+        len /= 0x80;
+        buf[pos++] = len > 0 ? v | 0x80 : v;
+    } while(len != 0);
+    return pos;
+}
+
+static bool get_varint(const uint8_t* buf, size_t& pos, size_t len, uint32_t& value) {
+    value = 0;
+    for(uint32_t scaling = 1, i = 0; i < 4 && pos < len; ++i, scaling *= 0x80){
+        uint8_t b = buf[pos++];
+        value += (b & 0x7F) * scaling;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Walks an MQTT 5 property block at pos, calling visit(id, value, value_len) for each property.
+// Returns false when the block is malformed.
+template<class Visit>
+static bool read_properties(const uint8_t* buf, size_t& pos, size_t len, Visit visit) {
+    uint32_t size;
+    if(!get_varint(buf, pos, len, size) || pos + size > len) return false;
+    const size_t end = pos + size;
+    while(pos < end){
+        uint8_t id = buf[pos++];
+        size_t n = 0;
+        switch(id){
+            case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A: n = 1; break;
+            case 0x13: case 0x21: case 0x22: case 0x23: n = 2; break;
+            case 0x02: case 0x11: case 0x18: case 0x27: n = 4; break;
+            case 0x0B: { size_t p = pos; uint32_t v; if(!get_varint(buf, p, end, v)) return false; n = p - pos; break; }
+            case 0x26: n = pos + 2 <= end ? 2 + ((buf[pos] << 8) | buf[pos+1]) : 0;
+                       n = pos + n + 2 <= end ? n + 2 + ((buf[pos+n] << 8) | buf[pos+n+1]) : 0; break;
+            default: n = pos + 2 <= end ? 2 + ((buf[pos] << 8) | buf[pos+1]) : 0; break; // strings and binary data
+        }
+        if(n == 0 || pos + n > end) return false;
+        visit(id, &buf[pos], n);
+        pos += n;
+    }
+    return true;
+}
+
+static uint32_t get_uint(const uint8_t* value, size_t n) {
+    uint32_t v = 0;
+    for(size_t i = 0; i < n; ++i) v = (v << 8) | value[i];
+    return v;
+}
+
+void MqttBrokerStub::send_publish(Client& client, const Message& msg, uint8_t qos) {
+    std::vector<uint8_t> pkt(5 + 2 + msg.topic.size() + 2 + 1 + msg.payload.size());
+    size_t body = 2 + msg.topic.size() + (qos ? 2 : 0) + (client.level >= 5 ? 1 : 0) + msg.payload.size();
+    pkt[0] = 0x30 | (qos << 1) | (msg.retain ? 1 : 0);
+    size_t pos = 1 + put_remaining_length(&pkt[1], body);
+    pkt[pos++] = uint8_t(msg.topic.size() >> 8);
+    pkt[pos++] = uint8_t(msg.topic.size() & 0xFF);
+    memcpy(&pkt[pos], msg.topic.data(), msg.topic.size());
+    pos += msg.topic.size();
+    if(qos){
+        if(++client.next_id == 0) client.next_id = 1;
+        pkt[pos++] = uint8_t(client.next_id >> 8);
+        pkt[pos++] = uint8_t(client.next_id & 0xFF);
+    }
+    if(client.level >= 5) pkt[pos++] = 0; // no properties
+    memcpy(&pkt[pos], msg.payload.data(), msg.payload.size());
+    pos += msg.payload.size();
+    send_all(client.fd, pkt.data(), pos);
+}
+
+// caller holds the lock
+void MqttBrokerStub::route(const Message& msg) {
+    if(msg.retain){
+        if(msg.payload.empty()) retained.erase(msg.topic);
+        else retained[msg.topic] = msg;
+    }
+    for(Client& c : clients){
+        uint8_t granted = 0xFF;
+        for(const auto& [filter, qos] : c.filters){
+            if(topic_matches(filter, msg.topic)) granted = std::max<uint8_t>(granted == 0xFF ? 0 : granted, qos);
+        }
+        if(granted != 0xFF) send_publish(c, msg, std::min(granted, msg.qos));
+    }
+}
+
+// caller holds the lock; returns false when the client must be dropped
+bool MqttBrokerStub::handle_packet(Client& client, uint8_t header, const uint8_t* body, size_t len, size_t packet_size) {
+    auto read_string = [&](size_t& pos) -> std::string {
+        if(pos + 2 > len) return {};
+        size_t n = (size_t(body[pos]) << 8) | body[pos+1];
+        pos += 2;
+        if(pos + n > len) n = len - pos;
+        std::string s((const char*)&body[pos], n);
+        pos += n;
+        return s;
+    };
+
+    switch(header >> 4){
+        case 1: { // CONNECT
+            size_t pos = 0;
+            read_string(pos); // protocol name
+            if(pos + 4 > len) return false;
+            uint8_t level = body[pos], flags = body[pos+1];
+            pos += 4; // level, flags, keepalive
+            if(level > max_level){
+                const uint8_t connack[4] = { 0x20, 0x02, 0x00, 0x01 }; // unacceptable protocol version
+                send_all(client.fd, connack, 4);
+                return false;
+            }
+            client.level = level;
+            if(level >= 5 && !read_properties(body, pos, len, [&](uint8_t id, const uint8_t* value, size_t n){
+                if(id == 0x11) client.session_expiry_s = get_uint(value, n);
+            })) return false;
+            client.client_id = read_string(pos);
+            ++connects;
+            if(level < 5){
+                const uint8_t connack[4] = { 0x20, 0x02, 0x00, 0x00 };
+                return send_all(client.fd, connack, 4);
+            }
+
+            // clean start drops a kept session, otherwise one that hasn't expired is picked up
+            bool present = false;
+            auto kept = sessions.find(client.client_id);
+            if(kept != sessions.end()){
+                if(!(flags & 0x02) && kept->second.expires_ms > now_ms()){
+                    client.filters = kept->second.filters;
+                    present = true;
+                    ++resumed;
+                }
+                sessions.erase(kept);
+            }
+            uint8_t connack[8] = { 0x20, 0x02, uint8_t(present ? 1 : 0), 0x00, 0x00, 0x22, uint8_t(alias_max >> 8), uint8_t(alias_max & 0xFF) };
+            if(alias_max){
+                connack[1] = 6;
+                connack[4] = 3;
+            } else {
+                connack[1] = 3;
+            }
+            bool ok = send_all(client.fd, connack, size_t(connack[1]) + 2);
+            if(present) changed.notify_all();
+            return ok;
+        }
+        case 3: { // PUBLISH
+            uint8_t qos = (header >> 1) & 0x03;
+            size_t pos = 0;
+            Message msg;
+            msg.topic = read_string(pos);
+            msg.qos = qos;
+            msg.retain = header & 1;
+            uint16_t id = 0;
+            if(qos){
+                id = uint16_t((body[pos] << 8) | body[pos+1]);
+                pos += 2;
+            }
+            if(client.level >= 5){
+                uint16_t alias = 0;
+                if(!read_properties(body, pos, len, [&](uint8_t prop, const uint8_t* value, size_t n){
+                    if(prop == 0x23) alias = uint16_t(get_uint(value, n));
+                })) return false;
+                if(alias){
+                    if(alias > alias_max) return false; // topic alias invalid
+                    if(msg.topic.empty()){
+                        auto known = client.aliases.find(alias);
+                        if(known == client.aliases.end()) return false; // a protocol error as well
+                        msg.topic = known->second;
+                    } else {
+                        client.aliases[alias] = msg.topic;
+                    }
+                }
+            }
+            msg.payload.assign((const char*)&body[pos], len - pos);
+            msg.tick = gpioTick();
+            msg.wire_bytes = packet_size;
+
+            uint8_t reason = 0;
+            for(const auto& [filter, code] : refused){
+                if(topic_matches(filter, msg.topic)) reason = code;
+            }
+            if(reason && client.level < 5) return false; // 3.1.1 has no way to refuse a publish but to disconnect
+            if(qos){
+                const uint8_t puback[5] = { 0x40, uint8_t(reason ? 3 : 2), uint8_t(id >> 8), uint8_t(id & 0xFF), reason };
+                send_all(client.fd, puback, reason ? 5 : 4);
+            }
+            if(reason) return true;
+            if(publish_hook){
+                PublishHook hook = publish_hook;
+                lock.unlock();
+                hook(msg);
+                lock.lock();
+            }
+            route(msg);
+            return true;
+        }
+        case 4: // PUBACK
+            return true;
+        case 8: { // SUBSCRIBE
+            size_t pos = 2;
+            ++subscribes;
+            std::vector<uint8_t> suback { 0x90, 0x00, body[0], body[1] };
+            if(client.level >= 5){
+                if(!read_properties(body, pos, len, [](uint8_t, const uint8_t*, size_t){})) return false;
+                suback.push_back(0); // no properties
+            }
+            std::vector<std::string> added;
+            while(pos < len){
+                std::string filter = read_string(pos);
+                uint8_t qos = pos < len ? body[pos++] & 0x03 : 0;
+                client.filters.emplace_back(filter, qos);
+                added.push_back(filter);
+                suback.push_back(qos);
+            }
+            suback[1] = uint8_t(suback.size() - 2);
+            bool ok = send_all(client.fd, suback.data(), suback.size());
+            for(const std::string& filter : added){
+                for(const auto& [topic, msg] : retained){
+                    if(topic_matches(filter, topic)) send_publish(client, msg, msg.qos);
+                }
+            }
+            changed.notify_all();
+            return ok;
+        }
+        case 10: { // UNSUBSCRIBE
+            size_t pos = 2;
+            std::vector<uint8_t> unsuback { 0xB0, 0x00, body[0], body[1] };
+            if(client.level >= 5){
+                if(!read_properties(body, pos, len, [](uint8_t, const uint8_t*, size_t){})) return false;
+                unsuback.push_back(0); // no properties
+            }
+            while(pos < len){
+                std::string filter = read_string(pos);
+                size_t removed = std::erase_if(client.filters, [&](const auto& f){ return f.first == filter; });
+                if(client.level >= 5) unsuback.push_back(removed ? 0x00 : 0x11); // success, no subscription existed
+            }
+            unsuback[1] = uint8_t(unsuback.size() - 2);
+            return send_all(client.fd, unsuback.data(), unsuback.size());
+        }
+        case 12: { // PINGREQ
+            const uint8_t pingresp[2] = { 0xD0, 0x00 };
+            return send_all(client.fd, pingresp, 2);
+        }
+        case 14: { // DISCONNECT
+            // MQTT 5 may change the Session Expiry Interval on the way out, 0 ends the session with it
+            size_t pos = 1;
+            if(client.level >= 5 && len > 1){
+                read_properties(body, pos, len, [&](uint8_t id, const uint8_t* value, size_t n){
+                    if(id == 0x11) client.session_expiry_s = get_uint(value, n);
+                });
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// caller holds the lock
+bool MqttBrokerStub::read_client(Client& client) {
+    uint8_t chunk[4096];
+    ssize_t n = ::recv(client.fd, chunk, sizeof chunk, MSG_DONTWAIT);
+    if(n == 0) return false;
+    if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    client.inbuf.insert(client.inbuf.end(), chunk, chunk + n);
+
+    // consume every complete packet in the buffer
+    while(client.inbuf.size() >= 2){
+        size_t len = 0, mult = 1, pos = 1;
+        bool complete = false;
+        while(pos < client.inbuf.size() && pos < 5){
+            uint8_t b = client.inbuf[pos++];
+            len += (b & 0x7F) * mult;
+            mult *= 0x80;
+            if(!(b & 0x80)){ complete = true; break; }
+        }
+        if(!complete || client.inbuf.size() < pos + len) break;
+        std::vector<uint8_t> packet(client.inbuf.begin(), client.inbuf.begin() + pos + len);
+        client.inbuf.erase(client.inbuf.begin(), client.inbuf.begin() + pos + len);
+        if(!handle_packet(client, packet[0], packet.data() + pos, len, pos + len)) return false;
+    }
+    return true;
+}
+
+void MqttBrokerStub::accept_clients() {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if(fd == -1) return;
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+    Client& client = clients.emplace_back();
+    client.fd = fd;
+}
+
+void MqttBrokerStub::serve() {
+    std::vector<pollfd> fds;
+    while(running){
+        if(frozen){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            fds.clear();
+            fds.push_back({ listen_fd, POLLIN, 0 });
+            fds.push_back({ wake_pipe[0], POLLIN, 0 });
+            for(const Client& c : clients) fds.push_back({ c.fd, POLLIN, 0 });
+        }
+
+        if(::poll(fds.data(), fds.size(), 100) <= 0) continue;
+
+        timespec t0, t1;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+
+        std::unique_lock<std::mutex> guard(lock);
+        if(fds[1].revents & POLLIN){
+            uint8_t drain[64];
+            while(::read(wake_pipe[0], drain, sizeof drain) > 0);
+            std::vector<Message> pending;
+            pending.swap(outbox);
+            for(const Message& msg : pending) route(msg);
+        }
+
+        // client indices are stable for this pass; closed clients are removed afterwards
+        std::vector<int> dead;
+        for(size_t i = 2; i < fds.size(); ++i){
+            if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            auto it = std::find_if(clients.begin(), clients.end(), [&](const Client& c){ return c.fd == fds[i].fd; });
+            if(it != clients.end() && !read_client(*it)) dead.push_back(it->fd);
+        }
+        for(int fd : dead){
+            ::close(fd);
+            std::erase_if(clients, [&](const Client& c){
+                if(c.fd != fd) return false;
+                end_session(c);
+                return true;
+            });
+        }
+        if(fds[0].revents & POLLIN) accept_clients();
+        guard.unlock();
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+        cpu_ns += uint64_t(t1.tv_sec - t0.tv_sec) * 1000000000ull + uint64_t(t1.tv_nsec - t0.tv_nsec);
+    }
+}
@@ -0,0 +1,237 @@
+#include "pigpiod_stub.h"
+
+#include <command.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+PigpiodStub::PigpiodStub(): listen_port(0), listen_fd(-1), wake_pipe{-1,-1}, running(false),
+    next_handle(0), alert_bits(0), refuse_until_ms(0), commands(0) {}
+
+PigpiodStub::~PigpiodStub() {
+    stop();
+}
+
+bool PigpiodStub::start(uint16_t port) {
+    listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd == -1) return false;
+
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::bind(listen_fd, (sockaddr*)&addr, sizeof addr) == -1 || ::listen(listen_fd, 8) == -1){
+        ::close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    socklen_t len = sizeof addr;
+    getsockname(listen_fd, (sockaddr*)&addr, &len);
+    listen_port = ntohs(addr.sin_port);
+
+    if(::pipe(wake_pipe) == -1) return false;
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+
+    running = true;
+    worker = std::thread(&PigpiodStub::serve, this);
+    return true;
+}
+
+void PigpiodStub::stop() {
+    if(!running) return;
+    running = false;
+    uint8_t b = 0;
+    (void)::write(wake_pipe[1], &b, 1);
+    if(worker.joinable()) worker.join();
+
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    for(Client& c : clients) ::close(c.fd);
+    clients.clear();
+    update_alerts();
+    ::close(listen_fd);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    listen_fd = wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+void PigpiodStub::outage(uint32_t ms) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    refuse_until_ms = now_ms() + ms;
+    for(Client& c : clients) ::shutdown(c.fd, SHUT_RDWR); // the serve thread sees EOF and drops them
+}
+
+bool PigpiodStub::send_all(int fd, const void* buf, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    while(len > 0){
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+// caller holds the lock; claim the simulator alert on every pin some stream reports
+void PigpiodStub::update_alerts() {
+    uint32_t wanted = 0;
+    for(const Client& c : clients){
+        if(c.notify) wanted |= c.bits;
+    }
+    for(unsigned g = 0; g <= PI_MAX_USER_GPIO; ++g){
+        uint32_t bit = 1u << g;
+        if((wanted ^ alert_bits) & bit){
+            gpioSetAlertFuncEx(g, (wanted & bit) ? &PigpiodStub::alert : nullptr, (wanted & bit) ? this : nullptr);
+        }
+    }
+    alert_bits = wanted;
+}
+
+void PigpiodStub::alert(int gpio, int level, uint32_t tick, void* userdata) {
+    PigpiodStub& self = *static_cast<PigpiodStub*>(userdata);
+    std::lock_guard<std::recursive_mutex> guard(self.lock);
+    uint32_t bit = 1u << gpio;
+    gpioReport_t report {};
+    report.tick = tick;
+    if(level == PI_TIMEOUT){
+        report.flags = PI_NTFY_FLAGS_WDOG | PI_NTFY_FLAGS_BIT(gpio);
+        report.level = gpioRead_Bits_0_31();
+    } else {
+        // the bank may already have moved on, this sample carries the level of this edge
+        report.level = (gpioRead_Bits_0_31() & ~bit) | (level ? bit : 0);
+    }
+    for(Client& c : self.clients){
+        if(!c.notify || !(c.bits & bit)) continue;
+        report.seqno = c.seqno++;
+        send_all(c.fd, &report, sizeof report);
+    }
+}
+
+void PigpiodStub::serve() {
+    std::vector<pollfd> fds;
+    while(running){
+        fds.clear();
+        fds.push_back({ listen_fd, POLLIN, 0 });
+        fds.push_back({ wake_pipe[0], POLLIN, 0 });
+        {
+            std::lock_guard<std::recursive_mutex> guard(lock);
+            for(const Client& c : clients) fds.push_back({ c.fd, POLLIN, 0 });
+        }
+        if(::poll(fds.data(), fds.size(), 500) <= 0) continue;
+
+        if(fds[0].revents & POLLIN){
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if(fd >= 0){
+                std::lock_guard<std::recursive_mutex> guard(lock);
+                if(now_ms() < refuse_until_ms){
+                    ::close(fd);
+                } else {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+                    clients.push_back({ fd });
+                }
+            }
+        }
+        if(fds[1].revents & POLLIN){
+            uint8_t drain[16];
+            while(::read(wake_pipe[0], drain, sizeof drain) > 0);
+        }
+
+        std::lock_guard<std::recursive_mutex> guard(lock);
+        bool dropped = false;
+        for(size_t i = 2; i < fds.size(); ++i){
+            if(!fds[i].revents) continue;
+            auto it = std::find_if(clients.begin(), clients.end(), [&](const Client& c){ return c.fd == fds[i].fd; });
+            if(it == clients.end()) continue;
+            if(!handle_command(*it)){
+                ::close(it->fd);
+                clients.erase(it);
+                dropped = true;
+            }
+        }
+        if(dropped) update_alerts();
+    }
+}
+
+// caller holds the lock; returns false when the connection must be dropped
+bool PigpiodStub::handle_command(Client& client) {
+    cmdCmd_t frame;
+    if(::recv(client.fd, &frame, sizeof frame, MSG_WAITALL) != ssize_t(sizeof frame)) return false;
+    if(client.notify) return true; // a report stream carries no further commands
+
+    std::vector<uint8_t> ext(frame.ext_len);
+    if(frame.ext_len && ::recv(client.fd, ext.data(), ext.size(), MSG_WAITALL) != ssize_t(ext.size())) return false;
+
+    ++commands;
+    frame.res = uint32_t(execute(client, frame.cmd, frame.p1, frame.p2, ext));
+    return send_all(client.fd, &frame, sizeof frame);
+}
+
+// caller holds the lock
+int PigpiodStub::execute(Client& client, uint32_t cmd, uint32_t p1, uint32_t p2, const std::vector<uint8_t>& ext) {
+    switch(cmd){
+        case PI_CMD_MODES: return gpioSetMode(p1, p2);
+        case PI_CMD_MODEG: return gpioGetMode(p1);
+        case PI_CMD_PUD: return gpioSetPullUpDown(p1, p2);
+        case PI_CMD_READ: return gpioRead(p1);
+        case PI_CMD_WRITE: return gpioWrite(p1, p2);
+        case PI_CMD_BR1: return int(gpioRead_Bits_0_31());
+        case PI_CMD_BC1: return gpioWrite_Bits_0_31_Clear(p1);
+        case PI_CMD_BS1: return gpioWrite_Bits_0_31_Set(p1);
+        case PI_CMD_TICK: return int(gpioTick());
+        case PI_CMD_FG: return gpioGlitchFilter(p1, p2);
+        case PI_CMD_WDOG: return gpioSetWatchdog(p1, p2);
+        case PI_CMD_FN: {
+            uint32_t active = 0;
+            if(ext.size() >= 4) memcpy(&active, ext.data(), 4);
+            return gpioNoiseFilter(p1, p2, active);
+        }
+        case PI_CMD_TRIG: {
+            uint32_t level = 0;
+            if(ext.size() >= 4) memcpy(&level, ext.data(), 4);
+            return gpioTrigger(p1, p2, level);
+        }
+        case PI_CMD_WVNEW: return gpioWaveAddNew();
+        case PI_CMD_WVAG: {
+            std::vector<gpioPulse_t> pulses(ext.size() / sizeof(gpioPulse_t));
+            if(!pulses.empty()) memcpy(pulses.data(), ext.data(), pulses.size() * sizeof(gpioPulse_t));
+            return gpioWaveAddGeneric(unsigned(pulses.size()), pulses.data());
+        }
+        case PI_CMD_WVCRE: return gpioWaveCreate();
+        case PI_CMD_WVDEL: return gpioWaveDelete(p1);
+        case PI_CMD_WVTX: return gpioWaveTxSend(p1, PI_WAVE_MODE_ONE_SHOT);
+        case PI_CMD_WVBSY: return gpioWaveTxBusy();
+        case PI_CMD_WVTAT: return gpioWaveTxAt();
+        case PI_CMD_WVHLT: return gpioWaveTxStop();
+        case PI_CMD_NOIB:
+            client.notify = true;
+            client.handle = next_handle++;
+            return int(client.handle);
+        case PI_CMD_NB:
+        case PI_CMD_NC:
+            for(Client& c : clients){
+                if(c.notify && c.handle == p1){
+                    c.bits = cmd == PI_CMD_NB ? p2 : 0;
+                    update_alerts();
+                    return 0;
+                }
+            }
+            return PI_BAD_HANDLE;
+        default:
+            return PI_UNKNOWN_COMMAND;
+    }
+}
@@ -0,0 +1,67 @@
+#include "serial_wire.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+SerialWire::SerialWire(): pty_master(-1), pty_slave(-1), sockets{-1,-1}, baud(9600), running(false), to_nodes(0), to_master(0) {}
+
+SerialWire::~SerialWire() {
+    close();
+}
+
+bool SerialWire::open(uint32_t line_baud) {
+    baud = line_baud;
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(pty_master < 0 || grantpt(pty_master) != 0 || unlockpt(pty_master) != 0) return false;
+    slave_path = ptsname(pty_master);
+
+    // hold the slave open in raw mode so nothing is echoed or line-buffered before the service opens it
+    pty_slave = ::open(slave_path.c_str(), O_RDWR | O_NOCTTY);
+    if(pty_slave < 0) return false;
+    termios tio;
+    tcgetattr(pty_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty_slave, TCSANOW, &tio);
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+
+    running = true;
+    relay = std::thread(&SerialWire::run, this);
+    return true;
+}
+
+void SerialWire::close() {
+    running = false;
+    if(relay.joinable()) relay.join();
+    for(int* fd : { &pty_master, &pty_slave, &sockets[0], &sockets[1] }){
+        if(*fd >= 0) ::close(*fd);
+        *fd = -1;
+    }
+}
+
+void SerialWire::run() {
+    uint8_t buf[256];
+    while(running){
+        pollfd fds[2] = { { pty_master, POLLIN, 0 }, { sockets[0], POLLIN, 0 } };
+        if(::poll(fds, 2, 50) <= 0) continue;
+        for(int i = 0; i < 2; ++i){
+            if(!(fds[i].revents & POLLIN)) continue;
+            ssize_t n = ::read(fds[i].fd, buf, sizeof buf);
+            if(n <= 0) continue;
+            // the bytes arrive once they have been clocked out at the line rate
+            std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(n) * 10 * 1000000 / baud));
+            int dest = i == 0 ? sockets[0] : pty_master;
+            for(ssize_t off = 0; off < n;){
+                ssize_t w = ::write(dest, buf + off, size_t(n - off));
+                if(w <= 0) break;
+                off += w;
+            }
+            (i == 0 ? to_nodes : to_master) += uint64_t(n);
+        }
+    }
+}
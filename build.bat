@@ -26,12 +26,19 @@ set ASYNC_BUILD=1
 
 set LINK_ONLY=0
 
+:: GPIO backend library: pigpio (hardware) or pigpio-sim (simulated, no Raspberry Pi required)
+set GPIO_BACKEND=pigpio
+
+:: Build target: program (the service) or bench (benchmark harness, always uses pigpio-sim)
+set BUILD_TARGET=program
+if "%BUILD_TARGET%" == "bench" set GPIO_BACKEND=pigpio-sim
+
 call ssh_creds.bat
 
 :: Configure Source For Compiling And Additional Custom Library Directories / Names
 set SOURCE_DIRECTORIES=src
-set INCLUDE_DIRECTORIES=include
-set LIBRARY_DIRECTORIES=libraries\pigpio libraries\PJON-13.1 libraries\libjsonloader-class libraries\librapidjson-main
+set INCLUDE_DIRECTORIES=include libraries\pigpio\include
+set LIBRARY_DIRECTORIES=libraries\%GPIO_BACKEND% libraries\PJON-13.1 libraries\libjsonloader-class libraries\librapidjson-main
 set LIBRARY_NAMES=atomic
 
 :: Additional Compiler Flags And Configuration Settings
@@ -40,6 +47,14 @@ set CPP_COMPILER_FLAGS=-std=c++20 -DSMCTOPICSIZE=1024 -DSMCBUFSIZE=65535 -DLINUX
 set C_COMPILER_FLAGS=
 set OBJECT_DIRECTORY=.objs
 
+:: The benchmark harness links the service sources with its own entry point
+if "%BUILD_TARGET%" == "bench" (
+	set OUTPUT=bench
+	set SOURCE_DIRECTORIES=%SOURCE_DIRECTORIES% bench\src
+	set INCLUDE_DIRECTORIES=%INCLUDE_DIRECTORIES% bench\include
+	set CPP_COMPILER_FLAGS=%CPP_COMPILER_FLAGS% -DZCL_BENCHMARK
+)
+
 :: Advanced / Extra Command Line Settings For Building / Linking
 set ADDITIONAL_INCLUDEDIRS=
 set ADDITIONAL_LIBRARIES=-static-libstdc++ -static-libgcc -lpthread
@@ -481,7 +496,7 @@ if exist .\%OUTPUT% (
 
 	echo Uploading To Pi...
 	:: Remote Update - Send Updates To Remote Server For Update
-	scp -i %SSH_KEY% .\%OUTPUT% %PI_USERNAME%@%PI_HOSTNAME%:~/program
+	scp -i %SSH_KEY% .\%OUTPUT% %PI_USERNAME%@%PI_HOSTNAME%:~/%OUTPUT%
 	scp -i %SSH_KEY% .\config.conf %PI_USERNAME%@%PI_HOSTNAME%:~/config.conf
 
 	echo Build Success!
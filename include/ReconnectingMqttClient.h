@@ -1,5 +1,6 @@
 #pragma once
 // Based on the spec http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718016
+// and, for protocol level 5, https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html
 // Lib Docs: https://github.com/fredilarsen/ReconnectingMqttClient
 
 #include <PJONEthernetTCP.h>
@@ -7,8 +8,17 @@
 
 #ifndef ARDUINO
   #include <string>
+  #include <string_view>
+  #include <deque>
+  #include <vector>
+  #include <unordered_map>
   using String = std::string;
 #endif
+#if !defined(ARDUINO) && !defined(_WIN32)
+  #include <poll.h>
+  #include <sys/ioctl.h>
+  #include <cerrno>
+#endif
 
 #ifndef SMCBUFSIZE
   #ifdef ARDUINO
@@ -35,6 +45,15 @@ typedef void(*OnConnectCallback)(
   uint64_t reconnect,   
   void *custom_ptr
 );
+typedef int(*SocketConnector)( // returns a connected socket the client then owns, or -1
+  void *custom_ptr
+);
+typedef void(*ReasonCodeCallback)(
+  uint8_t  packet_type, // PUBACK, SUBACK or UNSUBACK
+  uint16_t msg_id,
+  uint8_t  reason,      // 0x80 and above
+  void     *custom_ptr
+);
 
 class ReconnectingMqttClient {
 public:
@@ -50,16 +69,25 @@ public:
     PINGREQ_2[2] =     { 12 << 4, 0 },
     PINGRESP_2[2] =    { 13 << 4, 0 },
     DISCONNECT_2[2] =  { 14 << 4, 0 },
-    CONNECT_7[7] = { 0x00,0x04,'M','Q','T','T',0x04 }; // MQTT version 4 = 3.1.1
-  
-  const char* MQTT_VERSION = "3.1.1";
-  const uint16_t KEEPALIVE_S = 60, PING_TIMEOUT = 15000;
+    CONNECT_6[6] = { 0x00,0x04,'M','Q','T','T' }; // followed by the protocol level
+  const uint8_t LEVEL_311 = 4, LEVEL_5 = 5;
+  // MQTT 5 property identifiers in use
+  const uint8_t PROP_SESSION_EXPIRY = 0x11, PROP_TOPIC_ALIAS_MAX = 0x22, PROP_TOPIC_ALIAS = 0x23;
+
   const uint32_t READ_TIMEOUT = 10000;
 
   String client_id, user, password, will_payload, will_topic;
   bool will_retain = false;
   uint8_t server_ip[4];
   uint16_t port = 1883;
+  // Sent in CONNECT. A PINGREQ goes out after a quarter of it without a packet from the broker,
+  // and the connection is dropped when the PINGRESP takes another quarter.
+  uint16_t keepalive_s = 60;
+  // Level asked for in CONNECT, 5 falls back to 4 (3.1.1) for good when the broker turns it down
+  uint8_t protocol_level = LEVEL_5;
+  // MQTT 5: seconds the broker keeps the session after the connection drops, a reconnect within
+  // it resumes the subscriptions instead of starting clean. 0 ends the session with the connection.
+  uint32_t session_expiry_s = 0;
 
 private:
 
@@ -67,15 +95,36 @@ private:
   bool enabled = true;
   uint16_t msg_id = 1, pubacked_msg_id = 0;
   bool waiting_for_ping = false;
-  uint32_t last_packet_in = 0, last_packet_out = 0;
+  uint32_t last_packet_in = 0, last_packet_out = 0, ping_sent = 0;
+  int socket_fd = -1; // the socket when it came from the connector or adopt_socket
   int8_t last_connect_error = 0x7F; // Unknown
   uint64_t connect_retries = 0;
+  uint8_t protocol = 4; // level of the current connection
+  bool session_resumed = false; // the last CONNACK reported a session present
   RMCReceiveCallback receive_callback = NULL;
   OnConnectCallback on_connect_callback = NULL;
+  ReasonCodeCallback reason_callback = NULL;
+  SocketConnector connector = NULL;
+  void *custom_ptr_connector = NULL;
   void *custom_ptr_receive = NULL; // Custom data for the callback, for example a pointer to a derived class object
   void *custom_ptr_on_connect = NULL; // Custom data for the callback, for example a pointer to a derived class object
+  void *custom_ptr_reason = NULL;
+
+  // Topic aliases (MQTT 5): registered topics are numbered from 1 in order, the broker's Topic Alias
+  // Maximum decides how many are used. The first PUBLISH on a connection carries the topic and the
+  // alias, later ones only the alias. Mappings live as long as the connection.
+  std::deque<String> alias_topics; // stable storage for the keys of alias_index
+  std::unordered_map<std::string_view, uint16_t> alias_index;
+  std::vector<bool> alias_sent;
+  uint16_t server_alias_max = 0;
   char topicbuf[SMCTOPICSIZE];
   uint8_t buffer[SMCBUFSIZE];
+#if !defined(ARDUINO) && !defined(_WIN32)
+  // With the socket at hand, packets are written without waiting: what the send buffer has no room for
+  // is kept here and sent ahead of anything else as room appears, so no write waits on the send timeout.
+  std::vector<uint8_t> unsent;
+  size_t unsent_pos = 0;
+#endif
   volatile bool last_sub_acked = false, last_pub_acked = false; // With QoS 1 the success of the last SUB or PUB can be checked
 
   void init_system() {
@@ -133,14 +182,84 @@ private:
     return put_string(text, (uint16_t) strlen(text), buf, pos);
   }
 
+  // Read a variable byte integer at pos, advancing it. Returns false past end.
+  bool get_varint(const uint8_t *buf, uint16_t &pos, const uint16_t end, uint32_t &value) {
+    uint32_t scaling = 1;
+    value = 0;
+    for (uint8_t i = 0; i < 4 && pos < end; i++) {
+      uint8_t b = buf[pos++];
+      value += (b & 0x7F) * scaling;
+      if (!(b & 0x80)) return true;
+      scaling *= 0x80;
+    }
+    return false;
+  }
+
+  // Size of the value of an MQTT 5 property starting at pos, 0 for an identifier this client doesn't know
+  uint16_t property_value_len(const uint8_t id, const uint8_t *buf, const uint16_t pos, const uint16_t end) {
+    switch (id) {
+      case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A: return 1;
+      case 0x13: case 0x21: case 0x22: case 0x23: return 2;
+      case 0x02: case 0x11: case 0x18: case 0x27: return 4;
+      case 0x0B: { uint16_t p = pos; uint32_t v; return get_varint(buf, p, end, v) ? p - pos : 0; }
+      case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+        return pos + 2 <= end ? 2 + ((buf[pos] << 8) | buf[pos + 1]) : 0;
+      case 0x26: { // user property, a string pair
+        if (pos + 2 > end) return 0;
+        uint16_t first = 2 + ((buf[pos] << 8) | buf[pos + 1]);
+        if (pos + first + 2 > end) return 0;
+        return first + 2 + ((buf[pos + first] << 8) | buf[pos + first + 1]);
+      }
+    }
+    return 0;
+  }
+
+  // Walk a property block starting at pos (its length first), remembering what this client uses.
+  // Returns the position after the block, or 0 when it is malformed.
+  uint16_t read_properties(const uint8_t *buf, uint16_t pos, const uint16_t end) {
+    uint32_t len;
+    if (!get_varint(buf, pos, end, len) || pos + len > end) return 0;
+    const uint16_t stop = pos + (uint16_t)len;
+    while (pos < stop) {
+      uint8_t id = buf[pos++];
+      uint16_t n = property_value_len(id, buf, pos, stop);
+      if (n == 0 || pos + n > stop) return 0;
+      if (id == PROP_TOPIC_ALIAS_MAX) server_alias_max = (buf[pos] << 8) | buf[pos + 1];
+      pos += n;
+    }
+    return stop;
+  }
+
+  // Alias to send for a topic on this connection, 0 for none
+  uint16_t topic_alias(const char *topic) {
+    if (protocol != LEVEL_5 || server_alias_max == 0 || alias_index.empty()) return 0;
+    auto it = alias_index.find(std::string_view(topic));
+    return it != alias_index.end() && it->second <= server_alias_max ? it->second : 0;
+  }
+
+  void reset_aliases() {
+    alias_sent.assign(alias_topics.size() + 1, false);
+  }
+
   bool send_disconnect() { return write_to_socket(DISCONNECT_2, 2); }
-  bool send_pingreq() { waiting_for_ping = true; return write_to_socket(PINGREQ_2, 2); }
+  // MQTT 5: a normal disconnect that also drops the session kept for session_expiry_s
+  bool send_final_disconnect() {
+    if (protocol != LEVEL_5 || session_expiry_s == 0) return send_disconnect();
+    const uint8_t packet[9] = { 14 << 4, 7, 0x00, 5, PROP_SESSION_EXPIRY, 0, 0, 0, 0 };
+    return write_to_socket(packet, sizeof packet);
+  }
+  bool send_pingreq() { waiting_for_ping = true; ping_sent = millis(); return write_to_socket(PINGREQ_2, 2); }
   bool send_pingresp() { return write_to_socket(PINGRESP_2, 2); }
 
-  uint32_t inactivity_time() {
-    uint32_t in = last_packet_in == 0 ? 1000000000 : (uint32_t)(millis() - last_packet_in),
-             out = last_packet_out == 0 ? 1000000000 : (uint32_t)(millis() - last_packet_out);
-    return in < out ? in : out;
+  // The helper reads an orderly close as "nothing yet", a peek tells the two apart
+  bool peer_closed() {
+#ifndef _WIN32
+    uint8_t b;
+    return socket_fd >= 0 && client.operator==(TCPHelperClient(socket_fd)) &&
+           ::recv(socket_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+#else
+    return false;
+#endif
   }
 
   void socket_reconnect() {
@@ -150,7 +269,63 @@ private:
     start();
   }
 
+  bool own_socket() {
+    return socket_fd >= 0 && client.operator==(TCPHelperClient(socket_fd));
+  }
+
+  // Sends what it can of the unsent tail without waiting, false while some of it is left
+  bool send_unsent() {
+#if !defined(ARDUINO) && !defined(_WIN32)
+    while (unsent_pos < unsent.size()) {
+      ssize_t w = ::send(socket_fd, unsent.data() + unsent_pos, unsent.size() - unsent_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) drop_unsent(true);
+        return false;
+      }
+      unsent_pos += (size_t)w;
+    }
+    if (!unsent.empty()) last_packet_out = millis();
+    drop_unsent(false);
+#endif
+    return true;
+  }
+
+  // the tail belongs to this connection only, a new one starts on a packet boundary
+  void drop_unsent(bool close) {
+#if !defined(ARDUINO) && !defined(_WIN32)
+    unsent.clear();
+    unsent_pos = 0;
+#endif
+    if (close) client.stop();
+  }
+
   bool write_to_socket(const uint8_t *buf, const uint16_t len) {
+#if !defined(ARDUINO) && !defined(_WIN32)
+    if (client.connected() && own_socket()) {
+      size_t sent = 0;
+      if (send_unsent()) {
+        while (sent < len) {
+          ssize_t w = ::send(socket_fd, buf + sent, len - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+          if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            drop_unsent(true);
+            return false;
+          }
+          sent += (size_t)w;
+        }
+      } else if (!client.connected()) {
+        return false;
+      }
+      if (sent < len) unsent.insert(unsent.end(), buf + sent, buf + len); // in order behind the tail already kept
+      else last_packet_out = millis();
+#ifdef MQTT_DEBUGPRINT
+      printf("%u Sent packet %u len %d, %u bytes kept\n", millis(), buf[0], len, (unsigned)(unsent.size() - unsent_pos));
+#endif
+      return true;
+    }
+#endif
     if (client.connected()) {
       uint16_t remain = len;
       while (remain > 0) {
@@ -218,32 +393,63 @@ private:
   }
 
   bool socket_connect() {
-    if (!client.connect(server_ip, port)) { delay(100); return false; }
+    drop_unsent(false);
+    if (connector) {
+      int fd = connector(custom_ptr_connector); // paces its own retries
+      if (fd < 0) return false;
+      client = TCPHelperClient(fd);
+      socket_fd = fd;
+    } else {
+      socket_fd = -1;
+      if (!client.connect(server_ip, port)) { delay(100); return false; }
+    }
+    waiting_for_ping = false;
+    protocol = protocol_level == LEVEL_5 ? LEVEL_5 : LEVEL_311;
+
+    // MQTT 5: resume the session of an earlier connection when the broker is asked to keep one
+    bool resume = protocol == LEVEL_5 && session_expiry_s > 0 && connect_retries > 0;
+    uint8_t properties[16];
+    uint8_t properties_len = 0;
+    if (protocol == LEVEL_5 && session_expiry_s > 0) {
+      properties[properties_len++] = PROP_SESSION_EXPIRY;
+      properties[properties_len++] = session_expiry_s >> 24;
+      properties[properties_len++] = (session_expiry_s >> 16) & 0xFF;
+      properties[properties_len++] = (session_expiry_s >> 8) & 0xFF;
+      properties[properties_len++] = session_expiry_s & 0xFF;
+    }
 
     // Compose packet
     uint16_t len = 0, payloadsize = (uint16_t) (10 + (client_id.length() + 2)
       + (user.length() > 0 ? user.length() + 2 : 0)
       + (password.length() > 0 ? password.length() + 2 : 0)
-      + (will_topic.length() > 0 ? will_topic.length() + will_payload.length() + 4 : 0));
+      + (will_topic.length() > 0 ? will_topic.length() + will_payload.length() + 4 : 0)
+      + (protocol == LEVEL_5 ? 1 + properties_len + (will_topic.length() > 0 ? 1 : 0) : 0));
 
     len += put_header(CONNECT, buffer, payloadsize);
-    memcpy(&buffer[len], CONNECT_7, 7);
-    len += 7;
+    memcpy(&buffer[len], CONNECT_6, 6);
+    len += 6;
+    buffer[len++] = protocol;
 
     // [ username , password , will retain , will QOS, will QOS , will enabled , clean start , reserved ]
     // [    0x80  ,   0x40   ,    0x20     ,  0x10   ,   0x08   ,     0x04     ,    0x02     ,    0x01  ]
 
-    uint8_t flags = 0x02; // Clean session, No will
+    uint8_t flags = resume ? 0x00 : 0x02; // Clean session, No will
     if (user.length() > 0) flags |=  0x80 | (password.length() > 0 ? 0x40 : 0x00);
     if (will_topic.length() > 0) flags |= 0x04 | 0x08 | (will_retain ? 0x20 : 0x00);
     
     buffer[len++] = flags;
-    buffer[len++] = KEEPALIVE_S >> 8;
-    buffer[len++] = KEEPALIVE_S & 0xFF;
+    buffer[len++] = keepalive_s >> 8;
+    buffer[len++] = keepalive_s & 0xFF;
+    if (protocol == LEVEL_5) {
+      buffer[len++] = properties_len;
+      memcpy(&buffer[len], properties, properties_len);
+      len += properties_len;
+    }
 
     uint16_t __pos = len;
     len += put_string(client_id.c_str(), client_id.length(), buffer, len);
     if(will_topic.length() > 0){
+      if (protocol == LEVEL_5) buffer[len++] = 0; // no will properties
       len += put_string(will_topic.c_str(), will_topic.length(), buffer, len);
       if(!will_payload.length()){ // an empty will payload MUST still have a size of zero!
         buffer[len++] = 0;
@@ -257,20 +463,42 @@ private:
 
     last_connect_error = 0x7F;
     last_packet_in = millis();
+    server_alias_max = 0;
+    session_resumed = false;
+    reset_aliases();
+    bool answered = false;
     if (write_to_socket(buffer, len)) {
       response_delay();
       uint16_t packet_len, payload_len;
-      if (read_packet_from_socket(buffer, sizeof(buffer), packet_len, payload_len)) {
-        if (packet_len == 4 && buffer[0] == CONNACK) {
-          if (buffer[3] == 0) { // Connection Successful
-            // Call the OnConnect callback so the client can resubscribe to all topics
-            on_connect_callback(connect_retries++, custom_ptr_on_connect);
-            return client.connected();
-          }
-          else last_connect_error = buffer[3]; // Got an error code
+      if (read_packet_from_socket(buffer, sizeof(buffer), packet_len, payload_len) && buffer[0] == CONNACK && payload_len >= 2) {
+        uint16_t pos = packet_len - payload_len;
+        uint8_t ack_flags = buffer[pos], code = buffer[pos + 1];
+        answered = true;
+        // a 3.1.1 broker answers level 5 with "unacceptable protocol version" (0x01), an MQTT 5 one
+        // that is configured not to speak it with "unsupported protocol version" (0x84)
+        if (protocol == LEVEL_5 && (code == 0x01 || code == 0x84)) {
+          client.stop();
+          protocol_level = LEVEL_311;
+          return socket_connect();
+        }
+        if (code == 0 && (protocol == LEVEL_311 || (payload_len > 2 && read_properties(buffer, pos + 2, packet_len)))) { // Connection Successful
+          session_resumed = resume && (ack_flags & 0x01);
+          // Call the OnConnect callback so the client can resubscribe to all topics
+          on_connect_callback(connect_retries++, custom_ptr_on_connect);
+          return client.connected();
         }
+        else last_connect_error = code; // Got an error code
       }
     }
+    // some 3.1.1 brokers close the connection on a level they don't know instead of answering,
+    // 3.1.1 is kept only if the broker takes it
+    if (!answered && protocol == LEVEL_5) {
+      client.stop();
+      protocol_level = LEVEL_311;
+      if (socket_connect()) return true;
+      protocol_level = LEVEL_5; // not this, the broker may just be restarting
+    }
+    client.stop(); // a connection without a CONNACK is of no use, the next attempt starts over
     return false;
   }
 
@@ -288,47 +516,59 @@ private:
       if (buf[0] & 0b00000110) { // QOS1 or QOS2
         uint8_t sendbuf[4];
         sendbuf[0] = PUBACK;
-        sendbuf[1] = 2;
+        sendbuf[1] = 2; // for MQTT 5 too, a PUBACK without a reason code means success
         sendbuf[2] = buf[pos++]; // message id MSB
         sendbuf[3] = buf[pos++]; // message id LSB
         write_to_socket(sendbuf, 4);
       }
+      if (protocol == LEVEL_5) { // no alias was offered to the broker, the properties are skipped
+        uint32_t props;
+        if (!get_varint(buf, pos, packet_len, props) || pos + props > packet_len) return;
+        pos += (uint16_t)props;
+      }
       receive_callback(topicbuf, &buf[pos], packet_len - pos, custom_ptr_receive);
     }
   }
 
   void send_ping_if_needed() {
-    static uint32_t timeout = millis();
-    static int retries = 3; // retry the ping 3 times
-
-    if(inactivity_time() > PING_TIMEOUT && timeout > PING_TIMEOUT) {
-      if(waiting_for_ping){
-        if(retries++ > 3 || !send_pingreq()){
-          socket_reconnect();
-          return;
-        }
-      } else {
-        timeout = millis();
-        retries = 3;
-        send_pingreq();
-      } 
+    uint32_t quarter = keepalive_s * 250UL;
+    if (waiting_for_ping) {
+      if ((uint32_t)(millis() - ping_sent) > quarter) socket_reconnect(); // the broker stopped answering
+    } else if ((uint32_t)(millis() - last_packet_in) > quarter) {
+      send_pingreq();
     }
   }
 
   const char *next_topic(const char *p) { while (*p && *p != ',') p++; return p; }
 
+  void report_reason(const uint8_t packet_type, const uint16_t mess_id, const uint8_t reason) {
+    if (reason_callback) reason_callback(packet_type, mess_id, reason, custom_ptr_reason);
+  }
+
+  // One return code per topic filter; 3.1.1 has no codes for UNSUBACK, MQTT 5 puts properties ahead of them
   void handle_suback(const uint8_t *buf, const uint16_t packet_len, const uint16_t payload_len, bool unsubscribe) {
-    if (packet_len == (unsubscribe ? 4 : 5) && buf[0] == (unsubscribe ? UNSUBACK : SUBACK)) {
-      uint16_t mess_id = (buf[2] << 8) | buf[3];
-      if (!unsubscribe && buf[4] > 2) return; // Return code indicates failure
-      if (mess_id == msg_id) last_sub_acked = true;
+    uint16_t pos = packet_len - payload_len;
+    if (payload_len < 2 || buf[0] != (unsubscribe ? UNSUBACK : SUBACK)) return;
+    uint16_t mess_id = (buf[pos] << 8) | buf[pos + 1];
+    pos += 2;
+    if (protocol == LEVEL_5 && !(pos = read_properties(buf, pos, packet_len))) return;
+    bool ok = true;
+    for (; pos < packet_len; pos++) {
+      if (buf[pos] < 0x80) continue;
+      report_reason(buf[0], mess_id, buf[pos]); // Return code indicates failure
+      ok = false;
     }
+    if (ok && mess_id == msg_id) last_sub_acked = true;
   }
 
+  // MQTT 5 adds an optional reason code, 0x10 "no matching subscribers" is still a success
   void handle_puback(const uint8_t *buf, const uint16_t packet_len, const uint16_t payload_len) {
-    if (packet_len == 4 && buf[0] == PUBACK) {
-      pubacked_msg_id = (buf[2] << 8) | buf[3];
-      if (pubacked_msg_id == msg_id) last_pub_acked = true;
+    uint16_t pos = packet_len - payload_len;
+    if (payload_len >= 2 && buf[0] == PUBACK) {
+      pubacked_msg_id = (buf[pos] << 8) | buf[pos + 1];
+      uint8_t reason = payload_len > 2 ? buf[pos + 2] : 0;
+      if (reason >= 0x80) report_reason(PUBACK, pubacked_msg_id, reason);
+      else if (pubacked_msg_id == msg_id) last_pub_acked = true;
     }
   }
 
@@ -336,7 +576,7 @@ private:
     last_sub_acked = false;
     if (client.connected()) {
       // Pre-scan to find total payload length
-      uint16_t payload_len = 2; // packet identifier
+      uint16_t payload_len = protocol == LEVEL_5 ? 3 : 2; // packet identifier, MQTT 5 properties
       const char *p = topic, *p2 = p;
       while (*p && (p2 = next_topic(p))) { // Find next comma or final null-terminator
         payload_len += ((uint16_t)(p2-p) + 2) + (unsubscribe ? 0 : 1);
@@ -347,6 +587,7 @@ private:
       if (++msg_id == 0) msg_id++; // Avoid 0
       buffer[len++] = msg_id >> 8;
       buffer[len++] = msg_id & 0xFF;
+      if (protocol == LEVEL_5) buffer[len++] = 0; // no properties
       // Add each topic
       p = topic;
       while (*p && (p2 = next_topic(p))) {
@@ -383,24 +624,64 @@ public:
     on_connect_callback = callback;
     custom_ptr_on_connect = custom_pointer;
   }
+  // Called for PUBACK and SUBACK/UNSUBACK return codes that report a failure
+  // Opens the connection instead of the built-in IPv4 connect, e.g. to pick among several brokers
+  void set_connector(SocketConnector callback, void *custom_pointer) {
+    connector = callback;
+    custom_ptr_connector = custom_pointer;
+  }
+  void set_reason_code_callback(ReasonCodeCallback callback, void *custom_pointer) {
+    reason_callback = callback;
+    custom_ptr_reason = custom_pointer;
+  }
+
+  // Publishes on this topic use a topic alias where the broker allows one, returns the alias.
+  // Aliases are numbered in the order topics are added, so the most published go first.
+  uint16_t add_topic_alias(const char *topic) {
+    auto it = alias_index.find(std::string_view(topic));
+    if (it != alias_index.end()) return it->second;
+    if (alias_topics.size() >= 0xFFFF) return 0;
+    alias_topics.emplace_back(topic);
+    uint16_t alias = (uint16_t)alias_topics.size();
+    alias_index.emplace(std::string_view(alias_topics.back()), alias);
+    alias_sent.resize(alias_topics.size() + 1, false);
+    return alias;
+  }
 
   bool publish(const char *topic, const uint8_t *payload, const uint16_t payloadlen, const  bool retain, const uint8_t qos = 0) {
     last_pub_acked = false;
     if (connect()) {
-      uint16_t total = ((uint16_t) strlen(topic) + 2) + (qos > 0 ? 2 : 0) + payloadlen,
+      // with an alias the broker already maps, the topic is left empty
+      uint16_t alias = topic_alias(topic);
+      bool alias_known = alias && alias_sent[alias];
+      uint16_t topiclen = alias_known ? 0 : (uint16_t) strlen(topic);
+      uint16_t total = (topiclen + 2) + (qos > 0 ? 2 : 0) + payloadlen
+                       + (protocol == LEVEL_5 ? 1 + (alias ? 3 : 0) : 0),
                len = put_header(PUBLISH, buffer, total);
       if (retain) buffer[0] |= 1;
       buffer[0] |= qos << 1; // Add QOS into second or third bit
-      len += put_string(topic, buffer, len);
+      buffer[len++] = topiclen >> 8;
+      buffer[len++] = topiclen & 0xFF;
+      memcpy(&buffer[len], topic, topiclen);
+      len += topiclen;
       if (qos > 0) {
         if (++msg_id == 0) msg_id++;
         buffer[len++] = msg_id >> 8;
         buffer[len++] = msg_id & 0xFF;
       }
+      if (protocol == LEVEL_5) {
+        buffer[len++] = alias ? 3 : 0; // properties
+        if (alias) {
+          buffer[len++] = PROP_TOPIC_ALIAS;
+          buffer[len++] = alias >> 8;
+          buffer[len++] = alias & 0xFF;
+        }
+      }
       assert(len + payloadlen < SMCBUFSIZE);
       memcpy(&buffer[len], payload, payloadlen);
       len += payloadlen;
       bool ok = write_to_socket(buffer, len);
+      if (ok && alias) alias_sent[alias] = true;
       if (qos == 0) last_pub_acked = ok;
       return ok;
     }
@@ -422,6 +703,7 @@ public:
 
   void update() {
     if (connect()) {
+      send_unsent();
       send_ping_if_needed();
       #ifdef ARDUINO
       yield();
@@ -429,7 +711,9 @@ public:
       int16_t avail = client.available();
       if (avail > 0) {
         uint16_t packet_len, payload_len;
-        if (read_packet_from_socket(buffer, sizeof buffer, packet_len, payload_len, false) && packet_len > 1) {
+        bool got = read_packet_from_socket(buffer, sizeof buffer, packet_len, payload_len, false);
+        if (!got && buffer[0] == 0 && peer_closed()) client.stop(); // reconnects on the next update
+        if (got && packet_len > 1) {
           if ((buffer[0] & PUBLISH) == PUBLISH) handle_publish(buffer, packet_len, payload_len);
           else if (buffer[0] == PUBACK) handle_puback(buffer, packet_len, payload_len);
           else if (buffer[0] == SUBACK) handle_suback(buffer, packet_len, payload_len, false);
@@ -451,13 +735,48 @@ public:
   }
 
   void stop() {
-    send_disconnect();
+    send_final_disconnect();
     client.stop();
     enabled = false;
     connect_retries = 0;
     cleanup_system();
   }
 
+  // Gives up the connected socket without a DISCONNECT or a shutdown, so another process can carry on
+  // the session. Returns the socket, or -1 when it is not connected, its descriptor is unknown or a
+  // packet is still partly unsent; the connection then carries on as it was.
+  int release_socket() {
+    if (!send_unsent()) return -1; // the successor would start in the middle of a packet
+    // only a socket from the connector or adopt_socket is known, the built-in connect keeps its own
+    if (!client.connected() || !own_socket()) return -1;
+    int fd = socket_fd;
+    client = TCPHelperClient();
+    socket_fd = -1;
+    enabled = false;
+    return fd;
+  }
+
+  // Carries on a session another process connected, its subscriptions are still held by the broker.
+  // The level and alias maximum are those the session was negotiated with; the aliases themselves are
+  // set up again, each topic is sent in full once more.
+  bool adopt_socket(int fd, uint16_t next_msg_id, uint8_t level = 4, uint16_t alias_max = 0) {
+    if (fd < 0) return false;
+    init_system();
+    client = TCPHelperClient(fd);
+    socket_fd = fd;
+    drop_unsent(false);
+    protocol = level == LEVEL_5 ? LEVEL_5 : LEVEL_311;
+    if (protocol == LEVEL_311) protocol_level = LEVEL_311; // a later reconnect doesn't try level 5 again
+    server_alias_max = protocol == LEVEL_5 ? alias_max : 0;
+    reset_aliases();
+    msg_id = next_msg_id ? next_msg_id : 1;
+    waiting_for_ping = false;
+    last_packet_in = last_packet_out = millis();
+    connect_retries = 1; // a later reconnect is not the first connect, the client resubscribes
+    enabled = true;
+    return true;
+  }
+
   bool connect() {
     if (!client.connected() && enabled){
       return socket_connect();
@@ -470,6 +789,42 @@ public:
     }
     return client.connected();
   }
+  // True when a packet of len bytes should be written now: the tail of an earlier one is out and the
+  // send buffer has room for it. Without the socket at hand it can only tell whether there is a connection.
+  bool can_write(size_t len) {
+    if (!client.connected()) return false;
+#if !defined(ARDUINO) && !defined(_WIN32)
+    if (!own_socket()) return true;
+    if (!send_unsent()) return false;
+    pollfd pfd = { socket_fd, POLLOUT, 0 };
+    if (::poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT)) return false;
+    int sndbuf = 0, queued = 0;
+    socklen_t size = sizeof sndbuf;
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &size) != 0 || ioctl(socket_fd, TIOCOUTQ, &queued) != 0) return true;
+    // half of SO_SNDBUF is payload, the rest is kernel bookkeeping; a packet larger than that goes once the
+    // buffer is empty, and the part that does not fit is kept and sent by later calls, never waited on
+    return queued == 0 || (size_t)queued + len <= (size_t)sndbuf / 2;
+#else
+    return true;
+#endif
+  }
+
+  // Waits up to timeout_ms for a partly sent packet to go out, ahead of a shutdown or a handoff
+  bool flush(uint32_t timeout_ms) {
+#if !defined(ARDUINO) && !defined(_WIN32)
+    uint32_t start = millis();
+    while (client.connected() && !send_unsent()) {
+      uint32_t waited = (uint32_t)(millis() - start);
+      if (waited >= timeout_ms) return false;
+      pollfd pfd = { socket_fd, POLLOUT, 0 };
+      ::poll(&pfd, 1, (int)(timeout_ms - waited));
+    }
+    return client.connected();
+#else
+    (void)timeout_ms;
+    return client.connected();
+#endif
+  }
 
   // The subscribe call and the publish calls With QoS 1 will return true or false depending on whether
   // the message was written, not whether an ACK was received. This can be checked here, and it may be set
@@ -477,6 +832,11 @@ public:
   bool was_last_sub_acked() const { return last_sub_acked; }
   bool was_last_pub_acked() const { return last_pub_acked; }
   uint16_t last_pub_msgid() const { return msg_id; }
+  uint8_t negotiated_level() const { return protocol; }
+  const char *version() const { return protocol == LEVEL_5 ? "5.0" : "3.1.1"; }
+  uint16_t topic_alias_max() const { return server_alias_max; }
+  // True when the broker kept the session of the previous connection, its subscriptions included
+  bool was_session_resumed() const { return session_resumed; }
   uint16_t last_puback_msgid() const { return pubacked_msg_id; }
   bool wait_for_puback(uint16_t timeout_ms = 100) {
     uint32_t start = millis();
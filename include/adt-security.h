@@ -5,8 +5,17 @@
 #include "jsonloader.h"
 #include "ReconnectingMqttClient.h"
 #include "zone.h"
+#include "alarm_panel.h"
 #include "gpio.h"
+#include "remote_gpio.h"
+#include "pjon_expander.h"
+#include "pjon_federation.h"
 #include "sha1_local.h"
+#include "logger.h"
+#include "realtime.h"
+#include "handoff.h"
+#include "broker_endpoints.h"
+#include "outbound_queue.h"
 
 #include <string>
 #include <map>
@@ -15,25 +24,46 @@
 #include <fstream>
 #include <functional>
 #include <sstream>
+#include <string_view>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // publish device discovery to: "homeassistant/device/adtcs/config"
 // subscribe to birth/will message: "homeassistant/status"
 
-using MQTTCallback = std::function<void(const std::string&, const std::string&)>;
+using MQTTCallback = std::function<void(std::string_view, std::string_view)>; // topic and payload, valid for the call only
 
 class SecuritySystem {
     std::map<std::string, std::string> cpuinfo;
     JsonLoader config;
 
     ReconnectingMqttClient* mqtt;
+    BrokerEndpoints brokers; // opens the connection for mqtt, failing over between brokers
     ZoneManager* zone_manager;
+    RemoteGPIOManager* remote_gpio;
+    PJONExpanderBus* expander_bus; // nullptr unless pjon_port is configured
+    PJONFederation* federation; // nullptr unless federation_id is configured
+    bool local_gpio; // false when only remote hosts are usable
 
     std::atomic_bool system_online;
+    std::atomic_bool upgrade_requested; // set by SIGUSR2, handled between passes of the run loop
+    bool takeover_session; // the broker still holds the subscriptions of the adopted session
     std::string system_name;
     std::string system_uptime_name;
     std::string system_version_json;
     size_t auto_refresh_timer;
+    size_t metrics_interval; // seconds between <name>/metrics reports, 0 for none
+
+    RealtimeProfile realtime;
+    SchedLatency sched_latency; // lateness of each zone pass
+    std::thread zone_thread; // runs the zone passes in realtime mode
+    std::atomic_bool zone_thread_stop; // ends the zone thread without ending the service
+    std::mutex zone_lock; // held around every zone manager access in realtime mode
+
+    OutboundQueue outbound; // every publish, sent by the I/O thread as the socket allows
+    static constexpr uint32_t FLUSH_TIMEOUT_MS = 2000; // a flush waits this long for the broker to take a partly sent packet
 
     const std::string serial_number;
 
@@ -46,35 +76,70 @@ class SecuritySystem {
     std::string mqtt_topic_entity_update;
     std::string mqtt_topic_system_status;
     std::string mqtt_topic_system_command;
+    std::string mqtt_topic_event;
+    std::string mqtt_topic_alarm_state;
+    std::string mqtt_topic_alarm_command;
+    std::string mqtt_topic_alarm_attributes;
+    std::string mqtt_topic_alarm_bypass;
+    std::string mqtt_topic_metrics;
+    std::string mqtt_topic_button_press;
+    std::string mqtt_topic_group_command;
     std::string mqtt_will_payload;
     std::string mqtt_birth_payload;
     // -------------------------------------
+
+    std::string device_discovery_payload; // formatted on the first discovery, the zones and the panel are fixed after load
     
-    std::map<std::string, std::vector<MQTTCallback>> sub_hooks;
+    std::map<std::string, std::vector<MQTTCallback>, std::less<>> sub_hooks;
 
     static void static_mqtt_rx_callback(const char *topic, const uint8_t *payload, uint16_t len, void *_this);
     static void static_mqtt_on_connect_callback(uint64_t retries, void *_this);
-    void mqtt_rx_callback(const std::string& topic, const std::string& message);
+    static void static_mqtt_reason_callback(uint8_t packet_type, uint16_t msg_id, uint8_t reason, void *_this);
+    void mqtt_rx_callback(std::string_view topic, std::string_view message);
     void mqtt_on_connect_callback(uint64_t retries);
 
     std::string calculate_serial();
-    void connect(); // connect to MQTT broker
+    void connect(const HandoffState* takeover); // connect to MQTT broker, or carry on the session of the previous process
     void autodiscover(); // send mqtt auto-discover message for home-assistant
-    void handle_device_commands(const std::string& topic, const std::string& json_payload); // handle all commands for device control
-    void handle_device_updates(const std::string& zone_name, int level); // handle all zone updates and publish MQTT updates
+    void format_discovery(); // the device discovery payload, from the cached zone components
+    void handle_device_commands(std::string_view unique_id, std::string_view payload); // handle all commands for device control
+    void handle_device_updates(const std::string& zone_name, const char* topic, int level, bool alarm); // handle all zone updates and publish MQTT updates, alarm zones ahead of the rest
+    void handle_rule_event(const std::string& payload); // publish an event raised by a rule
+    void handle_zone_event(const std::string& payload); // publish an event raised by a zone, such as lost supervision
+    void handle_device_attributes(const char* topic, std::string_view attributes); // publish the attributes of a zone
+    void handle_button_press(const std::string& zone_name, const char* topic, std::string_view payload, bool alarm); // publish a classified press of a button zone
+    void handle_state_snapshot(std::string_view payload); // publish the retained snapshot of every zone
+    void handle_alarm_state(const std::string& state, const std::string& attributes); // publish the alarm panel state
+    void publish_metrics(); // publish the scheduling latency since the last report
 
-    bool mqtt_pub(const std::string& topic, const std::string& payload, bool retain = false, uint8_t qos=1);
+    void zone_loop(); // the realtime zone thread
+    bool hand_over(); // passes the session, the hardware and the zone state to the installed binary
+    void drain_outbound(bool flush = false); // send queued publishes while the socket has room, or all of them
+    std::unique_lock<std::mutex> lock_zones(); // owns zone_lock in realtime mode only
+
+    // queued, false when the queue dropped it; replaceable is false for events, a later one must not supersede them
+    bool mqtt_pub(const char* topic, std::string_view payload, bool retain = false, uint8_t qos=1,
+                  OutboundQueue::Priority priority = OutboundQueue::STATE, bool replaceable = true);
+    bool mqtt_pub(const std::string& topic, std::string_view payload, bool retain = false, uint8_t qos=1,
+                  OutboundQueue::Priority priority = OutboundQueue::STATE, bool replaceable = true) {
+        return mqtt_pub(topic.c_str(), payload, retain, qos, priority, replaceable);
+    }
     bool mqtt_sub(const std::string& topic, MQTTCallback cb, uint8_t qos=1);
 
 public:
     
-    // Security system connects to MQTT and loads/initializes all zones from config
-    SecuritySystem(const std::string& config_string);
+    // Security system connects to MQTT and loads/initializes all zones from config,
+    // or takes over the broker session and zone state handed over by the previous process
+    SecuritySystem(const std::string& config_string, const HandoffState* takeover = nullptr);
     
     virtual ~SecuritySystem();
 
+    // the successor's side of an upgrade, started with --takeover <fd>; nullptr when the handoff failed
+    static SecuritySystem* take_over(const std::string& config_string, int channel_fd);
+
     bool online() const { return system_online; }
     void shutdown_system();
+    void request_upgrade() { upgrade_requested = true; } // safe from a signal handler
     void run();
 
     friend class ZoneManager;
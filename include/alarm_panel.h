@@ -0,0 +1,110 @@
+#pragma once
+#include "forward_declarations.h"
+#include "jsonloader.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/*
+    Alarm panel
+
+    An alarm_control_panel entity whose arming logic runs on the controller, so an
+    intrusion sounds the siren without a round trip through the broker and Home
+    Assistant. Zones join the panel through their "alarm" key:
+
+        perimeter   armed in both armed_home and armed_away
+        interior    armed in armed_away only
+        24h         triggers in every state, including disarmed
+
+    and may carry an "entry_delay" (time in pending before triggering) and an
+    "exit_delay" (time after arming before the zone is watched), in milliseconds.
+
+    Group membership, bypass, open and watched zones are kept as bitmasks over
+    every zone, so arming, bypass and exit delay bookkeeping are word operations.
+*/
+
+class AlarmPanel {
+public:
+    using ZoneList = std::vector<std::unique_ptr<Zone>>;
+    using StateHandler = std::function<void(const std::string& state, const std::string& attributes)>;
+
+    enum State : uint8_t {
+        DISARMED, ARMING, ARMED_HOME, ARMED_AWAY, PENDING, TRIGGERED
+    };
+    enum Group : uint8_t {
+        GROUP_NONE, GROUP_PERIMETER, GROUP_INTERIOR, GROUP_24H
+    };
+
+    // the panel settings of one zone, in zone list order
+    struct ZoneConfig {
+        Group group = GROUP_NONE;
+        bool invert = false; // level 0 is the active level
+        uint32_t entry_delay_ms = 0;
+        uint32_t exit_delay_ms = 0;
+    };
+
+    static bool parse_group(const std::string& name, Group& group);
+    static const char* state_name(State state);
+
+private:
+    using Mask = std::vector<uint64_t>; // one bit per zone
+
+    const ZoneList& zones;
+    StateHandler on_change;
+
+    std::string name, unique_id, code;
+    int siren; // zone index driven while triggered, -1 for none
+    uint32_t trigger_time_ms; // 0 stays triggered until disarmed
+
+    Mask perimeter, interior, always, delayed, inverted;
+    Mask bypass; // ignored until the next disarm
+    Mask active; // zones currently at their active level
+    Mask armed; // zones watched by the current arming mode
+    Mask live; // armed zones past their exit delay, cleared for zones left open after a trigger
+    std::vector<uint32_t> entry_delay_ms, exit_delay_ms;
+    std::vector<uint64_t> exit_due_ms; // 0 once the exit delay has run out
+
+    State state;
+    State armed_state; // where the panel returns once a trigger times out
+    uint64_t pending_due_ms, triggered_due_ms;
+    int triggered_by; // zone index, -1 for none
+    bool exit_pending; // some armed zone is still inside its exit delay
+    bool publish_pending;
+
+    static bool test(const Mask& mask, size_t zone) { return (mask[zone >> 6] >> (zone & 63)) & 1; }
+    static void assign(Mask& mask, size_t zone, bool value);
+    std::string zone_list(const Mask& mask) const;
+    void load_list(Mask& mask, const std::string& list) const;
+    int find_zone(const std::string& unique_id) const;
+
+    void set_state(State next);
+    void trip(size_t zone, uint64_t now);
+    void trigger(size_t zone, uint64_t now);
+    void arm(State target, uint64_t now);
+    void disarm();
+
+public:
+    // zone event path: a zone reported a new debounced state
+    void on_state(size_t zone, int level);
+    void update(); // runs the delays and publishes state changes
+
+    // commands from <name>/alarm/set: DISARM, ARM_HOME, ARM_AWAY, or {"action":...,"code":...}
+    void command(const std::string& payload);
+    void set_bypass(const std::string& zone_unique_id, bool enabled);
+    void refresh() { publish_pending = true; }
+
+    // upgrade handoff: the arming state carries over as it is, the siren is left as it stands
+    void save_state(HandoffState& state) const;
+    void restore_state(const HandoffState& state);
+
+    State get_state() const { return state; }
+    const std::string& get_name() const { return name; }
+    const std::string& get_unique_id() const { return unique_id; }
+    bool requires_code() const { return !code.empty(); }
+
+    AlarmPanel(JsonLoader& config, const std::string& name, const ZoneList& zones, const std::vector<ZoneConfig>& settings, StateHandler on_change);
+    virtual ~AlarmPanel() = default;
+};
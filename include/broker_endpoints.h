@@ -0,0 +1,97 @@
+#pragma once
+#include "jsonloader.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <cstdint>
+#include <sys/socket.h>
+
+/*
+    Broker endpoints
+
+    The MQTT connection goes to one of the brokers in "mqtt_brokers" (or to
+    "mqtt_ip"/"mqtt_port" alone). Each is a host name, an IPv4 or an IPv6
+    address. Names are resolved on a background thread, and the addresses are
+    cached for RESOLVE_TTL_MS. A reconnect never waits on DNS: an endpoint whose
+    name isn't resolved yet is skipped for that round, and a stale address list
+    is used while it is refreshed.
+
+    A connect tries the endpoints in turn, starting after the one last used, so
+    a broker that goes away fails over to the next. An endpoint that refuses,
+    times out or drops its connection within STABLE_MS waits a backoff before it
+    is tried again. The backoff doubles from BACKOFF_MIN_MS to BACKOFF_MAX_MS and
+    is drawn between half and all of that. Sockets get TCP keepalives and
+    TCP_USER_TIMEOUT, so the kernel drops a connection to a dead host within
+    the user timeout, data in flight or not. "mqtt_send_buffer" caps the kernel
+    send buffer, keeping a backlog in the outbound queue where it is sent by
+    priority rather than in the kernel in the order it was written.
+*/
+
+class BrokerEndpoints {
+public:
+    static constexpr int CONNECT_TIMEOUT_MS = 1000; // per address
+    static constexpr uint64_t RESOLVE_TTL_MS = 300000;
+    static constexpr uint64_t RESOLVE_RETRY_MS = 5000; // after a failed lookup
+    static constexpr uint64_t STABLE_MS = 10000; // a shorter connection counts as a failure
+    static constexpr uint64_t BACKOFF_MIN_MS = 250;
+    static constexpr uint64_t BACKOFF_MAX_MS = 30000;
+
+private:
+    struct Address {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+    struct Endpoint {
+        std::string host;
+        uint16_t port;
+        bool numeric = false; // an address literal, resolved once at load
+        // guarded by Resolver::lock
+        std::vector<Address> addresses;
+        uint64_t resolved_until_ms = 0;
+        bool resolving = false;
+        // owned by the connecting thread
+        uint32_t failures = 0;
+        uint64_t retry_at_ms = 0;
+    };
+    // outlives this object on a detached thread, a lookup in progress can't be cancelled
+    struct Resolver {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::deque<size_t> queue;
+        std::vector<Endpoint> endpoints;
+        bool stop = false;
+    };
+
+    std::shared_ptr<Resolver> resolver;
+    bool resolver_started;
+    size_t next; // where the next round starts
+    size_t current; // endpoint of the open connection, npos when none
+    uint64_t connected_at_ms;
+    int user_timeout_ms;
+    int send_buffer; // SO_SNDBUF in bytes, 0 leaves it to the kernel
+    std::minstd_rand jitter;
+
+    static void resolve_loop(std::shared_ptr<Resolver> resolver);
+    static bool lookup(const std::string& host, uint16_t port, bool numeric, std::vector<Address>& out);
+    void request_resolve(size_t index); // caller holds the resolver lock
+    void failed(Endpoint& endpoint, uint64_t now);
+    int open_socket(const Address& address) const;
+
+public:
+    BrokerEndpoints();
+    ~BrokerEndpoints();
+
+    bool load(JsonLoader& config); // false when no endpoint is configured
+    size_t count() const { return resolver->endpoints.size(); }
+    std::string describe() const; // "host:port, ..." for the log
+
+    // A connected socket to the first endpoint that answers, or -1. Blocks at most
+    // CONNECT_TIMEOUT_MS per address tried, never on name resolution.
+    int connect();
+    static int connect(void* self) { return static_cast<BrokerEndpoints*>(self)->connect(); }
+};
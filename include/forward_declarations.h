@@ -3,4 +3,12 @@
 class SecuritySystem;
 class ZoneManager;
 class Zone;
-class GPIO;
\ No newline at end of file
+class ZoneStateTable;
+class GPIO;
+class RemoteGPIOHost;
+class RemoteGPIOManager;
+class PJONExpanderBus;
+class PJONFederation;
+class RuleEngine;
+class AlarmPanel;
+struct HandoffState;
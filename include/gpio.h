@@ -7,6 +7,35 @@
 #include <chrono>
 #include <array>
 #include <functional>
+#include <cstdint>
+
+// A non-allocating function reference: an object pointer and a thunk that knows its type.
+// Nothing is owned or copied, the object must outlive every call through the delegate.
+template<typename... Args>
+class Delegate {
+public:
+    using Thunk = void (*)(Args..., void* object); // the object goes last, as pigpio passes its userdata
+
+private:
+    Thunk thunk;
+    void* object;
+
+    Delegate(Thunk thunk, void* object): thunk(thunk), object(object) {}
+
+public:
+    // Handler is a static function or member function called with the object and Args
+    template<auto Handler, typename T>
+    static Delegate bind(T* object) {
+        return Delegate([](Args... args, void* o){ std::invoke(Handler, static_cast<T*>(o), args...); }, object);
+    }
+
+    void operator()(Args... args) const { thunk(args..., object); }
+    explicit operator bool() const { return thunk != nullptr; }
+    Thunk function() const { return thunk; }
+    void* target() const { return object; }
+
+    Delegate(): thunk(nullptr), object(nullptr) {}
+};
 
 
 class GPIO : public std::ostream {
@@ -15,24 +44,33 @@ class GPIO : public std::ostream {
             PIN_OUTPUT, PIN_INPUT, PIN_INPUT_PULLUP, PIN_INPUT_PULLDOWN
         };
 
-        using Callback = std::function<void(int)>;
+        // gpio, level (or PI_TIMEOUT from a watchdog) and tick of an edge; the thunk is registered with pigpio as it is,
+        // with the bound object as the alert userdata, so an edge is one indirect call
+        using Callback = Delegate<int, int, uint32_t>;
 
         static const std::array<const char*,4> StringType;
 
+        // set ahead of an upgrade handoff, released pins keep their mode, pull and level for the successor
+        static bool keep_state;
+
     private:
         int8_t pin;
         PinType type;
-        Callback gpio_callback;
+        RemoteGPIOHost* host; // nullptr for pins on this Pi
+        bool filtered; // a glitch filter is set, cleared with the pin
 
-        static void gpioStaticAlert(int gpio, int level, uint32_t tick, void* _this);
-        void gpioAlert(int gpio, int level, uint32_t tick);
+        int setMode(unsigned mode);
+        int setPullUpDown(unsigned pud);
 
     public:
         void updateMode();
         int read();
         bool write(int output);
+        int setWatchdog(unsigned timeout_ms); // 0 disarms it; a pin silent for timeout_ms alerts PI_TIMEOUT
+        int setGlitchFilter(unsigned steady_us); // edges are reported once the level holds for steady_us, with the tick they began at
+        bool remote() const { return host != nullptr; } // its commands wait on a reply from the host's pigpiod
 
-        GPIO(int,PinType, Callback);
+        GPIO(int,PinType, Callback, RemoteGPIOHost* host=nullptr);
         virtual ~GPIO();
     
         inline friend std::ostream& operator<<(std::ostream& stream, const GPIO& obj) {
@@ -0,0 +1,110 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/*
+    Upgrade handoff
+
+    An upgrade replaces the running service without dropping the broker session
+    or touching the outputs. The running process (on SIGUSR2, or a systemd
+    reload) starts the installed binary with --takeover <fd>, one end of a Unix
+    socketpair, and the two walk through:
+
+        successor -> READY      config loaded, nothing opened yet
+        service   -> STATE      zone, alarm and rule state, with the connected
+                                broker socket attached as SCM_RIGHTS
+        service   -> RELEASED   pigpio, the expander bus and remote hosts are
+                                closed, with every pin left as it was
+        successor -> RUNNING    the successor owns the hardware and the session
+
+    Until STATE is sent the service keeps running and a failed successor is
+    simply dropped. Times in the state are steady clock ms, which both processes
+    share.
+*/
+
+struct HandoffState {
+    struct ZoneLevel {
+        std::string id;
+        int16_t level; // the debounced level the service last saw
+        int16_t published; // -1 before the first publish
+    };
+    struct RuleTimer {
+        uint64_t due_ms;
+        uint16_t action;
+        std::string zone; // the action's target, checked against the successor's rules
+        bool revert;
+    };
+    struct Pulse {
+        std::string zone; // the output, checked against the successor's
+        unsigned pin;
+        uint8_t off; // the level written once it is due
+        uint64_t due_ms;
+    };
+    struct ExitDelay {
+        std::string zone;
+        uint64_t due_ms;
+    };
+    struct Alarm {
+        uint8_t state = 0, armed_state = 0;
+        std::string triggered_by;
+        uint64_t pending_due_ms = 0, triggered_due_ms = 0;
+        bool exit_pending = false;
+        std::string active, bypass, armed, live; // comma separated zone ids
+        std::vector<ExitDelay> exit_due;
+    };
+
+    int mqtt_fd = -1; // passed beside the text, as SCM_RIGHTS
+    uint16_t mqtt_msg_id = 1;
+    uint8_t mqtt_level = 4; // the protocol level the session was connected with
+    uint16_t mqtt_alias_max = 0; // the broker's Topic Alias Maximum for it
+    uint64_t sequence = 0;
+    std::vector<ZoneLevel> zones;
+    std::vector<RuleTimer> timers;
+    std::vector<Pulse> pulses; // output pulses on this Pi, which end with pigpio
+    bool has_alarm = false;
+    Alarm alarm;
+
+    std::string format() const;
+    bool parse(const std::string& text);
+};
+
+static constexpr uint32_t HANDOFF_TIMEOUT_MS = 10000; // for each step, the broker keepalive is 60s
+
+// The running service's side of an upgrade
+class HandoffSender {
+    int channel;
+    pid_t successor;
+
+public:
+    // starts executable --takeover and waits for READY
+    bool spawn(const std::string& executable, uint32_t timeout_ms);
+    bool send_state(const std::string& state, int mqtt_fd);
+    bool send_released();
+    bool wait_running(uint32_t timeout_ms);
+    void abandon(); // the successor exits once the channel closes
+
+    HandoffSender();
+    ~HandoffSender();
+};
+
+// The successor's side, started with --takeover <fd>
+class HandoffReceiver {
+    int channel;
+
+public:
+    bool send_ready();
+    bool receive_state(std::string& state, int& mqtt_fd, uint32_t timeout_ms);
+    bool wait_released(uint32_t timeout_ms);
+    bool send_running();
+
+    explicit HandoffReceiver(int fd);
+    ~HandoffReceiver();
+};
+
+// the path of the running binary, remembered at startup before an install replaces it
+const std::string& service_executable();
+
+// sd_notify without libsystemd, a no-op outside a Type=notify unit
+void notify_service_manager(const std::string& state);
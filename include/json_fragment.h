@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+#include <charconv>
+
+/*
+    JSON fragments
+
+    Payloads that are formatted once and then reused, such as the discovery
+    components, are written straight into a string instead of going through a
+    JsonLoader DOM. Only what those payloads need is here: quoted strings and
+    members appended to an object that is still open.
+*/
+
+// Appends text as a quoted JSON string
+inline void append_json_string(std::string& out, std::string_view text) {
+    out += '"';
+    for(char c : text){
+        switch(c){
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20){
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// Appends "key": to an open object, after a comma unless it is the first member
+inline void append_json_key(std::string& out, std::string_view key) {
+    if(!out.empty() && out.back() != '{') out += ',';
+    append_json_string(out, key);
+    out += ':';
+}
+
+inline void append_json_field(std::string& out, std::string_view key, std::string_view value) {
+    append_json_key(out, key);
+    append_json_string(out, value);
+}
+
+// a separate name, a string literal would otherwise convert to bool ahead of string_view
+inline void append_json_bool(std::string& out, std::string_view key, bool value) {
+    append_json_key(out, key);
+    out += value ? "true" : "false";
+}
+
+inline void append_json_number(std::string& out, std::string_view key, int64_t value) {
+    append_json_key(out, key);
+    char number[24];
+    out.append(number, std::to_chars(number, number + sizeof(number), value).ptr);
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+/*
+    Asynchronous logger
+
+    Callers never touch stdout: a log call copies its format pointer and arguments
+    into a fixed-size record of a bounded lock-free ring and returns. A background
+    thread formats the records ("{}" placeholders) and writes them out in batches.
+    When the ring is full the record is dropped and counted instead of blocking.
+*/
+
+class Logger {
+public:
+    enum Level : uint8_t {
+        LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR
+    };
+    static constexpr size_t MAX_ARGS = 6;
+    static constexpr size_t TEXT_SIZE = 224; // shared storage for string arguments
+    static constexpr size_t RING_SIZE = 1024; // must be a power of two
+
+private:
+    struct Arg {
+        enum Type : uint8_t { INT, UINT, DOUBLE, STRING };
+        Type type;
+        uint16_t offset, length; // string arguments are copied into Record::text
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+        };
+    };
+    struct Record {
+        std::atomic<size_t> sequence;
+        Level level;
+        uint8_t argc;
+        uint16_t text_used;
+        const char* format;
+        Arg args[MAX_ARGS];
+        char text[TEXT_SIZE];
+    };
+
+    Record ring[RING_SIZE];
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+    std::atomic<size_t> written_pos; // records before this position have reached stdout
+    alignas(64) std::atomic<uint32_t> wake; // bumped by producers, waited on by the writer thread
+    std::atomic<uint64_t> dropped_records;
+    std::atomic<uint8_t> min_level;
+    std::atomic_bool running;
+    std::thread writer;
+
+    Logger();
+    ~Logger();
+
+    static Logger& instance();
+    Record* claim();
+    void publish(Record* record);
+    void writer_thread();
+    size_t drain(std::string& out);
+    static void format(const Record& record, std::string& out);
+
+    static void capture(Record& r, bool v) { capture_int(r, v); }
+    static void capture(Record& r, char v) { capture_string(r, std::string_view(&v, 1)); }
+    template<typename T>
+    static std::enable_if_t<std::is_integral_v<T>> capture(Record& r, T v) { capture_int(r, v); }
+    template<typename T>
+    static std::enable_if_t<std::is_floating_point_v<T>> capture(Record& r, T v) {
+        Arg& a = r.args[r.argc++]; a.type = Arg::DOUBLE; a.d = double(v);
+    }
+    template<typename T>
+    static std::enable_if_t<std::is_enum_v<T>> capture(Record& r, T v) { capture_int(r, std::underlying_type_t<T>(v)); }
+    static void capture(Record& r, const char* v) { capture_string(r, v ? std::string_view(v) : std::string_view("(null)")); }
+    static void capture(Record& r, const std::string& v) { capture_string(r, v); }
+    static void capture(Record& r, std::string_view v) { capture_string(r, v); }
+
+    template<typename T>
+    static void capture_int(Record& r, T v) {
+        Arg& a = r.args[r.argc++];
+        if constexpr (std::is_signed_v<T>) { a.type = Arg::INT; a.i = int64_t(v); }
+        else { a.type = Arg::UINT; a.u = uint64_t(v); }
+    }
+    static void capture_string(Record& r, std::string_view v);
+
+    template<typename... Args>
+    void log(Level level, const char* fmt, const Args&... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        if(level < min_level.load(std::memory_order_relaxed)) return;
+        Record* r = claim();
+        if(!r) return;
+        r->level = level;
+        r->format = fmt;
+        r->argc = 0;
+        r->text_used = 0;
+        (capture(*r, args), ...);
+        publish(r);
+    }
+
+public:
+    Logger(const Logger&) = delete;
+
+    // Format strings must outlive the call; string literals are expected
+    template<typename... Args> static void debug(const char* fmt, const Args&... args) { instance().log(LOG_DEBUG, fmt, args...); }
+    template<typename... Args> static void info(const char* fmt, const Args&... args) { instance().log(LOG_INFO, fmt, args...); }
+    template<typename... Args> static void warn(const char* fmt, const Args&... args) { instance().log(LOG_WARN, fmt, args...); }
+    template<typename... Args> static void error(const char* fmt, const Args&... args) { instance().log(LOG_ERROR, fmt, args...); }
+
+    static void set_level(Level level) { instance().min_level = level; }
+    static bool parse_level(const std::string& name, Level& level);
+    static uint64_t dropped() { return instance().dropped_records.load(); }
+    static void flush(); // block until every queued record has been written
+};
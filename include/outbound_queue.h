@@ -0,0 +1,113 @@
+#pragma once
+#include "jsonloader.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+/*
+    Outbound queue
+
+    Every publish is queued in one of three priority classes and sent from the
+    I/O thread only while the socket has room for it, so a slow broker never
+    blocks the service loop on the socket send timeout:
+
+        alarm       the alarm panel, live states of its zones, zone events
+        state       every other zone state, snapshots and rule events
+        diagnostic  attributes, metrics, discovery, version and status
+
+    The highest class with a message goes first, and a class waits for room
+    rather than letting a lower one pass it. Each class holds at most
+    "outbound_<class>_limit" messages; once full, "outbound_<class>_policy"
+    decides:
+
+        coalesce     a message replaces the queued one on its topic, where there
+                     is none the oldest is dropped (events are never replaced)
+        drop_oldest  the oldest queued message is dropped
+        drop_newest  the new message is dropped
+
+    Records are allocated once at load and reused, their strings keep their
+    capacity, so queueing a publish does not allocate once warmed up.
+*/
+
+class OutboundQueue {
+public:
+    enum Priority : uint8_t {
+        ALARM, STATE, DIAGNOSTIC, PRIORITIES
+    };
+    enum Policy : uint8_t {
+        COALESCE, DROP_OLDEST, DROP_NEWEST
+    };
+
+    struct Message {
+        std::string topic, payload;
+        bool retain = false;
+        uint8_t qos = 0;
+        bool replaceable = true; // a later message on the topic supersedes it
+    };
+
+    // topic and payload of one publish, the client's packet length and buffer are 16 bit and it needs a few bytes of header
+    static constexpr size_t MAX_MESSAGE_BYTES = 65535 - 16;
+
+    static const char* priority_name(Priority priority);
+    static bool parse_policy(const std::string& name, Policy& policy);
+
+private:
+    struct Class {
+        std::vector<Message> ring; // limit long
+        size_t head = 0, count = 0;
+        Policy policy = COALESCE;
+        uint64_t dropped = 0; // since the last take_dropped()
+    };
+
+    std::mutex lock;
+    std::condition_variable ready;
+    Class classes[PRIORITIES];
+    bool added; // a push since the last pop
+    bool woken;
+    Message in_flight; // the last message popped, read by the I/O thread outside the lock
+
+    static void reserve(Message& record);
+
+    Message& at(Class& c, size_t n) { return c.ring[(c.head + n) % c.ring.size()]; }
+    void drop(Priority priority); // caller holds the lock
+
+public:
+    void load(JsonLoader& config);
+
+    // false when the message was dropped, or is too large to send at all
+    bool push(Priority priority, std::string_view topic, std::string_view payload, bool retain, uint8_t qos, bool replaceable);
+
+    // The next message when fits(wire size) allows it, valid until the next pop; nullptr when the
+    // queue is empty or the next message has to wait. Called from one thread only.
+    template<typename Fits>
+    const Message* pop(Fits fits) {
+        std::lock_guard<std::mutex> guard(lock);
+        added = false;
+        for(Class& c : classes){
+            if(!c.count) continue;
+            Message& next = at(c, 0);
+            if(!fits(next.topic.size() + next.payload.size() + 16)) return nullptr; // nothing passes a waiting class
+            // copied, each record keeps the capacity it grew to for what lands in it
+            in_flight.topic.assign(next.topic);
+            in_flight.payload.assign(next.payload);
+            in_flight.retain = next.retain;
+            in_flight.qos = next.qos;
+            c.head = --c.count ? (c.head + 1) % c.ring.size() : 0; // an empty class starts over on its warm records
+            return &in_flight;
+        }
+        return nullptr;
+    }
+
+    // the I/O thread sleeps here between passes, a push or wake() ends the wait early
+    void wait(uint32_t timeout_ms);
+    void wake();
+
+    size_t size(); // messages queued in every class
+    void take_dropped(uint64_t (&dropped)[PRIORITIES]); // the drops per class since the previous call
+
+    OutboundQueue();
+};
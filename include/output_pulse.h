@@ -0,0 +1,100 @@
+#pragma once
+#include "forward_declarations.h"
+
+#include <pigpio.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+    Output pulses
+
+    "On for N ms" for door strikes and buzzers. The turn-off is timed by pigpio,
+    not by the zone pass, so it lands on time however late the loop runs and
+    whether or not the broker is reachable:
+
+        up to 100us  gpioTrigger
+        longer       a one-shot wave of two pulses on the DMA engine, while the
+                     host's engine is idle
+        otherwise    one of pigpio's ten timers, on a pin of this Pi only and
+                     for at least 10ms; it writes the off level when it first
+                     fires and is cancelled on the next pass
+
+    A pulse on another Pi whose wave engine is busy is refused, the off level
+    is never left to the zone pass. Waves are deleted once they have finished.
+
+    An upgrade hands running pulses over instead of ending them: a wave on
+    another Pi finishes in its pigpiod, and the due time of a wave or timer on
+    this Pi, which stop with pigpio, goes into the handoff for the successor.
+
+    Each pulse carries the zone it drives. The zone pass records the off level
+    in that zone's row once the pulse has ended and its "on" has been taken,
+    so both levels are published like any other change.
+*/
+
+class OutputPulses {
+public:
+    static constexpr uint32_t TRIGGER_MAX_US = 100;
+    static constexpr uint32_t MAX_PULSE_US = PI_MAX_MS * 1000u; // the longest timer period
+
+    enum Method : uint8_t {
+        REFUSED, TRIGGER, WAVE, TIMER
+    };
+    static const char* method_name(Method method);
+    static constexpr size_t NO_ZONE = SIZE_MAX; // a cancelled pulse, its end is not recorded
+
+private:
+    // a pulse that has ended, its off level waits until the zone's "on" has been taken
+    struct Ended {
+        RemoteGPIOHost* host;
+        unsigned pin, off;
+        size_t zone;
+    };
+    std::vector<Ended> ended;
+
+    struct Trigger {
+        RemoteGPIOHost* host;
+        unsigned pin, off;
+        size_t zone;
+        uint32_t over; // ZoneStateTable tick after which the pulse has ended
+    };
+    std::vector<Trigger> triggers;
+
+    struct Wave {
+        RemoteGPIOHost* host; // nullptr for this Pi
+        unsigned pin, off;
+        size_t zone;
+        int id;
+        uint64_t due_ms; // steady clock
+    };
+    std::vector<Wave> waves; // sent and not yet deleted
+
+    struct Timer {
+        std::atomic_bool armed { false }; // cleared by whichever of the timer and a cancel gets there first
+        unsigned pin = 0, off = 0, millis = 0;
+        size_t zone = NO_ZONE;
+        uint64_t due_ms = 0; // steady clock
+        bool active = false; // registered with pigpio, only the zone pass touches it
+    };
+    std::array<Timer, PI_MAX_TIMER + 1> timers;
+
+    static void timer_expired(void* userdata); // pigpio's timer thread
+    bool wave_idle(RemoteGPIOHost* host) const;
+    void stop(unsigned pin, RemoteGPIOHost* host, bool write_off);
+
+public:
+    // drives pin to level for pulse_us, then back to !level; zone is the row its levels are recorded in
+    Method start(unsigned pin, RemoteGPIOHost* host, unsigned level, uint32_t pulse_us, size_t zone);
+    void cancel(unsigned pin, RemoteGPIOHost* host) { stop(pin, host, false); } // a later write owns the pin
+    void update(ZoneStateTable& table); // records ended pulses, deletes finished waves and cancels spent timers
+
+    // upgrade handoff: the pulses on this Pi's pins that pigpio stops with it
+    void save_state(HandoffState& state, const std::vector<std::unique_ptr<Zone>>& zones) const;
+
+    OutputPulses() = default;
+    OutputPulses(const OutputPulses&) = delete;
+    ~OutputPulses(); // a pulse still running is ended with its off level, or left running for a handoff
+};
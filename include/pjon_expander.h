@@ -0,0 +1,90 @@
+#pragma once
+#include "forward_declarations.h"
+#include "jsonloader.h"
+
+#include <string>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+/*
+    Zone expander nodes on a PJON ThroughSerial bus (RS-485)
+
+    Each expander node owns up to 32 inputs and reports them as a packed bitmap.
+    A node sends a DELTA frame only when inputs change; the bus master applies the
+    changed bits and feeds them into the zones attached to them. A sequence number
+    on every frame lets the master notice a lost delta, in which case it POLLs the
+    node for a full SNAPSHOT. Nodes are also polled at a slow resync interval and
+    until their first snapshot arrives.
+
+    Frames are little endian:
+        DELTA     'D' seq changed_mask(4) levels(4)    node -> master
+        POLL      'P'                                  master -> node
+        SNAPSHOT  'S' seq levels(4)                    node -> master
+*/
+
+class PJONExpanderBus {
+public:
+    using Callback = std::function<void(int)>;
+
+    enum Frame : uint8_t {
+        FRAME_DELTA = 'D',
+        FRAME_POLL = 'P',
+        FRAME_SNAPSHOT = 'S'
+    };
+    static constexpr size_t DELTA_SIZE = 10;
+    static constexpr size_t SNAPSHOT_SIZE = 6;
+    static constexpr uint8_t DEFAULT_MASTER_ID = 254;
+
+private:
+    struct Node {
+        uint32_t levels = 0;
+        uint8_t seq = 0;
+        bool synced = false; // a snapshot has been received
+        uint64_t next_poll_ms = 0;
+        uint64_t synced_at_ms = 0; // when the last snapshot arrived
+        uint32_t attached = 0;
+        std::array<Callback, 32> inputs;
+    };
+    struct Link; // the PJON<ThroughSerial> instance, kept out of this header
+
+    std::string device;
+    uint32_t baud;
+    uint8_t master_id;
+    uint32_t resync_ms;
+
+    std::unique_ptr<Link> link;
+    std::mutex lock; // guards nodes, held while callbacks run
+    std::map<uint8_t, Node> nodes;
+    int awaiting; // node whose snapshot is outstanding, -1 when none
+    uint64_t awaiting_since_ms, awaiting_until_ms;
+    std::thread worker;
+    std::atomic_bool running;
+    std::atomic<uint64_t> deltas, snapshots, gaps, polls;
+
+    static int open_serial(const std::string& device, uint32_t baud);
+    void receive(uint8_t sender, const uint8_t* payload, uint16_t length);
+    void apply(Node& node, uint32_t changed, uint32_t levels); // caller holds the lock
+    void run();
+
+public:
+    static constexpr uint32_t POLL_RETRY_MS = 1000;
+    static constexpr uint32_t REPLY_TIMEOUT_MS = 500;
+
+    bool attach(uint8_t node, uint8_t bit, Callback cb);
+    void detach(uint8_t node, uint8_t bit);
+    int level(uint8_t node, uint8_t bit); // -1 until the node has reported
+
+    uint64_t delta_count() const { return deltas; }
+    uint64_t snapshot_count() const { return snapshots; }
+    uint64_t gap_count() const { return gaps; }
+    uint64_t poll_count() const { return polls; }
+
+    PJONExpanderBus(JsonLoader& config); // reads pjon_port, pjon_baud, pjon_id and pjon_resync
+    virtual ~PJONExpanderBus();
+};
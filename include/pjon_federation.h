@@ -0,0 +1,110 @@
+#pragma once
+#include "forward_declarations.h"
+#include "jsonloader.h"
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+/*
+    Controller federation over PJON DualUDP
+
+    Controllers replicate their zone states to each other so site-wide logic can
+    run without the broker. Every controller exports the states of its own zones
+    and keeps a read-only view of the peer zones its "federated" zones mirror.
+    Zones are identified on the wire by a 16 bit hash of their unique id.
+
+    A DELTA frame is sent to every known peer when exported states change. Each
+    carries a sequence number, and a HEARTBEAT repeats the latest one, so a peer
+    that sees a gap or a mismatch asks for a paginated SNAPSHOT with a REQUEST.
+    Frames are not acknowledged; the sequence numbers do the recovery.
+
+    Frames are little endian, entries are hash(2) state(1):
+        HEARTBEAT 'H' seq(2)
+        DELTA     'D' seq(2) count(1) entries
+        REQUEST   'R'
+        SNAPSHOT  'S' seq(2) page(1) pages(1) entries
+*/
+
+class PJONFederation {
+public:
+    using Callback = std::function<void(int)>;
+
+    enum Frame : uint8_t {
+        FRAME_HEARTBEAT = 'H',
+        FRAME_DELTA = 'D',
+        FRAME_REQUEST = 'R',
+        FRAME_SNAPSHOT = 'S'
+    };
+    static constexpr size_t ENTRY_SIZE = 3;
+    static constexpr size_t MAX_PAYLOAD = 40; // PJON_PACKET_MAX_LENGTH less the header and CRC32
+    static constexpr size_t DELTA_ENTRIES = (MAX_PAYLOAD - 4) / ENTRY_SIZE;
+    static constexpr size_t SNAPSHOT_ENTRIES = (MAX_PAYLOAD - 5) / ENTRY_SIZE;
+    static constexpr uint16_t DEFAULT_PORT = 7500;
+    static constexpr uint32_t HEARTBEAT_MS = 2000;
+    static constexpr uint32_t PEER_TIMEOUT_MS = 3 * HEARTBEAT_MS;
+    static constexpr uint32_t REQUEST_RETRY_MS = 1000;
+
+    static uint16_t zone_hash(const std::string& unique_id);
+
+private:
+    struct Peer {
+        uint16_t seq = 0;
+        bool synced = false; // a complete snapshot has been received
+        bool alive = false;
+        uint8_t next_page = 0; // snapshot page expected next
+        uint64_t heard_ms = 0;
+        uint64_t request_ms = 0; // when a snapshot was last requested
+        std::map<uint16_t, int> levels;
+        std::map<uint16_t, Callback> mirrors; // zones of this controller following the peer's zones
+    };
+    struct Link; // the PJON<DualUDP> instance, kept out of this header
+
+    uint8_t federation_id;
+    uint16_t port;
+
+    std::unique_ptr<Link> link;
+    std::mutex lock; // guards everything below, held while callbacks run
+    std::map<uint8_t, Peer> peers;
+    std::map<uint16_t, int> exports; // hash -> last exported state, -1 until known
+    std::map<uint16_t, int> pending; // changed exports not yet sent
+    std::set<uint8_t> snapshot_for; // peers that asked for a snapshot
+    uint16_t seq;
+
+    std::thread worker;
+    std::atomic_bool running;
+    std::atomic<uint64_t> deltas_sent, deltas_received, snapshots_sent, gaps, bytes_sent;
+
+    void receive(uint8_t sender, const uint8_t* payload, uint16_t length);
+    void apply(Peer& peer, const uint8_t* entries, size_t count); // caller holds the lock
+    void send(uint8_t peer, const std::vector<uint8_t>& frame);
+    void run();
+
+public:
+    uint8_t id() const { return federation_id; }
+
+    // zones of this controller replicated to the peers
+    bool export_zone(const std::string& unique_id);
+    void export_state(const std::string& unique_id, int state);
+
+    // read-only views of peer zones
+    bool attach(uint8_t peer, const std::string& unique_id, Callback cb);
+    void detach(uint8_t peer, const std::string& unique_id);
+    int level(uint8_t peer, const std::string& unique_id); // -1 until the peer has been synced
+
+    uint64_t deltas_sent_count() const { return deltas_sent; }
+    uint64_t deltas_received_count() const { return deltas_received; }
+    uint64_t snapshots_sent_count() const { return snapshots_sent; }
+    uint64_t gap_count() const { return gaps; }
+    uint64_t bytes_sent_count() const { return bytes_sent; } // frame payloads, without PJON and UDP overhead
+
+    PJONFederation(JsonLoader& config); // reads federation_id, federation_port and federation_peers
+    virtual ~PJONFederation();
+};
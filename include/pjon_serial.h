@@ -0,0 +1,10 @@
+#pragma once
+// PJON ThroughSerial with this project's serial overrides
+// Every translation unit that uses ThroughSerial must include it through here so the
+// strategy is compiled with the same macros everywhere.
+
+// tcflush would also discard bytes another node already put on the wire, wait for the output instead
+extern "C" int tcdrain(int fd);
+#define PJON_SERIAL_FLUSH(S) tcdrain(S)
+
+#include <PJONThroughSerial.h>
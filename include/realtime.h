@@ -0,0 +1,70 @@
+#pragma once
+#include "jsonloader.h"
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <pthread.h>
+
+/*
+    Realtime profile
+
+    With "realtime" enabled the zone event consumer leaves the MQTT loop and runs
+    on its own SCHED_FIFO thread, woken on an absolute period and optionally pinned
+    to a core, while socket I/O stays on the service thread pinned to another core.
+    Memory is locked once the service is up so a page fault cannot stall a pass.
+
+    Every step is best effort: without the privilege for SCHED_FIFO or mlockall
+    the service logs a warning and keeps running with the default policy.
+*/
+
+struct RealtimeProfile {
+    bool enabled = false;
+    int priority = 50; // SCHED_FIFO priority of the zone thread, 1-99
+    int zone_cpu = -1; // -1 leaves the thread unpinned
+    int io_cpu = -1;
+    uint32_t period_ms = 10; // wake period of the zone thread
+    bool lock_memory = true;
+
+    void load(JsonLoader& config);
+
+    // these act on the calling thread
+    static bool pin_thread(int cpu, const char* role);
+    static bool set_fifo(int priority, const char* role);
+    static bool lock_all_memory();
+};
+
+// a mutex with priority inheritance, so a SCHED_FIFO thread waiting on it lends its priority to the holder
+class InheritMutex {
+    pthread_mutex_t mutex;
+
+public:
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+    InheritMutex();
+    InheritMutex(const InheritMutex&) = delete;
+    ~InheritMutex() { pthread_mutex_destroy(&mutex); }
+};
+
+// wake-up lateness of a periodic thread, collected between two metric reports
+class SchedLatency {
+    InheritMutex lock; // the zone thread adds, take() only swaps the buffers under it
+    static constexpr size_t MAX_SAMPLES = 16384; // older samples are overwritten past this
+
+    std::vector<uint32_t> samples; // microseconds
+    std::vector<uint32_t> sorted; // swapped with samples by take(), both are sized once so recording never allocates
+    uint64_t passes;
+    uint32_t max_us;
+
+public:
+    struct Summary {
+        uint64_t passes;
+        uint32_t p50_us, p99_us, max_us;
+    };
+
+    void add(uint32_t late_us);
+    Summary take(); // the figures since the previous call
+
+    SchedLatency();
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "forward_declarations.h"
+#include "jsonloader.h"
+
+#include <pigpio.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+/*
+    Remote GPIO over the pigpiod socket protocol
+
+    Each host gets two connections to its pigpiod: a command socket for
+    request/response calls (16 byte cmdCmd_t frames) and a notification socket
+    switched into in-band mode with PI_CMD_NOIB, which then carries a stream of
+    12 byte gpioReport_t level/tick samples. One event loop thread polls every
+    host's notification socket, turns level changes on watched pins into alert
+    callbacks and reconnects hosts that drop, restoring their pin setup.
+*/
+
+class RemoteGPIOHost {
+    struct Alert {
+        gpioAlertFuncEx_t func = nullptr;
+        void* userdata = nullptr;
+    };
+    // pin setup replayed after a reconnect, -1 when never set
+    struct PinSetup {
+        int mode = -1;
+        int pud = -1;
+        int glitch = -1;
+        int watchdog = -1;
+    };
+
+    RemoteGPIOManager* manager;
+    std::string host_name, address;
+    uint16_t port;
+
+    std::mutex cmd_lock; // one request in flight on the command socket, guards the sockets
+    int cmd_fd, notify_fd;
+    uint32_t notify_handle;
+    std::atomic_bool online;
+
+    std::mutex dispatch_lock; // held while alert callbacks run
+    std::mutex state_lock; // guards alerts, pins, watched and the level image
+    std::array<Alert, 32> alerts;
+    std::array<PinSetup, 32> pins;
+    uint32_t watched;
+    uint32_t last_levels;
+    bool have_levels;
+
+    // owned by the event loop thread
+    uint8_t report_buf[sizeof(gpioReport_t)];
+    size_t report_used;
+    uint64_t retry_at_ms;
+
+    static int open_socket(const std::string& address, uint16_t port);
+    int command(uint32_t cmd, uint32_t p1, uint32_t p2, const void* ext=nullptr, uint32_t ext_len=0);
+    int command_locked(uint32_t cmd, uint32_t p1, uint32_t p2, const void* ext=nullptr, uint32_t ext_len=0);
+    // the reply word as it came, false when the host did not answer; for replies that are data rather than a status
+    bool exchange_locked(uint32_t cmd, uint32_t p1, uint32_t p2, uint32_t& reply);
+    void drop_command_socket();
+
+    bool connect(); // event loop thread
+    void disconnect();
+    bool read_reports(); // event loop thread, false when the stream has closed
+    void dispatch(const gpioReport_t& report);
+
+public:
+    RemoteGPIOHost(RemoteGPIOManager* manager, const std::string& name, const std::string& address, uint16_t port);
+    ~RemoteGPIOHost();
+
+    RemoteGPIOHost(const RemoteGPIOHost&) = delete;
+
+    const std::string& name() const { return host_name; }
+    bool connected() const { return online; }
+
+    // same contract as the pigpio functions they mirror, negative results are pigpio/pigif errors
+    int setMode(unsigned gpio, unsigned mode);
+    int setPullUpDown(unsigned gpio, unsigned pud);
+    int glitchFilter(unsigned gpio, unsigned steady);
+    int setWatchdog(unsigned gpio, unsigned timeout_ms); // timeouts arrive as PI_TIMEOUT alerts
+    int read(unsigned gpio);
+    int write(unsigned gpio, unsigned level);
+    bool readBits(uint32_t& levels); // gpioRead_Bits_0_31, false while the host is unreachable
+    int writeBits(uint32_t set, uint32_t clear); // a bank set and clear back to back, like gpioWrite_Bits_0_31_Set/Clear
+    int trigger(unsigned gpio, unsigned pulse_us, unsigned level);
+    int pulseWave(unsigned gpio, unsigned level, uint32_t pulse_us); // builds and sends a one-shot pulse, returns the wave id
+    int waveBusy();
+    int waveTxAt();
+    int waveStop();
+    int waveDelete(unsigned wave_id);
+    int setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata);
+
+    friend class RemoteGPIOManager;
+};
+
+class RemoteGPIOManager {
+    std::vector<std::unique_ptr<RemoteGPIOHost>> hosts;
+    std::thread event_loop;
+    std::atomic_bool running;
+    int wake_pipe[2];
+
+    void loop();
+
+public:
+    static constexpr int CONNECT_TIMEOUT_MS = 1000;
+    static constexpr int IO_TIMEOUT_MS = 2000;
+    static constexpr uint64_t RECONNECT_INTERVAL_MS = 2000;
+
+    RemoteGPIOHost* find(const std::string& name) const;
+    size_t count() const { return hosts.size(); }
+    void wake(); // re-read the notification socket set, called after a host reconnects
+
+    RemoteGPIOManager(JsonLoader& config); // loads the "hosts" list
+    virtual ~RemoteGPIOManager();
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "forward_declarations.h"
+#include "jsonloader.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/*
+    On-device rules
+
+    The "rules" config section is compiled once into flat tables indexed by zone.
+    trigger_offsets[z] .. trigger_offsets[z + 1] is the run of triggers watching
+    zone z, and each trigger points at its condition and its run of actions, so a
+    state change costs one row lookup and a short linear scan with no allocation.
+
+    A rule fires when its "when" zone changes to "is" (any change when omitted)
+    and the optional "if" zone is currently at "if_is". It can set a zone "to" a
+    level, "after" a delay and/or "for" a duration before reverting, and publish
+    an event on <name>/event. A rule firing again restarts its timers; each
+    action holds its own timer, so the pending ones never outgrow the table.
+*/
+
+class RuleEngine {
+public:
+    using ZoneList = std::vector<std::unique_ptr<Zone>>;
+    using EventHandler = std::function<void(const std::string& payload)>;
+
+    static constexpr uint16_t NONE = 0xffff;
+
+private:
+    struct Trigger {
+        int16_t level; // -1 fires on any change
+        uint16_t condition_zone; // NONE without a condition
+        int16_t condition_level;
+        uint16_t first_action, action_count;
+    };
+    enum ActionType : uint8_t {
+        ACTION_SET, ACTION_PUBLISH
+    };
+    struct Action {
+        ActionType type;
+        uint16_t zone; // set target
+        int16_t level;
+        uint32_t after_ms, for_ms;
+        uint16_t event; // index into event_payloads
+        // the one timer an action can have, a firing replaces it
+        uint64_t due_ms; // 0 when none is pending
+        bool revert; // false applies the delayed set, true undoes it
+    };
+
+    const ZoneList& zones;
+    EventHandler on_event;
+
+    std::vector<uint32_t> trigger_offsets; // zone count + 1 entries
+    std::vector<Trigger> triggers;
+    std::vector<Action> actions;
+    std::vector<std::string> event_payloads; // JSON built at load time
+    std::vector<int16_t> states; // last state seen per zone, -1 before the first
+    uint64_t next_due_ms; // the earliest pending timer, UINT64_MAX when none is
+    uint64_t fired;
+
+    int find_zone(const std::string& name) const;
+    void run(uint16_t first, uint16_t count, uint64_t now);
+    void apply(uint16_t index, bool revert, uint64_t now);
+    void schedule(Action& action, uint64_t due_ms, bool revert);
+
+public:
+    // zone event path: evaluates the triggers of a zone whose state changed
+    void on_state(size_t zone, int state);
+    void update(); // fires due timers
+
+    // upgrade handoff: the pending timers, restored against the zone states the successor starts from
+    void save_state(HandoffState& state) const;
+    void restore_state(const HandoffState& state, const std::vector<int16_t>& levels);
+
+    size_t rule_count() const { return triggers.size(); }
+    uint64_t fired_count() const { return fired; }
+
+    RuleEngine(JsonLoader& config, const ZoneList& zones, EventHandler on_event);
+    virtual ~RuleEngine() = default;
+};
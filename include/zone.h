@@ -5,13 +5,22 @@
 #include "clock.h"
 #include "ReconnectingMqttClient.h"
 #include "jsonloader.h"
+#include "logger.h"
+#include "zone_arena.h"
+#include "json_fragment.h"
+#include "output_pulse.h"
 
 #include <vector>
 #include <iostream>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <atomic>
 #include <memory>
+#include <random>
+#include <array>
+#include <chrono>
+#include <memory_resource>
 
 
 // Base Zone / All Zones Inherited From
@@ -19,67 +28,248 @@
 struct ZoneMetaFields {
     std::string device_class;
     std::string icon;
-    uint32_t trigger_timeout_threshold;
+    uint32_t trigger_timeout_threshold = 0;
+    uint32_t supervision_timeout = 0; // ms a heartbeat input may stay silent, 0 when it is not supervised
 };
 
-class Zone {
+// Hot per-zone state as a structure of arrays, owned by the ZoneManager and carved from its arena.
+// The fields every pass reads sit in a few contiguous arrays instead of behind each Zone object:
+// zone callbacks write their row from the GPIO, bus and federation threads, and a bit per zone in
+// the pending mask tells update() which rows hold an unreported change. A second mask holds the
+// supervised zones whose watchdog has fired since their last edge.
+class ZoneStateTable {
+    std::pmr::vector<std::atomic_uint64_t> pending; // one bit per zone, 64 zones a word
+    std::pmr::vector<std::atomic_uint64_t> silent; // one bit per zone, set by a watchdog timeout
+    std::pmr::vector<std::atomic_int16_t> levels;
+    std::pmr::vector<std::atomic_uint32_t> deadlines; // tick the last change settles at
+    std::pmr::vector<std::atomic_uint32_t> transitions; // every raw level change, read by flap detection
+    std::pmr::vector<uint32_t> debounce; // trigger_timeout of each zone, set once when it binds
 
-    std::atomic_bool state_changed;
-    Clock last_state_changed;
-    std::atomic_int16_t state;
-    std::string unique_id;
-    int trigger_timeout;
+    static uint64_t bit(size_t zone) { return uint64_t(1) << (zone % 64); }
 
-protected:
-    void set_state_level(int16_t level) { last_state_changed.restart(); state = level; state_changed = true; }
+public:
+    // wrapping millisecond tick, compared as a signed difference
+    static uint32_t tick() {
+        return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
 
-    JsonLoader metadata;
+    size_t size() const { return levels.size(); }
+    size_t words() const { return pending.size(); }
 
-public:
-    static const std::vector<std::string> ZoneTypes;
+    void bind(size_t zone, uint32_t debounce_ms) {
+        debounce[zone] = debounce_ms;
+        deadlines[zone].store(tick() - 1, std::memory_order_relaxed);
+        pending[zone / 64].fetch_or(bit(zone), std::memory_order_release); // a new zone reports its level once
+    }
+
+    void set_level(size_t zone, int16_t level) { set_level_at(zone, level, tick() + debounce[zone]); }
+
+    // with the tick it settles at given, so levels written together are published in the same pass
+    void set_level_at(size_t zone, int16_t level, uint32_t settles) {
+        levels[zone].store(level, std::memory_order_relaxed);
+        deadlines[zone].store(settles, std::memory_order_relaxed);
+        transitions[zone].fetch_add(1, std::memory_order_relaxed);
+        pending[zone / 64].fetch_or(bit(zone), std::memory_order_release); // last, the row is complete when the bit shows
+    }
 
+    void mark(size_t zone) { pending[zone / 64].fetch_or(bit(zone), std::memory_order_release); }
+
+    // only written when it changes, every edge of a supervised zone clears it
+    void set_silent(size_t zone, bool lost) {
+        if(bool(silent_word(zone / 64) & bit(zone)) == lost) return;
+        if(lost) silent[zone / 64].fetch_or(bit(zone), std::memory_order_release);
+        else silent[zone / 64].fetch_and(~bit(zone), std::memory_order_release);
+    }
+    uint64_t silent_word(size_t word) const { return silent[word].load(std::memory_order_acquire); }
+    uint64_t pending_word(size_t word) const { return pending[word].load(std::memory_order_acquire); }
+    bool is_pending(size_t zone) const { return pending_word(zone / 64) & bit(zone); }
+    bool settled(size_t zone, uint32_t now) const { return int32_t(now - deadlines[zone].load(std::memory_order_relaxed)) > 0; }
+    int16_t level(size_t zone) const { return levels[zone].load(std::memory_order_relaxed); }
+    uint32_t debounce_of(size_t zone) const { return debounce[zone]; }
+    uint32_t transition_count(size_t zone) const { return transitions[zone].load(std::memory_order_relaxed); }
+
+    // clears the pending bit before reading the level, so a change racing with it stays pending
+    int16_t take(size_t zone) {
+        pending[zone / 64].fetch_and(~bit(zone), std::memory_order_acq_rel);
+        return levels[zone].load(std::memory_order_relaxed);
+    }
+
+    // bytes the arrays take from a memory resource, for sizing an arena
+    static size_t footprint(size_t zones) {
+        return 2 * ((zones + 63) / 64) * sizeof(uint64_t) + zones * (sizeof(int16_t) + 3 * sizeof(uint32_t)) + 6 * alignof(uint64_t);
+    }
+
+    ZoneStateTable(size_t zones, std::pmr::memory_resource* resource):
+        pending((zones + 63) / 64, resource), silent((zones + 63) / 64, resource), levels(zones, resource), deadlines(zones, resource),
+        transitions(zones, resource), debounce(zones, 0, resource) {}
+    ZoneStateTable(const ZoneStateTable&) = delete;
+};
+
+// where a zone keeps its hot state: its row in a ZoneStateTable
+struct ZoneSlot {
+    ZoneStateTable* table;
+    uint32_t index;
+};
+
+class Zone {
+public:
     enum IO : int {
         IO_OUTPUT, IO_INPUT
     };
 
-    std::string get_meta() const { return metadata.toString(); }
+private:
+    ZoneSlot slot; // level, pending flag and deadline live in the table, the zone only keeps cold data
+    std::string name, unique_id;
+    IO type;
+    bool invert;
+    ZoneMetaFields meta;
+    std::string metadata; // the fields above as a discovery JSON object, formatted once
+    std::string discovery; // "<id>":{...} component of the device discovery payload, with its topics
+
+protected:
+    void set_state_level(int16_t level) { slot.table->set_level(slot.index, level); }
+    void set_silent(bool lost) { slot.table->set_silent(slot.index, lost); }
+    std::string& discovery_text() { return discovery; } // for zones that announce more than one component
+
+public:
+    static const std::vector<std::string> ZoneTypes;
+
+    const std::string& get_meta() const { return metadata; }
+    const std::string& get_discovery() const { return discovery; }
+    const std::string& get_name() const { return name; }
     const std::string& get_unique_id() const { return unique_id; }
+    IO get_io() const { return type; }
+    bool is_inverted() const { return invert; }
+    const ZoneMetaFields& get_meta_fields() const { return meta; }
+
+    // formats the discovery component once the zone's topics are known
+    void format_discovery(std::string_view state_topic, std::string_view command_topic, std::string_view attributes_topic);
 
     virtual void set(int state) = 0; // abstract - all zones must implement / sets the real state
     virtual int get() = 0; // abstract - all zones must implement / gets the real state and returns
 
-    Zone(const std::string& name, IO type, bool invert, const ZoneMetaFields& meta);
+    size_t get_index() const { return slot.index; }
+
+    Zone(ZoneSlot slot, const std::string& name, IO type, bool invert, const ZoneMetaFields& meta);
     virtual ~Zone() = default;
 
     Zone(const Zone&) = delete;
 
+    // zones are only created in a ZoneArena: new (arena) DigitalGPIO_Zone(...)
+    static void* operator new(size_t size, ZoneArena& arena) { return arena.allocate(size, alignof(std::max_align_t)); }
+    static void operator delete(void*, ZoneArena&) {}
+    static void operator delete(void*) {} // the memory goes with the arena
+
     inline friend std::ostream& operator<<(std::ostream& stream, const Zone& obj) {
         stream << obj.get_meta();
         return stream;
     }
-    
-    friend class ZoneManager;
 };
 
 class DigitalGPIO_Zone : public Zone {
-    std::unique_ptr<GPIO> gpio;
     IO type;
-    static void onGPIOStateChange(DigitalGPIO_Zone* _this, int level);
+    GPIO gpio; // last, its alert is registered once the state it reads exists and removed before that state goes
+    static void onGPIOStateChange(DigitalGPIO_Zone* _this, int gpio, int level, uint32_t tick);
 
 public:
-    DigitalGPIO_Zone(const std::string& name, IO type, int pin, bool invert=false, const ZoneMetaFields& meta={"",""}, GPIO::PinType mode=GPIO::PIN_INPUT_PULLDOWN);
+    DigitalGPIO_Zone(ZoneSlot slot, const std::string& name, IO type, int pin, bool invert=false, const ZoneMetaFields& meta={"",""}, GPIO::PinType mode=GPIO::PIN_INPUT_PULLDOWN, RemoteGPIOHost* host=nullptr);
     virtual ~DigitalGPIO_Zone();
 
     void set(int level) override;
     int get() override;
 };
 
+// A push button on a local or remote pin, a gpio_digital input with "mode":"button". Its level reports like any
+// input, and its press patterns are classified from the pigpio edge ticks as the alerts arrive: a single, double
+// or long press, or a hold while it is still down. The pin watchdog ends the wait for a second press and marks a
+// hold, so nothing polls the pin, and the glitch filter takes the contact bounce. Classified presses wait in a
+// single producer ring for the zone pass, which publishes them as a Home Assistant event entity.
+class Button_Zone : public Zone {
+public:
+    enum Press : uint8_t {
+        PRESS_SINGLE, PRESS_DOUBLE, PRESS_LONG, PRESS_HOLD
+    };
+    static const std::array<const char*,4> PressNames;
+
+    struct Timing {
+        uint32_t double_window_ms = 300; // a second press this soon after a release makes a double, 0 never waits for one
+        uint32_t long_press_ms = 800; // a press released after this long is a long press
+        uint32_t hold_ms = 2000; // a press still down this long is a hold, reported without waiting for the release
+        uint32_t bounce_ms = 10; // edges must hold this long to be reported, 0 leaves the pin unfiltered
+    };
+
+private:
+    enum Phase : uint8_t {
+        IDLE, PRESSED, RELEASED, LATCHED // LATCHED has reported the press and waits for the release
+    };
+
+    Timing timing;
+    int pressed_level;
+    Phase phase; // only touched by the alert callback
+    uint32_t press_tick, release_tick; // pigpio microsecond ticks
+
+    static constexpr uint32_t RING_SIZE = 16; // presses a zone pass may fall behind by
+    std::array<Press, RING_SIZE> ring;
+    std::atomic_uint32_t ring_head, ring_tail; // the zone pass moves the head, the alert callback the tail
+    std::atomic_uint32_t overflow;
+    static constexpr int32_t NO_REARM = -1;
+    std::atomic_int32_t rearm; // a remote watchdog timeout left for the zone pass, the alert callback must not wait on pigpiod
+    GPIO gpio; // last, as in DigitalGPIO_Zone: an edge during construction finds the classifier ready
+
+    void emit(Press press);
+    void arm(uint32_t timeout_ms);
+    static void onGPIOStateChange(Button_Zone* _this, int gpio, int level, uint32_t tick);
+
+public:
+    Button_Zone(ZoneSlot slot, const std::string& name, int pin, bool invert, const ZoneMetaFields& meta, const Timing& timing,
+                GPIO::PinType mode=GPIO::PIN_INPUT_PULLDOWN, RemoteGPIOHost* host=nullptr);
+    virtual ~Button_Zone();
+
+    // appends the event entity to the discovery component, once the press topic is known
+    void format_press_discovery(std::string_view press_topic);
+    bool take_press(Press& press); // the zone pass, oldest first
+    uint32_t take_overflow(); // presses lost to a full ring since the last call
+    void apply_rearm(); // the zone pass, sends the last watchdog timeout armed on a remote pin
+
+    void set(int level) override;
+    int get() override;
+};
+
+// An input on an expander node of the PJON serial bus
+class PJONRemote_Zone : public Zone {
+    PJONExpanderBus* bus;
+    uint8_t node, bit;
+    static void onBusStateChange(PJONRemote_Zone* _this, int level);
+
+public:
+    PJONRemote_Zone(ZoneSlot slot, const std::string& name, PJONExpanderBus* bus, uint8_t node, uint8_t bit, bool invert=false, const ZoneMetaFields& meta={"",""});
+    virtual ~PJONRemote_Zone();
+
+    void set(int level) override;
+    int get() override;
+};
+
+// A read-only mirror of a zone on another controller, replicated by the federation
+class Federated_Zone : public Zone {
+    PJONFederation* federation;
+    uint8_t peer;
+    std::string remote_id;
+    static void onPeerStateChange(Federated_Zone* _this, int level);
+
+public:
+    Federated_Zone(ZoneSlot slot, const std::string& name, PJONFederation* federation, uint8_t peer, const std::string& remote_id, bool invert=false, const ZoneMetaFields& meta={"",""});
+    virtual ~Federated_Zone();
+
+    void set(int level) override;
+    int get() override;
+};
+
 // A virtual zone is one that must be controlled in software
 using VirtualCallback = std::function<bool(int)>; // virtual callback to simulate a GPIO pin
 class Virtual_Zone : public Zone {
     VirtualCallback virtual_callback;
 public:
-    Virtual_Zone(const std::string& name, IO type, bool invert, VirtualCallback cb={}, const ZoneMetaFields& meta={"",""});
+    Virtual_Zone(ZoneSlot slot, const std::string& name, IO type, bool invert, VirtualCallback cb={}, const ZoneMetaFields& meta={"",""});
     virtual ~Virtual_Zone() = default;
 
     void set(int level) override;
@@ -92,14 +282,115 @@ class ZoneManager {
 
     using ZoneList = std::vector<std::unique_ptr<Zone>>;
 
+    ZoneArena arena; // ahead of everything allocated from it
+    std::unique_ptr<ZoneStateTable> hot; // hot state of every zone, ahead of the zones that write it
     ZoneList zones;
+    std::unique_ptr<RuleEngine> rules; // compiled from the "rules" section
+    std::unique_ptr<AlarmPanel> alarm; // nullptr unless alarm_panel is configured
+
+    // per-zone publish policy: a minimum interval between publishes and flap detection
+    struct ZoneTraffic {
+        uint32_t min_interval_ms = 0; // from max_rate, 0 publishes every settled change
+        uint32_t flap_count = 0, flap_window_ms = 0; // flap_count transitions inside flap_window is a fault, 0 disables it
+        uint64_t last_publish_ms = 0, last_transition_ms = 0;
+        uint32_t seen_transitions = 0, recent_total = 0;
+        struct Recent {
+            uint64_t ms;
+            uint32_t transitions;
+        };
+        std::pmr::vector<Recent> recent; // ring of the transitions seen per pass inside the window, flap_count long
+        uint32_t recent_head = 0, recent_size = 0;
+        bool fault = false;
+    };
+    std::vector<ZoneTraffic> traffic;
+
+    // publish topics of every zone, formatted once
+    struct ZoneTopics {
+        std::pmr::string state; // <name>/state/<id>
+        std::pmr::string attributes; // <name>/attr/<id>
+        std::pmr::string press; // <name>/press/<id> for a button, otherwise empty
+        bool alarm; // in an alarm panel group, its live changes go out ahead of other traffic
+    };
+    std::vector<ZoneTopics> topics;
+    std::vector<size_t> buttons; // zones whose classified presses each pass drains
+    void publish_presses();
+
+    // output zones in config order, bit n of a group command's mask is outputs[n]
+    struct OutputPin {
+        size_t zone;
+        unsigned pin;
+        RemoteGPIOHost* host; // nullptr for a pin on this Pi
+        uint32_t pulse_us; // from "pulse", how long an "on" command lasts, 0 latches it
+    };
+    std::vector<OutputPin> outputs;
+    // a group command's scratch, sized at load so it allocates nothing
+    struct OutputBank {
+        RemoteGPIOHost* host; // nullptr for this Pi
+        uint32_t set, clear;
+    };
+    std::vector<int8_t> output_levels; // one level per output, -1 leaves it as it is
+    std::vector<OutputBank> output_banks; // one per host with an output in the first bank
+    void write_outputs(); // writes output_levels
+    OutputPulses pulses; // after the zones, so a pulse still running ends before its pin is released
+
+    // gpio_digital inputs per host, so one bank read checks every pin of a host against its zone's level
+    struct PinBank {
+        RemoteGPIOHost* host; // nullptr for this Pi
+        uint32_t mask = 0; // pins with a zone
+        uint32_t suspect = 0, suspect_levels = 0; // pins that differed on the last read, and what they read
+        std::vector<std::pair<unsigned, size_t>> pins; // pin, zone
+    };
+    std::vector<PinBank> banks;
+    static constexpr uint32_t RECONCILE_CONFIRM_MS = 50; // a pin must still differ this much later, past any alert in flight
+    uint32_t reconcile_interval; // ms between bank reads, 0 reads them only ahead of a refresh
+    uint64_t last_reconcile_ms;
+    bool reconcile_confirm; // a pin differed, it is read again once RECONCILE_CONFIRM_MS has passed
+    std::atomic<uint64_t> missed_edges;
+    std::pmr::string snapshot; // the <name>/state text, rebuilt in place
+
+    void check_flapping(size_t index, uint64_t now);
+    void check_supervision(); // reports the supervised zones whose silent bit changed
+    void publish_attributes(size_t index); // the flap fault and, for a supervised zone, its supervision
+    std::vector<uint64_t> silent_reported; // the silent mask as last reported
+
+    std::vector<int16_t> published; // last level published per zone, -1 before the first
+    uint64_t sequence; // bumped by every published change, names the state a snapshot holds
+    bool snapshot_dirty;
+    uint32_t snapshot_interval; // minimum ms between snapshots that follow changes, 0 for refreshes only
+    Clock last_snapshot;
+
+    // refreshes are paced by a token bucket so a fleet answering one birth message does not burst
+    static constexpr double REFRESH_BURST = 4;
+    std::vector<size_t> refresh_queue; // zones still to be refreshed, in order
+    std::vector<uint8_t> refresh_pending; // cleared when a live change publishes the zone first
+    size_t refresh_head;
+    uint32_t refresh_window; // ms a refresh is spread over, 0 publishes it at once
+    uint32_t refresh_jitter; // upper bound of the random ms a refresh waits before it starts
+    double refresh_tokens;
+    uint64_t refresh_start_ms, refresh_refill_ms;
+    std::mt19937 refresh_random;
+
+    void publish_refresh();
 
 public:
 
     const ZoneList& get_zones() const { return zones; }
+    const RuleEngine* get_rules() const { return rules.get(); }
+    AlarmPanel* get_alarm() const { return alarm.get(); }
     void refresh_states();
+    void publish_snapshot(); // every zone level in one retained message on <name>/state
+    void reconcile(); // reads the pin banks and corrects zones whose alerts were lost
+    uint64_t take_missed_edges() { return missed_edges.exchange(0, std::memory_order_relaxed); } // corrected since the last call
+    void command_outputs(std::string_view payload); // a group command: {"<id>":level,...} or <mask>:<levels>
+    // a timed level on an output zone, pulse_us 0 takes the zone's "pulse"; false when it is a plain set
+    bool pulse_output(size_t index, int level, uint32_t pulse_us);
+    void cancel_pulse(size_t index); // ahead of a plain set
     void update();
 
+    // upgrade handoff: what was published and what is still running, so the successor carries on without republishing
+    void save_state(HandoffState& state) const;
+    void restore_state(const HandoffState& state);
+
     ZoneManager(SecuritySystem* system);
     virtual ~ZoneManager();
 
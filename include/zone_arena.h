@@ -0,0 +1,38 @@
+#pragma once
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <cstddef>
+
+/*
+    Zone arena
+
+    Zone objects and their per-zone buffers (preformatted topics, flap history,
+    the snapshot text) are carved out of one block that is sized when the config
+    is loaded. The objects the event loop walks sit next to each other, and the
+    edge and command paths never go back to the heap.
+
+    The arena is a std::pmr::memory_resource so pmr strings and vectors can live
+    in it. Nothing is freed until the arena itself goes; a request that does not
+    fit the block is served from an extra heap block and logged.
+*/
+
+class ZoneArena : public std::pmr::memory_resource {
+    std::unique_ptr<std::byte[]> block;
+    size_t capacity, used;
+    std::vector<std::unique_ptr<std::byte[]>> overflow;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {} // released with the arena
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    void reserve(size_t bytes); // sizes the block, before the first allocation
+    size_t size() const { return capacity; }
+    size_t in_use() const { return used; }
+    size_t overflow_blocks() const { return overflow.size(); }
+
+    ZoneArena(): capacity(0), used(0) {}
+    ZoneArena(const ZoneArena&) = delete;
+    virtual ~ZoneArena() = default;
+};
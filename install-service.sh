@@ -21,8 +21,11 @@ StartLimitIntervalSec=30
 [Service]
 WorkingDirectory=$SERVICE_WORKING_DIR
 ExecStart=$SERVICE_PATH
+# reload hands the session and zone state over to the installed binary
+ExecReload=/bin/kill -USR2 \$MAINPID
 
-Type=simple
+Type=notify
+NotifyAccess=all
 Restart=always
 RestartSec=5
 #User=
@@ -47,15 +50,17 @@ if [ ! -f "$PROGRAM_PATH" ]; then
  exit 1
 fi
 
+UPGRADE=0
 if systemctl is-active --quiet "$SERVICE_NAME" ; then
- info "Stopping running service..."
-# sudo pkill -f "$SERVICE_PATH"
- sudo service "$SERVICE_NAME" stop
+ info "Service is running, it will hand over to the new version..."
+ UPGRADE=1
 fi
 
 info "Installing service application..."
-sudo cp "$PROGRAM_PATH" "$SERVICE_PATH"
-sudo chmod ug+rx "$SERVICE_PATH"
+# copied beside the binary and renamed over it, the running service keeps its own file
+sudo cp "$PROGRAM_PATH" "$SERVICE_PATH.new"
+sudo chmod ug+rx "$SERVICE_PATH.new"
+sudo mv -f "$SERVICE_PATH.new" "$SERVICE_PATH"
 
 info "Preparing service directory..."
 
@@ -77,9 +82,15 @@ echo "$SERVICE_INI"
 # Write to service file
 echo "$SERVICE_INI">"$SERVICE_INI_PATH"
 
+sudo systemctl daemon-reload
+
 info "Enable and Start the service daemon..."
 sudo systemctl enable "$SERVICE_NAME"
-sudo systemctl start "$SERVICE_NAME"
+if [ "$UPGRADE" = 1 ]; then
+ sudo systemctl reload "$SERVICE_NAME"
+else
+ sudo systemctl start "$SERVICE_NAME"
+fi
 
 if [ -f "$SERVICE_INI_PATH" ] && systemctl is-enabled --quiet "$SERVICE_NAME" && systemctl is-active --quiet "$SERVICE_NAME"; then
  success "Service Installed Successfully!"
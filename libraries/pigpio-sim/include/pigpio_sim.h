@@ -0,0 +1,69 @@
+#pragma once
+/*
+    pigpio-sim - software stand-in for the pigpio C library
+
+    Link this library instead of libraries/pigpio to run the zone controller
+    without a Raspberry Pi. It implements the subset of <pigpio.h> used by the
+    service (modes, pulls, read/write, bank read/write, alerts, watchdogs,
+    glitch/noise filters, PWM, waves, triggers and timers) on top of a
+    simulated timeline with microsecond ticks, delivered by a dedicated alert
+    thread just like the real library.
+
+    The functions below drive the simulation: inject edges on inputs, script
+    timed edge sequences, and inspect every level written by the application.
+*/
+#include <pigpio.h>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// A scripted edge: drive `gpio` to `level` after `delay_us` microseconds
+// counted from the previous edge of the same script
+struct SimEdge {
+    uint32_t delay_us;
+    uint8_t gpio;
+    uint8_t level;
+};
+
+// A level written by the application (gpioWrite, bank writes, PWM, waves, triggers)
+struct SimWrite {
+    enum Source : uint8_t {
+        SIM_WRITE, SIM_WRITE_BITS, SIM_PWM, SIM_WAVE, SIM_TRIGGER
+    };
+    uint32_t tick;
+    uint8_t gpio;
+    uint8_t level; // for SIM_PWM this is non-zero when the duty cycle is non-zero
+    Source source;
+    uint32_t value; // PWM duty cycle, otherwise equal to level
+};
+
+// Called synchronously from the writing thread for every recorded write
+typedef void (*SimWriteHook_t)(const SimWrite& write, void* userdata);
+
+// Drive an input immediately; the alert is delivered from the alert thread
+int simInjectEdge(unsigned gpio, unsigned level);
+
+// Drive an input with no alert at all, as an edge lost to an overflowed sample buffer would be
+int simLoseEdge(unsigned gpio, unsigned level);
+
+// Drive an input at an absolute simulated tick (may be in the past to replay history)
+int simScheduleEdge(unsigned gpio, unsigned level, uint32_t tick);
+
+// Queue a relative edge sequence starting now, returns the tick of the final edge
+uint32_t simScript(const SimEdge* edges, size_t count);
+uint32_t simScript(const std::vector<SimEdge>& edges);
+
+// Toggle a pin `count` times, one edge every `period_us` (0 = as fast as the alert thread can go)
+uint32_t simPulseTrain(unsigned gpio, unsigned count, uint32_t period_us);
+
+// Block until every queued edge has been dispatched, returns false on timeout; armed watchdogs do not count
+bool simWaitIdle(uint32_t timeout_ms);
+
+// Write log access
+std::vector<SimWrite> simGetWrites();
+void simClearWrites();
+void simSetWriteHook(SimWriteHook_t hook, void* userdata);
+
+// Counters for benchmarking the alert path
+uint64_t simAlertsDelivered();
+uint64_t simEdgesFiltered();
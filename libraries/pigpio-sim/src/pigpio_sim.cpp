@@ -0,0 +1,823 @@
+#include "pigpio_sim.h"
+
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <queue>
+#include <map>
+#include <atomic>
+#include <cstring>
+
+/*
+    Simulated pigpio
+
+    All pin state lives behind one mutex. Level changes are placed on a timeline
+    ordered by their simulated tick; the alert thread sleeps until the next due
+    entry, applies it, runs it through the glitch/noise filters and delivers
+    the alert outside the lock so callbacks may call back into the library.
+
+    Writes the timeline makes itself (wave pulses, trigger ends, and whatever
+    a timer callback writes) are logged at the tick they were due, not when
+    the alert thread got to them, as the DMA engine and pigpio's timer thread
+    would on an idle Pi. A host scheduling hiccup then delays the callback,
+    not the level the write log reports.
+*/
+
+namespace {
+
+constexpr unsigned SIM_GPIOS = PI_MAX_GPIO + 1;
+constexpr unsigned SIM_USER_GPIOS = PI_MAX_USER_GPIO + 1;
+
+struct AlertSlot {
+    gpioAlertFunc_t func = nullptr;
+    gpioAlertFuncEx_t func_ex = nullptr;
+    void* userdata = nullptr;
+};
+
+struct FilterState {
+    uint32_t glitch_steady = 0;
+    uint32_t noise_steady = 0, noise_active = 0;
+    uint64_t generation = 0; // bumped on every raw edge, stale checks are discarded
+    uint64_t active_until = 0;
+    uint8_t reported = 0;
+};
+
+// one outstanding WATCHDOG event per armed pin, moved on lazily: an edge only records its time
+struct WatchdogState {
+    uint32_t timeout_ms = 0; // 0 when disarmed
+    uint64_t generation = 0; // bumped by gpioSetWatchdog, stale events are discarded
+    uint64_t last_report = 0; // timeline us of the last reported level change
+};
+
+struct Event {
+    enum Kind : uint8_t {
+        EDGE,         // an external level change on an input
+        REPORT,       // a level already applied by a write, only needs reporting
+        FILTER_CHECK, // the end of a glitch/noise steady period
+        WAVE_PULSE,   // the next pulse of the transmitting wave
+        WATCHDOG,     // a watchdog deadline, reported as PI_TIMEOUT when nothing changed since
+        TRIGGER_END,  // the end of a gpioTrigger pulse, drives the pin back
+        TIMER         // a gpioSetTimerFunc period, the timer number is in gpio
+    };
+    uint64_t due;
+    uint64_t order;
+    Kind kind;
+    uint8_t gpio;
+    uint8_t level;
+    uint64_t generation;
+    uint32_t tick; // the tick reported for FILTER_CHECK events
+    bool operator>(const Event& rhs) const { return due != rhs.due ? due > rhs.due : order > rhs.order; }
+};
+
+struct TimerState {
+    unsigned millis = 0;
+    gpioTimerFunc_t func = nullptr;
+    gpioTimerFuncEx_t func_ex = nullptr;
+    void* userdata = nullptr;
+    uint64_t generation = 0; // bumped by every gpioSetTimerFunc, stale events are discarded
+};
+
+struct Wave {
+    std::vector<gpioPulse_t> pulses;
+    uint32_t micros = 0;
+};
+
+struct Sim {
+    std::mutex lock;
+    std::condition_variable wake, idle;
+    std::thread alert_thread;
+    bool initialised = false, running = false, dispatching = false;
+    std::chrono::steady_clock::time_point epoch;
+    bool epoch_set = false;
+
+    uint8_t level[SIM_GPIOS] {};
+    uint8_t mode[SIM_GPIOS] {};
+    uint8_t pud[SIM_GPIOS] {};
+    bool driven[SIM_GPIOS] {};
+
+    AlertSlot alerts[SIM_USER_GPIOS];
+    FilterState filters[SIM_USER_GPIOS];
+    WatchdogState watchdogs[SIM_USER_GPIOS];
+    TimerState timers[PI_MAX_TIMER + 1];
+    size_t background_events = 0; // WATCHDOG and TIMER entries on the timeline, which never make it busy
+
+    uint32_t pwm_duty[SIM_USER_GPIOS] {};
+    uint32_t pwm_range[SIM_USER_GPIOS] {};
+    uint32_t pwm_freq[SIM_USER_GPIOS] {};
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> timeline;
+    uint64_t order = 0;
+
+    std::vector<gpioPulse_t> wave_building;
+    std::map<unsigned, Wave> waves;
+    int wave_tx = -1;
+    uint64_t wave_busy_until = 0;
+    unsigned wave_mode = PI_WAVE_MODE_ONE_SHOT;
+    uint64_t wave_generation = 0;
+    size_t wave_index = 0;
+
+    std::vector<SimWrite> writes;
+    std::atomic<SimWriteHook_t> write_hook {nullptr};
+    std::atomic<void*> write_hook_userdata {nullptr};
+
+    std::atomic<uint64_t> alerts_delivered {0}, edges_filtered {0};
+
+    Sim() {
+        for(auto& r : pwm_range) r = PI_DEFAULT_DUTYCYCLE_RANGE;
+        for(auto& f : pwm_freq) f = 800;
+    }
+};
+
+Sim sim;
+
+uint64_t now_us() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sim.epoch).count());
+}
+
+// set on the alert thread while a timer callback runs, its writes are logged at the timer's tick
+thread_local bool timer_dispatch = false;
+thread_local uint64_t timer_due = 0;
+
+uint64_t write_time() {
+    return timer_dispatch ? timer_due : now_us();
+}
+
+// expand a 32 bit tick to the 64 bit timeline, choosing the value closest to now
+uint64_t tick_to_us(uint32_t tick) {
+    uint64_t now = now_us();
+    int32_t delta = int32_t(tick - uint32_t(now));
+    return int64_t(now) + delta < 0 ? 0 : uint64_t(int64_t(now) + delta);
+}
+
+// caller holds the lock
+void push_event(Event ev) {
+    ev.order = sim.order++;
+    if(ev.kind == Event::WATCHDOG || ev.kind == Event::TIMER) ++sim.background_events;
+    sim.timeline.push(ev);
+    sim.wake.notify_one();
+}
+
+// caller holds the lock; records a write and returns it for the hook
+SimWrite record_write(unsigned gpio, unsigned level, SimWrite::Source source, uint32_t value, uint64_t at) {
+    SimWrite w { uint32_t(at), uint8_t(gpio), uint8_t(level ? 1 : 0), source, value };
+    sim.writes.push_back(w);
+    return w;
+}
+
+void call_write_hook(const SimWrite& w) {
+    SimWriteHook_t hook = sim.write_hook.load();
+    if(hook) hook(w, sim.write_hook_userdata.load());
+}
+
+// caller holds the lock; drives an output and queues the alert
+void apply_output(unsigned gpio, unsigned level) {
+    level = level ? 1 : 0;
+    if(sim.level[gpio] == level) return;
+    sim.level[gpio] = uint8_t(level);
+    if(gpio < SIM_USER_GPIOS){
+        push_event({ now_us(), 0, Event::REPORT, uint8_t(gpio), uint8_t(level), 0, 0 });
+    }
+}
+
+// caller holds the lock; the level a floating input settles at with its pull resistor
+void apply_pull(unsigned gpio) {
+    if(sim.driven[gpio] || sim.mode[gpio] != PI_INPUT) return;
+    if(sim.pud[gpio] == PI_PUD_UP) apply_output(gpio, 1);
+    else if(sim.pud[gpio] == PI_PUD_DOWN) apply_output(gpio, 0);
+}
+
+// the lock is held on entry and exit; released around the callback
+void deliver(std::unique_lock<std::mutex>& guard, unsigned gpio, unsigned level, uint32_t tick) {
+    AlertSlot slot = sim.alerts[gpio];
+    if(level != PI_TIMEOUT){
+        sim.filters[gpio].reported = uint8_t(level);
+        sim.watchdogs[gpio].last_report = now_us();
+    }
+    if(!slot.func && !slot.func_ex) return;
+
+    sim.dispatching = true;
+    guard.unlock();
+    if(slot.func_ex) slot.func_ex(int(gpio), int(level), tick, slot.userdata);
+    else slot.func(int(gpio), int(level), tick);
+    sim.alerts_delivered.fetch_add(1, std::memory_order_relaxed);
+    guard.lock();
+    sim.dispatching = false;
+}
+
+// the lock is held; decide whether a raw level change is reported now, later or never
+void filter_edge(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    FilterState& f = sim.filters[ev.gpio];
+    uint32_t tick = uint32_t(ev.due);
+    uint32_t steady = f.glitch_steady ? f.glitch_steady : f.noise_steady;
+
+    if(!steady || (f.noise_steady && ev.due < f.active_until)){
+        deliver(guard, ev.gpio, ev.level, tick);
+        return;
+    }
+    // level must hold for the steady period; any newer edge invalidates this check
+    ++f.generation;
+    push_event({ ev.due + steady, 0, Event::FILTER_CHECK, ev.gpio, ev.level, f.generation, tick });
+}
+
+void filter_check(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    FilterState& f = sim.filters[ev.gpio];
+    if(ev.generation != f.generation || sim.level[ev.gpio] != ev.level || f.reported == ev.level){
+        sim.edges_filtered.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if(f.noise_steady) f.active_until = ev.due + f.noise_active;
+    deliver(guard, ev.gpio, ev.level, ev.tick);
+}
+
+// the lock is held; apply one pulse of the transmitting wave and schedule the next
+void wave_pulse(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    if(ev.generation != sim.wave_generation || sim.wave_tx < 0) return;
+    auto it = sim.waves.find(unsigned(sim.wave_tx));
+    if(it == sim.waves.end() || it->second.pulses.empty()){
+        sim.wave_tx = -1;
+        return;
+    }
+    const std::vector<gpioPulse_t>& pulses = it->second.pulses;
+    const gpioPulse_t& pulse = pulses[sim.wave_index];
+
+    std::vector<SimWrite> recorded;
+    for(unsigned g = 0; g < SIM_USER_GPIOS; ++g){
+        uint32_t bit = 1u << g;
+        if(pulse.gpioOn & bit){ recorded.push_back(record_write(g, 1, SimWrite::SIM_WAVE, 1, ev.due)); apply_output(g, 1); }
+        if(pulse.gpioOff & bit){ recorded.push_back(record_write(g, 0, SimWrite::SIM_WAVE, 0, ev.due)); apply_output(g, 0); }
+    }
+
+    if(++sim.wave_index >= pulses.size()){
+        sim.wave_index = 0;
+        bool repeat = sim.wave_mode == PI_WAVE_MODE_REPEAT || sim.wave_mode == PI_WAVE_MODE_REPEAT_SYNC;
+        if(!repeat){
+            // the wave stays busy until the final delay has elapsed
+            sim.wave_busy_until = ev.due + pulse.usDelay;
+            sim.wave_tx = -1;
+        } else {
+            push_event({ ev.due + pulse.usDelay, 0, Event::WAVE_PULSE, 0, 0, sim.wave_generation, 0 });
+        }
+    } else {
+        push_event({ ev.due + pulse.usDelay, 0, Event::WAVE_PULSE, 0, 0, sim.wave_generation, 0 });
+    }
+
+    if(!recorded.empty()){
+        guard.unlock();
+        for(const SimWrite& w : recorded) call_write_hook(w);
+        guard.lock();
+    }
+}
+
+// the lock is held; like pigpio, a silent pin reports PI_TIMEOUT every timeout until it changes or is disarmed
+void watchdog(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    WatchdogState& w = sim.watchdogs[ev.gpio];
+    if(ev.generation != w.generation || !w.timeout_ms) return;
+    uint64_t timeout_us = uint64_t(w.timeout_ms) * 1000;
+    if(w.last_report + timeout_us > ev.due){
+        push_event({ w.last_report + timeout_us, 0, Event::WATCHDOG, ev.gpio, 0, ev.generation, 0 });
+        return;
+    }
+    w.last_report = ev.due; // the next timeout counts from this one
+    push_event({ ev.due + timeout_us, 0, Event::WATCHDOG, ev.gpio, 0, ev.generation, 0 });
+    deliver(guard, ev.gpio, PI_TIMEOUT, uint32_t(ev.due));
+}
+
+// the lock is held; the end of a gpioTrigger pulse
+void trigger_end(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    SimWrite w = record_write(ev.gpio, ev.level, SimWrite::SIM_TRIGGER, ev.level, ev.due);
+    apply_output(ev.gpio, ev.level);
+    guard.unlock();
+    call_write_hook(w);
+    guard.lock();
+}
+
+// the lock is held on entry and exit; released around the callback, which may change the timer
+void timer(std::unique_lock<std::mutex>& guard, const Event& ev) {
+    TimerState& t = sim.timers[ev.gpio];
+    if(ev.generation != t.generation || (!t.func && !t.func_ex)) return;
+    push_event({ ev.due + uint64_t(t.millis) * 1000, 0, Event::TIMER, ev.gpio, 0, ev.generation, 0 });
+    TimerState call = t;
+    sim.dispatching = true;
+    guard.unlock();
+    timer_dispatch = true;
+    timer_due = ev.due;
+    if(call.func_ex) call.func_ex(call.userdata);
+    else call.func();
+    timer_dispatch = false;
+    guard.lock();
+    sim.dispatching = false;
+}
+
+void alert_thread() {
+    std::unique_lock<std::mutex> guard(sim.lock);
+    while(sim.running){
+        if(sim.timeline.size() == sim.background_events) sim.idle.notify_all();
+        if(sim.timeline.empty()){
+            sim.wake.wait(guard);
+            continue;
+        }
+        Event ev = sim.timeline.top();
+        uint64_t now = now_us();
+        if(ev.due > now){
+            sim.wake.wait_for(guard, std::chrono::microseconds(ev.due - now));
+            continue;
+        }
+        sim.timeline.pop();
+        if(ev.kind == Event::WATCHDOG || ev.kind == Event::TIMER) --sim.background_events;
+
+        switch(ev.kind){
+            case Event::EDGE:
+                if(sim.level[ev.gpio] == ev.level) break;
+                sim.level[ev.gpio] = ev.level;
+                if(ev.gpio < SIM_USER_GPIOS) filter_edge(guard, ev);
+                break;
+            case Event::REPORT:
+                filter_edge(guard, ev);
+                break;
+            case Event::FILTER_CHECK:
+                filter_check(guard, ev);
+                break;
+            case Event::WAVE_PULSE:
+                wave_pulse(guard, ev);
+                break;
+            case Event::WATCHDOG:
+                watchdog(guard, ev);
+                break;
+            case Event::TRIGGER_END:
+                trigger_end(guard, ev);
+                break;
+            case Event::TIMER:
+                timer(guard, ev);
+                break;
+        }
+    }
+    sim.idle.notify_all();
+}
+
+} // namespace
+
+#define SIM_CHECK_INIT() if(!sim.initialised) return PI_NOT_INITIALISED
+#define SIM_CHECK_GPIO(g) if((g) >= SIM_GPIOS) return PI_BAD_GPIO
+#define SIM_CHECK_USER_GPIO(g) if((g) >= SIM_USER_GPIOS) return PI_BAD_USER_GPIO
+
+/* pigpio API */
+
+int gpioInitialise(void) {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    if(sim.initialised) return PIGPIO_VERSION;
+    if(!sim.epoch_set){
+        // ticks keep counting across re-initialisation, like the real tick counter
+        sim.epoch = std::chrono::steady_clock::now();
+        sim.epoch_set = true;
+    }
+    sim.initialised = true;
+    sim.running = true;
+    sim.alert_thread = std::thread(&alert_thread);
+    return PIGPIO_VERSION;
+}
+
+void gpioTerminate(void) {
+    {
+        std::lock_guard<std::mutex> guard(sim.lock);
+        if(!sim.initialised) return;
+        sim.running = false;
+        sim.initialised = false;
+        sim.wake.notify_all();
+    }
+    if(sim.alert_thread.joinable()) sim.alert_thread.join();
+
+    std::lock_guard<std::mutex> guard(sim.lock);
+    while(!sim.timeline.empty()) sim.timeline.pop();
+    sim.background_events = 0;
+    for(auto& slot : sim.alerts) slot = {};
+    for(auto& f : sim.filters) f = {};
+    for(auto& w : sim.watchdogs) w = { 0, w.generation + 1, 0 };
+    for(auto& t : sim.timers) t = { 0, nullptr, nullptr, nullptr, t.generation + 1 };
+    sim.wave_tx = -1;
+    ++sim.wave_generation;
+}
+
+int gpioSetMode(unsigned gpio, unsigned mode) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_GPIO(gpio);
+    if(mode > PI_ALT3) return PI_BAD_MODE;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.mode[gpio] = uint8_t(mode);
+    apply_pull(gpio);
+    return 0;
+}
+
+int gpioGetMode(unsigned gpio) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_GPIO(gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.mode[gpio];
+}
+
+int gpioSetPullUpDown(unsigned gpio, unsigned pud) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_GPIO(gpio);
+    if(pud > PI_PUD_UP) return PI_BAD_PUD;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.pud[gpio] = uint8_t(pud);
+    apply_pull(gpio);
+    return 0;
+}
+
+int gpioRead(unsigned gpio) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_GPIO(gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.level[gpio];
+}
+
+int gpioWrite(unsigned gpio, unsigned level) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_GPIO(gpio);
+    if(level > PI_ON) return PI_BAD_LEVEL;
+    SimWrite w;
+    {
+        std::lock_guard<std::mutex> guard(sim.lock);
+        if(gpio < SIM_USER_GPIOS) sim.pwm_duty[gpio] = 0; // a write switches PWM off
+        w = record_write(gpio, level, SimWrite::SIM_WRITE, level, write_time());
+        apply_output(gpio, level);
+    }
+    call_write_hook(w);
+    return 0;
+}
+
+int gpioTrigger(unsigned user_gpio, unsigned pulseLen, unsigned level) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    if(pulseLen < 1 || pulseLen > 100) return PI_BAD_PULSELEN;
+    if(level > PI_ON) return PI_BAD_LEVEL;
+    SimWrite w;
+    {
+        std::lock_guard<std::mutex> guard(sim.lock);
+        sim.pwm_duty[user_gpio] = 0;
+        uint64_t at = write_time();
+        w = record_write(user_gpio, level, SimWrite::SIM_TRIGGER, level, at);
+        apply_output(user_gpio, level);
+        push_event({ at + pulseLen, 0, Event::TRIGGER_END, uint8_t(user_gpio), uint8_t(!level), 0, 0 });
+    }
+    call_write_hook(w);
+    return 0;
+}
+
+uint32_t gpioRead_Bits_0_31(void) {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    uint32_t bits = 0;
+    for(unsigned g = 0; g < 32; ++g){
+        if(sim.level[g]) bits |= 1u << g;
+    }
+    return bits;
+}
+
+uint32_t gpioRead_Bits_32_53(void) {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    uint32_t bits = 0;
+    for(unsigned g = 32; g < SIM_GPIOS; ++g){
+        if(sim.level[g]) bits |= 1u << (g - 32);
+    }
+    return bits;
+}
+
+static int write_bank(uint32_t bits, unsigned base, unsigned level) {
+    SIM_CHECK_INIT();
+    std::array<SimWrite, 32> recorded; // on the caller's stack, a bank write allocates nothing of its own
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> guard(sim.lock);
+        for(unsigned b = 0; b < 32 && base + b < SIM_GPIOS; ++b){
+            if(!(bits & (1u << b))) continue;
+            recorded[count++] = record_write(base + b, level, SimWrite::SIM_WRITE_BITS, level, write_time());
+            apply_output(base + b, level);
+        }
+    }
+    for(size_t n = 0; n < count; ++n) call_write_hook(recorded[n]);
+    return 0;
+}
+
+int gpioWrite_Bits_0_31_Clear(uint32_t bits) { return write_bank(bits, 0, 0); }
+int gpioWrite_Bits_32_53_Clear(uint32_t bits) { return write_bank(bits, 32, 0); }
+int gpioWrite_Bits_0_31_Set(uint32_t bits) { return write_bank(bits, 0, 1); }
+int gpioWrite_Bits_32_53_Set(uint32_t bits) { return write_bank(bits, 32, 1); }
+
+int gpioSetAlertFunc(unsigned user_gpio, gpioAlertFunc_t f) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.alerts[user_gpio] = { f, nullptr, nullptr };
+    return 0;
+}
+
+int gpioSetAlertFuncEx(unsigned user_gpio, gpioAlertFuncEx_t f, void *userdata) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.alerts[user_gpio] = { nullptr, f, userdata };
+    return 0;
+}
+
+int gpioGlitchFilter(unsigned user_gpio, unsigned steady) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    if(steady > PI_MAX_STEADY) return PI_BAD_FILTER;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    FilterState& f = sim.filters[user_gpio];
+    f.glitch_steady = steady;
+    f.reported = sim.level[user_gpio];
+    ++f.generation;
+    return 0;
+}
+
+int gpioNoiseFilter(unsigned user_gpio, unsigned steady, unsigned active) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    if(steady > PI_MAX_STEADY || active > PI_MAX_ACTIVE) return PI_BAD_FILTER;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    FilterState& f = sim.filters[user_gpio];
+    f.noise_steady = steady;
+    f.noise_active = active;
+    f.active_until = 0;
+    f.reported = sim.level[user_gpio];
+    ++f.generation;
+    return 0;
+}
+
+int gpioSetWatchdog(unsigned user_gpio, unsigned timeout) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    if(timeout > PI_MAX_WDOG_TIMEOUT) return PI_BAD_WDOG_TIMEOUT;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    WatchdogState& w = sim.watchdogs[user_gpio];
+    w.timeout_ms = timeout;
+    w.last_report = now_us();
+    ++w.generation;
+    if(timeout) push_event({ w.last_report + uint64_t(timeout) * 1000, 0, Event::WATCHDOG, uint8_t(user_gpio), 0, w.generation, 0 });
+    return 0;
+}
+
+int gpioPWM(unsigned user_gpio, unsigned dutycycle) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    SimWrite w;
+    {
+        std::lock_guard<std::mutex> guard(sim.lock);
+        if(dutycycle > sim.pwm_range[user_gpio]) return PI_BAD_DUTYCYCLE;
+        sim.pwm_duty[user_gpio] = dutycycle;
+        sim.mode[user_gpio] = PI_OUTPUT;
+        w = record_write(user_gpio, dutycycle != 0, SimWrite::SIM_PWM, dutycycle, write_time());
+        // only fully off / fully on duty cycles settle at a steady level
+        if(dutycycle == 0) apply_output(user_gpio, 0);
+        else if(dutycycle == sim.pwm_range[user_gpio]) apply_output(user_gpio, 1);
+    }
+    call_write_hook(w);
+    return 0;
+}
+
+int gpioGetPWMdutycycle(unsigned user_gpio) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return int(sim.pwm_duty[user_gpio]);
+}
+
+int gpioSetPWMrange(unsigned user_gpio, unsigned range) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    if(range < PI_MIN_DUTYCYCLE_RANGE || range > PI_MAX_DUTYCYCLE_RANGE) return PI_BAD_DUTYRANGE;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    // pigpio rescales the active duty cycle to the new range
+    sim.pwm_duty[user_gpio] = uint32_t(uint64_t(sim.pwm_duty[user_gpio]) * range / sim.pwm_range[user_gpio]);
+    sim.pwm_range[user_gpio] = range;
+    return int(range);
+}
+
+int gpioGetPWMrange(unsigned user_gpio) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return int(sim.pwm_range[user_gpio]);
+}
+
+int gpioGetPWMrealRange(unsigned user_gpio) {
+    return gpioGetPWMrange(user_gpio);
+}
+
+int gpioSetPWMfrequency(unsigned user_gpio, unsigned frequency) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.pwm_freq[user_gpio] = frequency;
+    return int(frequency);
+}
+
+int gpioGetPWMfrequency(unsigned user_gpio) {
+    SIM_CHECK_INIT();
+    SIM_CHECK_USER_GPIO(user_gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return int(sim.pwm_freq[user_gpio]);
+}
+
+int gpioWaveClear(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.wave_building.clear();
+    sim.waves.clear();
+    sim.wave_tx = -1;
+    ++sim.wave_generation;
+    return 0;
+}
+
+int gpioWaveAddNew(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.wave_building.clear();
+    return 0;
+}
+
+int gpioWaveAddGeneric(unsigned numPulses, gpioPulse_t *pulses) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.wave_building.insert(sim.wave_building.end(), pulses, pulses + numPulses);
+    return int(sim.wave_building.size());
+}
+
+int gpioWaveCreate(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    if(sim.wave_building.empty()) return PI_EMPTY_WAVEFORM;
+    unsigned id = 0;
+    while(sim.waves.count(id)) ++id;
+    if(id >= PI_MAX_WAVES) return PI_NO_WAVEFORM_ID;
+    Wave& wave = sim.waves[id];
+    wave.pulses = std::move(sim.wave_building);
+    for(const gpioPulse_t& p : wave.pulses) wave.micros += p.usDelay;
+    sim.wave_building.clear();
+    return int(id);
+}
+
+int gpioWaveDelete(unsigned wave_id) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    if(!sim.waves.erase(wave_id)) return PI_BAD_WAVE_ID;
+    return 0;
+}
+
+int gpioWaveTxSend(unsigned wave_id, unsigned wave_mode) {
+    SIM_CHECK_INIT();
+    if(wave_mode > PI_WAVE_MODE_REPEAT_SYNC) return PI_BAD_WAVE_MODE;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    auto it = sim.waves.find(wave_id);
+    if(it == sim.waves.end()) return PI_BAD_WAVE_ID;
+    sim.wave_tx = int(wave_id);
+    sim.wave_mode = wave_mode;
+    sim.wave_index = 0;
+    push_event({ now_us(), 0, Event::WAVE_PULSE, 0, 0, ++sim.wave_generation, 0 });
+    return int(it->second.pulses.size());
+}
+
+int gpioWaveTxBusy(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.wave_tx >= 0 || now_us() < sim.wave_busy_until;
+}
+
+int gpioWaveTxAt(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.wave_tx >= 0 ? sim.wave_tx : PI_NO_TX_WAVE;
+}
+
+int gpioWaveTxStop(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.wave_tx = -1;
+    sim.wave_busy_until = 0;
+    ++sim.wave_generation;
+    return 0;
+}
+
+int gpioWaveGetMicros(void) {
+    SIM_CHECK_INIT();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.wave_tx >= 0 ? int(sim.waves[unsigned(sim.wave_tx)].micros) : 0;
+}
+
+static int set_timer(unsigned timer, unsigned millis, gpioTimerFunc_t f, gpioTimerFuncEx_t f_ex, void* userdata) {
+    SIM_CHECK_INIT();
+    if(timer > PI_MAX_TIMER) return PI_BAD_TIMER;
+    if(millis < PI_MIN_MS || millis > PI_MAX_MS) return PI_BAD_MS;
+    std::lock_guard<std::mutex> guard(sim.lock);
+    TimerState& t = sim.timers[timer];
+    t = { millis, f, f_ex, userdata, t.generation + 1 };
+    if(f || f_ex) push_event({ now_us() + uint64_t(millis) * 1000, 0, Event::TIMER, uint8_t(timer), 0, t.generation, 0 });
+    return 0;
+}
+
+int gpioSetTimerFunc(unsigned timer, unsigned millis, gpioTimerFunc_t f) {
+    return set_timer(timer, millis, f, nullptr, nullptr);
+}
+
+int gpioSetTimerFuncEx(unsigned timer, unsigned millis, gpioTimerFuncEx_t f, void *userdata) {
+    return set_timer(timer, millis, nullptr, f, userdata);
+}
+
+uint32_t gpioTick(void) {
+    return uint32_t(now_us());
+}
+
+uint32_t gpioDelay(uint32_t micros) {
+    uint32_t start = gpioTick();
+    std::this_thread::sleep_for(std::chrono::microseconds(micros));
+    return gpioTick() - start;
+}
+
+/* Simulation control */
+
+int simInjectEdge(unsigned gpio, unsigned level) {
+    SIM_CHECK_GPIO(gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.driven[gpio] = true;
+    push_event({ now_us(), 0, Event::EDGE, uint8_t(gpio), uint8_t(level ? 1 : 0), 0, 0 });
+    return 0;
+}
+
+int simLoseEdge(unsigned gpio, unsigned level) {
+    SIM_CHECK_GPIO(gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.driven[gpio] = true;
+    sim.level[gpio] = uint8_t(level ? 1 : 0);
+    return 0;
+}
+
+int simScheduleEdge(unsigned gpio, unsigned level, uint32_t tick) {
+    SIM_CHECK_GPIO(gpio);
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.driven[gpio] = true;
+    push_event({ tick_to_us(tick), 0, Event::EDGE, uint8_t(gpio), uint8_t(level ? 1 : 0), 0, 0 });
+    return 0;
+}
+
+uint32_t simScript(const SimEdge* edges, size_t count) {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    uint64_t at = now_us();
+    for(size_t i = 0; i < count; ++i){
+        if(edges[i].gpio >= SIM_GPIOS) continue;
+        at += edges[i].delay_us;
+        sim.driven[edges[i].gpio] = true;
+        push_event({ at, 0, Event::EDGE, edges[i].gpio, uint8_t(edges[i].level ? 1 : 0), 0, 0 });
+    }
+    return uint32_t(at);
+}
+
+uint32_t simScript(const std::vector<SimEdge>& edges) {
+    return simScript(edges.data(), edges.size());
+}
+
+uint32_t simPulseTrain(unsigned gpio, unsigned count, uint32_t period_us) {
+    if(gpio >= SIM_GPIOS) return gpioTick();
+    std::lock_guard<std::mutex> guard(sim.lock);
+    uint64_t at = now_us();
+    uint8_t level = sim.level[gpio];
+    sim.driven[gpio] = true;
+    for(unsigned i = 0; i < count; ++i){
+        level ^= 1;
+        at += period_us;
+        push_event({ at, 0, Event::EDGE, uint8_t(gpio), level, 0, 0 });
+    }
+    return uint32_t(at);
+}
+
+bool simWaitIdle(uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(sim.lock);
+    return sim.idle.wait_for(guard, std::chrono::milliseconds(timeout_ms), [](){
+        return !sim.running || (sim.timeline.size() == sim.background_events && !sim.dispatching); // an armed watchdog never goes idle
+    });
+}
+
+std::vector<SimWrite> simGetWrites() {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    return sim.writes;
+}
+
+void simClearWrites() {
+    std::lock_guard<std::mutex> guard(sim.lock);
+    sim.writes.clear();
+}
+
+void simSetWriteHook(SimWriteHook_t hook, void* userdata) {
+    sim.write_hook_userdata = userdata;
+    sim.write_hook = hook;
+}
+
+uint64_t simAlertsDelivered() {
+    return sim.alerts_delivered.load();
+}
+
+uint64_t simEdgesFiltered() {
+    return sim.edges_filtered.load();
+}
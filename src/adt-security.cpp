@@ -1,9 +1,15 @@
 #include "adt-security.h"
 #include <regex>
-
-SecuritySystem::SecuritySystem(const std::string& config_string):
-mqtt(nullptr), zone_manager(nullptr),
-system_online(false),
+#include <ctime>
+#include <charconv>
+#include <cstdio>
+#include <unistd.h>
+
+SecuritySystem::SecuritySystem(const std::string& config_string, const HandoffState* takeover):
+mqtt(nullptr), zone_manager(nullptr), remote_gpio(nullptr), expander_bus(nullptr), federation(nullptr),
+local_gpio(false),
+system_online(false), upgrade_requested(false), takeover_session(false), auto_refresh_timer(0), metrics_interval(60),
+zone_thread_stop(false),
 serial_number(calculate_serial())
 
 {
@@ -11,40 +17,69 @@ serial_number(calculate_serial())
 
     // import system config
     if(!config.parseString(config_string)){
-        std::cerr << "failed to load config\n";
+        Logger::error("failed to load config");
         return;
     }
 
+    std::string log_level;
+    Logger::Level level;
+    if(config.loadProperty("log_level", log_level) && Logger::parse_level(log_level, level)){
+        Logger::set_level(level);
+    }
+
     int gpio_state = gpioInitialise();
-    
-    if(gpio_state != PIGPIO_VERSION){
+    local_gpio = gpio_state == PIGPIO_VERSION;
+
+    remote_gpio = new RemoteGPIOManager(config); // connects to every configured pigpiod host
+
+    std::string pjon_port;
+    if(config.loadProperty("pjon_port", pjon_port) && !pjon_port.empty()){
+        expander_bus = new PJONExpanderBus(config);
+    }
+
+    int federation_id = -1;
+    if(config.loadProperty("federation_id", federation_id)){
+        if(federation_id >= 1 && federation_id <= 253){
+            federation = new PJONFederation(config);
+        } else {
+            Logger::warn("federation_id must be between 1 and 253, federation is disabled");
+        }
+    }
+
+    if(!local_gpio){
         gpioTerminate();
-        std::cerr << "failed to initialize GPIO!\n";
-        return;
+        if(remote_gpio->count() == 0 && !expander_bus && !federation){
+            Logger::error("failed to initialize GPIO!");
+            return;
+        }
+        Logger::warn("failed to initialize local GPIO, only remote zones are available");
     }
 
     config.loadProperty("name", system_name);
     config.loadProperty("system_runtime_name", system_uptime_name);
     config.loadProperty("auto_refresh_states", auto_refresh_timer);
+    config.loadProperty("metrics_interval", metrics_interval);
+    realtime.load(config);
+    outbound.load(config);
     
     // load mqtt settings
-    uint8_t ip[4];
-    int port;
-    std::string ip_address, user, password;
-    config.loadProperty("mqtt_ip", ip_address);
-    std::cout << ip_address << "\n";
-    size_t p=0;
-    for(int i=0;i < 4;++i){
-        int xp = ip_address.find_first_of(".",p);
-        std::string oct = ip_address.substr(p,xp - p);
-        p = xp + 1;
-        ip[i] = uint8_t(std::stoi(oct));
-    }
-    config.loadProperty("mqtt_port", port);
+    std::string user, password, version = "5";
+    int session_expiry = 300, keepalive = 60;
+    if(!brokers.load(config)){
+        Logger::error("no mqtt broker is configured");
+        return;
+    }
     config.loadProperty("mqtt_user", user);
     config.loadProperty("mqtt_password", password);
     config.loadProperty("birth", mqtt_birth_payload);
     config.loadProperty("will", mqtt_will_payload);
+    config.loadProperty("mqtt_version", version);
+    config.loadProperty("mqtt_session_expiry", session_expiry);
+    config.loadProperty("mqtt_keepalive", keepalive);
+    if(version != "5" && version != "3.1.1"){
+        Logger::warn("unknown mqtt_version {}, asking for 5", version);
+        version = "5";
+    }
     
     // load mqtt topics
     mqtt_topic_version_info = system_name + "/version";
@@ -55,38 +90,62 @@ serial_number(calculate_serial())
     mqtt_topic_homeassistant_status = "homeassistant/status";
     mqtt_topic_system_status = system_name + "/system/status";
     mqtt_topic_system_command = system_name + "/system/command";
-
-    std::cout << user << ":" << password << "@" << int(ip[0]) << "." << int(ip[1]) << "." << int(ip[2]) << "." << int(ip[3]) << ":" << port << "\n";
+    mqtt_topic_event = system_name + "/event";
+    mqtt_topic_alarm_state = system_name + "/alarm";
+    mqtt_topic_alarm_command = system_name + "/alarm/set";
+    mqtt_topic_alarm_attributes = system_name + "/alarm/attr";
+    mqtt_topic_alarm_bypass = system_name + "/alarm/bypass";
+    mqtt_topic_metrics = system_name + "/metrics";
+    mqtt_topic_button_press = system_name + "/press";
+    mqtt_topic_group_command = system_name + "/group/set";
+
+    Logger::info("mqtt brokers: {}", brokers.describe());
     // initialize mqtt
-    mqtt = new ReconnectingMqttClient(ip, port, system_name.c_str());
+    mqtt = new ReconnectingMqttClient();
+    mqtt->client_id = system_name;
+    mqtt->set_connector(&BrokerEndpoints::connect, &brokers);
+    mqtt->keepalive_s = uint16_t(std::clamp(keepalive, 4, 65535));
     mqtt->user = user;
     mqtt->password = password;
     mqtt->will_topic = mqtt_topic_system_status;
     mqtt->will_payload = mqtt_will_payload;
+    mqtt->protocol_level = version == "5" ? 5 : 4; // 5 falls back to 3.1.1 on its own
+    mqtt->session_expiry_s = uint32_t(std::max(0, session_expiry));
     
     mqtt->set_receive_callback(&SecuritySystem::static_mqtt_rx_callback, this);
     mqtt->set_on_connect_callback(&SecuritySystem::static_mqtt_on_connect_callback, this);
+    mqtt->set_reason_code_callback(&SecuritySystem::static_mqtt_reason_callback, this);
 
     zone_manager = new ZoneManager(this); // Zone manager will load Zones, which may depend on a valid MQTT object
+    if(takeover) zone_manager->restore_state(*takeover); // ahead of the first pass, only what changed in between is published
+
+    if(federation){
+        // every zone of this controller is replicated once it first reports, mirrors of peer zones are not passed on
+        for(const auto& zone : zone_manager->get_zones()){
+            if(!dynamic_cast<const Federated_Zone*>(zone.get())) federation->export_zone(zone->get_unique_id());
+        }
+    }
     
     {
         JsonLoader info;
         info.saveProperty("gpio_version", PIGPIO_VERSION);
         info.saveProperty("gpio_state", gpio_state);
-        info.saveProperty("mqtt_version", mqtt->MQTT_VERSION);
+        info.saveProperty("mqtt_version", mqtt->version()); // corrected once connected
         info.saveProperty("adt_version", int(SYS_VERSION));
         info.saveProperty("adt_serial", serial_number);
         info.saveProperty("adt_zones", zone_manager->get_zones().size());
+        info.saveProperty("remote_hosts", remote_gpio->count());
         
         system_version_json = info.toString();
     }
 
-    connect(); // This will initialize the MQTT system and subscribe to all relavent topics
+    connect(takeover); // This will initialize the MQTT system and subscribe to all relavent topics
 }
 
 SecuritySystem::~SecuritySystem() {    
     if(mqtt != nullptr && mqtt->is_connected()){
-        mqtt_pub(mqtt_topic_system_status, "offline");
+        mqtt_pub(mqtt_topic_system_status, "offline", false, 1, OutboundQueue::DIAGNOSTIC);
+        drain_outbound(true);
 
         for(const auto& [topic,callback] : sub_hooks){
             mqtt->unsubscribe(topic.c_str()); // unsubscribe all topics
@@ -99,12 +158,21 @@ SecuritySystem::~SecuritySystem() {
     delete zone_manager;
     zone_manager = nullptr;
 
-    gpioTerminate();
+    delete remote_gpio;
+    remote_gpio = nullptr;
+
+    delete expander_bus;
+    expander_bus = nullptr;
+
+    delete federation;
+    federation = nullptr;
+
+    if(local_gpio) gpioTerminate();
 }
 
 // this function is called once in the class initializer list
 std::string SecuritySystem::calculate_serial() {
-    std::cout << "calculate serial...\n";
+    Logger::info("calculate serial...");
     std::string serial = "NULL";
 
     std::stringstream proc;
@@ -135,37 +203,57 @@ std::string SecuritySystem::calculate_serial() {
 }
 
 void SecuritySystem::static_mqtt_rx_callback(const char *topic, const uint8_t *payload, uint16_t len, void *_this) {
-    static_cast<SecuritySystem*>(_this)->mqtt_rx_callback(topic, std::string((const char*)payload,len));
+    static_cast<SecuritySystem*>(_this)->mqtt_rx_callback(topic, std::string_view((const char*)payload, len));
 }
 
 void SecuritySystem::static_mqtt_on_connect_callback(uint64_t retries, void *_this) {
     static_cast<SecuritySystem*>(_this)->mqtt_on_connect_callback(retries);
 }
 
-void SecuritySystem::mqtt_rx_callback(const std::string& topic, const std::string& message) {
+void SecuritySystem::static_mqtt_reason_callback(uint8_t packet_type, uint16_t msg_id, uint8_t reason, void*) {
+    // these come from the broker in answer to one of our packets, the id is all there is to go by
+    Logger::warn("broker refused {} {}: reason code {}", packet_type == 0x40 ? "publish" : "subscription", msg_id, reason);
+}
+
+void SecuritySystem::mqtt_rx_callback(std::string_view topic, std::string_view message) {
     // handle wild card subscribed topics
     for(const auto& [ktop,cbs] : sub_hooks){
         if(topic.size() < ktop.size() - 1 || (!ktop.ends_with("#") && !ktop.ends_with("+"))) continue;
-        if( topic.find_first_of(ktop.substr(0, ktop.size() - 1)) == 0) {
+        if( topic.starts_with(std::string_view(ktop).substr(0, ktop.size() - 1)) ) {
             for(const auto& cb : cbs){
                 cb(topic, message);
             }
         }
     }
 
-    if(!sub_hooks.count(topic)) return;
+    auto hooks = sub_hooks.find(topic);
+    if(hooks == sub_hooks.end()) return;
     // handle standard subscribed topics
-    for(const auto& cb : sub_hooks.at(topic)){
+    for(const auto& cb : hooks->second){
         cb(topic, message);
     }
 }
 
-bool SecuritySystem::mqtt_pub(const std::string& topic, const std::string& payload, bool retain, uint8_t qos) {
-    return mqtt->is_connected() ? mqtt->publish(topic.c_str(), payload.c_str(), retain, qos) : false;
+bool SecuritySystem::mqtt_pub(const char* topic, std::string_view payload, bool retain, uint8_t qos, OutboundQueue::Priority priority, bool replaceable) {
+    // the client is not thread safe and the socket may be slow, the I/O thread sends this as the socket allows
+    return outbound.push(priority, topic, payload, retain, qos, replaceable);
+}
+
+void SecuritySystem::drain_outbound(bool flush) {
+    auto fits = [&](size_t bytes){ return flush || mqtt->can_write(bytes); };
+    const OutboundQueue::Message* msg;
+    while(mqtt->is_connected() && (msg = outbound.pop(fits))){
+        if(!mqtt->publish(msg->topic.c_str(), (const uint8_t*)msg->payload.data(), uint16_t(msg->payload.size()), msg->retain, msg->qos)) break;
+    }
+    if(flush && !mqtt->flush(FLUSH_TIMEOUT_MS)) Logger::warn("the broker did not take every queued publish within {}ms", FLUSH_TIMEOUT_MS);
+}
+
+std::unique_lock<std::mutex> SecuritySystem::lock_zones() {
+    return realtime.enabled ? std::unique_lock<std::mutex>(zone_lock) : std::unique_lock<std::mutex>();
 }
 
 bool SecuritySystem::mqtt_sub(const std::string& topic, MQTTCallback cb, uint8_t qos) {
-    bool status = mqtt->subscribe(topic.c_str(), qos);
+    bool status = takeover_session || mqtt->subscribe(topic.c_str(), qos);
 
     if(status){
         if(!sub_hooks.count(topic)){
@@ -174,8 +262,8 @@ bool SecuritySystem::mqtt_sub(const std::string& topic, MQTTCallback cb, uint8_t
 
         sub_hooks.at(topic).push_back(cb);
         sub_hooks.at(topic).push_back(
-            [](const std::string& topic, const std::string& message){
-                std::cout << topic << " : " << message << std::endl;
+            [](std::string_view topic, std::string_view message){
+                Logger::debug("{} : {}", topic, message);
             }
         );
     }
@@ -183,57 +271,92 @@ bool SecuritySystem::mqtt_sub(const std::string& topic, MQTTCallback cb, uint8_t
 }
 
 
-void SecuritySystem::connect() {
+void SecuritySystem::connect(const HandoffState* takeover) {
     if(mqtt->is_connected() || system_online){
         system_online = true;
         return;
     }
 
-    mqtt->connect();
+    if(takeover && mqtt->adopt_socket(takeover->mqtt_fd, takeover->mqtt_msg_id, takeover->mqtt_level, takeover->mqtt_alias_max)){
+        // no CONNECT, no resubscribe and no discovery, Home Assistant sees the same session carry on
+        Logger::info("carrying on the MQTT session of the previous process");
+        takeover_session = true;
+        system_online = true;
+    } else {
+        if(takeover) Logger::warn("no MQTT session was handed over, connecting again");
+        mqtt->connect();
+    }
 
     Clock timeout;
     while(!mqtt->is_connected() && timeout.getSeconds() < 10){
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if(!takeover_session) mqtt->connect(); // broker names may still be resolving, or the first broker is down
     }
 
     if(!mqtt->is_connected()){
-        std::cout << "failed to connect to MQTT broker\n";
+        Logger::warn("failed to connect to MQTT broker");
         system_online = false;
         return;
     }
 
     // subscribe to essential topics
-    mqtt_sub(mqtt_topic_homeassistant_status, [=,this](const std::string& topic, const std::string& status){
+    mqtt_sub(mqtt_topic_homeassistant_status, [=,this](std::string_view, std::string_view status){
         if(status == "online") autodiscover();
     });
-    mqtt_sub(mqtt_topic_system_command, [=,this](const std::string& topic, const std::string& command){
+    mqtt_sub(mqtt_topic_system_command, [=,this](std::string_view, std::string_view command){
         std::map<std::string, std::function<void()>> commands {
             {"shutdown", [=,this](){
                 shutdown_system();
             }}
         };
 
-        if(commands.count(command)){
-            commands.at(command)();
+        auto it = commands.find(std::string(command));
+        if(it != commands.end()){
+            it->second();
         }
     });
 
-    mqtt_sub(mqtt_topic_entity_update + "/+",[=,this](const std::string& topic, const std::string& payload){
+    mqtt_sub(mqtt_topic_entity_update + "/+",[=,this](std::string_view topic, std::string_view payload){
         handle_device_commands(topic.substr(topic.find_last_of("/") + 1), payload);
     });
+
+    mqtt_sub(mqtt_topic_group_command, [=,this](std::string_view, std::string_view payload){
+        Logger::info("group command: {}", payload);
+        auto guard = lock_zones();
+        zone_manager->command_outputs(payload);
+    });
+
+    if(zone_manager->get_alarm()){
+        mqtt_sub(mqtt_topic_alarm_command, [=,this](std::string_view, std::string_view payload){
+            auto guard = lock_zones();
+            zone_manager->get_alarm()->command(std::string(payload));
+        });
+        mqtt_sub(mqtt_topic_alarm_bypass + "/+", [=,this](std::string_view topic, std::string_view payload){
+            auto guard = lock_zones();
+            zone_manager->get_alarm()->set_bypass(std::string(topic.substr(topic.find_last_of("/") + 1)), payload == "1");
+        });
+    }
+    takeover_session = false;
 }
 
 // When the MQTT system is connected OR the MQTT system reconnects after an inturruption
 void SecuritySystem::mqtt_on_connect_callback(uint64_t retries) {
     system_online = true;
+    Logger::info("connected to the MQTT broker with MQTT {}{}", mqtt->version(), mqtt->was_session_resumed() ? ", session resumed" : "");
 
-    if(retries > 0){
+    // a resumed session still holds the subscriptions
+    if(retries > 0 && !mqtt->was_session_resumed()){
         for(const auto& [topic,cbs] : sub_hooks){
             mqtt->subscribe(topic.c_str());
         }
     }
 
-    mqtt_pub(mqtt_topic_version_info, system_version_json);
+    JsonLoader info;
+    if(info.parseString(system_version_json)){
+        info.saveProperty("mqtt_version", mqtt->version());
+        system_version_json = info.toString();
+    }
+    mqtt_pub(mqtt_topic_version_info, system_version_json, false, 1, OutboundQueue::DIAGNOSTIC);
     autodiscover();
 }
 
@@ -241,96 +364,340 @@ void SecuritySystem::mqtt_on_connect_callback(uint64_t retries) {
     Generate the MQTT Device Discovery for HASS
     Dynamically load all Zones, then generate the device discovery payload
 */
-void SecuritySystem::autodiscover() {
-    JsonLoader json;
-
-    JsonLoader::Object dev;
-    json.saveProperty(dev, "name", system_uptime_name);
-    json.saveProperty(dev, "mf", std::string(""));
-    json.saveProperty(dev, "mdl", std::string(""));
-    json.saveProperty(dev, "sw", std::to_string(SYS_VERSION));
-    json.saveProperty(dev, "hw", cpuinfo.count("CPU revision") ? cpuinfo.at("CPU revision") : "");
-    JsonLoader::Array ids;
-    json.appendArrayValue(ids, serial_number);
-    json.savePropertyArray(dev, "ids", ids);
-    json.saveProperty("dev", dev);
-    
-    JsonLoader::Object o;
-    json.saveProperty(o, "name", std::string("adt2mqtt"));
-    json.saveProperty(o, "sw", std::string(mqtt->MQTT_VERSION));
-    json.saveProperty(o, "url", std::string("https://github.com/jmscreation"));
-    json.saveProperty("o", o);
-
-    json.saveProperty("availability_topic", mqtt_topic_system_status);
-    json.saveProperty("qos", std::string("1"));
-
-    JsonLoader::Object cmps;
-    for(const auto& ptr : zone_manager->get_zones()){
-        const Zone& zone = *ptr;
-        
-        JsonLoader::Object cmp;
-        json.parseStringObject(zone.get_meta(), cmp);
-        
-        std::string name,id; // used for topic population
-        json.loadProperty(cmp, "name", name);
-        json.loadProperty(cmp, "unique_id", id);
+void SecuritySystem::format_discovery() {
+    std::string& out = device_discovery_payload;
+    const auto& zones = zone_manager->get_zones();
+    size_t bytes = 512;
+    for(const auto& zone : zones) bytes += zone->get_discovery().size() + 1;
+    out.clear();
+    out.reserve(bytes);
+
+    out += '{';
+    append_json_key(out, "dev");
+    out += '{';
+    append_json_field(out, "name", system_uptime_name);
+    append_json_field(out, "mf", "");
+    append_json_field(out, "mdl", "");
+    append_json_field(out, "sw", std::to_string(SYS_VERSION));
+    append_json_field(out, "hw", cpuinfo.count("CPU revision") ? cpuinfo.at("CPU revision") : "");
+    append_json_key(out, "ids");
+    out += '[';
+    append_json_string(out, serial_number);
+    out += "]}";
+
+    append_json_key(out, "o");
+    out += '{';
+    append_json_field(out, "name", "adt2mqtt");
+    append_json_field(out, "sw", mqtt->version());
+    append_json_field(out, "url", "https://github.com/jmscreation");
+    out += '}';
+
+    append_json_field(out, "availability_topic", mqtt_topic_system_status);
+    append_json_field(out, "qos", "1");
+
+    // every zone component was formatted when it was loaded
+    append_json_key(out, "cmps");
+    out += '{';
+    for(const auto& zone : zones){
+        if(out.back() != '{') out += ',';
+        out += zone->get_discovery();
+    }
 
-        json.saveProperty(cmp, "state_topic", mqtt_topic_entity_state + "/" + id);
-        json.saveProperty(cmp, "command_topic", mqtt_topic_entity_update + "/" + id);
-        json.saveProperty(cmp, "json_attr_t", mqtt_topic_device_attributes + "/" + id);
-        
-        json.saveProperty(cmps, (new std::string(id))->c_str() , cmp);
+    if(const AlarmPanel* alarm = zone_manager->get_alarm()){
+        append_json_key(out, alarm->get_unique_id());
+        out += '{';
+        append_json_field(out, "name", alarm->get_name());
+        append_json_field(out, "unique_id", alarm->get_unique_id());
+        append_json_field(out, "p", "alarm_control_panel");
+        append_json_field(out, "state_topic", mqtt_topic_alarm_state);
+        append_json_field(out, "command_topic", mqtt_topic_alarm_command);
+        append_json_field(out, "json_attr_t", mqtt_topic_alarm_attributes);
+        append_json_key(out, "supported_features");
+        out += "[\"arm_home\",\"arm_away\"]";
+
+        if(alarm->requires_code()){
+            // the keypad code is checked on the device, Home Assistant passes it through
+            append_json_field(out, "code", "REMOTE_CODE");
+            append_json_field(out, "command_template", "{\"action\":\"{{ action }}\",\"code\":\"{{ code }}\"}");
+        } else {
+            append_json_bool(out, "code_arm_required", false);
+        }
+        out += '}';
     }
-    json.saveProperty("cmps", cmps);
+    out += "}}";
+}
 
-    std::string device_discovery_payload = json.toString();
-        
-    mqtt_pub(mqtt_topic_device_discovery, device_discovery_payload, true, 1);
-    
-    mqtt_pub(mqtt_topic_system_status, mqtt_birth_payload, false, 1);
+void SecuritySystem::autodiscover() {
+    if(device_discovery_payload.empty()) format_discovery();
+    mqtt_pub(mqtt_topic_device_discovery, device_discovery_payload, true, 1, OutboundQueue::DIAGNOSTIC);
 
+    mqtt_pub(mqtt_topic_system_status, mqtt_birth_payload, false, 1, OutboundQueue::DIAGNOSTIC); // in line behind the discovery it announces
+
+    auto guard = lock_zones();
     zone_manager->refresh_states(); // refresh all the entity states so the MQTT can get the latest image
+    zone_manager->publish_snapshot();
 }
 
-void SecuritySystem::handle_device_commands(const std::string& unique_id, const std::string& payload) {
-    std::cout << "device command: set " << unique_id << " to level " << payload << "\n";
-    for(auto& ptr : zone_manager->get_zones()){
-        Zone& zone = *ptr;
-        if(zone.get_unique_id() != unique_id) continue;
-        if(std::regex_match(payload, std::regex("^\\d{1,3}$"))){
-            zone.set(std::stoi(payload));
+void SecuritySystem::handle_device_commands(std::string_view unique_id, std::string_view payload) {
+    Logger::info("device command: set {} to level {}", unique_id, payload);
+    // <level> or <level>:<duration>, the duration in ms or with a "us" suffix in microseconds
+    size_t colon = payload.find(':');
+    std::string_view level_text = payload.substr(0, colon), duration_text;
+    unsigned level = 0;
+    if(level_text.empty() || level_text.size() > 3 || std::from_chars(level_text.data(), level_text.data() + level_text.size(), level).ptr != level_text.data() + level_text.size()){
+        return; // a level is one to three digits
+    }
+    uint32_t pulse_us = 0;
+    if(colon != std::string_view::npos){
+        duration_text = payload.substr(colon + 1);
+        uint32_t scale = 1000;
+        if(duration_text.ends_with("us")) scale = 1;
+        if(duration_text.ends_with("us") || duration_text.ends_with("ms")) duration_text.remove_suffix(2);
+        uint32_t duration = 0;
+        auto [end, error] = std::from_chars(duration_text.data(), duration_text.data() + duration_text.size(), duration);
+        if(duration_text.empty() || error != std::errc() || end != duration_text.data() + duration_text.size() || !duration ||
+                uint64_t(duration) * scale > OutputPulses::MAX_PULSE_US){
+            Logger::warn("device command {} has a bad duration, the longest pulse is {}ms", payload, OutputPulses::MAX_PULSE_US / 1000);
+            return;
         }
+        pulse_us = duration * scale;
     }
+
+    auto guard = lock_zones();
+    const auto& zones = zone_manager->get_zones();
+    for(size_t i = 0; i < zones.size(); ++i){
+        Zone& zone = *zones[i];
+        if(zone.get_unique_id() != unique_id) continue;
+        if(zone_manager->pulse_output(i, int(level), pulse_us)) continue;
+        zone_manager->cancel_pulse(i); // a plain level ends a pulse still running
+        zone.set(int(level));
+    }
+}
+
+void SecuritySystem::handle_device_updates(const std::string& device_id, const char* topic, int level, bool alarm) {
+    Logger::info("device state changed: {} is now {}", device_id, level);
+    char payload[12];
+    mqtt_pub(topic, std::string_view(payload, size_t(std::to_chars(payload, payload + sizeof(payload), level).ptr - payload)), false, 1,
+             alarm ? OutboundQueue::ALARM : OutboundQueue::STATE);
+}
+
+void SecuritySystem::handle_device_attributes(const char* topic, std::string_view attributes) {
+    mqtt_pub(topic, attributes, true, 1, OutboundQueue::DIAGNOSTIC);
 }
 
-void SecuritySystem::handle_device_updates(const std::string& device_id, int level) {
-    std::cout << "device state changed: " << device_id << " is now " << level << "\n";
-    mqtt_pub(mqtt_topic_entity_state + "/" + device_id, std::to_string(level), false, 1);
+void SecuritySystem::handle_button_press(const std::string& device_id, const char* topic, std::string_view payload, bool alarm) {
+    Logger::info("button press: {} {}", device_id, payload);
+    mqtt_pub(topic, payload, false, 1, alarm ? OutboundQueue::ALARM : OutboundQueue::STATE, false);
+}
+
+void SecuritySystem::handle_state_snapshot(std::string_view payload) {
+    mqtt_pub(mqtt_topic_entity_state, payload, true, 1);
+}
+
+void SecuritySystem::handle_rule_event(const std::string& payload) {
+    Logger::info("rule event: {}", payload);
+    mqtt_pub(mqtt_topic_event, payload, false, 1, OutboundQueue::STATE, false);
+}
+
+void SecuritySystem::handle_zone_event(const std::string& payload) {
+    Logger::info("zone event: {}", payload);
+    mqtt_pub(mqtt_topic_event, payload, false, 1, OutboundQueue::ALARM, false);
+}
+
+void SecuritySystem::handle_alarm_state(const std::string& state, const std::string& attributes) {
+    Logger::info("alarm panel state: {} {}", state, attributes);
+    mqtt_pub(mqtt_topic_alarm_state, state, false, 1, OutboundQueue::ALARM);
+    mqtt_pub(mqtt_topic_alarm_attributes, attributes, false, 1, OutboundQueue::ALARM);
+}
+
+void SecuritySystem::publish_metrics() {
+    SchedLatency::Summary latency = sched_latency.take();
+    uint64_t dropped[OutboundQueue::PRIORITIES];
+    outbound.take_dropped(dropped);
+    uint64_t missed_edges = zone_manager->take_missed_edges();
+    char payload[352];
+    int length = snprintf(payload, sizeof(payload),
+        "{\"realtime\":%s,\"zone_passes\":%llu,\"sched_latency_p50_us\":%u,\"sched_latency_p99_us\":%u,\"sched_latency_max_us\":%u,"
+        "\"outbound_queued\":%zu,\"outbound_dropped_alarm\":%llu,\"outbound_dropped_state\":%llu,\"outbound_dropped_diagnostic\":%llu,"
+        "\"missed_edges\":%llu}",
+        realtime.enabled ? "true" : "false", (unsigned long long)latency.passes, latency.p50_us, latency.p99_us, latency.max_us,
+        outbound.size(), (unsigned long long)dropped[OutboundQueue::ALARM], (unsigned long long)dropped[OutboundQueue::STATE],
+        (unsigned long long)dropped[OutboundQueue::DIAGNOSTIC], (unsigned long long)missed_edges);
+    mqtt_pub(mqtt_topic_metrics.c_str(), std::string_view(payload, size_t(length)), false, 1, OutboundQueue::DIAGNOSTIC);
+}
+
+static void advance(timespec& t, uint32_t ms) {
+    t.tv_nsec += long(ms % 1000) * 1000000;
+    t.tv_sec += time_t(ms / 1000) + t.tv_nsec / 1000000000;
+    t.tv_nsec %= 1000000000;
+}
+
+static int64_t elapsed_us(const timespec& from, const timespec& to) {
+    return int64_t(to.tv_sec - from.tv_sec) * 1000000 + (to.tv_nsec - from.tv_nsec) / 1000;
+}
+
+// zone passes on an absolute period, so the time a pass takes does not drift the schedule
+void SecuritySystem::zone_loop() {
+    RealtimeProfile::set_fifo(realtime.priority, "zone");
+    RealtimeProfile::pin_thread(realtime.zone_cpu, "zone");
+
+    timespec due, now;
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    while(system_online && !zone_thread_stop){
+        advance(due, realtime.period_ms);
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr) == EINTR);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int64_t late = elapsed_us(due, now);
+        sched_latency.add(uint32_t(std::max<int64_t>(late, 0)));
+        if(late > int64_t(realtime.period_ms) * 1000) due = now; // skip missed passes rather than running them back to back
+
+        auto guard = lock_zones();
+        zone_manager->update();
+    }
 }
 
 void SecuritySystem::run() {
     if(!system_online){
-        std::cout << "failed to start system runtime!\n";
+        Logger::error("failed to start system runtime!");
     } else {
-        Clock refreshTimeout;
+        if(realtime.enabled){
+            RealtimeProfile::pin_thread(realtime.io_cpu, "I/O");
+            zone_thread = std::thread(&SecuritySystem::zone_loop, this);
+        }
+        if(realtime.lock_memory && realtime.enabled) RealtimeProfile::lock_all_memory(); // every thread is started by now
+
+        Clock refreshTimeout, metricsTimeout;
+        timespec due, now;
         while(system_online) {
+            if(upgrade_requested.exchange(false) && hand_over()) break;
             mqtt->update();
-            zone_manager->update();
+            if(!realtime.enabled) zone_manager->update();
+            drain_outbound();
 
             if(refreshTimeout.getSeconds() > auto_refresh_timer){
-                zone_manager->refresh_states();
+                auto guard = lock_zones();
+                zone_manager->reconcile();
+                zone_manager->publish_snapshot(); // one message instead of a publish per zone
                 refreshTimeout.restart();
             }
-            
-            std::cout << std::flush;
+            if(metrics_interval && metricsTimeout.getSeconds() > metrics_interval){
+                publish_metrics();
+                metricsTimeout.restart();
+            }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(80)); // cool-down
+            if(realtime.enabled){
+                outbound.wait(80); // woken early by a publish from the zone thread
+            } else {
+                clock_gettime(CLOCK_MONOTONIC, &due);
+                advance(due, 80);
+                std::this_thread::sleep_for(std::chrono::milliseconds(80)); // cool-down
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                sched_latency.add(uint32_t(std::max<int64_t>(elapsed_us(due, now), 0)));
+            }
         }
         
-        std::cout << "System shutting down...\n";
+        if(zone_thread.joinable()) zone_thread.join();
+        drain_outbound(true);
+        Logger::info("System shutting down...");
+    }
+}
+
+// The installed binary is started beside this process and takes over in steps; until the state is sent,
+// any failure leaves this process running as it was
+bool SecuritySystem::hand_over() {
+    const std::string& executable = service_executable();
+    if(executable.empty()){
+        Logger::error("upgrade requested, but the service binary is unknown");
+        return false;
+    }
+    Logger::info("upgrade requested, starting {}", executable);
+
+    HandoffSender successor;
+    if(!successor.spawn(executable, HANDOFF_TIMEOUT_MS)){
+        Logger::error("the upgrade was abandoned, the service keeps running");
+        return false;
+    }
+
+    // the zone passes stop here, the state sent is the state the successor starts from
+    if(zone_thread.joinable()){
+        zone_thread_stop = true;
+        zone_thread.join();
+    }
+    drain_outbound(true); // the successor starts from the state sent, nothing may be left behind
+
+    HandoffState state;
+    zone_manager->save_state(state);
+    state.mqtt_msg_id = mqtt->last_pub_msgid();
+    state.mqtt_level = mqtt->negotiated_level();
+    state.mqtt_alias_max = mqtt->topic_alias_max();
+    state.mqtt_fd = mqtt->release_socket();
+    if(state.mqtt_fd < 0 || !successor.send_state(state.format(), state.mqtt_fd)){
+        if(state.mqtt_fd >= 0) mqtt->adopt_socket(state.mqtt_fd, state.mqtt_msg_id, state.mqtt_level, state.mqtt_alias_max); else mqtt->start();
+        successor.abandon();
+        if(realtime.enabled){
+            zone_thread_stop = false;
+            zone_thread = std::thread(&SecuritySystem::zone_loop, this);
+        }
+        Logger::error("the upgrade was abandoned, the service keeps running");
+        return false;
+    }
+    close(state.mqtt_fd); // the successor holds its own reference, the connection stays up
+
+    // pins keep their mode and level, pigpio and the buses are closed for the successor to open
+    GPIO::keep_state = true;
+    delete zone_manager;
+    zone_manager = nullptr;
+    delete expander_bus;
+    expander_bus = nullptr;
+    delete federation;
+    federation = nullptr;
+    delete remote_gpio;
+    remote_gpio = nullptr;
+    if(local_gpio) gpioTerminate();
+    local_gpio = false;
+
+    if(!successor.send_released() || !successor.wait_running(HANDOFF_TIMEOUT_MS)){
+        Logger::error("the new process did not take over, the service manager restarts the service");
+    } else {
+        Logger::info("handed over to the new process");
+    }
+    system_online = false;
+    return true;
+}
+
+// The successor's side of an upgrade: the previous process hands over its state and broker
+// session, then releases the hardware before this process opens it
+SecuritySystem* SecuritySystem::take_over(const std::string& config_string, int channel_fd) {
+    HandoffReceiver channel(channel_fd);
+    HandoffState state;
+    std::string text;
+    if(!channel.send_ready() || !channel.receive_state(text, state.mqtt_fd, HANDOFF_TIMEOUT_MS)){
+        Logger::error("upgrade handoff failed, the running service carries on");
+        return nullptr;
+    }
+    if(!state.parse(text)){
+        Logger::warn("the handed over zone state is unreadable, every zone reports again");
+        state.zones.clear();
+        state.timers.clear();
+        state.has_alarm = false;
+    }
+    if(!channel.wait_released(HANDOFF_TIMEOUT_MS)){
+        Logger::error("the running service did not release the hardware");
+        if(state.mqtt_fd >= 0) close(state.mqtt_fd);
+        return nullptr;
+    }
+
+    SecuritySystem* service = new SecuritySystem(config_string, &state);
+    if(service->online()){
+        // this process is the service from now on, the previous one exits once it reads RUNNING
+        notify_service_manager("MAINPID=" + std::to_string(getpid()) + "\nREADY=1");
+        channel.send_running();
     }
+    return service;
 }
 
 void SecuritySystem::shutdown_system() {
     system_online = false;
+    outbound.wake();
 }
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include "alarm_panel.h"
+#include "zone.h"
+#include "logger.h"
+#include "handoff.h"
+
+#include <algorithm>
+#include <chrono>
+#include <regex>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool AlarmPanel::parse_group(const std::string& name, Group& group) {
+    if(name == "perimeter") group = GROUP_PERIMETER;
+    else if(name == "interior") group = GROUP_INTERIOR;
+    else if(name == "24h") group = GROUP_24H;
+    else return false;
+    return true;
+}
+
+// Home Assistant's alarm_control_panel states
+const char* AlarmPanel::state_name(State state) {
+    switch(state){
+        case DISARMED: return "disarmed";
+        case ARMING: return "arming";
+        case ARMED_HOME: return "armed_home";
+        case ARMED_AWAY: return "armed_away";
+        case PENDING: return "pending";
+        case TRIGGERED: return "triggered";
+    }
+    return "disarmed";
+}
+
+void AlarmPanel::assign(Mask& mask, size_t zone, bool value) {
+    uint64_t bit = uint64_t(1) << (zone & 63);
+    if(value) mask[zone >> 6] |= bit; else mask[zone >> 6] &= ~bit;
+}
+
+std::string AlarmPanel::zone_list(const Mask& mask) const {
+    std::string list;
+    for(size_t w = 0; w < mask.size(); ++w){
+        for(uint64_t bits = mask[w]; bits; bits &= bits - 1){
+            if(!list.empty()) list += ",";
+            list += zones[w * 64 + size_t(__builtin_ctzll(bits))]->get_unique_id();
+        }
+    }
+    return list;
+}
+
+void AlarmPanel::load_list(Mask& mask, const std::string& list) const {
+    std::fill(mask.begin(), mask.end(), 0);
+    for(size_t start = 0; start < list.size();){
+        size_t end = std::min(list.find(',', start), list.size());
+        int zone = find_zone(list.substr(start, end - start));
+        if(zone >= 0) assign(mask, size_t(zone), true);
+        start = end + 1;
+    }
+}
+
+int AlarmPanel::find_zone(const std::string& id) const {
+    for(size_t i = 0; i < zones.size(); ++i){
+        if(zones[i]->get_unique_id() == id) return int(i);
+    }
+    return -1;
+}
+
+AlarmPanel::AlarmPanel(JsonLoader& config, const std::string& name, const ZoneList& zones, const std::vector<ZoneConfig>& settings, StateHandler on_change):
+    zones(zones), on_change(on_change), name(name), siren(-1), trigger_time_ms(0),
+    state(DISARMED), armed_state(DISARMED), pending_due_ms(0), triggered_due_ms(0), triggered_by(-1), exit_pending(false), publish_pending(true)
+{
+    unique_id = std::regex_replace(name, std::regex("[^a-zA-Z0-9]"), "");
+
+    const size_t words = (zones.size() + 63) / 64;
+    for(Mask* mask : { &perimeter, &interior, &always, &delayed, &inverted, &bypass, &active, &armed, &live }){
+        mask->assign(words, 0);
+    }
+    entry_delay_ms.assign(zones.size(), 0);
+    exit_delay_ms.assign(zones.size(), 0);
+    exit_due_ms.assign(zones.size(), 0);
+
+    for(size_t i = 0; i < zones.size() && i < settings.size(); ++i){
+        const ZoneConfig& zone = settings[i];
+        assign(perimeter, i, zone.group == GROUP_PERIMETER);
+        assign(interior, i, zone.group == GROUP_INTERIOR);
+        assign(always, i, zone.group == GROUP_24H);
+        assign(delayed, i, zone.entry_delay_ms > 0);
+        assign(inverted, i, zone.invert);
+        entry_delay_ms[i] = zone.entry_delay_ms;
+        exit_delay_ms[i] = zone.exit_delay_ms;
+    }
+
+    config.loadProperty("alarm_code", code);
+    config.loadProperty("alarm_trigger_time", trigger_time_ms);
+
+    std::string siren_name;
+    if(config.loadProperty("alarm_siren", siren_name) && !siren_name.empty()){
+        siren = find_zone(std::regex_replace(siren_name, std::regex("[^a-zA-Z0-9]"), ""));
+        if(siren < 0) Logger::warn("alarm siren {} is not a zone, the panel has no siren", siren_name);
+    }
+
+    size_t watched = 0;
+    for(const Mask* mask : { &perimeter, &interior, &always }){
+        for(uint64_t word : *mask) watched += size_t(__builtin_popcountll(word));
+    }
+    Logger::info("alarm panel {} watches {} zones", name, watched);
+}
+
+void AlarmPanel::set_state(State next) {
+    if(next == state) return;
+    Logger::info("alarm panel is {}", state_name(next));
+    if(siren >= 0 && (next == TRIGGERED || state == TRIGGERED)){
+        zones[size_t(siren)]->set(next == TRIGGERED ? 1 : 0);
+    }
+    state = next;
+    publish_pending = true;
+}
+
+void AlarmPanel::trigger(size_t zone, uint64_t now) {
+    triggered_by = int(zone);
+    triggered_due_ms = trigger_time_ms ? now + trigger_time_ms : 0;
+    set_state(TRIGGERED);
+}
+
+// an armed zone, or a 24h zone, went active
+void AlarmPanel::trip(size_t zone, uint64_t now) {
+    if(test(bypass, zone) || state == TRIGGERED) return;
+    if(test(always, zone)){
+        trigger(zone, now);
+        return;
+    }
+    if(!test(live, zone)) return;
+
+    if(!test(delayed, zone)){
+        trigger(zone, now);
+    } else if(state == PENDING){
+        pending_due_ms = std::min(pending_due_ms, now + entry_delay_ms[zone]); // a faster zone shortens the entry delay
+    } else {
+        triggered_by = int(zone);
+        pending_due_ms = now + entry_delay_ms[zone];
+        set_state(PENDING);
+    }
+}
+
+void AlarmPanel::arm(State target, uint64_t now) {
+    if(state == PENDING || state == TRIGGERED){
+        Logger::warn("alarm panel cannot be armed while {}", state_name(state));
+        return;
+    }
+
+    Mask next_armed(armed.size()), next_live(live.size()), open(armed.size());
+    bool instant_open = false, exit_delay = false;
+    for(size_t w = 0; w < armed.size(); ++w){
+        next_armed[w] = perimeter[w] | (target == ARMED_AWAY ? interior[w] : 0);
+        for(uint64_t bits = next_armed[w]; bits; bits &= bits - 1){
+            if(exit_delay_ms[w * 64 + size_t(__builtin_ctzll(bits))]) exit_delay = true; else next_live[w] |= bits & -bits;
+        }
+        open[w] = active[w] & next_live[w] & ~bypass[w];
+        instant_open |= open[w] != 0;
+    }
+
+    if(instant_open){
+        Logger::warn("alarm panel is not ready, open zones: {}", zone_list(open));
+        publish_pending = true; // puts the entity back to its real state
+        return;
+    }
+
+    armed = next_armed;
+    live = next_live;
+    for(size_t zone = 0; zone < exit_due_ms.size(); ++zone){
+        exit_due_ms[zone] = test(armed, zone) && exit_delay_ms[zone] ? now + exit_delay_ms[zone] : 0;
+    }
+    exit_pending = exit_delay;
+    armed_state = target;
+    triggered_by = -1;
+    set_state(exit_delay ? ARMING : target);
+}
+
+void AlarmPanel::disarm() {
+    std::fill(armed.begin(), armed.end(), 0);
+    std::fill(live.begin(), live.end(), 0);
+    std::fill(bypass.begin(), bypass.end(), 0); // bypass lasts one arming cycle
+    exit_pending = false;
+    armed_state = DISARMED;
+    triggered_by = -1;
+    set_state(DISARMED);
+    publish_pending = true;
+}
+
+void AlarmPanel::on_state(size_t zone, int level) {
+    if(zone >= zones.size()) return;
+    bool on = (level != 0) != test(inverted, zone);
+    if(on == test(active, zone)) return;
+    assign(active, zone, on);
+
+    uint64_t now = now_ms();
+    if(on){
+        trip(zone, now);
+    } else if(test(armed, zone) && !exit_due_ms[zone]){
+        assign(live, zone, true); // a zone left open after a trigger is watched again once it closes
+    }
+}
+
+void AlarmPanel::update() {
+    uint64_t now = now_ms();
+
+    if(exit_pending){
+        bool waiting = false;
+        for(size_t w = 0; w < armed.size(); ++w){
+            uint64_t opened = 0;
+            for(uint64_t bits = armed[w] & ~live[w]; bits; bits &= bits - 1){
+                size_t zone = w * 64 + size_t(__builtin_ctzll(bits));
+                if(!exit_due_ms[zone]) continue; // closed out by a trigger, watched again once it closes
+                if(exit_due_ms[zone] > now){
+                    waiting = true;
+                    continue;
+                }
+                exit_due_ms[zone] = 0;
+                live[w] |= bits & -bits;
+                opened |= bits & -bits;
+            }
+            // a zone still open when its exit delay ends trips as if it had just opened
+            for(uint64_t bits = opened & active[w]; bits; bits &= bits - 1){
+                trip(w * 64 + size_t(__builtin_ctzll(bits)), now);
+            }
+        }
+        exit_pending = waiting;
+        if(!waiting && state == ARMING) set_state(armed_state);
+    }
+
+    if(state == PENDING && now >= pending_due_ms){
+        trigger(size_t(triggered_by), now);
+    }
+
+    if(state == TRIGGERED && triggered_due_ms && now >= triggered_due_ms){
+        // zones that are still open have to close before they can trigger again
+        for(size_t w = 0; w < live.size(); ++w) live[w] &= ~active[w] | ~armed[w];
+        set_state(armed_state);
+    }
+
+    if(publish_pending && on_change){
+        publish_pending = false;
+        JsonLoader attributes;
+        attributes.saveProperty("triggered_by", triggered_by >= 0 ? zones[size_t(triggered_by)]->get_unique_id() : std::string(""));
+        attributes.saveProperty("bypassed", zone_list(bypass));
+        on_change(state_name(state), attributes.toString());
+    }
+}
+
+void AlarmPanel::command(const std::string& payload) {
+    std::string action = payload, given;
+    if(payload.starts_with("{")){
+        JsonLoader json;
+        if(!json.parseString(payload) || !json.loadProperty("action", action)){
+            Logger::warn("alarm panel command {} is not understood", payload);
+            return;
+        }
+        json.loadProperty("code", given);
+    }
+
+    if(!code.empty() && given != code){
+        Logger::warn("alarm panel {} was refused, the code is wrong", action);
+        publish_pending = true;
+        return;
+    }
+
+    uint64_t now = now_ms();
+    if(action == "DISARM") disarm();
+    else if(action == "ARM_HOME") arm(ARMED_HOME, now);
+    else if(action == "ARM_AWAY") arm(ARMED_AWAY, now);
+    else Logger::warn("alarm panel command {} is not supported", action);
+}
+
+void AlarmPanel::set_bypass(const std::string& zone_unique_id, bool enabled) {
+    int zone = find_zone(zone_unique_id);
+    if(zone < 0){
+        Logger::warn("cannot bypass {}, it is not a zone", zone_unique_id);
+        return;
+    }
+    if(state == PENDING || state == TRIGGERED){
+        Logger::warn("cannot change the bypass of {} while the panel is {}", zone_unique_id, state_name(state));
+        return;
+    }
+    assign(bypass, size_t(zone), enabled);
+    publish_pending = true;
+}
+
+void AlarmPanel::save_state(HandoffState& saved) const {
+    HandoffState::Alarm& out = saved.alarm;
+    out.state = state;
+    out.armed_state = armed_state;
+    out.triggered_by = triggered_by >= 0 ? zones[size_t(triggered_by)]->get_unique_id() : std::string();
+    out.pending_due_ms = pending_due_ms;
+    out.triggered_due_ms = triggered_due_ms;
+    out.exit_pending = exit_pending;
+    out.active = zone_list(active);
+    out.bypass = zone_list(bypass);
+    out.armed = zone_list(armed);
+    out.live = zone_list(live);
+    out.exit_due.clear();
+    for(size_t zone = 0; zone < exit_due_ms.size(); ++zone){
+        if(exit_due_ms[zone]) out.exit_due.push_back({ zones[zone]->get_unique_id(), exit_due_ms[zone] });
+    }
+}
+
+void AlarmPanel::restore_state(const HandoffState& saved) {
+    const HandoffState::Alarm& in = saved.alarm;
+    if(in.state > TRIGGERED || in.armed_state > TRIGGERED) return;
+    state = State(in.state); // not through set_state, the siren output was handed over as it was
+    armed_state = State(in.armed_state);
+    triggered_by = in.triggered_by.empty() ? -1 : find_zone(in.triggered_by);
+    pending_due_ms = in.pending_due_ms;
+    triggered_due_ms = in.triggered_due_ms;
+    exit_pending = in.exit_pending;
+    load_list(active, in.active);
+    load_list(bypass, in.bypass);
+    load_list(armed, in.armed);
+    load_list(live, in.live);
+    std::fill(exit_due_ms.begin(), exit_due_ms.end(), 0);
+    for(const HandoffState::ExitDelay& delay : in.exit_due){
+        int zone = find_zone(delay.zone);
+        if(zone >= 0) exit_due_ms[size_t(zone)] = delay.due_ms;
+    }
+    if(state == PENDING && triggered_by < 0) state = armed_state; // the zone that tripped it is gone from the config
+    publish_pending = false; // Home Assistant already holds this state
+    Logger::info("alarm panel carried over as {}", state_name(state));
+}
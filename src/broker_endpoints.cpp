@@ -0,0 +1,217 @@
+#include "broker_endpoints.h"
+#include "logger.h"
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+BrokerEndpoints::BrokerEndpoints(): resolver(std::make_shared<Resolver>()), resolver_started(false),
+    next(0), current(std::string::npos), connected_at_ms(0), user_timeout_ms(10000), send_buffer(0),
+    jitter(uint32_t(std::chrono::steady_clock::now().time_since_epoch().count())) {}
+
+BrokerEndpoints::~BrokerEndpoints() {
+    std::lock_guard<std::mutex> guard(resolver->lock);
+    resolver->stop = true;
+    resolver->wake.notify_all();
+}
+
+bool BrokerEndpoints::load(JsonLoader& config) {
+    std::vector<Endpoint>& endpoints = resolver->endpoints;
+    JsonLoader::Array list;
+    if(config.loadPropertyArray("mqtt_brokers", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object broker = it->GetObject();
+            Endpoint endpoint;
+            int port = 1883;
+            if(!config.loadProperty(broker, "address", endpoint.host) || endpoint.host.empty()){
+                Logger::warn("an mqtt broker needs an address! skipping...");
+                continue;
+            }
+            config.loadProperty(broker, "port", port);
+            endpoint.port = uint16_t(port);
+            endpoints.push_back(std::move(endpoint));
+        }
+    } else {
+        Endpoint endpoint;
+        int port = 1883;
+        config.loadProperty("mqtt_ip", endpoint.host);
+        config.loadProperty("mqtt_port", port);
+        endpoint.port = uint16_t(port);
+        if(!endpoint.host.empty()) endpoints.push_back(std::move(endpoint));
+    }
+    config.loadProperty("mqtt_user_timeout", user_timeout_ms);
+    config.loadProperty("mqtt_send_buffer", send_buffer);
+
+    // address literals need no lookup, names are left to the resolver thread
+    for(Endpoint& endpoint : endpoints){
+        endpoint.numeric = lookup(endpoint.host, endpoint.port, true, endpoint.addresses);
+        if(endpoint.numeric) endpoint.resolved_until_ms = UINT64_MAX;
+    }
+    return !endpoints.empty();
+}
+
+std::string BrokerEndpoints::describe() const {
+    std::string out;
+    for(const Endpoint& endpoint : resolver->endpoints){
+        if(!out.empty()) out += ", ";
+        bool v6 = endpoint.host.find(':') != std::string::npos;
+        out += (v6 ? "[" : "") + endpoint.host + (v6 ? "]:" : ":") + std::to_string(endpoint.port);
+    }
+    return out;
+}
+
+bool BrokerEndpoints::lookup(const std::string& host, uint16_t port, bool numeric, std::vector<Address>& out) {
+    addrinfo hints {}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = numeric ? AI_NUMERICHOST : 0;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return false;
+    out.clear();
+    for(addrinfo* ai = res; ai; ai = ai->ai_next){
+        Address address {};
+        memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+        address.len = ai->ai_addrlen;
+        out.push_back(address);
+    }
+    freeaddrinfo(res);
+    return !out.empty();
+}
+
+void BrokerEndpoints::resolve_loop(std::shared_ptr<Resolver> resolver) {
+    std::unique_lock<std::mutex> guard(resolver->lock);
+    while(!resolver->stop){
+        if(resolver->queue.empty()){
+            resolver->wake.wait(guard);
+            continue;
+        }
+        size_t index = resolver->queue.front();
+        resolver->queue.pop_front();
+        std::string host = resolver->endpoints[index].host;
+        uint16_t port = resolver->endpoints[index].port;
+
+        guard.unlock();
+        std::vector<Address> addresses;
+        bool ok = lookup(host, port, false, addresses);
+        guard.lock();
+
+        Endpoint& endpoint = resolver->endpoints[index];
+        endpoint.resolving = false;
+        if(ok){
+            endpoint.addresses = std::move(addresses);
+            endpoint.resolved_until_ms = now_ms() + RESOLVE_TTL_MS;
+        } else {
+            // the last addresses stay in use, DNS being down doesn't mean the broker is
+            endpoint.resolved_until_ms = now_ms() + RESOLVE_RETRY_MS;
+            Logger::warn("failed to resolve mqtt broker {}", host);
+        }
+    }
+}
+
+// caller holds the resolver lock
+void BrokerEndpoints::request_resolve(size_t index) {
+    resolver->endpoints[index].resolving = true;
+    resolver->queue.push_back(index);
+    if(!resolver_started){
+        std::thread(&BrokerEndpoints::resolve_loop, resolver).detach();
+        resolver_started = true;
+    }
+    resolver->wake.notify_one();
+}
+
+void BrokerEndpoints::failed(Endpoint& endpoint, uint64_t now) {
+    uint64_t backoff = std::min(BACKOFF_MAX_MS, BACKOFF_MIN_MS << std::min<uint32_t>(endpoint.failures, 16));
+    endpoint.retry_at_ms = now + backoff / 2 + jitter() % (backoff / 2 + 1);
+    ++endpoint.failures;
+}
+
+// Non-blocking connect bounded by CONNECT_TIMEOUT_MS, the returned socket is blocking with
+// the timeouts the MQTT client expects of its helper
+int BrokerEndpoints::open_socket(const Address& address) const {
+    int fd = ::socket(address.addr.ss_family, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    bool ok = ::connect(fd, (const sockaddr*)&address.addr, address.len) == 0;
+    if(!ok && errno == EINPROGRESS){
+        pollfd pfd { fd, POLLOUT, 0 };
+        int err = 0;
+        socklen_t len = sizeof err;
+        ok = ::poll(&pfd, 1, CONNECT_TIMEOUT_MS) == 1 &&
+             getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+    }
+    if(!ok){
+        ::close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    timeval rcv { 0, 1000 }, snd { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rcv, sizeof rcv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof snd);
+    if(send_buffer > 0) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof send_buffer);
+
+    // unacknowledged data and unanswered keepalive probes both end the connection after the user timeout
+    if(user_timeout_ms > 0){
+        unsigned timeout = unsigned(user_timeout_ms);
+        int idle = std::max(1, user_timeout_ms / 2000), interval = std::max(1, user_timeout_ms / 4000), probes = 3;
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof timeout);
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof one);
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof idle);
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof interval);
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof probes);
+    }
+    return fd;
+}
+
+int BrokerEndpoints::connect() {
+    std::vector<Endpoint>& endpoints = resolver->endpoints;
+    if(endpoints.empty()) return -1;
+    uint64_t now = now_ms();
+
+    // being asked again means the last connection ended, or never got a CONNACK
+    if(current != std::string::npos){
+        Endpoint& last = endpoints[current];
+        if(now - connected_at_ms < STABLE_MS) failed(last, now);
+        else last.failures = 0;
+        next = (current + 1) % endpoints.size();
+        current = std::string::npos;
+    }
+
+    std::vector<Address> addresses;
+    for(size_t n = 0; n < endpoints.size(); ++n){
+        size_t index = (next + n) % endpoints.size();
+        Endpoint& endpoint = endpoints[index];
+        if(now < endpoint.retry_at_ms) continue;
+        {
+            std::lock_guard<std::mutex> guard(resolver->lock);
+            if(!endpoint.numeric && !endpoint.resolving && now >= endpoint.resolved_until_ms) request_resolve(index);
+            addresses = endpoint.addresses;
+        }
+        if(addresses.empty()) continue; // not resolved yet
+
+        for(const Address& address : addresses){
+            int fd = open_socket(address);
+            if(fd < 0) continue;
+            Logger::info("connected to mqtt broker {}:{}", endpoint.host, endpoint.port);
+            current = index;
+            connected_at_ms = now_ms();
+            return fd;
+        }
+        Logger::warn("mqtt broker {}:{} is unreachable", endpoint.host, endpoint.port);
+        now = now_ms();
+        failed(endpoint, now);
+    }
+    return -1;
+}
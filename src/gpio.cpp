@@ -1,57 +1,80 @@
 #include "gpio.h"
+#include "remote_gpio.h"
 
 const std::array<const char*,4> GPIO::StringType {
     "OUTPUT", "INPUT", "INPUT_PULLUP", "INPUT_PULLDOWN"
 };
 
-void GPIO::gpioStaticAlert(int gpio, int level, uint32_t tick, void* _this) {
-    static_cast<GPIO*>(_this)->gpioAlert(gpio, level, tick);
+bool GPIO::keep_state = false;
+
+// pigpio and the remote hosts only alert a pin's own callback, so the delegate needs no pin check
+GPIO::GPIO(int pin, GPIO::PinType type, GPIO::Callback cb, RemoteGPIOHost* host): pin(pin), type(type), host(host), filtered(false) {
+    if(host){
+        host->setAlertFuncEx(pin, cb.function(), cb.target());
+    } else {
+        gpioSetAlertFuncEx(pin, cb.function(), cb.target());
+    }
+    updateMode();
 }
 
-void GPIO::gpioAlert(int gpio, int level, uint32_t tick) {
-    if(gpio == pin){
-        gpio_callback(level);
+GPIO::~GPIO() {
+    setWatchdog(0); // the successor of a handoff arms its own
+    if(filtered) setGlitchFilter(0);
+    if(!keep_state){
+        setMode(PI_INPUT);
+        setPullUpDown(PI_OFF);
+    }
+    if(host){
+        host->setAlertFuncEx(pin, nullptr, nullptr);
+    } else {
+        gpioSetAlertFunc(pin, nullptr);
     }
 }
 
-GPIO::GPIO(int pin, GPIO::PinType type, GPIO::Callback cb): pin(pin), type(type), gpio_callback(cb) {
-    gpioSetAlertFuncEx(pin, &gpioStaticAlert, this);
-    updateMode();
+int GPIO::setMode(unsigned mode) {
+    return host ? host->setMode(pin, mode) : gpioSetMode(pin, mode);
 }
 
-GPIO::~GPIO() {
-    gpioSetMode(pin, PI_INPUT);
-    gpioSetPullUpDown(pin, PI_OFF);
-    gpioSetAlertFunc(pin, nullptr);
+int GPIO::setPullUpDown(unsigned pud) {
+    return host ? host->setPullUpDown(pin, pud) : gpioSetPullUpDown(pin, pud);
 }
 
 void GPIO::updateMode() {
     if(type != PIN_OUTPUT){
-        gpioSetMode(pin, PI_INPUT);
+        setMode(PI_INPUT);
     }
     switch (type) {
         case PIN_INPUT_PULLDOWN:
-            gpioSetPullUpDown(pin, PI_PUD_DOWN);
+            setPullUpDown(PI_PUD_DOWN);
             break;
         case PIN_INPUT_PULLUP:
-            gpioSetPullUpDown(pin, PI_PUD_UP);
+            setPullUpDown(PI_PUD_UP);
             break;
         default:
-            gpioSetPullUpDown(pin, PI_PUD_OFF);
+            setPullUpDown(PI_PUD_OFF);
             break;
     }
     if(type == PIN_OUTPUT){
-        gpioSetMode(pin, PI_OUTPUT);
+        setMode(PI_OUTPUT);
     }
 }
 
+int GPIO::setWatchdog(unsigned timeout_ms) {
+    return host ? host->setWatchdog(pin, timeout_ms) : gpioSetWatchdog(pin, timeout_ms);
+}
+
+int GPIO::setGlitchFilter(unsigned steady_us) {
+    filtered = steady_us != 0;
+    return host ? host->glitchFilter(pin, steady_us) : gpioGlitchFilter(pin, steady_us);
+}
+
 int GPIO::read() {
-    return gpioRead(pin);
+    return host ? host->read(pin) : gpioRead(pin);
 }
 
 bool GPIO::write(int output) {
     if(type == PIN_OUTPUT){
-        return gpioWrite(pin, output) == 0;
+        return (host ? host->write(pin, output) : gpioWrite(pin, output)) == 0;
     }
     return false;
 }
\ No newline at end of file
@@ -0,0 +1,395 @@
+#include "handoff.h"
+#include "json_fragment.h"
+#include "jsonloader.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+enum HandoffMessage : uint8_t {
+    MSG_READY = 'r', MSG_STATE = 's', MSG_RELEASED = 'x', MSG_RUNNING = 'g'
+};
+
+static constexpr int TAKEOVER_FD = 3; // where the successor finds its end of the channel
+static constexpr uint32_t MAX_STATE_BYTES = 16 << 20;
+
+std::string HandoffState::format() const {
+    std::string out;
+    out.reserve(128 + zones.size() * 48 + (timers.size() + pulses.size()) * 64);
+    out += '{';
+    append_json_number(out, "msg_id", mqtt_msg_id);
+    append_json_number(out, "mqtt_level", mqtt_level);
+    append_json_number(out, "alias_max", mqtt_alias_max);
+    append_json_number(out, "seq", int64_t(sequence));
+
+    append_json_key(out, "zones");
+    out += '[';
+    for(const ZoneLevel& zone : zones){
+        if(out.back() != '[') out += ',';
+        out += '{';
+        append_json_field(out, "id", zone.id);
+        append_json_number(out, "level", zone.level);
+        append_json_number(out, "published", zone.published);
+        out += '}';
+    }
+    out += ']';
+
+    append_json_key(out, "timers");
+    out += '[';
+    for(const RuleTimer& timer : timers){
+        if(out.back() != '[') out += ',';
+        out += '{';
+        append_json_number(out, "due", int64_t(timer.due_ms));
+        append_json_number(out, "action", timer.action);
+        append_json_field(out, "zone", timer.zone);
+        append_json_bool(out, "revert", timer.revert);
+        out += '}';
+    }
+    out += ']';
+
+    append_json_key(out, "pulses");
+    out += '[';
+    for(const Pulse& pulse : pulses){
+        if(out.back() != '[') out += ',';
+        out += '{';
+        append_json_field(out, "zone", pulse.zone);
+        append_json_number(out, "pin", pulse.pin);
+        append_json_number(out, "off", pulse.off);
+        append_json_number(out, "due", int64_t(pulse.due_ms));
+        out += '}';
+    }
+    out += ']';
+
+    // the panel is kept flat, one level of objects is all the parser side walks
+    append_json_bool(out, "alarm", has_alarm);
+    if(has_alarm){
+        append_json_number(out, "alarm_state", alarm.state);
+        append_json_number(out, "alarm_armed_state", alarm.armed_state);
+        append_json_field(out, "alarm_triggered_by", alarm.triggered_by);
+        append_json_number(out, "alarm_pending_due", int64_t(alarm.pending_due_ms));
+        append_json_number(out, "alarm_triggered_due", int64_t(alarm.triggered_due_ms));
+        append_json_bool(out, "alarm_exit_pending", alarm.exit_pending);
+        append_json_field(out, "alarm_active", alarm.active);
+        append_json_field(out, "alarm_bypass", alarm.bypass);
+        append_json_field(out, "alarm_armed", alarm.armed);
+        append_json_field(out, "alarm_live", alarm.live);
+        append_json_key(out, "alarm_exit_due");
+        out += '[';
+        for(const ExitDelay& delay : alarm.exit_due){
+            if(out.back() != '[') out += ',';
+            out += '{';
+            append_json_field(out, "zone", delay.zone);
+            append_json_number(out, "due", int64_t(delay.due_ms));
+            out += '}';
+        }
+        out += ']';
+    }
+    out += '}';
+    return out;
+}
+
+bool HandoffState::parse(const std::string& text) {
+    JsonLoader json;
+    if(!json.parseString(text)) return false;
+    json.loadProperty("msg_id", mqtt_msg_id);
+    json.loadProperty("mqtt_level", mqtt_level);
+    json.loadProperty("alias_max", mqtt_alias_max);
+    json.loadProperty("seq", sequence);
+
+    zones.clear();
+    JsonLoader::Array list;
+    if(json.loadPropertyArray("zones", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object item = it->GetObject();
+            ZoneLevel zone { "", -1, -1 };
+            if(!json.loadProperty(item, "id", zone.id)) continue;
+            json.loadProperty(item, "level", zone.level);
+            json.loadProperty(item, "published", zone.published);
+            zones.push_back(std::move(zone));
+        }
+    }
+
+    timers.clear();
+    if(json.loadPropertyArray("timers", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object item = it->GetObject();
+            RuleTimer timer { 0, 0, "", false };
+            if(!json.loadProperty(item, "due", timer.due_ms) || !json.loadProperty(item, "action", timer.action)) continue;
+            json.loadProperty(item, "zone", timer.zone);
+            json.loadProperty(item, "revert", timer.revert);
+            timers.push_back(std::move(timer));
+        }
+    }
+
+    pulses.clear();
+    if(json.loadPropertyArray("pulses", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object item = it->GetObject();
+            Pulse pulse { "", 0, 0, 0 };
+            if(!json.loadProperty(item, "zone", pulse.zone) || !json.loadProperty(item, "pin", pulse.pin) || !json.loadProperty(item, "due", pulse.due_ms)) continue;
+            json.loadProperty(item, "off", pulse.off);
+            pulses.push_back(std::move(pulse));
+        }
+    }
+
+    has_alarm = false;
+    json.loadProperty("alarm", has_alarm);
+    if(has_alarm){
+        json.loadProperty("alarm_state", alarm.state);
+        json.loadProperty("alarm_armed_state", alarm.armed_state);
+        json.loadProperty("alarm_triggered_by", alarm.triggered_by);
+        json.loadProperty("alarm_pending_due", alarm.pending_due_ms);
+        json.loadProperty("alarm_triggered_due", alarm.triggered_due_ms);
+        json.loadProperty("alarm_exit_pending", alarm.exit_pending);
+        json.loadProperty("alarm_active", alarm.active);
+        json.loadProperty("alarm_bypass", alarm.bypass);
+        json.loadProperty("alarm_armed", alarm.armed);
+        json.loadProperty("alarm_live", alarm.live);
+        alarm.exit_due.clear();
+        if(json.loadPropertyArray("alarm_exit_due", list)){
+            for(auto it = list.Begin(); it < list.End(); it++){
+                JsonLoader::Object item = it->GetObject();
+                ExitDelay delay { "", 0 };
+                if(json.loadProperty(item, "zone", delay.zone) && json.loadProperty(item, "due", delay.due_ms)) alarm.exit_due.push_back(std::move(delay));
+            }
+        }
+    }
+    return true;
+}
+
+// a message is a type byte and a 32 bit length ahead of the payload, the socket rides on the first byte
+static bool send_message(int channel, HandoffMessage type, const std::string& payload = {}, int fd = -1) {
+    uint8_t header[5] = { type };
+    uint32_t length = uint32_t(payload.size());
+    memcpy(header + 1, &length, sizeof(length));
+
+    iovec parts[2] = { { header, sizeof(header) }, { const_cast<char*>(payload.data()), payload.size() } };
+    msghdr msg {};
+    msg.msg_iov = parts;
+    msg.msg_iovlen = payload.empty() ? 1 : 2;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if(fd >= 0){
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    size_t total = sizeof(header) + payload.size(), sent = 0;
+    while(sent < total){
+        ssize_t n = sendmsg(channel, &msg, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            Logger::error("handoff: cannot send to the other process: {}", strerror(errno));
+            return false;
+        }
+        sent += size_t(n);
+        msg.msg_control = nullptr; // the socket went with the first bytes
+        msg.msg_controllen = 0;
+        // step over what was sent for a retry of the rest
+        while(msg.msg_iovlen && size_t(n) >= msg.msg_iov->iov_len){
+            n -= ssize_t(msg.msg_iov->iov_len);
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if(msg.msg_iovlen){
+            msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + n;
+            msg.msg_iov->iov_len -= size_t(n);
+        }
+    }
+    return true;
+}
+
+static bool wait_readable(int channel, uint32_t timeout_ms) {
+    pollfd pfd { channel, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, int(std::min<uint32_t>(timeout_ms, INT_MAX)));
+    } while(ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+// fd is set when the message carried a socket, otherwise left at -1
+static bool receive_message(int channel, HandoffMessage expected, uint32_t timeout_ms, std::string* payload = nullptr, int* fd = nullptr) {
+    if(fd) *fd = -1;
+    if(!wait_readable(channel, timeout_ms)){
+        Logger::error("handoff: the other process did not answer in {}ms", timeout_ms);
+        return false;
+    }
+
+    uint8_t header[5];
+    iovec part { header, sizeof(header) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg {};
+    msg.msg_iov = &part;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(channel, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while(n < 0 && errno == EINTR);
+    if(n != ssize_t(sizeof(header))){
+        Logger::error("handoff: the other process closed the channel");
+        return false;
+    }
+
+    int received = -1;
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    uint32_t length;
+    memcpy(&length, header + 1, sizeof(length));
+    if(header[0] != expected || length > MAX_STATE_BYTES){
+        Logger::error("handoff: unexpected message '{}' of {} bytes", char(header[0]), length);
+        if(received >= 0) close(received);
+        return false;
+    }
+    if(fd) *fd = received; else if(received >= 0) close(received);
+
+    std::string body(length, '\0');
+    for(size_t read = 0; read < length;){
+        n = recv(channel, body.data() + read, length - read, MSG_WAITALL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            Logger::error("handoff: the other process closed the channel");
+            return false;
+        }
+        read += size_t(n);
+    }
+    if(payload) *payload = std::move(body);
+    return true;
+}
+
+HandoffSender::HandoffSender(): channel(-1), successor(-1) {}
+
+HandoffSender::~HandoffSender() {
+    if(channel >= 0) close(channel);
+}
+
+bool HandoffSender::spawn(const std::string& executable, uint32_t timeout_ms) {
+    int pair[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0){
+        Logger::error("handoff: cannot create the channel: {}", strerror(errno));
+        return false;
+    }
+
+    // everything the child needs is built ahead of the fork, it only calls async-signal-safe functions
+    std::string fd_arg = std::to_string(TAKEOVER_FD);
+    const char* argv[] = { executable.c_str(), "--takeover", fd_arg.c_str(), nullptr };
+
+    successor = fork();
+    if(successor < 0){
+        Logger::error("handoff: cannot start {}: {}", executable, strerror(errno));
+        close(pair[0]);
+        close(pair[1]);
+        return false;
+    }
+    if(successor == 0){
+        // the channel becomes fd 3 and nothing else of this process survives the exec
+        if(dup2(pair[1], TAKEOVER_FD) < 0 || fcntl(TAKEOVER_FD, F_SETFD, 0) < 0) _exit(127);
+        close_range(TAKEOVER_FD + 1, ~0U, 0);
+        execv(argv[0], const_cast<char* const*>(argv));
+        _exit(127);
+    }
+
+    close(pair[1]);
+    channel = pair[0];
+    Logger::info("handoff: started {} as pid {}", executable, successor);
+    if(!receive_message(channel, MSG_READY, timeout_ms)){
+        abandon();
+        return false;
+    }
+    return true;
+}
+
+bool HandoffSender::send_state(const std::string& state, int mqtt_fd) {
+    return send_message(channel, MSG_STATE, state, mqtt_fd);
+}
+
+bool HandoffSender::send_released() {
+    return send_message(channel, MSG_RELEASED);
+}
+
+bool HandoffSender::wait_running(uint32_t timeout_ms) {
+    return receive_message(channel, MSG_RUNNING, timeout_ms);
+}
+
+void HandoffSender::abandon() {
+    if(channel >= 0) close(channel);
+    channel = -1;
+    if(successor > 0){
+        kill(successor, SIGKILL); // it has not opened the hardware, nothing is left behind
+        waitpid(successor, nullptr, 0);
+        successor = -1;
+    }
+}
+
+HandoffReceiver::HandoffReceiver(int fd): channel(fd) {
+    fcntl(channel, F_SETFD, FD_CLOEXEC);
+}
+
+HandoffReceiver::~HandoffReceiver() {
+    if(channel >= 0) close(channel);
+}
+
+bool HandoffReceiver::send_ready() {
+    return send_message(channel, MSG_READY);
+}
+
+bool HandoffReceiver::receive_state(std::string& state, int& mqtt_fd, uint32_t timeout_ms) {
+    return receive_message(channel, MSG_STATE, timeout_ms, &state, &mqtt_fd);
+}
+
+bool HandoffReceiver::wait_released(uint32_t timeout_ms) {
+    return receive_message(channel, MSG_RELEASED, timeout_ms);
+}
+
+bool HandoffReceiver::send_running() {
+    return send_message(channel, MSG_RUNNING);
+}
+
+const std::string& service_executable() {
+    static const std::string path = [](){
+        char buffer[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+        return n > 0 ? std::string(buffer, size_t(n)) : std::string();
+    }();
+    return path;
+}
+
+void notify_service_manager(const std::string& state) {
+    const char* path = getenv("NOTIFY_SOCKET");
+    if(!path || !*path) return;
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    size_t length = strlen(path);
+    if(length >= sizeof(address.sun_path)) return;
+    memcpy(address.sun_path, path, length);
+    if(path[0] == '@') address.sun_path[0] = '\0'; // abstract namespace
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return;
+    if(sendto(fd, state.data(), state.size(), MSG_NOSIGNAL, reinterpret_cast<sockaddr*>(&address), socklen_t(offsetof(sockaddr_un, sun_path) + length)) < 0){
+        Logger::warn("cannot notify the service manager: {}", strerror(errno));
+    }
+    close(fd);
+}
@@ -0,0 +1,151 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
+#include <unistd.h>
+
+static const char* const LevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+Logger::Logger(): enqueue_pos(0), dequeue_pos(0), written_pos(0), wake(0), dropped_records(0), min_level(LOG_INFO), running(true) {
+    for(size_t i = 0; i < RING_SIZE; ++i){
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    writer = std::thread(&Logger::writer_thread, this);
+}
+
+Logger::~Logger() {
+    running = false;
+    wake.fetch_add(1);
+    wake.notify_one();
+    if(writer.joinable()) writer.join();
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+bool Logger::parse_level(const std::string& name, Level& level) {
+    for(uint8_t i = 0; i < 4; ++i){
+        std::string lower = LevelNames[i];
+        for(char& c : lower) c = char(tolower(c));
+        if(name == lower){
+            level = Level(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bounded MPMC ring (Vyukov): each slot's sequence tells producers and the consumer whose turn it is
+Logger::Record* Logger::claim() {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for(;;){
+        Record* r = &ring[pos & (RING_SIZE - 1)];
+        size_t seq = r->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if(diff == 0){
+            if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return r;
+        } else if(diff < 0){
+            dropped_records.fetch_add(1, std::memory_order_relaxed); // ring is full
+            return nullptr;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::publish(Record* r) {
+    // a claimed slot's sequence equals its position; position + 1 hands it to the writer
+    r->sequence.store(r->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    wake.fetch_add(1, std::memory_order_release);
+    wake.notify_one();
+}
+
+void Logger::capture_string(Record& r, std::string_view v) {
+    Arg& a = r.args[r.argc++];
+    a.type = Arg::STRING;
+    a.offset = r.text_used;
+    a.length = uint16_t(std::min(v.size(), TEXT_SIZE - r.text_used));
+    memcpy(&r.text[a.offset], v.data(), a.length);
+    r.text_used += a.length;
+}
+
+void Logger::format(const Record& r, std::string& out) {
+    out += '[';
+    out += LevelNames[r.level];
+    out += "] ";
+    uint8_t next = 0;
+    char num[32];
+    for(const char* p = r.format; *p; ++p){
+        if(p[0] == '{' && p[1] == '}' && next < r.argc){
+            const Arg& a = r.args[next++];
+            switch(a.type){
+                case Arg::INT: out.append(num, size_t(snprintf(num, sizeof num, "%lld", (long long)a.i))); break;
+                case Arg::UINT: out.append(num, size_t(snprintf(num, sizeof num, "%llu", (unsigned long long)a.u))); break;
+                case Arg::DOUBLE: out.append(num, size_t(snprintf(num, sizeof num, "%g", a.d))); break;
+                case Arg::STRING: out.append(&r.text[a.offset], a.length); break;
+            }
+            ++p;
+        } else {
+            out += *p;
+        }
+    }
+    out += '\n';
+}
+
+// Consume every ready record, returns how many were written into out
+size_t Logger::drain(std::string& out) {
+    size_t count = 0;
+    for(;;){
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Record& r = ring[pos & (RING_SIZE - 1)];
+        size_t seq = r.sequence.load(std::memory_order_acquire);
+        if(intptr_t(seq) - intptr_t(pos + 1) < 0) break; // not published yet
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        format(r, out);
+        r.sequence.store(pos + RING_SIZE, std::memory_order_release);
+        ++count;
+    }
+    return count;
+}
+
+void Logger::writer_thread() {
+    std::string batch;
+    uint64_t reported_drops = 0;
+    for(;;){
+        uint32_t seen = wake.load(std::memory_order_acquire);
+        batch.clear();
+        drain(batch);
+        size_t drained = dequeue_pos.load(std::memory_order_relaxed);
+
+        uint64_t drops = dropped_records.load(std::memory_order_relaxed);
+        if(drops != reported_drops){
+            batch += "[WARN] logger dropped " + std::to_string(drops - reported_drops) + " records\n";
+            reported_drops = drops;
+        }
+        if(!batch.empty()){
+            size_t off = 0;
+            while(off < batch.size()){
+                ssize_t n = ::write(STDOUT_FILENO, batch.data() + off, batch.size() - off);
+                if(n <= 0) break;
+                off += size_t(n);
+            }
+            written_pos.store(drained, std::memory_order_release);
+            continue; // more may have arrived while writing
+        }
+        written_pos.store(drained, std::memory_order_release);
+        if(!running) break;
+        wake.wait(seen, std::memory_order_acquire);
+    }
+}
+
+void Logger::flush() {
+    Logger& log = instance();
+    // the writer has caught up once everything claimed so far has been written out
+    size_t target = log.enqueue_pos.load();
+    while(log.written_pos.load() < target && log.running){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
@@ -7,6 +7,7 @@
 #include <filesystem>
 #include <cstdlib>
 #include <csignal>
+#include <string_view>
 
 namespace fs = std::filesystem;
 
@@ -14,20 +15,31 @@ static SecuritySystem* system_service = nullptr;
 
 void signalHandler(int signum) {
     if (signum == SIGTERM) {
-        std::cout << "... SIGTERM" << std::endl;
+        Logger::info("... SIGTERM");
 
-        system_service->shutdown_system();
+        if(system_service) system_service->shutdown_system();
+    } else if (signum == SIGUSR2 && system_service) {
+        system_service->request_upgrade(); // systemctl reload, after the binary was replaced
     }
 }
 
+#ifndef ZCL_BENCHMARK // the benchmark harness provides its own entry point
 int main(int argc, const char* argv[]) {
+    service_executable(); // remembered before an install replaces the binary
+
+    int takeover_fd = -1;
+    for(int i = 1; i + 1 < argc; ++i){
+        if(std::string_view(argv[i]) == "--takeover") takeover_fd = std::atoi(argv[i + 1]);
+    }
+
     // Register the signal handler for SIGTERM
-    if (signal(SIGTERM, signalHandler) == SIG_ERR) {
-        std::cerr << "Error registering signal handler." << std::endl;
+    if (signal(SIGTERM, signalHandler) == SIG_ERR || signal(SIGUSR2, signalHandler) == SIG_ERR) {
+        Logger::error("Error registering signal handler.");
+        Logger::flush();
         return 1;
     }
 
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if(takeover_fd < 0) std::this_thread::sleep_for(std::chrono::seconds(1));
 
     {
         std::string config;
@@ -37,10 +49,16 @@ int main(int argc, const char* argv[]) {
             str << cfg.rdbuf();
             config = str.str();
         } else {
-            std::cout << "config file is missing!\n";
+            Logger::error("config file is missing!");
+            Logger::flush();
             return 1;
         }
-        system_service = new SecuritySystem(config);
+        if(takeover_fd >= 0){
+            system_service = SecuritySystem::take_over(config, takeover_fd);
+        } else {
+            system_service = new SecuritySystem(config);
+            if(system_service->online()) notify_service_manager("READY=1");
+        }
     }
 
     if(system_service != nullptr){
@@ -48,5 +66,8 @@ int main(int argc, const char* argv[]) {
         delete system_service; // finally free the system process
     }
 
+    Logger::flush();
+
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "outbound_queue.h"
+#include "logger.h"
+
+#include <chrono>
+
+static constexpr size_t DEFAULT_LIMITS[OutboundQueue::PRIORITIES] = { 256, 128, 64 };
+static constexpr size_t RESERVE_TOPIC = 64, RESERVE_PAYLOAD = 32;
+
+const char* OutboundQueue::priority_name(Priority priority) {
+    switch(priority){
+        case ALARM: return "alarm";
+        case STATE: return "state";
+        default: return "diagnostic";
+    }
+}
+
+bool OutboundQueue::parse_policy(const std::string& name, Policy& policy) {
+    if(name == "coalesce") policy = COALESCE;
+    else if(name == "drop_oldest") policy = DROP_OLDEST;
+    else if(name == "drop_newest") policy = DROP_NEWEST;
+    else return false;
+    return true;
+}
+
+// room for a zone topic and a level, so a burst of changes reaching records not used before doesn't allocate
+void OutboundQueue::reserve(Message& record) {
+    record.topic.reserve(RESERVE_TOPIC);
+    record.payload.reserve(RESERVE_PAYLOAD);
+}
+
+OutboundQueue::OutboundQueue(): added(false), woken(false) {
+    for(int p = 0; p < PRIORITIES; ++p) classes[p].ring.resize(DEFAULT_LIMITS[p]);
+    reserve(in_flight);
+}
+
+void OutboundQueue::load(JsonLoader& config) {
+    std::lock_guard<std::mutex> guard(lock);
+    for(int p = 0; p < PRIORITIES; ++p){
+        const std::string prefix = std::string("outbound_") + priority_name(Priority(p));
+        Class& c = classes[p];
+        int limit = int(DEFAULT_LIMITS[p]);
+        std::string policy;
+        config.loadProperty((prefix + "_limit").c_str(), limit);
+        if(limit < 1){
+            Logger::warn("{}_limit must be at least 1, using 1", prefix);
+            limit = 1;
+        }
+        if(config.loadProperty((prefix + "_policy").c_str(), policy) && !parse_policy(policy, c.policy)){
+            Logger::warn("unknown {}_policy {}, using coalesce", prefix, policy);
+            c.policy = COALESCE;
+        }
+        c.ring.clear();
+        c.ring.resize(size_t(limit));
+        for(Message& record : c.ring) reserve(record);
+        c.head = c.count = 0;
+    }
+}
+
+// caller holds the lock
+void OutboundQueue::drop(Priority priority) {
+    Class& c = classes[priority];
+    if(!c.dropped) Logger::warn("the broker is falling behind, {} publishes are being dropped", priority_name(priority));
+    ++c.dropped;
+}
+
+bool OutboundQueue::push(Priority priority, std::string_view topic, std::string_view payload, bool retain, uint8_t qos, bool replaceable) {
+    if(topic.size() + payload.size() > MAX_MESSAGE_BYTES){
+        Logger::error("a {} byte publish on {} is larger than one packet can carry, it is dropped", payload.size(), topic);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Class& c = classes[priority];
+        Message* slot = nullptr;
+        if(c.policy == COALESCE && replaceable){
+            for(size_t n = 0; n < c.count && !slot; ++n){
+                Message& queued = at(c, n);
+                if(queued.replaceable && queued.topic == topic) slot = &queued; // keeps its place in the line
+            }
+        }
+        if(!slot){
+            if(c.count == c.ring.size()){
+                drop(priority);
+                if(c.policy == DROP_NEWEST) return false;
+                c.head = (c.head + 1) % c.ring.size(); // the oldest makes room
+                --c.count;
+            }
+            slot = &at(c, c.count++);
+            slot->topic.assign(topic);
+        }
+        slot->payload.assign(payload);
+        slot->retain = retain;
+        slot->qos = qos;
+        slot->replaceable = replaceable;
+        added = true;
+    }
+    ready.notify_one();
+    return true;
+}
+
+void OutboundQueue::wait(uint32_t timeout_ms) {
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this](){ return added || woken; });
+    woken = false;
+}
+
+void OutboundQueue::wake() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        woken = true;
+    }
+    ready.notify_all();
+}
+
+size_t OutboundQueue::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t total = 0;
+    for(const Class& c : classes) total += c.count;
+    return total;
+}
+
+void OutboundQueue::take_dropped(uint64_t (&dropped)[PRIORITIES]) {
+    std::lock_guard<std::mutex> guard(lock);
+    for(int p = 0; p < PRIORITIES; ++p){
+        dropped[p] = classes[p].dropped;
+        classes[p].dropped = 0;
+    }
+}
@@ -0,0 +1,185 @@
+#include "output_pulse.h"
+#include "remote_gpio.h"
+#include "zone.h"
+#include "gpio.h"
+#include "handoff.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+const char* OutputPulses::method_name(Method method) {
+    switch(method){
+        case TRIGGER: return "trigger";
+        case WAVE: return "wave";
+        case TIMER: return "timer";
+        default: return "refused";
+    }
+}
+
+// the first period ends the pulse, later ones find it disarmed until the zone pass cancels the timer
+void OutputPulses::timer_expired(void* userdata) {
+    Timer& t = *static_cast<Timer*>(userdata);
+    if(t.armed.exchange(false)) gpioWrite(t.pin, t.off);
+}
+
+bool OutputPulses::wave_idle(RemoteGPIOHost* host) const {
+    return (host ? host->waveBusy() : gpioWaveTxBusy()) == 0;
+}
+
+OutputPulses::Method OutputPulses::start(unsigned pin, RemoteGPIOHost* host, unsigned level, uint32_t pulse_us, size_t zone) {
+    if(pin > PI_MAX_USER_GPIO || !pulse_us || pulse_us > MAX_PULSE_US) return REFUSED;
+    stop(pin, host, false); // a new pulse replaces one still running on the pin
+    const unsigned off = level ? 0 : 1;
+
+    if(pulse_us <= TRIGGER_MAX_US){
+        int result = host ? host->trigger(pin, pulse_us, level) : gpioTrigger(pin, pulse_us, level);
+        if(result == 0){
+            triggers.push_back({ host, pin, off, zone, ZoneStateTable::tick() + 2 }); // a whole millisecond has passed by then
+            return TRIGGER;
+        }
+        Logger::error("trigger pulse on gpio {} failed ({})", pin, result);
+        return REFUSED;
+    }
+
+    // sending a wave replaces the one being sent, so only an idle engine is used
+    if(wave_idle(host)){
+        const uint32_t bit = 1u << pin;
+        int id;
+        if(host){
+            id = host->pulseWave(pin, level, pulse_us);
+        } else {
+            gpioPulse_t pulses[2] {
+                { level ? bit : 0, level ? 0 : bit, pulse_us },
+                { level ? 0 : bit, level ? bit : 0, 1 }
+            };
+            gpioWaveAddNew();
+            gpioWaveAddGeneric(2, pulses);
+            id = gpioWaveCreate();
+            if(id >= 0){
+                int result = gpioWaveTxSend(unsigned(id), PI_WAVE_MODE_ONE_SHOT);
+                if(result < 0){
+                    gpioWaveDelete(unsigned(id));
+                    id = result;
+                }
+            }
+        }
+        if(id >= 0){
+            waves.push_back({ host, pin, off, zone, id, now_ms() + (pulse_us + 999) / 1000 });
+            return WAVE;
+        }
+        Logger::warn("pulse wave on gpio {} failed ({})", pin, id);
+    }
+
+    // the timers belong to this Pi's pigpio, and their period is whole milliseconds from 10ms
+    if(host || pulse_us < PI_MIN_MS * 1000u) return REFUSED;
+    auto slot = std::find_if(timers.begin(), timers.end(), [](const Timer& t){ return !t.active; });
+    if(slot == timers.end()) return REFUSED;
+    Timer& t = *slot;
+    t.pin = pin;
+    t.off = off;
+    t.zone = zone;
+    t.millis = (pulse_us + 500) / 1000;
+    t.due_ms = now_ms() + t.millis;
+    t.active = true;
+    t.armed = true;
+    gpioWrite(pin, level);
+    int result = gpioSetTimerFuncEx(unsigned(slot - timers.begin()), t.millis, &timer_expired, &t);
+    if(result < 0){
+        t.armed = false;
+        t.active = false;
+        gpioWrite(pin, off);
+        Logger::error("pulse timer on gpio {} failed ({})", pin, result);
+        return REFUSED;
+    }
+    return TIMER;
+}
+
+void OutputPulses::stop(unsigned pin, RemoteGPIOHost* host, bool write_off) {
+    if(!host){
+        for(Timer& t : timers){
+            if(!t.active || t.pin != pin) continue;
+            if(t.armed.exchange(false) && write_off) gpioWrite(pin, t.off);
+            t.zone = NO_ZONE; // whatever wrote the pin next records its level
+        }
+    }
+    std::erase_if(triggers, [&](const Trigger& t){ return t.pin == pin && t.host == host; });
+    std::erase_if(ended, [&](const Ended& e){ return e.pin == pin && e.host == host; });
+    std::erase_if(waves, [&](const Wave& w){
+        if(w.pin != pin || w.host != host) return false;
+        if((host ? host->waveTxAt() : gpioWaveTxAt()) == w.id){
+            if(host) host->waveStop();
+            else gpioWaveTxStop();
+            if(write_off){
+                if(host) host->write(pin, w.off);
+                else gpioWrite(pin, w.off);
+            }
+        }
+        if(host) host->waveDelete(unsigned(w.id));
+        else gpioWaveDelete(unsigned(w.id));
+        return true;
+    });
+}
+
+void OutputPulses::update(ZoneStateTable& table) {
+    const uint32_t now = ZoneStateTable::tick();
+    std::erase_if(triggers, [&](const Trigger& t){
+        if(int32_t(now - t.over) < 0) return false;
+        ended.push_back({ t.host, t.pin, t.off, t.zone });
+        return true;
+    });
+    for(size_t n = 0; n < timers.size(); ++n){
+        Timer& t = timers[n];
+        if(!t.active || t.armed) continue;
+        gpioSetTimerFuncEx(unsigned(n), t.millis, nullptr, nullptr);
+        t.active = false;
+        if(t.zone != NO_ZONE) ended.push_back({ nullptr, t.pin, t.off, t.zone });
+    }
+    std::erase_if(waves, [&](const Wave& w){
+        if((w.host ? w.host->waveTxAt() : gpioWaveTxAt()) == w.id) return false;
+        if(w.host) w.host->waveDelete(unsigned(w.id)); // a host that went away has lost it anyway
+        else gpioWaveDelete(unsigned(w.id));
+        ended.push_back({ w.host, w.pin, w.off, w.zone });
+        return true;
+    });
+
+    // a pulse shorter than a pass must not fold its "on" into the "off", so the off waits until the on went out
+    std::erase_if(ended, [&](const Ended& e){
+        if(table.is_pending(e.zone)) return false;
+        table.set_level(e.zone, int16_t(e.off));
+        return true;
+    });
+}
+
+void OutputPulses::save_state(HandoffState& state, const std::vector<std::unique_ptr<Zone>>& zones) const {
+    state.pulses.clear();
+    for(const Timer& t : timers){
+        if(t.active && t.armed && t.zone != NO_ZONE) state.pulses.push_back({ zones[t.zone]->get_unique_id(), t.pin, uint8_t(t.off), t.due_ms });
+    }
+    for(const Wave& w : waves){
+        if(!w.host && w.zone != NO_ZONE) state.pulses.push_back({ zones[w.zone]->get_unique_id(), w.pin, uint8_t(w.off), w.due_ms });
+    }
+}
+
+OutputPulses::~OutputPulses() {
+    if(GPIO::keep_state){
+        // the pins stay on for the successor, which ends what save_state handed it; waves are left to pigpio
+        for(size_t n = 0; n < timers.size(); ++n){
+            if(!timers[n].active) continue;
+            timers[n].armed = false;
+            gpioSetTimerFuncEx(unsigned(n), timers[n].millis, nullptr, nullptr);
+        }
+        return;
+    }
+    for(Timer& t : timers){
+        if(t.active) stop(t.pin, nullptr, true);
+    }
+    while(!waves.empty()) stop(waves.front().pin, waves.front().host, true);
+    for(size_t n = 0; n < timers.size(); ++n){
+        if(timers[n].active) gpioSetTimerFuncEx(unsigned(n), timers[n].millis, nullptr, nullptr);
+    }
+}
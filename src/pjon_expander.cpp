@@ -0,0 +1,221 @@
+#include "pjon_serial.h"
+#include "pjon_expander.h"
+#include "logger.h"
+
+#include <chrono>
+#include <poll.h>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+struct PJONExpanderBus::Link {
+    PJONThroughSerial bus;
+    int fd = -1;
+
+    Link(uint8_t id): bus(id) {}
+
+    static void receiver(uint8_t* payload, uint16_t length, const PJON_Packet_Info& info) {
+        static_cast<PJONExpanderBus*>(info.custom_pointer)->receive(info.tx.id, payload, length);
+    }
+
+    // drain whatever the line has delivered; a completed frame needs one more call to be handed over
+    void receive_pending() {
+        do {
+            bus.receive();
+        } while(serialDataAvailable(fd) > 0 || bus.strategy.state == TS_DONE);
+    }
+};
+
+/* PJON Expander Bus */
+
+PJONExpanderBus::PJONExpanderBus(JsonLoader& config):
+    baud(9600), master_id(DEFAULT_MASTER_ID), resync_ms(30000),
+    awaiting(-1), awaiting_since_ms(0), awaiting_until_ms(0),
+    running(true), deltas(0), snapshots(0), gaps(0), polls(0)
+{
+    int id = master_id, resync = int(resync_ms / 1000);
+    config.loadProperty("pjon_port", device);
+    config.loadProperty("pjon_baud", baud);
+    config.loadProperty("pjon_id", id);
+    config.loadProperty("pjon_resync", resync);
+    master_id = uint8_t(id);
+    resync_ms = uint32_t(std::max(1, resync)) * 1000;
+
+    link = std::make_unique<Link>(master_id);
+    worker = std::thread(&PJONExpanderBus::run, this);
+}
+
+PJONExpanderBus::~PJONExpanderBus() {
+    running = false;
+    if(worker.joinable()) worker.join();
+    if(link->fd >= 0) ::close(link->fd);
+}
+
+// Raw 8N1 at any baud rate. Unlike serialOpen this tolerates ports without modem lines, such as pseudo-terminals
+int PJONExpanderBus::open_serial(const std::string& device, uint32_t baud) {
+    int fd = ::open(device.c_str(), O_RDWR | O_NOCTTY);
+    if(fd < 0) return -1;
+
+    struct termios2 tio;
+    if(ioctl(fd, TCGETS2, &tio) != 0){
+        ::close(fd);
+        return -1;
+    }
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHOE | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSTOPB | CSIZE | PARENB | CBAUD);
+    tio.c_cflag |= CS8 | BOTHER | CLOCAL | CREAD;
+    tio.c_ispeed = tio.c_ospeed = baud;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if(ioctl(fd, TCSETS2, &tio) != 0){
+        ::close(fd);
+        return -1;
+    }
+
+    int state;
+    if(ioctl(fd, TIOCMGET, &state) == 0){
+        state |= TIOCM_DTR | TIOCM_RTS;
+        ioctl(fd, TIOCMSET, &state);
+    }
+    return fd;
+}
+
+bool PJONExpanderBus::attach(uint8_t node, uint8_t bit, Callback cb) {
+    if(bit > 31 || node == master_id || node == PJON_BROADCAST || node == PJON_NOT_ASSIGNED) return false;
+    std::lock_guard<std::mutex> guard(lock);
+    Node& n = nodes[node];
+    if(n.attached & (1u << bit)) return false;
+    n.inputs[bit] = cb;
+    n.attached |= 1u << bit;
+    return true;
+}
+
+void PJONExpanderBus::detach(uint8_t node, uint8_t bit) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!nodes.count(node) || bit > 31) return;
+    Node& n = nodes.at(node);
+    n.inputs[bit] = nullptr;
+    n.attached &= ~(1u << bit);
+}
+
+int PJONExpanderBus::level(uint8_t node, uint8_t bit) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!nodes.count(node) || bit > 31 || !nodes.at(node).synced) return -1;
+    return int((nodes.at(node).levels >> bit) & 1);
+}
+
+void PJONExpanderBus::apply(Node& node, uint32_t changed, uint32_t levels) {
+    node.levels = (node.levels & ~changed) | (levels & changed);
+    changed &= node.attached;
+    for(uint8_t bit = 0; changed; ++bit, changed >>= 1){
+        if(changed & 1) node.inputs[bit]((node.levels >> bit) & 1);
+    }
+}
+
+// bus thread
+void PJONExpanderBus::receive(uint8_t sender, const uint8_t* payload, uint16_t length) {
+    if(!length) return;
+    std::lock_guard<std::mutex> guard(lock);
+    if(!nodes.count(sender)) return; // no zone uses this node
+    Node& node = nodes.at(sender);
+
+    if(payload[0] == FRAME_DELTA && length >= DELTA_SIZE){
+        ++deltas;
+        uint8_t seq = payload[1];
+        if(node.synced && seq != uint8_t(node.seq + 1)){
+            // a delta went missing, what it carried can only be recovered from a snapshot
+            ++gaps;
+            node.synced = false;
+            node.next_poll_ms = 0;
+            Logger::warn("expander node {} skipped from sequence {} to {}, resyncing", sender, node.seq, seq);
+        }
+        node.seq = seq;
+        apply(node, get_u32(&payload[2]), get_u32(&payload[6]));
+    } else if(payload[0] == FRAME_SNAPSHOT && length >= SNAPSHOT_SIZE){
+        ++snapshots;
+        uint32_t levels = get_u32(&payload[2]);
+        bool first = !node.synced;
+        apply(node, first ? ~0u : node.levels ^ levels, levels);
+        if(first) Logger::info("expander node {} is in sync", sender);
+        node.seq = payload[1];
+        node.synced = true;
+        node.synced_at_ms = now_ms();
+        node.next_poll_ms = now_ms() + resync_ms;
+    }
+}
+
+void PJONExpanderBus::run() {
+    uint64_t retry_open = 0;
+    bool begun = false;
+    while(running){
+        if(link->fd < 0){
+            if(now_ms() < retry_open){
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            link->fd = open_serial(device, baud);
+            if(link->fd < 0){
+                Logger::error("failed to open expander bus port {}", device);
+                retry_open = now_ms() + 5000;
+                continue;
+            }
+            link->bus.strategy.set_serial(int16_t(link->fd));
+            link->bus.strategy.set_read_interval(0);
+            link->bus.set_custom_pointer(this);
+            link->bus.set_receiver(&Link::receiver);
+            if(!begun){
+                link->bus.begin();
+                begun = true;
+            }
+            Logger::info("expander bus open on {} at {} baud", device, baud);
+        }
+
+        pollfd pfd { link->fd, POLLIN, 0 };
+        if(::poll(&pfd, 1, 20) < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))){
+            Logger::error("expander bus port {} failed", device);
+            ::close(link->fd);
+            link->fd = -1;
+            retry_open = now_ms() + 5000;
+            continue;
+        }
+        link->receive_pending();
+
+        // poll nodes that are out of sync or due for their periodic snapshot, one at a time so the
+        // snapshot reply does not collide with the next poll on the half-duplex line
+        uint64_t now = now_ms();
+        int due = -1;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(awaiting >= 0 && (now >= awaiting_until_ms || nodes.at(uint8_t(awaiting)).synced_at_ms >= awaiting_since_ms)){
+                awaiting = -1;
+            }
+            for(auto& [id, node] : nodes){
+                if(awaiting < 0 && node.attached && now >= node.next_poll_ms){
+                    due = id;
+                    node.next_poll_ms = now + (node.synced ? resync_ms : POLL_RETRY_MS);
+                    break;
+                }
+            }
+        }
+        if(due >= 0){
+            const uint8_t frame = FRAME_POLL;
+            ++polls;
+            if(link->bus.send_packet_blocking(uint8_t(due), &frame, 1, PJON_NO_HEADER, 0, PJON_BROADCAST, 200000) == PJON_ACK){
+                std::lock_guard<std::mutex> guard(lock);
+                awaiting = due;
+                awaiting_since_ms = now;
+                awaiting_until_ms = now_ms() + REPLY_TIMEOUT_MS;
+            } else {
+                Logger::debug("expander node {} did not answer a poll", due);
+            }
+            link->receive_pending();
+        }
+    }
+}
@@ -0,0 +1,307 @@
+// frames are paced by the federation itself, DualUDP's minimum gap between sends would only delay deltas
+#define DUDP_MINIMUM_SEND_INTERVAL_MS 0
+#include <PJONDualUDP.h>
+
+#include "pjon_federation.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
+
+static void put_u16(std::vector<uint8_t>& frame, uint16_t v) {
+    frame.push_back(uint8_t(v));
+    frame.push_back(uint8_t(v >> 8));
+}
+
+static void put_entry(std::vector<uint8_t>& frame, uint16_t hash, int state) {
+    put_u16(frame, hash);
+    frame.push_back(uint8_t(state));
+}
+
+struct PJONFederation::Link {
+    PJON<DualUDP> bus;
+
+    Link(uint8_t id): bus(id) {}
+
+    static void receiver(uint8_t* payload, uint16_t length, const PJON_Packet_Info& info) {
+        static_cast<PJONFederation*>(info.custom_pointer)->receive(info.tx.id, payload, length);
+    }
+};
+
+// FNV-1a folded to 16 bits
+uint16_t PJONFederation::zone_hash(const std::string& unique_id) {
+    uint32_t h = 2166136261u;
+    for(unsigned char c : unique_id){
+        h ^= c;
+        h *= 16777619u;
+    }
+    return uint16_t((h >> 16) ^ (h & 0xffff));
+}
+
+/* PJON Federation */
+
+PJONFederation::PJONFederation(JsonLoader& config):
+    federation_id(PJON_NOT_ASSIGNED), port(DEFAULT_PORT), seq(0),
+    running(true), deltas_sent(0), deltas_received(0), snapshots_sent(0), gaps(0), bytes_sent(0)
+{
+    int id = PJON_NOT_ASSIGNED, udp_port = port;
+    config.loadProperty("federation_id", id);
+    config.loadProperty("federation_port", udp_port);
+    federation_id = uint8_t(id);
+    port = uint16_t(udp_port);
+
+    link = std::make_unique<Link>(federation_id);
+    link->bus.strategy.set_port(port);
+    link->bus.set_acknowledge(false);
+    link->bus.set_custom_pointer(this);
+    link->bus.set_receiver(&Link::receiver);
+
+    // peers outside the broadcast domain, or on another port, have to be listed; LAN peers are learned
+    JsonLoader::Array list;
+    if(config.loadPropertyArray("federation_peers", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object entry = it->GetObject();
+            std::string address;
+            int peer = -1, peer_port = DEFAULT_PORT;
+            if(!config.loadProperty(entry, "id", peer) || peer < 1 || peer > 253 || peer == federation_id ||
+                    !config.loadProperty(entry, "address", address)){
+                Logger::warn("a federation peer needs an id (1-253) and an address! skipping...");
+                continue;
+            }
+            config.loadProperty(entry, "port", peer_port);
+
+            addrinfo hints {}, *res = nullptr;
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            if(getaddrinfo(address.c_str(), nullptr, &hints, &res) != 0 || !res){
+                Logger::warn("federation peer {} has an unknown address {}! skipping...", peer, address);
+                continue;
+            }
+            uint8_t ip[4];
+            memcpy(ip, &reinterpret_cast<sockaddr_in*>(res->ai_addr)->sin_addr.s_addr, 4);
+            freeaddrinfo(res);
+
+            if(link->bus.strategy.add_node(uint8_t(peer), ip, uint16_t(peer_port)) < 0){
+                Logger::warn("too many federation peers, {} is ignored", peer);
+                continue;
+            }
+            peers[uint8_t(peer)];
+        }
+    }
+
+    link->bus.begin();
+    if(!link->bus.strategy.can_start()){
+        Logger::error("federation cannot bind udp port {}, retrying in the background", port);
+    }
+    Logger::info("federation id {} on udp port {}", federation_id, port);
+
+    worker = std::thread(&PJONFederation::run, this);
+}
+
+PJONFederation::~PJONFederation() {
+    running = false;
+    if(worker.joinable()) worker.join();
+}
+
+bool PJONFederation::export_zone(const std::string& unique_id) {
+    uint16_t hash = zone_hash(unique_id);
+    std::lock_guard<std::mutex> guard(lock);
+    if(exports.count(hash)){
+        Logger::warn("{} cannot be federated, its id hash collides with another zone", unique_id);
+        return false;
+    }
+    exports[hash] = -1;
+    return true;
+}
+
+void PJONFederation::export_state(const std::string& unique_id, int state) {
+    uint16_t hash = zone_hash(unique_id);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = exports.find(hash);
+    if(it == exports.end() || it->second == state) return; // refreshes of an unchanged state stay local
+    it->second = state;
+    pending[hash] = state;
+}
+
+bool PJONFederation::attach(uint8_t peer, const std::string& unique_id, Callback cb) {
+    if(peer == federation_id || peer == PJON_BROADCAST || peer == PJON_NOT_ASSIGNED) return false;
+    uint16_t hash = zone_hash(unique_id);
+    std::lock_guard<std::mutex> guard(lock);
+    Peer& p = peers[peer];
+    if(p.mirrors.count(hash)) return false;
+    p.mirrors[hash] = cb;
+    return true;
+}
+
+void PJONFederation::detach(uint8_t peer, const std::string& unique_id) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(peers.count(peer)) peers.at(peer).mirrors.erase(zone_hash(unique_id));
+}
+
+int PJONFederation::level(uint8_t peer, const std::string& unique_id) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!peers.count(peer) || !peers.at(peer).synced) return -1;
+    const Peer& p = peers.at(peer);
+    auto it = p.levels.find(zone_hash(unique_id));
+    return it == p.levels.end() ? -1 : it->second;
+}
+
+void PJONFederation::apply(Peer& peer, const uint8_t* entries, size_t count) {
+    for(size_t i = 0; i < count; ++i, entries += ENTRY_SIZE){
+        uint16_t hash = get_u16(entries);
+        int state = entries[2];
+        auto known = peer.levels.find(hash);
+        bool changed = known == peer.levels.end() || known->second != state;
+        peer.levels[hash] = state;
+        auto mirror = peer.mirrors.find(hash);
+        if(changed && mirror != peer.mirrors.end() && mirror->second) mirror->second(state);
+    }
+}
+
+// worker thread
+void PJONFederation::receive(uint8_t sender, const uint8_t* payload, uint16_t length) {
+    if(!length || sender == federation_id || sender == PJON_BROADCAST || sender == PJON_NOT_ASSIGNED) return;
+    std::lock_guard<std::mutex> guard(lock);
+    Peer& peer = peers[sender];
+    peer.heard_ms = now_ms();
+    if(!peer.alive){
+        peer.alive = true;
+        Logger::info("federation peer {} is online", sender);
+    }
+
+    switch(payload[0]){
+        case FRAME_HEARTBEAT:
+            if(length < 3) return;
+            if(peer.synced && get_u16(&payload[1]) != peer.seq){
+                // the trailing deltas were lost, or the peer restarted
+                ++gaps;
+                peer.synced = false;
+                peer.request_ms = 0;
+                Logger::warn("federation peer {} is at sequence {}, expected {}, resyncing", sender, get_u16(&payload[1]), peer.seq);
+            }
+            break;
+        case FRAME_DELTA: {
+            if(length < 4 || length < 4 + payload[3] * ENTRY_SIZE) return;
+            ++deltas_received;
+            uint16_t s = get_u16(&payload[1]);
+            if(peer.synced && s != uint16_t(peer.seq + 1)){
+                ++gaps;
+                peer.synced = false;
+                peer.request_ms = 0;
+                Logger::warn("federation peer {} skipped from sequence {} to {}, resyncing", sender, peer.seq, s);
+            }
+            peer.seq = s;
+            apply(peer, &payload[4], payload[3]);
+            break;
+        }
+        case FRAME_REQUEST:
+            snapshot_for.insert(sender);
+            break;
+        case FRAME_SNAPSHOT: {
+            if(length < 5) return;
+            uint8_t page = payload[3], pages = payload[4];
+            if(page == 0) peer.next_page = 0;
+            if(page != peer.next_page) return; // a page went missing, the request is retried
+            ++peer.next_page;
+            apply(peer, &payload[5], (length - 5) / ENTRY_SIZE);
+            if(page + 1 >= pages){
+                peer.seq = get_u16(&payload[1]);
+                if(!peer.synced) Logger::info("federation peer {} is in sync", sender);
+                peer.synced = true;
+            }
+            break;
+        }
+    }
+}
+
+// worker thread
+void PJONFederation::send(uint8_t peer, const std::vector<uint8_t>& frame) {
+    if(link->bus.send_packet(peer, frame.data(), uint16_t(frame.size())) == PJON_ACK){
+        bytes_sent += frame.size();
+    }
+}
+
+void PJONFederation::run() {
+    uint64_t next_heartbeat = 0;
+    while(running){
+        if(!link->bus.strategy.can_start()){
+            // the port could not be bound yet
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        while(link->bus.receive() != PJON_FAIL); // each idle call waits up to a millisecond for a datagram
+
+        std::vector<std::pair<uint8_t, std::vector<uint8_t>>> out;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            uint64_t now = now_ms();
+
+            if(!pending.empty()){
+                for(auto it = pending.begin(); it != pending.end();){
+                    std::vector<uint8_t> frame { FRAME_DELTA };
+                    put_u16(frame, ++seq);
+                    frame.push_back(0);
+                    for(; it != pending.end() && frame[3] < DELTA_ENTRIES; ++it, ++frame[3]){
+                        put_entry(frame, it->first, it->second);
+                    }
+                    for(const auto& [id, peer] : peers) out.push_back({ id, frame });
+                    ++deltas_sent;
+                }
+                pending.clear();
+            }
+
+            for(uint8_t id : snapshot_for){
+                size_t count = 0;
+                for(const auto& [hash, state] : exports) count += state >= 0;
+                uint8_t pages = uint8_t(std::max<size_t>(1, (count + SNAPSHOT_ENTRIES - 1) / SNAPSHOT_ENTRIES));
+                auto it = exports.begin();
+                for(uint8_t page = 0; page < pages; ++page){
+                    std::vector<uint8_t> frame { FRAME_SNAPSHOT };
+                    put_u16(frame, seq);
+                    frame.push_back(page);
+                    frame.push_back(pages);
+                    for(size_t n = 0; it != exports.end() && n < SNAPSHOT_ENTRIES; ++it){
+                        if(it->second < 0) continue;
+                        put_entry(frame, it->first, it->second);
+                        ++n;
+                    }
+                    out.push_back({ id, frame });
+                }
+                ++snapshots_sent;
+            }
+            snapshot_for.clear();
+
+            if(now >= next_heartbeat){
+                std::vector<uint8_t> frame { FRAME_HEARTBEAT };
+                put_u16(frame, seq);
+                out.push_back({ PJON_BROADCAST, frame }); // lets controllers on the LAN learn about this one
+                for(const auto& [id, peer] : peers) out.push_back({ id, frame });
+                next_heartbeat = now + HEARTBEAT_MS;
+            }
+
+            for(auto& [id, peer] : peers){
+                if(peer.alive && now - peer.heard_ms > PEER_TIMEOUT_MS){
+                    peer.alive = false;
+                    peer.synced = false;
+                    Logger::warn("federation peer {} stopped responding", id);
+                }
+                if(!peer.mirrors.empty() && !peer.synced && now - peer.request_ms >= REQUEST_RETRY_MS){
+                    peer.request_ms = now;
+                    out.push_back({ id, { FRAME_REQUEST } });
+                }
+            }
+        }
+
+        for(const auto& [id, frame] : out) send(id, frame);
+    }
+}
@@ -0,0 +1,103 @@
+#include "realtime.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+void RealtimeProfile::load(JsonLoader& config) {
+    config.loadProperty("realtime", enabled);
+    config.loadProperty("realtime_priority", priority);
+    config.loadProperty("realtime_zone_cpu", zone_cpu);
+    config.loadProperty("realtime_io_cpu", io_cpu);
+    config.loadProperty("realtime_period", period_ms);
+    config.loadProperty("realtime_lock_memory", lock_memory);
+
+    int low = sched_get_priority_min(SCHED_FIFO), high = sched_get_priority_max(SCHED_FIFO);
+    if(priority < low || priority > high){
+        Logger::warn("realtime_priority must be between {} and {}, using {}", low, high, std::clamp(priority, low, high));
+        priority = std::clamp(priority, low, high);
+    }
+    if(period_ms == 0) period_ms = 1;
+}
+
+bool RealtimeProfile::pin_thread(int cpu, const char* role) {
+    if(cpu < 0) return true;
+    if(cpu >= CPU_SETSIZE){
+        Logger::warn("cannot pin the {} thread to cpu {}, it does not exist", role, cpu);
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(error){
+        Logger::warn("cannot pin the {} thread to cpu {}: {}", role, cpu, strerror(error));
+        return false;
+    }
+    Logger::info("{} thread pinned to cpu {}", role, cpu);
+    return true;
+}
+
+bool RealtimeProfile::set_fifo(int priority, const char* role) {
+    sched_param param {};
+    param.sched_priority = priority;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(error){
+        Logger::warn("cannot run the {} thread as SCHED_FIFO {}: {}", role, priority, strerror(error));
+        return false;
+    }
+    Logger::info("{} thread runs as SCHED_FIFO {}", role, priority);
+    return true;
+}
+
+bool RealtimeProfile::lock_all_memory() {
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+        Logger::warn("cannot lock the service memory: {}", strerror(errno));
+        return false;
+    }
+    Logger::info("service memory locked");
+    return true;
+}
+
+InheritMutex::InheritMutex() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+SchedLatency::SchedLatency(): passes(0), max_us(0) {
+    samples.reserve(MAX_SAMPLES);
+    sorted.reserve(MAX_SAMPLES);
+}
+
+void SchedLatency::add(uint32_t late_us) {
+    std::lock_guard<InheritMutex> guard(lock);
+    if(samples.size() < MAX_SAMPLES) samples.push_back(late_us); else samples[passes % MAX_SAMPLES] = late_us;
+    max_us = std::max(max_us, late_us);
+    ++passes;
+}
+
+SchedLatency::Summary SchedLatency::take() {
+    Summary summary { 0, 0, 0, 0 };
+    {
+        std::lock_guard<InheritMutex> guard(lock);
+        sorted.swap(samples); // the capacities travel with them
+        samples.clear();
+        summary.passes = passes;
+        summary.max_us = max_us;
+        passes = 0;
+        max_us = 0;
+    }
+    if(sorted.empty()) return summary;
+
+    std::sort(sorted.begin(), sorted.end());
+    summary.p50_us = sorted[(sorted.size() - 1) / 2];
+    summary.p99_us = sorted[(sorted.size() - 1) * 99 / 100];
+    return summary;
+}
@@ -0,0 +1,481 @@
+#include "remote_gpio.h"
+#include "logger.h"
+
+#include <pigpiod_if2.h>
+#include <command.h>
+
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static bool send_all(int fd, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while(len){
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void* data, size_t len) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while(len){
+        ssize_t n = ::recv(fd, p, len, 0);
+        if(n <= 0) return false;
+        p += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+/* Remote GPIO Host */
+
+RemoteGPIOHost::RemoteGPIOHost(RemoteGPIOManager* manager, const std::string& name, const std::string& address, uint16_t port):
+    manager(manager), host_name(name), address(address), port(port),
+    cmd_fd(-1), notify_fd(-1), notify_handle(0), online(false), watched(0),
+    last_levels(0), have_levels(false), report_used(0), retry_at_ms(0) {}
+
+RemoteGPIOHost::~RemoteGPIOHost() {
+    disconnect();
+}
+
+// Blocking TCP connect bounded by CONNECT_TIMEOUT_MS, the returned socket is blocking
+int RemoteGPIOHost::open_socket(const std::string& address, uint16_t port) {
+    addrinfo hints {}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for(addrinfo* ai = res; ai; ai = ai->ai_next){
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd < 0) continue;
+        int flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        bool ok = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+        if(!ok && errno == EINPROGRESS){
+            pollfd pfd { fd, POLLOUT, 0 };
+            int err = 0;
+            socklen_t len = sizeof err;
+            ok = ::poll(&pfd, 1, RemoteGPIOManager::CONNECT_TIMEOUT_MS) == 1 &&
+                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+        }
+        if(ok){
+            fcntl(fd, F_SETFL, flags);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            timeval tv { RemoteGPIOManager::IO_TIMEOUT_MS / 1000, (RemoteGPIOManager::IO_TIMEOUT_MS % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Caller holds cmd_lock. A transport failure drops the command socket and hands reconnection to the event loop
+int RemoteGPIOHost::command_locked(uint32_t cmd, uint32_t p1, uint32_t p2, const void* ext, uint32_t ext_len) {
+    if(cmd_fd < 0) return pigif_bad_send;
+
+    cmdCmd_t frame { cmd, p1, p2, { ext_len } };
+    if(!send_all(cmd_fd, &frame, sizeof frame) || (ext_len && !send_all(cmd_fd, ext, ext_len))){
+        drop_command_socket();
+        return pigif_bad_send;
+    }
+    if(!recv_all(cmd_fd, &frame, sizeof frame)){
+        drop_command_socket();
+        return pigif_bad_recv;
+    }
+    return int32_t(frame.res);
+}
+
+bool RemoteGPIOHost::exchange_locked(uint32_t cmd, uint32_t p1, uint32_t p2, uint32_t& reply) {
+    if(cmd_fd < 0) return false;
+    cmdCmd_t frame { cmd, p1, p2, { 0 } };
+    if(!send_all(cmd_fd, &frame, sizeof frame) || !recv_all(cmd_fd, &frame, sizeof frame)){
+        drop_command_socket();
+        return false;
+    }
+    reply = frame.res;
+    return true;
+}
+
+int RemoteGPIOHost::command(uint32_t cmd, uint32_t p1, uint32_t p2, const void* ext, uint32_t ext_len) {
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    return command_locked(cmd, p1, p2, ext, ext_len);
+}
+
+void RemoteGPIOHost::drop_command_socket() {
+    ::close(cmd_fd);
+    cmd_fd = -1;
+    if(online.exchange(false)){
+        Logger::warn("remote gpio host {} stopped responding", host_name);
+        manager->wake();
+    }
+}
+
+bool RemoteGPIOHost::connect() {
+    int cfd = open_socket(address, port);
+    int nfd = cfd < 0 ? -1 : open_socket(address, port);
+    if(nfd < 0){
+        if(cfd >= 0) ::close(cfd);
+        return false;
+    }
+
+    // switch the second socket into an in-band notification stream
+    cmdCmd_t frame { PI_CMD_NOIB, 0, 0, { 0 } };
+    if(!send_all(nfd, &frame, sizeof frame) || !recv_all(nfd, &frame, sizeof frame) || int32_t(frame.res) < 0){
+        ::close(cfd);
+        ::close(nfd);
+        return false;
+    }
+    fcntl(nfd, F_SETFL, fcntl(nfd, F_GETFL) | O_NONBLOCK);
+
+    int levels, tick;
+    {
+        std::lock_guard<std::mutex> cmd_guard(cmd_lock);
+        cmd_fd = cfd;
+        notify_fd = nfd;
+        notify_handle = frame.res;
+        report_used = 0;
+
+        // replay the pin setup, then start the stream before sampling so no edge falls in between
+        uint32_t bits;
+        std::array<PinSetup, 32> setup;
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            setup = pins;
+            bits = watched;
+        }
+        for(unsigned g = 0; g < setup.size(); ++g){
+            if(setup[g].mode >= 0) command_locked(PI_CMD_MODES, g, uint32_t(setup[g].mode));
+            if(setup[g].pud >= 0) command_locked(PI_CMD_PUD, g, uint32_t(setup[g].pud));
+            if(setup[g].glitch >= 0) command_locked(PI_CMD_FG, g, uint32_t(setup[g].glitch));
+            if(setup[g].watchdog >= 0) command_locked(PI_CMD_WDOG, g, uint32_t(setup[g].watchdog));
+        }
+        int nb = command_locked(PI_CMD_NB, notify_handle, bits);
+        levels = command_locked(PI_CMD_BR1, 0, 0);
+        tick = command_locked(PI_CMD_TICK, 0, 0);
+        if(cmd_fd < 0 || nb < 0){
+            ::close(notify_fd);
+            notify_fd = -1;
+            if(cmd_fd >= 0) ::close(cmd_fd);
+            cmd_fd = -1;
+            return false;
+        }
+        online = true;
+    }
+    Logger::info("remote gpio host {} connected ({}:{})", host_name, address, port);
+
+    // anything that moved while the host was unreachable is reported as a fresh level
+    gpioReport_t sample { 0, 0, uint32_t(tick), uint32_t(levels) };
+    dispatch(sample);
+    return true;
+}
+
+void RemoteGPIOHost::disconnect() {
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    online = false;
+    if(cmd_fd >= 0 && notify_fd >= 0){
+        command_locked(PI_CMD_NC, notify_handle, 0);
+    }
+    if(cmd_fd >= 0) ::close(cmd_fd);
+    if(notify_fd >= 0) ::close(notify_fd);
+    cmd_fd = notify_fd = -1;
+}
+
+bool RemoteGPIOHost::read_reports() {
+    for(;;){
+        ssize_t n = ::recv(notify_fd, report_buf + report_used, sizeof report_buf - report_used, 0);
+        if(n == 0) return false;
+        if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        report_used += size_t(n);
+        if(report_used == sizeof report_buf){
+            gpioReport_t report;
+            memcpy(&report, report_buf, sizeof report);
+            report_used = 0;
+            dispatch(report);
+        }
+    }
+}
+
+void RemoteGPIOHost::dispatch(const gpioReport_t& report) {
+    if(report.flags & (PI_NTFY_FLAGS_ALIVE | PI_NTFY_FLAGS_EVENT)) return;
+
+    std::lock_guard<std::mutex> dispatch_guard(dispatch_lock);
+    std::array<Alert, 32> table;
+    uint32_t changed = 0;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        table = alerts;
+        if(!(report.flags & PI_NTFY_FLAGS_WDOG)){
+            changed = (have_levels ? report.level ^ last_levels : ~0u) & watched;
+            last_levels = report.level;
+            have_levels = true;
+        }
+    }
+    if(report.flags & PI_NTFY_FLAGS_WDOG){
+        unsigned gpio = PI_NTFY_FLAGS_BIT(report.flags);
+        if(table[gpio].func) table[gpio].func(int(gpio), PI_TIMEOUT, report.tick, table[gpio].userdata);
+        return;
+    }
+    for(unsigned gpio = 0; changed; ++gpio, changed >>= 1){
+        if((changed & 1) && table[gpio].func){
+            table[gpio].func(int(gpio), int((report.level >> gpio) & 1), report.tick, table[gpio].userdata);
+        }
+    }
+}
+
+int RemoteGPIOHost::setMode(unsigned gpio, unsigned mode) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_GPIO;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        pins[gpio].mode = int(mode);
+    }
+    return command(PI_CMD_MODES, gpio, mode);
+}
+
+int RemoteGPIOHost::setPullUpDown(unsigned gpio, unsigned pud) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_GPIO;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        pins[gpio].pud = int(pud);
+    }
+    return command(PI_CMD_PUD, gpio, pud);
+}
+
+int RemoteGPIOHost::glitchFilter(unsigned gpio, unsigned steady) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_USER_GPIO;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        pins[gpio].glitch = steady ? int(steady) : -1;
+    }
+    return command(PI_CMD_FG, gpio, steady);
+}
+
+int RemoteGPIOHost::setWatchdog(unsigned gpio, unsigned timeout_ms) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_USER_GPIO;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        pins[gpio].watchdog = timeout_ms ? int(timeout_ms) : -1;
+    }
+    int result = command(PI_CMD_WDOG, gpio, timeout_ms);
+    return result == pigif_bad_send || result == pigif_bad_recv ? 0 : result; // applied on reconnect
+}
+
+int RemoteGPIOHost::read(unsigned gpio) {
+    return command(PI_CMD_READ, gpio, 0);
+}
+
+int RemoteGPIOHost::write(unsigned gpio, unsigned level) {
+    return command(PI_CMD_WRITE, gpio, level);
+}
+
+// the levels are a full 32 bit word that may look negative, only a failed exchange is an error
+bool RemoteGPIOHost::readBits(uint32_t& levels) {
+    if(!online) return false;
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    return exchange_locked(PI_CMD_BR1, 0, 0, levels);
+}
+
+// one lock for both, no other command on this host lands between the set and the clear
+int RemoteGPIOHost::writeBits(uint32_t set, uint32_t clear) {
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    int result = set ? command_locked(PI_CMD_BS1, set, 0) : 0;
+    if(result >= 0 && clear) result = command_locked(PI_CMD_BC1, clear, 0);
+    return result;
+}
+
+int RemoteGPIOHost::trigger(unsigned gpio, unsigned pulse_us, unsigned level) {
+    uint32_t ext = level;
+    return command(PI_CMD_TRIG, gpio, pulse_us, &ext, sizeof ext);
+}
+
+// the wave is built, created and sent under one lock, so two pulses cannot mix their pulses
+int RemoteGPIOHost::pulseWave(unsigned gpio, unsigned level, uint32_t pulse_us) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_USER_GPIO;
+    const uint32_t bit = 1u << gpio;
+    gpioPulse_t pulses[2] {
+        { level ? bit : 0, level ? 0 : bit, pulse_us },
+        { level ? 0 : bit, level ? bit : 0, 1 }
+    };
+    std::lock_guard<std::mutex> guard(cmd_lock);
+    int result = command_locked(PI_CMD_WVNEW, 0, 0);
+    if(result >= 0) result = command_locked(PI_CMD_WVAG, 0, 0, pulses, sizeof pulses);
+    if(result < 0) return result;
+    int wave_id = command_locked(PI_CMD_WVCRE, 0, 0);
+    if(wave_id < 0) return wave_id;
+    result = command_locked(PI_CMD_WVTX, unsigned(wave_id), 0);
+    if(result < 0){
+        command_locked(PI_CMD_WVDEL, unsigned(wave_id), 0);
+        return result;
+    }
+    return wave_id;
+}
+
+int RemoteGPIOHost::waveBusy() {
+    return command(PI_CMD_WVBSY, 0, 0);
+}
+
+int RemoteGPIOHost::waveTxAt() {
+    return command(PI_CMD_WVTAT, 0, 0);
+}
+
+int RemoteGPIOHost::waveStop() {
+    return command(PI_CMD_WVHLT, 0, 0);
+}
+
+int RemoteGPIOHost::waveDelete(unsigned wave_id) {
+    return command(PI_CMD_WVDEL, wave_id, 0);
+}
+
+// Callbacks run on the event loop thread and must not call setAlertFuncEx themselves
+int RemoteGPIOHost::setAlertFuncEx(unsigned gpio, gpioAlertFuncEx_t f, void* userdata) {
+    if(gpio > PI_MAX_USER_GPIO) return PI_BAD_USER_GPIO;
+
+    std::lock_guard<std::mutex> dispatch_guard(dispatch_lock); // no callback for this pin is still running on return
+    uint32_t bits;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        alerts[gpio] = { f, userdata };
+        if(f) watched |= 1u << gpio; else watched &= ~(1u << gpio);
+        bits = watched;
+    }
+
+    std::lock_guard<std::mutex> cmd_guard(cmd_lock);
+    if(cmd_fd < 0) return 0; // applied on reconnect
+    int level = command_locked(PI_CMD_READ, gpio, 0);
+    if(level >= 0){
+        // a newly watched pin starts from its current level
+        std::lock_guard<std::mutex> guard(state_lock);
+        last_levels = (last_levels & ~(1u << gpio)) | (uint32_t(level & 1) << gpio);
+    }
+    int result = command_locked(PI_CMD_NB, notify_handle, bits);
+    return result < 0 ? result : 0;
+}
+
+/* Remote GPIO Manager */
+
+RemoteGPIOManager::RemoteGPIOManager(JsonLoader& config): running(true) {
+    if(pipe(wake_pipe) != 0){
+        wake_pipe[0] = wake_pipe[1] = -1;
+    } else {
+        fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    JsonLoader::Array list;
+    if(config.loadPropertyArray("hosts", list)){
+        for(auto it = list.Begin(); it < list.End(); it++){
+            JsonLoader::Object host = it->GetObject();
+            std::string name, address;
+            int port = PI_DEFAULT_SOCKET_PORT;
+            if(!config.loadProperty(host, "name", name) || name.empty() || !config.loadProperty(host, "address", address)){
+                Logger::warn("a remote gpio host needs a name and an address! skipping...");
+                continue;
+            }
+            config.loadProperty(host, "port", port);
+            if(find(name)){
+                Logger::warn("remote gpio host {} is defined twice! skipping...", name);
+                continue;
+            }
+
+            auto remote = std::make_unique<RemoteGPIOHost>(this, name, address, uint16_t(port));
+            if(!remote->connect()){
+                Logger::warn("remote gpio host {} ({}:{}) is unreachable, retrying in the background", name, address, port);
+                remote->retry_at_ms = now_ms() + RECONNECT_INTERVAL_MS;
+            }
+            hosts.push_back(std::move(remote));
+        }
+    }
+
+    if(!hosts.empty()){
+        event_loop = std::thread(&RemoteGPIOManager::loop, this);
+    }
+}
+
+RemoteGPIOManager::~RemoteGPIOManager() {
+    running = false;
+    wake();
+    if(event_loop.joinable()) event_loop.join();
+    hosts.clear();
+    if(wake_pipe[0] >= 0) ::close(wake_pipe[0]);
+    if(wake_pipe[1] >= 0) ::close(wake_pipe[1]);
+}
+
+RemoteGPIOHost* RemoteGPIOManager::find(const std::string& name) const {
+    for(const auto& host : hosts){
+        if(host->name() == name) return host.get();
+    }
+    return nullptr;
+}
+
+void RemoteGPIOManager::wake() {
+    char c = 0;
+    if(wake_pipe[1] >= 0 && ::write(wake_pipe[1], &c, 1) < 0){} // a full pipe already means a pending wake
+}
+
+// Every host's notification stream is serviced from this one thread
+void RemoteGPIOManager::loop() {
+    std::vector<pollfd> fds;
+    std::vector<RemoteGPIOHost*> owners;
+    while(running){
+        fds.clear();
+        owners.clear();
+        fds.push_back({ wake_pipe[0], POLLIN, 0 });
+        owners.push_back(nullptr);
+
+        uint64_t now = now_ms(), next_retry = now + 1000;
+        for(auto& host : hosts){
+            if(host->notify_fd >= 0 && host->online){
+                fds.push_back({ host->notify_fd, POLLIN, 0 });
+                owners.push_back(host.get());
+            } else {
+                next_retry = std::min(next_retry, host->retry_at_ms);
+            }
+        }
+
+        int timeout = int(next_retry > now ? next_retry - now : 0);
+        if(::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+        if(fds[0].revents & POLLIN){
+            char drain[64];
+            while(::read(wake_pipe[0], drain, sizeof drain) > 0);
+        }
+        for(size_t i = 1; i < fds.size(); ++i){
+            if(fds[i].revents && !owners[i]->read_reports()){
+                Logger::warn("remote gpio host {} closed its notification stream", owners[i]->name());
+                owners[i]->disconnect();
+                owners[i]->retry_at_ms = now_ms();
+            }
+        }
+        if(!running) break;
+
+        now = now_ms();
+        for(auto& host : hosts){
+            if(host->online) continue;
+            if(host->notify_fd >= 0){
+                host->disconnect(); // the command socket failed, restart both
+                host->retry_at_ms = now;
+            }
+            if(now >= host->retry_at_ms && !host->connect()){
+                host->retry_at_ms = now_ms() + RECONNECT_INTERVAL_MS;
+            }
+        }
+    }
+}
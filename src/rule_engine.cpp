@@ -0,0 +1,181 @@
+#include "rule_engine.h"
+#include "zone.h"
+#include "logger.h"
+#include "handoff.h"
+
+#include <algorithm>
+#include <chrono>
+#include <regex>
+
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// zones are referenced by name or unique id
+int RuleEngine::find_zone(const std::string& name) const {
+    std::string id = std::regex_replace(name, std::regex("[^a-zA-Z0-9]"), "");
+    for(size_t i = 0; i < zones.size(); ++i){
+        if(zones[i]->get_unique_id() == id) return int(i);
+    }
+    return -1;
+}
+
+RuleEngine::RuleEngine(JsonLoader& config, const ZoneList& zones, EventHandler on_event):
+    zones(zones), on_event(on_event), states(zones.size(), -1), next_due_ms(UINT64_MAX), fired(0)
+{
+    struct Compiled {
+        uint16_t zone;
+        Trigger trigger;
+        std::vector<Action> actions;
+    };
+    std::vector<Compiled> compiled;
+
+    JsonLoader::Array list;
+    if(config.loadPropertyArray("rules", list)){
+        int index = 0;
+        for(auto it = list.Begin(); it < list.End(); it++, index++){
+            JsonLoader::Object rule = it->GetObject();
+            std::string name = "rule " + std::to_string(index), when, condition, target, event;
+            config.loadProperty(rule, "name", name);
+
+            int zone = -1;
+            if(!config.loadProperty(rule, "when", when) || (zone = find_zone(when)) < 0){
+                Logger::warn("{} has an unknown when zone! skipping...", name);
+                continue;
+            }
+            Compiled c { uint16_t(zone), { -1, NONE, 0, 0, 0 }, {} };
+
+            int level = -1;
+            if(config.loadProperty(rule, "is", level)) c.trigger.level = int16_t(level);
+
+            if(config.loadProperty(rule, "if", condition)){
+                int condition_zone = find_zone(condition), condition_level = 1;
+                if(condition_zone < 0){
+                    Logger::warn("{} has an unknown if zone! skipping...", name);
+                    continue;
+                }
+                config.loadProperty(rule, "if_is", condition_level);
+                c.trigger.condition_zone = uint16_t(condition_zone);
+                c.trigger.condition_level = int16_t(condition_level);
+            }
+
+            if(config.loadProperty(rule, "set", target)){
+                int target_zone = find_zone(target), to = 1, after = 0, duration = 0;
+                if(target_zone < 0){
+                    Logger::warn("{} sets an unknown zone! skipping...", name);
+                    continue;
+                }
+                config.loadProperty(rule, "to", to);
+                config.loadProperty(rule, "after", after);
+                config.loadProperty(rule, "for", duration);
+                c.actions.push_back({ ACTION_SET, uint16_t(target_zone), int16_t(to), uint32_t(std::max(0, after)), uint32_t(std::max(0, duration)), 0, 0, false });
+            }
+
+            if(config.loadProperty(rule, "publish", event) && !event.empty()){
+                JsonLoader payload;
+                payload.saveProperty("event_type", event);
+                payload.saveProperty("rule", name);
+                event_payloads.push_back(payload.toString());
+                c.actions.push_back({ ACTION_PUBLISH, NONE, 0, 0, 0, uint16_t(event_payloads.size() - 1), 0, false });
+            }
+
+            if(c.actions.empty()){
+                Logger::warn("{} has no action! skipping...", name);
+                continue;
+            }
+            compiled.push_back(std::move(c));
+        }
+    }
+
+    // lay the triggers out by zone, keeping config order within a zone
+    std::stable_sort(compiled.begin(), compiled.end(), [](const Compiled& a, const Compiled& b){ return a.zone < b.zone; });
+    trigger_offsets.assign(zones.size() + 1, 0);
+    for(Compiled& c : compiled){
+        c.trigger.first_action = uint16_t(actions.size());
+        c.trigger.action_count = uint16_t(c.actions.size());
+        actions.insert(actions.end(), c.actions.begin(), c.actions.end());
+        triggers.push_back(c.trigger);
+        ++trigger_offsets[c.zone + 1];
+    }
+    for(size_t i = 1; i < trigger_offsets.size(); ++i) trigger_offsets[i] += trigger_offsets[i - 1];
+
+    if(!triggers.empty()) Logger::info("{} rules loaded", triggers.size());
+}
+
+void RuleEngine::on_state(size_t zone, int state) {
+    if(zone >= states.size() || states[zone] == state) return;
+    bool first = states[zone] < 0; // the initial report of a zone is not a change
+    states[zone] = int16_t(state);
+    if(first) return;
+
+    for(uint32_t t = trigger_offsets[zone], end = trigger_offsets[zone + 1]; t < end; ++t){
+        const Trigger& trigger = triggers[t];
+        if(trigger.level >= 0 && trigger.level != state) continue;
+        if(trigger.condition_zone != NONE && states[trigger.condition_zone] != trigger.condition_level) continue;
+        ++fired;
+        run(trigger.first_action, trigger.action_count, now_ms());
+    }
+}
+
+void RuleEngine::run(uint16_t first, uint16_t count, uint64_t now) {
+    for(uint16_t i = first; i < first + count; ++i){
+        Action& action = actions[i];
+        action.due_ms = 0; // cancels a timer left from an earlier firing
+        if(action.type == ACTION_PUBLISH){
+            if(on_event) on_event(event_payloads[action.event]);
+        } else if(action.after_ms){
+            schedule(action, now + action.after_ms, false);
+        } else {
+            apply(i, false, now);
+        }
+    }
+}
+
+void RuleEngine::schedule(Action& action, uint64_t due_ms, bool revert) {
+    action.due_ms = std::max<uint64_t>(due_ms, 1);
+    action.revert = revert;
+    next_due_ms = std::min(next_due_ms, action.due_ms);
+}
+
+void RuleEngine::apply(uint16_t index, bool revert, uint64_t now) {
+    Action& action = actions[index];
+    zones[action.zone]->set(revert ? (action.level ? 0 : 1) : action.level);
+    if(!revert && action.for_ms) schedule(action, now + action.for_ms, true);
+}
+
+// a pass with nothing due is one compare, otherwise the actions are scanned for theirs
+void RuleEngine::update() {
+    uint64_t now = now_ms();
+    if(now < next_due_ms) return;
+    next_due_ms = UINT64_MAX;
+    for(uint16_t i = 0; i < actions.size(); ++i){
+        Action& action = actions[i];
+        if(!action.due_ms) continue;
+        if(action.due_ms > now){
+            next_due_ms = std::min(next_due_ms, action.due_ms);
+            continue;
+        }
+        action.due_ms = 0;
+        apply(i, action.revert, now); // may schedule the revert, which lowers next_due_ms
+    }
+}
+
+void RuleEngine::save_state(HandoffState& state) const {
+    state.timers.clear();
+    for(uint16_t i = 0; i < actions.size(); ++i){
+        const Action& action = actions[i];
+        if(action.due_ms) state.timers.push_back({ action.due_ms, i, zones[action.zone]->get_unique_id(), action.revert });
+    }
+}
+
+void RuleEngine::restore_state(const HandoffState& state, const std::vector<int16_t>& levels) {
+    for(size_t z = 0; z < states.size() && z < levels.size(); ++z) states[z] = levels[z];
+    for(const HandoffState::RuleTimer& timer : state.timers){
+        // the action index only holds if the successor compiled the same rules
+        if(timer.action >= actions.size() || actions[timer.action].type != ACTION_SET || zones[actions[timer.action].zone]->get_unique_id() != timer.zone){
+            Logger::warn("a rule timer for {} does not match the rules any more, it is dropped", timer.zone);
+            continue;
+        }
+        schedule(actions[timer.action], timer.due_ms, timer.revert);
+    }
+}
@@ -1,65 +1,298 @@
 #include "zone.h"
 #include "clock.h"
 #include "adt-security.h"
+#include "remote_gpio.h"
+#include "pjon_expander.h"
+#include "pjon_federation.h"
+#include "rule_engine.h"
+#include "alarm_panel.h"
+#include "handoff.h"
 
 #include <algorithm>
+#include <bit>
+#include <charconv>
+#include <chrono>
 #include <regex>
 #include <map>
 
 const std::vector<std::string> Zone::ZoneTypes {
-    "gpio_digital", "virtual"
+    "gpio_digital", "virtual", "pjon_remote", "federated"
 };
 
-Zone::Zone(const std::string& name, IO type, bool invert, const ZoneMetaFields& meta) {
+Zone::Zone(ZoneSlot slot, const std::string& name, IO type, bool invert, const ZoneMetaFields& meta):
+    slot(slot), name(name), type(type), invert(invert), meta(meta)
+{
     unique_id = std::regex_replace(name, std::regex("[^a-zA-Z0-9]"), "");
-    state_changed = true;
-    last_state_changed.setSeconds(100);
-    trigger_timeout = meta.trigger_timeout_threshold;
-    
-    metadata.saveProperty("name", name); // device name
-    metadata.saveProperty("unique_id", unique_id); // device id
-    metadata.saveProperty("p", std::string( type == IO::IO_OUTPUT ? "switch" : "binary_sensor" )); // platform
-    metadata.saveProperty("payload_on", std::string(invert ? "0":"1") ); // when on
-    metadata.saveProperty("payload_off", std::string(invert ? "1":"0")); // when off
+    slot.table->bind(slot.index, meta.trigger_timeout_threshold);
 
-    if(!meta.device_class.empty()) metadata.saveProperty("device_class", meta.device_class); // device class type
-    if(!meta.icon.empty()) metadata.saveProperty("icon", meta.icon); // device class type
+    metadata += '{';
+    append_json_field(metadata, "name", name); // device name
+    append_json_field(metadata, "unique_id", unique_id); // device id
+    append_json_field(metadata, "p", type == IO::IO_OUTPUT ? "switch" : "binary_sensor"); // platform
+    append_json_field(metadata, "payload_on", invert ? "0" : "1"); // when on
+    append_json_field(metadata, "payload_off", invert ? "1" : "0"); // when off
+
+    if(!meta.device_class.empty()) append_json_field(metadata, "device_class", meta.device_class); // device class type
+    if(!meta.icon.empty()) append_json_field(metadata, "icon", meta.icon); // icon
+    metadata += '}';
 }
 
+void Zone::format_discovery(std::string_view state_topic, std::string_view command_topic, std::string_view attributes_topic) {
+    discovery.clear();
+    append_json_string(discovery, unique_id);
+    discovery += ':';
+    discovery.append(metadata, 0, metadata.size() - 1); // still open for the topics
+    append_json_field(discovery, "state_topic", state_topic);
+    append_json_field(discovery, "command_topic", command_topic);
+    append_json_field(discovery, "json_attr_t", attributes_topic);
+    discovery += '}';
+}
 
-DigitalGPIO_Zone::DigitalGPIO_Zone(const std::string& name, IO type, int pin, bool invert, const ZoneMetaFields& meta, GPIO::PinType mode):
-    Zone(name, type, invert, meta),
-    gpio( std::make_unique<GPIO>(pin, type == IO::IO_INPUT ? mode : GPIO::PIN_OUTPUT, std::bind(&onGPIOStateChange, this, std::placeholders::_1)) ),
-    type(type)
+
+DigitalGPIO_Zone::DigitalGPIO_Zone(ZoneSlot slot, const std::string& name, IO type, int pin, bool invert, const ZoneMetaFields& meta, GPIO::PinType mode, RemoteGPIOHost* host):
+    Zone(slot, name, type, invert, meta),
+    type(type),
+    gpio(pin, type == IO::IO_INPUT ? mode : GPIO::PIN_OUTPUT, GPIO::Callback::bind<&onGPIOStateChange>(this), host)
 {
-    set_state_level(get());
+    int level = get();
+    if(level >= 0) set_state_level(level); // an unreachable remote host reports its levels once it connects
+    if(meta.supervision_timeout && gpio.setWatchdog(meta.supervision_timeout) < 0){
+        Logger::warn("{} could not arm its supervision watchdog", name);
+    }
 }
 
 DigitalGPIO_Zone::~DigitalGPIO_Zone() {}
 
-void DigitalGPIO_Zone::onGPIOStateChange(DigitalGPIO_Zone* _this, int level) {
+// the watchdog reports through the same alert as an edge, so supervision costs the zone pass nothing but a mask compare
+void DigitalGPIO_Zone::onGPIOStateChange(DigitalGPIO_Zone* _this, int, int level, uint32_t) {
+    if(level == PI_TIMEOUT){
+        _this->set_silent(true); // repeated every timeout while the pin stays quiet
+        return;
+    }
+    _this->set_silent(false);
     _this->set_state_level(level);
 }
 
 void DigitalGPIO_Zone::set(int level) {
     if(type == IO::IO_OUTPUT){
         // update the internal state if the GPIO updates successfully
-        if( gpio->write(level) ){
+        if( gpio.write(level) ){
             set_state_level(level);
         } else {
-            std::cerr << "gpio state change failure\n";
+            Logger::error("gpio state change failure");
         }
     } else {
-        std::cerr << "cannot set the state of an INPUT GPIO pin\n";
+        Logger::error("cannot set the state of an INPUT GPIO pin");
     }
 }
 
 int DigitalGPIO_Zone::get() {
-    return gpio->read();
+    return gpio.read();
+}
+
+const std::array<const char*,4> Button_Zone::PressNames {
+    "single", "double", "long", "hold"
+};
+
+Button_Zone::Button_Zone(ZoneSlot slot, const std::string& name, int pin, bool invert, const ZoneMetaFields& meta, const Timing& timing, GPIO::PinType mode, RemoteGPIOHost* host):
+    Zone(slot, name, IO::IO_INPUT, invert, meta),
+    timing(timing), pressed_level(invert ? 0 : 1), phase(IDLE), press_tick(0), release_tick(0),
+    ring_head(0), ring_tail(0), overflow(0), rearm(NO_REARM),
+    gpio(pin, mode, GPIO::Callback::bind<&onGPIOStateChange>(this), host)
+{
+    if(timing.bounce_ms && gpio.setGlitchFilter(timing.bounce_ms * 1000) < 0){
+        Logger::warn("{} could not set its glitch filter, presses may bounce", name);
+    }
+    int level = get();
+    if(level >= 0) set_state_level(level);
+}
+
+Button_Zone::~Button_Zone() {}
+
+void Button_Zone::emit(Press press) {
+    uint32_t tail = ring_tail.load(std::memory_order_relaxed);
+    if(tail - ring_head.load(std::memory_order_acquire) == RING_SIZE){
+        overflow.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring[tail % RING_SIZE] = press;
+    ring_tail.store(tail + 1, std::memory_order_release);
+}
+
+// A remote pin is re-armed by the next zone pass; only the last timeout matters, each edge supersedes the one before
+void Button_Zone::arm(uint32_t timeout_ms) {
+    if(gpio.remote()){
+        rearm.store(int32_t(timeout_ms), std::memory_order_release);
+        return;
+    }
+    if(gpio.setWatchdog(timeout_ms) < 0) Logger::warn("{} could not arm its press watchdog", get_unique_id());
+}
+
+void Button_Zone::apply_rearm() {
+    int32_t timeout_ms = rearm.exchange(NO_REARM, std::memory_order_acquire);
+    if(timeout_ms != NO_REARM && gpio.setWatchdog(uint32_t(timeout_ms)) < 0){
+        Logger::warn("{} could not arm its press watchdog", get_unique_id());
+    }
+}
+
+// Runs on the alert thread; every decision is taken from the ticks pigpio reports, not from when the alert runs.
+// The watchdog reports PI_TIMEOUT once the pin has been quiet for the timeout armed at the last edge.
+void Button_Zone::onGPIOStateChange(Button_Zone* _this, int, int level, uint32_t tick) {
+    const Timing& t = _this->timing;
+    if(level == PI_TIMEOUT){
+        switch(_this->phase){
+            case PRESSED:
+                _this->emit(PRESS_HOLD);
+                _this->phase = LATCHED;
+                break;
+            case RELEASED:
+                _this->emit(PRESS_SINGLE);
+                _this->phase = IDLE;
+                break;
+            default:
+                break;
+        }
+        _this->arm(0); // it would repeat every timeout
+        return;
+    }
+    _this->set_state_level(level);
+
+    if(level == _this->pressed_level){
+        if(_this->phase == RELEASED){
+            if(tick - _this->release_tick <= t.double_window_ms * 1000){
+                _this->emit(PRESS_DOUBLE);
+                _this->phase = LATCHED;
+                _this->arm(0);
+                return;
+            }
+            _this->emit(PRESS_SINGLE); // the watchdog was late, this press starts the next pattern
+        }
+        _this->press_tick = tick;
+        _this->phase = PRESSED;
+        _this->arm(t.hold_ms);
+        return;
+    }
+
+    switch(_this->phase){
+        case PRESSED:
+            if(tick - _this->press_tick >= t.long_press_ms * 1000){
+                _this->emit(PRESS_LONG);
+                _this->phase = IDLE;
+                _this->arm(0);
+            } else if(!t.double_window_ms){
+                _this->emit(PRESS_SINGLE);
+                _this->phase = IDLE;
+                _this->arm(0);
+            } else {
+                _this->release_tick = tick;
+                _this->phase = RELEASED;
+                _this->arm(t.double_window_ms);
+            }
+            break;
+        case LATCHED:
+            _this->phase = IDLE;
+            break;
+        default:
+            break;
+    }
+}
+
+void Button_Zone::format_press_discovery(std::string_view press_topic) {
+    std::string& out = discovery_text();
+    out += ',';
+    append_json_string(out, get_unique_id() + "_press");
+    out += ":{";
+    append_json_field(out, "name", get_name() + " Press");
+    append_json_field(out, "unique_id", get_unique_id() + "_press");
+    append_json_field(out, "p", "event");
+    append_json_field(out, "device_class", "button");
+    append_json_key(out, "event_types");
+    out += '[';
+    for(const char* press : PressNames){
+        if(out.back() != '[') out += ',';
+        append_json_string(out, press);
+    }
+    out += ']';
+    append_json_field(out, "state_topic", press_topic);
+    out += '}';
+}
+
+bool Button_Zone::take_press(Press& press) {
+    uint32_t head = ring_head.load(std::memory_order_relaxed);
+    if(head == ring_tail.load(std::memory_order_acquire)) return false;
+    press = ring[head % RING_SIZE];
+    ring_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t Button_Zone::take_overflow() {
+    return overflow.exchange(0, std::memory_order_relaxed);
+}
+
+void Button_Zone::set(int) {
+    Logger::error("cannot set the state of a button");
+}
+
+int Button_Zone::get() {
+    return gpio.read();
+}
+
+PJONRemote_Zone::PJONRemote_Zone(ZoneSlot slot, const std::string& name, PJONExpanderBus* bus, uint8_t node, uint8_t bit, bool invert, const ZoneMetaFields& meta):
+    Zone(slot, name, IO::IO_INPUT, invert, meta),
+    bus(bus), node(node), bit(bit)
+{
+    if(!bus->attach(node, bit, std::bind(&onBusStateChange, this, std::placeholders::_1))){
+        Logger::warn("{} could not attach to expander node {} input {}", name, node, bit);
+    }
+    int level = get();
+    if(level >= 0) set_state_level(level); // otherwise the node's first snapshot reports it
+}
+
+PJONRemote_Zone::~PJONRemote_Zone() {
+    bus->detach(node, bit);
+}
+
+void PJONRemote_Zone::onBusStateChange(PJONRemote_Zone* _this, int level) {
+    _this->set_state_level(level);
+}
+
+void PJONRemote_Zone::set(int) {
+    Logger::error("cannot set the state of an expander input");
+}
+
+int PJONRemote_Zone::get() {
+    return bus->level(node, bit);
+}
+
+Federated_Zone::Federated_Zone(ZoneSlot slot, const std::string& name, PJONFederation* federation, uint8_t peer, const std::string& remote_id, bool invert, const ZoneMetaFields& meta):
+    Zone(slot, name, IO::IO_INPUT, invert, meta),
+    federation(federation), peer(peer), remote_id(remote_id)
+{
+    if(!federation->attach(peer, remote_id, std::bind(&onPeerStateChange, this, std::placeholders::_1))){
+        Logger::warn("{} could not attach to zone {} of federation peer {}", name, remote_id, peer);
+    }
+    int level = get();
+    if(level >= 0) set_state_level(level); // otherwise the peer's first snapshot reports it
 }
 
-Virtual_Zone::Virtual_Zone(const std::string& name, IO type, bool invert, VirtualCallback cb, const ZoneMetaFields& meta):
-    Zone(name, type, invert, meta),
+Federated_Zone::~Federated_Zone() {
+    federation->detach(peer, remote_id);
+}
+
+void Federated_Zone::onPeerStateChange(Federated_Zone* _this, int level) {
+    _this->set_state_level(level);
+}
+
+void Federated_Zone::set(int) {
+    Logger::error("cannot set the state of a federated zone, it belongs to peer {}", peer);
+}
+
+int Federated_Zone::get() {
+    return federation->level(peer, remote_id);
+}
+
+Virtual_Zone::Virtual_Zone(ZoneSlot slot, const std::string& name, IO type, bool invert, VirtualCallback cb, const ZoneMetaFields& meta):
+    Zone(slot, name, type, invert, meta),
     virtual_callback(cb)
 {
 
@@ -69,7 +302,7 @@ void Virtual_Zone::set(int level) {
     if(!virtual_callback || virtual_callback(level)) {
         set_state_level(level);
     } else {
-        std::cout << "state change failure\n";
+        Logger::warn("state change failure");
     }
 }
 
@@ -79,32 +312,499 @@ int Virtual_Zone::get() {
 
 /* Zone Manager */
 
-// Automatic state refresh forces all zones to re-check and report their state
+static uint64_t now_ms() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Automatic state refresh forces all zones to report their state again, paced over refresh_window
 void ZoneManager::refresh_states() {
-    for(auto& zone : zones){
-        if(zone->last_state_changed.getMilliseconds() > zone->trigger_timeout){
-            zone->state_changed = true; // force the zone to update its state regardlees if it changed or not
+    reconcile(); // the refresh goes out from levels the pins were checked against
+    refresh_queue.clear();
+    refresh_head = 0;
+    for(size_t i = 0; i < zones.size(); ++i){
+        refresh_queue.push_back(i);
+        refresh_pending[i] = 1;
+    }
+    uint64_t now = now_ms();
+    refresh_start_ms = now + (refresh_jitter ? refresh_random() % refresh_jitter : 0);
+    refresh_refill_ms = refresh_start_ms;
+    refresh_tokens = std::min(refresh_tokens, 1.0);
+    if(alarm) alarm->refresh();
+    for(size_t i = 0; i < zones.size(); ++i){
+        if(zones[i]->get_meta_fields().supervision_timeout) publish_attributes(i); // a retained "lost" must not outlive the loss
+    }
+}
+
+// publishes queued refreshes while the bucket has tokens, live changes draw from the same bucket first
+void ZoneManager::publish_refresh() {
+    uint64_t now = now_ms();
+    if(now < refresh_start_ms) return;
+    if(refresh_window){
+        double rate = double(std::max<size_t>(1, zones.size())) / double(refresh_window); // tokens per ms
+        refresh_tokens = std::min(REFRESH_BURST, refresh_tokens + double(now - refresh_refill_ms) * rate);
+    } else {
+        refresh_tokens = double(zones.size());
+    }
+    refresh_refill_ms = now;
+
+    while(refresh_head < refresh_queue.size() && refresh_tokens >= 1){
+        size_t i = refresh_queue[refresh_head++];
+        if(!refresh_pending[i] || hot->is_pending(i) || traffic[i].fault) continue; // a live change reports it, a faulted zone stays quiet
+        refresh_pending[i] = 0;
+        system->handle_device_updates(zones[i]->get_unique_id(), topics[i].state.c_str(), hot->level(i), false); // a refresh repeats what is known
+        refresh_tokens -= 1;
+    }
+    if(refresh_head >= refresh_queue.size()){
+        refresh_queue.clear();
+        refresh_head = 0;
+    }
+}
+
+void ZoneManager::publish_snapshot() {
+    if(!sequence){
+        snapshot_dirty = true; // nothing has reported yet, the first changes publish it
+        return;
+    }
+    // formatted in place, the buffer was sized for every zone at load
+    char number[24];
+    snapshot.assign("{\"seq\":");
+    snapshot.append(number, std::to_chars(number, number + sizeof(number), sequence).ptr);
+    snapshot.append(",\"states\":{");
+    bool first = true;
+    for(size_t i = 0; i < zones.size(); ++i){
+        if(published[i] < 0) continue;
+        snapshot.append(first ? "\"" : ",\"");
+        snapshot.append(zones[i]->get_unique_id());
+        snapshot.append("\":");
+        snapshot.append(number, std::to_chars(number, number + sizeof(number), published[i]).ptr);
+        first = false;
+    }
+    snapshot.append("}}");
+    system->handle_state_snapshot(snapshot);
+    snapshot_dirty = false;
+    last_snapshot.restart();
+}
+
+void ZoneManager::publish_attributes(size_t index) {
+    static constexpr std::string_view plain[2] = { "{\"fault\":\"none\"}", "{\"fault\":\"flapping\"}" };
+    static constexpr std::string_view supervised[2][2] = {
+        { "{\"fault\":\"none\",\"supervision\":\"ok\"}", "{\"fault\":\"none\",\"supervision\":\"lost\"}" },
+        { "{\"fault\":\"flapping\",\"supervision\":\"ok\"}", "{\"fault\":\"flapping\",\"supervision\":\"lost\"}" }
+    };
+    const bool fault = traffic[index].fault, lost = silent_reported[index / 64] & (uint64_t(1) << (index % 64));
+    std::string_view attributes = zones[index]->get_meta_fields().supervision_timeout ? supervised[fault][lost] : plain[fault];
+    system->handle_device_attributes(topics[index].attributes.c_str(), attributes);
+}
+
+// A zone whose input changes flap_count times inside flap_window is faulted until it stays quiet for flap_window
+void ZoneManager::check_flapping(size_t index, uint64_t now) {
+    ZoneTraffic& t = traffic[index];
+    uint32_t count = hot->transition_count(index);
+    uint32_t delta = count - t.seen_transitions;
+    t.seen_transitions = count;
+    if(!t.flap_count || (!delta && !t.recent_size && !t.fault)) return; // a quiet zone has nothing to age out
+
+    const uint32_t slots = uint32_t(t.recent.size());
+    if(delta){
+        if(t.recent_size == slots){
+            // every slot holds a change, so the total stays at flap_count without the oldest
+            t.recent_total -= t.recent[t.recent_head].transitions;
+            t.recent_head = (t.recent_head + 1) % slots;
+            --t.recent_size;
+        }
+        t.recent[(t.recent_head + t.recent_size++) % slots] = { now, delta };
+        t.recent_total += delta;
+        t.last_transition_ms = now;
+    }
+    while(t.recent_size && now - t.recent[t.recent_head].ms > t.flap_window_ms){
+        t.recent_total -= t.recent[t.recent_head].transitions;
+        t.recent_head = (t.recent_head + 1) % slots;
+        --t.recent_size;
+    }
+
+    if(!t.fault && t.recent_total >= t.flap_count){
+        t.fault = true;
+        Logger::warn("{} is flapping ({} changes in {}ms), its state is held until it settles", zones[index]->get_unique_id(), t.recent_total, t.flap_window_ms);
+        publish_attributes(index);
+    } else if(t.fault && now - t.last_transition_ms >= t.flap_window_ms){
+        t.fault = false;
+        Logger::info("{} has settled", zones[index]->get_unique_id());
+        publish_attributes(index);
+        hot->mark(index); // publishes the level it settled at
+    }
+}
+
+// A supervised zone that went silent past its timeout, or pulsed again after one, raises an attribute and an event
+void ZoneManager::check_supervision() {
+    for(size_t word = 0; word < silent_reported.size(); ++word){
+        uint64_t silent = hot->silent_word(word);
+        for(uint64_t bits = silent ^ silent_reported[word]; bits; bits &= bits - 1){
+            size_t i = word * 64 + size_t(std::countr_zero(bits));
+            uint64_t bit = uint64_t(1) << (i % 64);
+            const bool lost = silent & bit;
+            silent_reported[word] ^= bit;
+
+            const std::string& id = zones[i]->get_unique_id();
+            if(lost) Logger::warn("{} has been silent for {}ms, supervision lost", id, zones[i]->get_meta_fields().supervision_timeout);
+            else Logger::info("{} is supervised again", id);
+            publish_attributes(i);
+
+            std::string event;
+            event += '{';
+            append_json_field(event, "event_type", lost ? "supervision_lost" : "supervision_restored");
+            append_json_field(event, "zone", id);
+            event += '}';
+            system->handle_zone_event(event);
+        }
+    }
+}
+
+// Alerts lost to an overflowed pigpio sample buffer leave a zone at a level its pin has since left. Each host's bank
+// is read in one call and compared with the zones' levels as masks. A pin that reads the same wrong level twice,
+// RECONCILE_CONFIRM_MS apart, missed an edge: the zone takes the level read and publishes it like any change.
+void ZoneManager::reconcile() {
+    last_reconcile_ms = now_ms();
+    reconcile_confirm = false;
+    for(PinBank& bank : banks){
+        uint32_t levels = 0;
+        if(!bank.host){
+            levels = gpioRead_Bits_0_31();
+        } else if(!bank.host->readBits(levels)){
+            bank.suspect = 0; // its levels are replayed when it reconnects
+            continue;
+        }
+        uint32_t expected = 0;
+        for(auto [pin, zone] : bank.pins) expected |= uint32_t(hot->level(zone) & 1) << pin;
+        const uint32_t differ = (levels ^ expected) & bank.mask;
+        const uint32_t missed = differ & bank.suspect & ~(levels ^ bank.suspect_levels);
+        if(missed){
+            for(auto [pin, zone] : bank.pins){
+                if(!(missed >> pin & 1)) continue;
+                int16_t level = int16_t(levels >> pin & 1);
+                Logger::warn("{} missed an edge, its pin reads {}", zones[zone]->get_unique_id(), level);
+                hot->set_level(zone, level);
+            }
+            missed_edges.fetch_add(uint64_t(std::popcount(missed)), std::memory_order_relaxed);
         }
+        bank.suspect = differ & ~missed;
+        bank.suspect_levels = levels;
+        reconcile_confirm = reconcile_confirm || bank.suspect;
+    }
+}
+
+// Presses were classified on the alert thread, each is an event of its own and never coalesced
+void ZoneManager::publish_presses() {
+    static constexpr std::string_view payloads[] = {
+        "{\"event_type\":\"single\"}", "{\"event_type\":\"double\"}", "{\"event_type\":\"long\"}", "{\"event_type\":\"hold\"}"
+    };
+    for(size_t i : buttons){
+        Button_Zone& button = static_cast<Button_Zone&>(*zones[i]);
+        button.apply_rearm();
+        Button_Zone::Press press;
+        while(button.take_press(press)){
+            system->handle_button_press(button.get_unique_id(), topics[i].press.c_str(), payloads[press], topics[i].alarm);
+        }
+        if(uint32_t lost = button.take_overflow()) Logger::warn("{} lost {} presses, the zone pass fell behind", button.get_unique_id(), lost);
+    }
+}
+
+// The pins of each host change in one bank write, a set then a clear, instead of a gpioWrite per zone a command
+// apart. Every level written settles at the same tick, so their publishes go out together in one pass.
+void ZoneManager::write_outputs() {
+    for(OutputBank& bank : output_banks) bank.set = bank.clear = 0;
+    uint32_t debounce = 0;
+    for(size_t n = 0; n < outputs.size(); ++n){
+        if(output_levels[n] < 0) continue;
+        const OutputPin& out = outputs[n];
+        pulses.cancel(out.pin, out.host); // the group command owns the pin now
+        if(out.pin > 31){
+            zones[out.zone]->set(output_levels[n]); // outside the first bank, written on its own
+            continue;
+        }
+        auto bank = std::find_if(output_banks.begin(), output_banks.end(), [&](const OutputBank& b){ return b.host == out.host; });
+        (output_levels[n] ? bank->set : bank->clear) |= 1u << out.pin;
+        debounce = std::max(debounce, hot->debounce_of(out.zone));
+    }
+
+    const uint32_t settles = ZoneStateTable::tick() + debounce;
+    for(const OutputBank& bank : output_banks){
+        if(!bank.set && !bank.clear) continue;
+        int result = 0;
+        if(bank.host){
+            result = bank.host->writeBits(bank.set, bank.clear);
+        } else {
+            if(bank.set) result = gpioWrite_Bits_0_31_Set(bank.set);
+            if(result >= 0 && bank.clear) result = gpioWrite_Bits_0_31_Clear(bank.clear);
+        }
+        if(result < 0){
+            Logger::error("group write on {} failed ({})", bank.host ? bank.host->name() : std::string("this Pi"), result);
+            continue;
+        }
+        for(size_t n = 0; n < outputs.size(); ++n){
+            if(output_levels[n] >= 0 && outputs[n].host == bank.host && outputs[n].pin <= 31) hot->set_level_at(outputs[n].zone, output_levels[n], settles);
+        }
+    }
+}
+
+static bool parse_mask(std::string_view text, uint64_t& value) {
+    int base = 10;
+    if(text.starts_with("0x") || text.starts_with("0X")){
+        text.remove_prefix(2);
+        base = 16;
+    }
+    return !text.empty() && std::from_chars(text.data(), text.data() + text.size(), value, base).ptr == text.data() + text.size();
+}
+
+// {"<id>":level,...} read in place, a level is an integer, true or false; an id with an escape is not understood
+template<typename OnLevel>
+static bool parse_levels(std::string_view text, OnLevel&& on_level) {
+    size_t i = 0;
+    auto skip = [&](){ while(i < text.size() && (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' || text[i] == '\r')) ++i; };
+    auto expect = [&](char c){
+        skip();
+        if(i == text.size() || text[i] != c) return false;
+        ++i;
+        return true;
+    };
+    if(!expect('{')) return false;
+    if(!expect('}')){
+        do {
+            if(!expect('"')) return false;
+            size_t end = text.find_first_of("\"\\", i);
+            if(end == std::string_view::npos || text[end] != '"') return false;
+            std::string_view id = text.substr(i, end - i);
+            i = end + 1;
+            if(!expect(':')) return false;
+            skip();
+            std::string_view value = text.substr(i);
+            int level = 0;
+            if(value.starts_with("true")){
+                level = 1;
+                i += 4;
+            } else if(value.starts_with("false")){
+                i += 5;
+            } else {
+                auto [end_of_number, error] = std::from_chars(value.data(), value.data() + value.size(), level);
+                if(error != std::errc()) return false;
+                i += size_t(end_of_number - value.data());
+            }
+            on_level(id, level);
+        } while(expect(','));
+        if(!expect('}')) return false;
+    }
+    skip();
+    return i == text.size();
+}
+
+void ZoneManager::command_outputs(std::string_view payload) {
+    std::fill(output_levels.begin(), output_levels.end(), int8_t(-1));
+    size_t count = 0;
+    if(payload.starts_with("{")){
+        bool understood = parse_levels(payload, [&](std::string_view id, int level){
+            for(size_t n = 0; n < outputs.size(); ++n){
+                if(zones[outputs[n].zone]->get_unique_id() != id) continue;
+                if(output_levels[n] < 0) ++count;
+                output_levels[n] = level ? 1 : 0;
+                break;
+            }
+        });
+        if(!understood){
+            Logger::warn("group command {} is not understood", payload);
+            return;
+        }
+    } else {
+        // bit n of the mask selects the nth output zone, the same bit of the levels is what it is set to
+        size_t colon = payload.find(':');
+        uint64_t mask = 0, values = 0;
+        if(colon == std::string_view::npos || !parse_mask(payload.substr(0, colon), mask) || !parse_mask(payload.substr(colon + 1), values)){
+            Logger::warn("group command {} is not understood", payload);
+            return;
+        }
+        if(outputs.size() < 64 && mask >> outputs.size()){
+            Logger::warn("group command {} selects outputs beyond the {} configured", payload, outputs.size());
+        }
+        for(size_t n = 0; n < outputs.size() && n < 64; ++n){
+            if(!(mask >> n & 1)) continue;
+            output_levels[n] = int8_t(values >> n & 1);
+            ++count;
+        }
+    }
+    if(!count){
+        Logger::warn("group command {} names no output zone", payload);
+        return;
+    }
+    write_outputs();
+}
+
+// A pulse is timed by pigpio, see output_pulse.h. Once asked for, the turn-off is never left to the zone pass:
+// a pulse that cannot be timed is refused and the output stays as it is. Both of its levels are published.
+bool ZoneManager::pulse_output(size_t index, int level, uint32_t pulse_us) {
+    auto out = std::find_if(outputs.begin(), outputs.end(), [index](const OutputPin& o){ return o.zone == index; });
+    if(out == outputs.end()){
+        if(pulse_us) Logger::warn("{} is not a gpio_digital output and cannot be pulsed", zones[index]->get_unique_id());
+        return pulse_us != 0;
+    }
+    if(!pulse_us){
+        // only the "on" level of a zone with a default pulse is timed, "off" still ends a pulse early
+        if(!out->pulse_us || (level != 0) == zones[index]->is_inverted()) return false;
+        pulse_us = out->pulse_us;
+    }
+    pulse_us = std::min(pulse_us, OutputPulses::MAX_PULSE_US);
+    OutputPulses::Method method = pulses.start(out->pin, out->host, level ? 1 : 0, pulse_us, index);
+    if(method == OutputPulses::REFUSED){
+        Logger::error("{} cannot be pulsed for {}us now, no pigpio timer or wave is free", zones[index]->get_unique_id(), pulse_us);
+    } else {
+        hot->set_level(index, int16_t(level ? 1 : 0)); // the off level is recorded by the pulse pass once it has ended
+        Logger::debug("{} pulsed to {} for {}us by {}", zones[index]->get_unique_id(), level, pulse_us, OutputPulses::method_name(method));
+    }
+    return true;
+}
+
+void ZoneManager::cancel_pulse(size_t index) {
+    for(const OutputPin& out : outputs){
+        if(out.zone == index) pulses.cancel(out.pin, out.host);
     }
 }
 
 // This is the main event loop which will handle all events for all zones
 void ZoneManager::update() {
-    for(auto& ptr : zones){
-        Zone& zone = *ptr;
-        if(zone.state_changed && zone.last_state_changed.getMilliseconds() > zone.trigger_timeout){
-            system->handle_device_updates(zone.get_unique_id(), zone.state);
-            zone.state_changed = false;
-            zone.last_state_changed.restart();
+    uint64_t now = now_ms();
+    for(size_t i = 0; i < zones.size(); ++i) check_flapping(i, now);
+    check_supervision();
+    publish_presses();
+    pulses.update(*hot);
+    if(reconcile_confirm ? now - last_reconcile_ms >= RECONCILE_CONFIRM_MS : reconcile_interval && now - last_reconcile_ms >= reconcile_interval){
+        reconcile();
+    }
+
+    // only zones with a pending bit are visited, a word at a time
+    const uint32_t tick = ZoneStateTable::tick();
+    for(size_t word = 0; word < hot->words(); ++word){
+        for(uint64_t bits = hot->pending_word(word); bits; bits &= bits - 1){
+            size_t i = word * 64 + size_t(std::countr_zero(bits));
+            if(!hot->settled(i, tick)) continue;
+            ZoneTraffic& t = traffic[i];
+            if(t.fault){
+                // only the alarm panel still follows a faulted zone, a tampered sensor must not silence it
+                int state = hot->take(i);
+                if(alarm) alarm->on_state(i, state);
+                continue;
+            }
+            if(now - t.last_publish_ms < t.min_interval_ms) continue; // held, the latest level goes out once the interval passes
+            t.last_publish_ms = now;
+
+            int state = hot->take(i);
+            const std::string& id = zones[i]->get_unique_id();
+            if(alarm) alarm->on_state(i, state); // ahead of the publish, the panel does not wait on the broker
+            system->handle_device_updates(id, topics[i].state.c_str(), state, topics[i].alarm);
+            if(system->federation) system->federation->export_state(id, state);
+            if(published[i] != state){
+                published[i] = int16_t(state);
+                ++sequence;
+                snapshot_dirty = true;
+            }
+            if(!refresh_queue.empty()){
+                refresh_pending[i] = 0; // this publish already refreshed the zone
+                refresh_tokens = std::max(-REFRESH_BURST, refresh_tokens - 1); // live changes never wait, but the refresh yields to them
+            }
+            rules->on_state(i, state); // may set other zones, which report on a later pass
+        }
+    }
+    rules->update();
+    if(alarm) alarm->update();
+    if(!refresh_queue.empty()) publish_refresh();
+
+    // changes are folded into at most one snapshot per interval
+    if(snapshot_dirty && snapshot_interval && last_snapshot.getMilliseconds() >= snapshot_interval){
+        publish_snapshot();
+    }
+}
+
+void ZoneManager::save_state(HandoffState& state) const {
+    state.sequence = sequence;
+    state.zones.clear();
+    state.zones.reserve(zones.size());
+    for(size_t i = 0; i < zones.size(); ++i){
+        state.zones.push_back({ zones[i]->get_unique_id(), hot->level(i), published[i] });
+    }
+    rules->save_state(state);
+    pulses.save_state(state, zones);
+    state.has_alarm = alarm != nullptr;
+    if(alarm) alarm->save_state(state);
+}
+
+// Zones are matched by id, so a zone added or removed by the upgrade only reports as it would at startup
+void ZoneManager::restore_state(const HandoffState& state) {
+    std::map<std::string_view, size_t> index;
+    for(size_t i = 0; i < zones.size(); ++i) index.emplace(zones[i]->get_unique_id(), i);
+
+    size_t carried = 0;
+    for(const HandoffState::ZoneLevel& saved : state.zones){
+        auto found = index.find(saved.id);
+        if(found == index.end()) continue;
+        size_t i = found->second;
+        // pins read back the level they were left at, only an output without one (a virtual zone) is set again
+        if(zones[i]->get_io() == Zone::IO_OUTPUT && saved.level >= 0 && hot->level(i) != saved.level) zones[i]->set(saved.level);
+        published[i] = saved.published;
+        // the first pass only reports zones that changed while the processes swapped
+        if(hot->take(i) != saved.published) hot->mark(i);
+        ++carried;
+    }
+    // a pulse the old process left on is timed again for what remains of it, or ended when that is nothing
+    const uint64_t now = now_ms();
+    for(const HandoffState::Pulse& saved : state.pulses){
+        auto out = std::find_if(outputs.begin(), outputs.end(), [&](const OutputPin& o){ return !o.host && o.pin == saved.pin && zones[o.zone]->get_unique_id() == saved.zone; });
+        if(out == outputs.end() || gpioRead(saved.pin) == int(saved.off)) continue;
+        const uint32_t remaining_us = saved.due_ms > now ? uint32_t(std::min<uint64_t>(saved.due_ms - now, OutputPulses::MAX_PULSE_US / 1000) * 1000) : 0;
+        if(!remaining_us || pulses.start(saved.pin, nullptr, saved.off ? 0 : 1, remaining_us, out->zone) == OutputPulses::REFUSED){
+            gpioWrite(saved.pin, saved.off);
+            hot->set_level(out->zone, int16_t(saved.off));
         }
     }
+
+    sequence = state.sequence;
+    snapshot_dirty = false;
+    last_snapshot.restart();
+
+    rules->restore_state(state, published);
+    if(alarm && state.has_alarm) alarm->restore_state(state);
+    Logger::info("carried over the state of {} of {} zones", carried, zones.size());
 }
 
-ZoneManager::ZoneManager(SecuritySystem* system): system(system) {
+ZoneManager::ZoneManager(SecuritySystem* system): system(system), reconcile_interval(1000), last_reconcile_ms(0), reconcile_confirm(false),
+    missed_edges(0), snapshot(&arena), sequence(0), snapshot_dirty(false), snapshot_interval(1000),
+    refresh_head(0), refresh_window(2000), refresh_jitter(1000), refresh_tokens(0), refresh_start_ms(0), refresh_refill_ms(0),
+    refresh_random(std::random_device{}())
+{
     JsonLoader& json = system->config;
+    json.loadProperty("state_snapshot_interval", snapshot_interval);
+    json.loadProperty("refresh_window", refresh_window);
+    json.loadProperty("refresh_jitter", refresh_jitter);
+    json.loadProperty("reconcile_interval", reconcile_interval);
+    std::vector<AlarmPanel::ZoneConfig> alarm_zones; // follows the zone list
+
+    // top-level defaults of the per-zone publish policy
+    uint32_t default_max_rate = 0, default_flap_count = 0, default_flap_window = 5000;
+    json.loadProperty("max_rate", default_max_rate);
+    json.loadProperty("flap_count", default_flap_count);
+    json.loadProperty("flap_window", default_flap_window);
     
     JsonLoader::Array zns;
     if(json.loadPropertyArray("zones", zns)){
+        // one block for every zone object and its buffers, topics are estimated at 64 bytes and a button has a third
+        constexpr size_t ZONE_OBJECT_BYTES = std::max({ sizeof(DigitalGPIO_Zone), sizeof(Button_Zone), sizeof(PJONRemote_Zone), sizeof(Federated_Zone), sizeof(Virtual_Zone) });
+        size_t configured = 0, flap_slots = 0;
+        for(auto it = zns.Begin(); it < zns.End(); it++){
+            JsonLoader::Object zone = it->GetObject();
+            uint32_t flap_count = default_flap_count; // at most what the zone will use, its own value or the default
+            json.loadProperty(zone, "flap_count", flap_count);
+            flap_slots += flap_count;
+            ++configured;
+        }
+        arena.reserve(configured * (ZONE_OBJECT_BYTES + 3 * (system->system_name.size() + 80) + 48 + 64) +
+                      flap_slots * sizeof(ZoneTraffic::Recent) + ZoneStateTable::footprint(configured) + 64);
+        hot = std::make_unique<ZoneStateTable>(configured, &arena);
+
         for(auto it = zns.Begin(); it < zns.End(); it++){
             JsonLoader::Object zone = it->GetObject();
             std::unique_ptr<Zone> new_zone;
@@ -119,22 +819,25 @@ ZoneManager::ZoneManager(SecuritySystem* system): system(system) {
                 { "input", Zone::IO_INPUT }
             };
 
+            ZoneSlot slot { hot.get(), uint32_t(zones.size()) }; // zones that are skipped leave no gap
             ZoneMetaFields meta {};
             meta.trigger_timeout_threshold = 100; // 100ms default trigger timeout
             std::string name, zone_type;
             int pin = -1;
+            RemoteGPIOHost* host = nullptr; // a gpio_digital pin on another Pi
+            uint32_t pulse_ms = 0; // an output that switches on for a while, like a door strike
             bool invert = false;
             Zone::IO io = Zone::IO_INPUT;
             GPIO::PinType pmode = GPIO::PIN_INPUT;
 
             if(!json.loadProperty(zone, "name", name) || name.empty()){
-                std::cout << "a zone has no name! skipping...\n";
+                Logger::warn("a zone has no name! skipping...");
                 continue;
             }
             
             if( !json.loadProperty(zone, "zone_type", zone_type) ||
                     std::find(Zone::ZoneTypes.begin(),Zone::ZoneTypes.end(), zone_type) == Zone::ZoneTypes.end() ){
-                std::cout << name << " has an invalid zone_type! skipping...\n";
+                Logger::warn("{} has an invalid zone_type! skipping...", name);
                 continue;
             }
             
@@ -142,34 +845,197 @@ ZoneManager::ZoneManager(SecuritySystem* system): system(system) {
             json.loadProperty(zone, "icon", meta.icon);
             json.loadProperty(zone, "invert", invert);
             json.loadProperty(zone, "trigger_timeout", meta.trigger_timeout_threshold);
+            json.loadProperty(zone, "supervision", meta.supervision_timeout);
+            if(meta.supervision_timeout > PI_MAX_WDOG_TIMEOUT){
+                Logger::warn("{} has a supervision timeout above {}ms, it is clamped", name, PI_MAX_WDOG_TIMEOUT);
+                meta.supervision_timeout = PI_MAX_WDOG_TIMEOUT;
+            }
 
             std::string s_io, s_pmode;
             if(json.loadProperty(zone, "io", s_io) && io_modes.count(s_io)){
                 io = io_modes.at(s_io);
             }
+            if(meta.supervision_timeout && (zone_type != "gpio_digital" || io != Zone::IO_INPUT)){
+                Logger::warn("{} is not a gpio_digital input, supervision is ignored", name);
+                meta.supervision_timeout = 0;
+            }
+
+            std::string input_mode;
+            bool button = false;
+            if(json.loadProperty(zone, "mode", input_mode) && !input_mode.empty()){
+                if(input_mode != "button" || zone_type != "gpio_digital" || io != Zone::IO_INPUT){
+                    Logger::warn("{} has an unknown mode {}, only a gpio_digital input can be a button", name, input_mode);
+                } else {
+                    button = true;
+                }
+            }
+            if(button && meta.supervision_timeout){
+                Logger::warn("{} is a button, its watchdog times presses and supervision is ignored", name);
+                meta.supervision_timeout = 0;
+            }
+
+            ZoneTraffic zone_traffic;
+            uint32_t max_rate = default_max_rate;
+            // a heartbeat or a button is meant to keep changing, and an output changes when it is told to
+            zone_traffic.flap_count = meta.supervision_timeout || button || io != Zone::IO_INPUT ? 0 : default_flap_count;
+            zone_traffic.flap_window_ms = default_flap_window;
+            json.loadProperty(zone, "max_rate", max_rate);
+            json.loadProperty(zone, "flap_count", zone_traffic.flap_count);
+            json.loadProperty(zone, "flap_window", zone_traffic.flap_window_ms);
+            zone_traffic.min_interval_ms = max_rate ? 1000 / max_rate : 0;
+            zone_traffic.recent = std::pmr::vector<ZoneTraffic::Recent>(zone_traffic.flap_count, ZoneTraffic::Recent{ 0, 0 }, &arena);
+
+            AlarmPanel::ZoneConfig alarm_zone;
+            std::string alarm_group;
+            if(json.loadProperty(zone, "alarm", alarm_group) && !AlarmPanel::parse_group(alarm_group, alarm_zone.group)){
+                Logger::warn("{} has an unknown alarm group {}, it is not watched by the panel", name, alarm_group);
+            }
+            alarm_zone.invert = invert;
+            json.loadProperty(zone, "entry_delay", alarm_zone.entry_delay_ms);
+            json.loadProperty(zone, "exit_delay", alarm_zone.exit_delay_ms);
+
 
             if(zone_type == "gpio_digital"){
                 if(!json.loadProperty(zone, "pin", pin) || pin == -1){
-                    std::cout << name << " has an invalid pin! skipping...\n";
+                    Logger::warn("{} has an invalid pin! skipping...", name);
                     continue;
                 }
                 if(json.loadProperty(zone, "pullmode", s_pmode) && pull_modes.count(s_pmode)){
                     pmode = pull_modes.at(s_pmode);
                 }
 
-                new_zone = std::make_unique<DigitalGPIO_Zone>( name, io, pin, invert, meta, pmode);
-                std::cout << "Loaded Zone: " << *new_zone << "\n";
+                // pins on another Pi are driven through that host's pigpiod
+                std::string host_name;
+                if(json.loadProperty(zone, "host", host_name) && !host_name.empty()){
+                    host = system->remote_gpio->find(host_name);
+                    if(!host){
+                        Logger::warn("{} uses an unknown host {}! skipping...", name, host_name);
+                        continue;
+                    }
+                } else if(!system->local_gpio){
+                    Logger::warn("{} needs local GPIO, which is unavailable! skipping...", name);
+                    continue;
+                }
+
+                if(io == Zone::IO_OUTPUT && json.loadProperty(zone, "pulse", pulse_ms) && pulse_ms * 1000ull > OutputPulses::MAX_PULSE_US){
+                    Logger::warn("{} has a pulse above {}ms, it is clamped", name, OutputPulses::MAX_PULSE_US / 1000);
+                    pulse_ms = OutputPulses::MAX_PULSE_US / 1000;
+                }
+
+                if(button){
+                    Button_Zone::Timing timing;
+                    json.loadProperty(zone, "double_window", timing.double_window_ms);
+                    json.loadProperty(zone, "long_press", timing.long_press_ms);
+                    json.loadProperty(zone, "hold_time", timing.hold_ms);
+                    json.loadProperty(zone, "bounce", timing.bounce_ms);
+                    if(timing.double_window_ms > PI_MAX_WDOG_TIMEOUT || timing.hold_ms > PI_MAX_WDOG_TIMEOUT){
+                        Logger::warn("{} has a double_window or hold_time above {}ms, they are clamped", name, PI_MAX_WDOG_TIMEOUT);
+                        timing.double_window_ms = std::min<uint32_t>(timing.double_window_ms, PI_MAX_WDOG_TIMEOUT);
+                        timing.hold_ms = std::min<uint32_t>(timing.hold_ms, PI_MAX_WDOG_TIMEOUT);
+                    }
+                    if(timing.hold_ms && timing.long_press_ms >= timing.hold_ms){
+                        Logger::warn("{} has a long_press of at least its hold_time, it only reports holds", name);
+                    }
+                    new_zone.reset(new (arena) Button_Zone( slot, name, pin, invert, meta, timing, pmode, host));
+                } else {
+                    new_zone.reset(new (arena) DigitalGPIO_Zone( slot, name, io, pin, invert, meta, pmode, host));
+                }
+                Logger::info("Loaded Zone: {}", new_zone->get_meta());
             }
             
+            if(zone_type == "pjon_remote"){
+                int node = -1, bit = -1;
+                if(!system->expander_bus){
+                    Logger::warn("{} needs the expander bus, set pjon_port! skipping...", name);
+                    continue;
+                }
+                if(!json.loadProperty(zone, "node", node) || node < 1 || node > 253 ||
+                        !json.loadProperty(zone, "bit", bit) || bit < 0 || bit > 31){
+                    Logger::warn("{} has an invalid node or bit! skipping...", name);
+                    continue;
+                }
+
+                new_zone.reset(new (arena) PJONRemote_Zone( slot, name, system->expander_bus, uint8_t(node), uint8_t(bit), invert, meta));
+                Logger::info("Loaded Zone: {}", new_zone->get_meta());
+            }
+
+            if(zone_type == "federated"){
+                int peer = -1;
+                std::string remote_id;
+                if(!system->federation){
+                    Logger::warn("{} needs the federation, set federation_id! skipping...", name);
+                    continue;
+                }
+                if(!json.loadProperty(zone, "peer", peer) || peer < 1 || peer > 253 || peer == system->federation->id() ||
+                        !json.loadProperty(zone, "zone", remote_id) || remote_id.empty()){
+                    Logger::warn("{} has an invalid peer or zone! skipping...", name);
+                    continue;
+                }
+
+                remote_id = std::regex_replace(remote_id, std::regex("[^a-zA-Z0-9]"), ""); // the peer's name or unique id
+                new_zone.reset(new (arena) Federated_Zone( slot, name, system->federation, uint8_t(peer), remote_id, invert, meta));
+                Logger::info("Loaded Zone: {}", new_zone->get_meta());
+            }
+
             if(new_zone){
+                Button_Zone* button_zone = button ? static_cast<Button_Zone*>(new_zone.get()) : nullptr;
+                topics.push_back({
+                    std::pmr::string(system->mqtt_topic_entity_state + "/" + new_zone->get_unique_id(), &arena),
+                    std::pmr::string(system->mqtt_topic_device_attributes + "/" + new_zone->get_unique_id(), &arena),
+                    std::pmr::string(button_zone ? system->mqtt_topic_button_press + "/" + new_zone->get_unique_id() : "", &arena),
+                    alarm_zone.group != AlarmPanel::GROUP_NONE
+                });
+                new_zone->format_discovery(topics.back().state, system->mqtt_topic_entity_update + "/" + new_zone->get_unique_id(), topics.back().attributes);
+                system->mqtt->add_topic_alias(topics.back().state.c_str()); // sent as a two byte alias on MQTT 5
+                if(button_zone){
+                    button_zone->format_press_discovery(topics.back().press);
+                    system->mqtt->add_topic_alias(topics.back().press.c_str());
+                    buttons.push_back(zones.size());
+                }
+                if(zone_type == "gpio_digital" && io == Zone::IO_OUTPUT) outputs.push_back({ zones.size(), unsigned(pin), host, pulse_ms * 1000 });
+                if(zone_type == "gpio_digital" && io == Zone::IO_INPUT && !button && pin <= PI_MAX_USER_GPIO){
+                    // an output is driven by the service and its pulses by pigpio, so it has no alert to lose;
+                    // a button's level only matters through its classifier, which a correction would bypass
+                    auto bank = std::find_if(banks.begin(), banks.end(), [host](const PinBank& b){ return b.host == host; });
+                    if(bank == banks.end()) bank = banks.insert(banks.end(), PinBank{ host, 0, 0, 0, {} });
+                    bank->mask |= 1u << pin;
+                    bank->pins.emplace_back(unsigned(pin), zones.size());
+                }
                 zones.push_back(std::move(new_zone));
+                alarm_zones.push_back(alarm_zone);
+                traffic.push_back(std::move(zone_traffic));
             }
         }
     } else {
-        std::cout << "No zones are configured!\n";
+        Logger::warn("No zones are configured!");
+        hot = std::make_unique<ZoneStateTable>(0, &arena);
+    }
+
+    output_levels.assign(outputs.size(), -1);
+    for(const OutputPin& out : outputs){
+        if(out.pin > 31) continue;
+        if(std::none_of(output_banks.begin(), output_banks.end(), [&](const OutputBank& b){ return b.host == out.host; })) output_banks.push_back({ out.host, 0, 0 });
+    }
+
+    rules = std::make_unique<RuleEngine>(json, zones, [system](const std::string& payload){ system->handle_rule_event(payload); });
+
+    published.assign(zones.size(), -1);
+    silent_reported.assign(hot->words(), 0);
+    refresh_pending.assign(zones.size(), 0);
+    refresh_queue.reserve(zones.size());
+
+    size_t snapshot_bytes = 64;
+    for(const auto& zone : zones) snapshot_bytes += zone->get_unique_id().size() + 8;
+    snapshot.reserve(snapshot_bytes);
+
+    std::string panel_name;
+    if(json.loadProperty("alarm_panel", panel_name) && !panel_name.empty()){
+        alarm = std::make_unique<AlarmPanel>(json, panel_name, zones, alarm_zones, [system](const std::string& state, const std::string& attributes){
+            system->handle_alarm_state(state, attributes);
+        });
     }
 
-    std::cout << "ZoneManager is ready\n";
+    Logger::info("ZoneManager is ready, {} of {} arena bytes in use", arena.in_use(), arena.size());
 }
 
 ZoneManager::~ZoneManager() {}
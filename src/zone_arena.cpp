@@ -0,0 +1,28 @@
+#include "zone_arena.h"
+#include "logger.h"
+
+#include <cstdint>
+
+void ZoneArena::reserve(size_t bytes) {
+    if(used){
+        Logger::warn("zone arena is in use, it cannot be resized");
+        return;
+    }
+    block = std::make_unique<std::byte[]>(bytes);
+    capacity = bytes;
+}
+
+void* ZoneArena::do_allocate(size_t bytes, size_t alignment) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.get());
+    size_t offset = ((base + used + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+    if(block && offset + bytes <= capacity){
+        used = offset + bytes;
+        return block.get() + offset;
+    }
+
+    // the estimate made at config load was short, the rest comes from the heap
+    Logger::warn("zone arena is full ({} of {} bytes), {} bytes come from the heap", used, capacity, bytes);
+    overflow.push_back(std::make_unique<std::byte[]>(bytes + alignment));
+    uintptr_t extra = reinterpret_cast<uintptr_t>(overflow.back().get());
+    return reinterpret_cast<void*>((extra + alignment - 1) & ~(uintptr_t(alignment) - 1));
+}